@@ -0,0 +1,81 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <span>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace soda {
+
+  //
+  // Bump allocator
+  //
+  // Objects are carved out of large chunks and released all at once when
+  // the arena is destroyed, so they must not need destruction. Allocation is
+  // not synchronized.
+  //
+
+  class arena {
+  public:
+    explicit arena(std::size_t chunk_size = 64 * 1024)
+        : chunk_size_{chunk_size} {
+    }
+
+    void *allocate(std::size_t size, std::size_t align) {
+      auto p = reinterpret_cast<std::uintptr_t>(cur_);
+      auto aligned = (p + align - 1) & ~(align - 1);
+      if (!cur_ || aligned + size > reinterpret_cast<std::uintptr_t>(end_)) {
+        grow(size + align);
+        p = reinterpret_cast<std::uintptr_t>(cur_);
+        aligned = (p + align - 1) & ~(align - 1);
+      }
+      cur_ = reinterpret_cast<std::byte *>(aligned + size);
+      bytes_ += size;
+      return reinterpret_cast<void *>(aligned);
+    }
+
+    template <typename T, typename... Args>
+    T *make(Args &&...args) {
+      static_assert(std::is_trivially_destructible_v<T>,
+                    "arena objects are never destroyed");
+      return new (allocate(sizeof(T), alignof(T)))
+          T{std::forward<Args>(args)...};
+    }
+
+    template <typename T>
+    std::span<T> copy(std::span<T const> items) {
+      static_assert(std::is_trivially_copyable_v<T>);
+      if (items.empty()) {
+        return {};
+      }
+      auto p = static_cast<T *>(allocate(items.size_bytes(), alignof(T)));
+      std::ranges::copy(items, p);
+      return {p, items.size()};
+    }
+
+    // bytes handed out, excluding alignment padding and unused chunk space
+    std::size_t bytes() const noexcept {
+      return bytes_;
+    }
+
+  private:
+    std::size_t chunk_size_;
+    std::vector<std::unique_ptr<std::byte[]>> chunks_;
+    std::byte *cur_ = nullptr;
+    std::byte *end_ = nullptr;
+    std::size_t bytes_ = 0;
+
+    void grow(std::size_t min_size) {
+      auto size = std::max(chunk_size_, min_size);
+      chunks_.push_back(std::make_unique_for_overwrite<std::byte[]>(size));
+      cur_ = chunks_.back().get();
+      end_ = cur_ + size;
+    }
+  };
+
+} // namespace soda
@@ -1,6 +1,8 @@
 #include "ast.hpp"
 #include "utils.hpp"
 
+#include <cstdio>
+
 namespace soda::ast {
 
   std::string_view to_string(node_kind kind) {
@@ -36,6 +38,8 @@ namespace soda::ast {
         return "expr_stmt";
       case node_kind::block_stmt:
         return "block_stmt";
+      case node_kind::label_stmt:
+        return "label_stmt";
       case node_kind::goto_stmt:
         return "goto_stmt";
       case node_kind::break_stmt:
@@ -63,6 +67,8 @@ namespace soda::ast {
         return "let_decl";
       case node_kind::fun_decl:
         return "fun_decl";
+      case node_kind::type_decl:
+        return "type_decl";
       // miscellaneous
       case node_kind::type_ref:
         return "type_ref";
@@ -79,4 +85,233 @@ namespace soda::ast {
     return "unknown_node_kind";
   }
 
+  static void dump_string(std::ostream &out, std::string_view s) {
+    out << '"';
+    for (auto ch : s) {
+      if (ch == '"' || ch == '\\') {
+        out << '\\' << ch;
+      } else if (ch == '\n') {
+        out << "\\n";
+      } else if (static_cast<unsigned char>(ch) < 0x20) {
+        char buf[8] = {0};
+        std::snprintf(buf, 8, "\\x%02X", ch);
+        out << buf;
+      } else {
+        out << ch;
+      }
+    }
+    out << '"';
+  }
+
+  template <typename T>
+  static void dump_list(std::ostream &out, node::list<T> const &nodes,
+                        int indent) {
+    for (auto const &n : nodes) {
+      dump(out, *n, indent);
+    }
+  }
+
+  static void dump_child(std::ostream &out, node const *n, int indent) {
+    if (n) {
+      dump(out, *n, indent);
+    }
+  }
+
+  void dump(std::ostream &out, node const &n, int indent) {
+    for (int i = 0; i < indent; i++) {
+      out << "  ";
+    }
+    out << n.kind_name();
+    if (n.is_error_node()) {
+      out << '\n';
+      return;
+    }
+
+    auto child = indent + 1;
+    switch (n.kind) {
+      case node_kind::bool_expr:
+        out << (static_cast<bool_expr const &>(n).value ? " true\n"
+                                                         : " false\n");
+        break;
+      case node_kind::int_expr:
+        out << ' '
+            << static_cast<std::int64_t>(static_cast<int_expr const &>(n).value)
+            << '\n';
+        break;
+      case node_kind::float_expr:
+        out << ' ' << static_cast<float_expr const &>(n).precise_value()
+            << '\n';
+        break;
+      case node_kind::char_expr: {
+        char buf[16] = {0};
+        std::snprintf(buf, 16, " U+%04X\n",
+                      static_cast<unsigned>(
+                          static_cast<char_expr const &>(n).value));
+        out << buf;
+        break;
+      }
+      case node_kind::string_expr:
+        out << ' ';
+        dump_string(out, static_cast<string_expr const &>(n).value);
+        out << '\n';
+        break;
+      case node_kind::ident_expr:
+        out << ' ' << static_cast<ident_expr const &>(n).name << '\n';
+        break;
+      case node_kind::unop_expr: {
+        auto &e = static_cast<unop_expr const &>(n);
+        out << ' ' << e.op << '\n';
+        dump_child(out, e.operand.get(), child);
+        break;
+      }
+      case node_kind::binop_expr: {
+        auto &e = static_cast<binop_expr const &>(n);
+        out << ' ' << e.op << '\n';
+        dump_child(out, e.lhs.get(), child);
+        dump_child(out, e.rhs.get(), child);
+        break;
+      }
+      case node_kind::if_expr: {
+        auto &e = static_cast<if_expr const &>(n);
+        out << '\n';
+        dump_child(out, e.cond.get(), child);
+        dump_child(out, e.cons.get(), child);
+        dump_child(out, e.altn.get(), child);
+        break;
+      }
+      case node_kind::call_expr: {
+        auto &e = static_cast<call_expr const &>(n);
+        out << '\n';
+        dump_child(out, e.callee.get(), child);
+        dump_list(out, e.arguments, child);
+        break;
+      }
+      case node_kind::empty_stmt:
+        out << '\n';
+        break;
+      case node_kind::expr_stmt:
+        out << '\n';
+        dump_child(out, static_cast<expr_stmt const &>(n).exp.get(), child);
+        break;
+      case node_kind::block_stmt:
+        out << '\n';
+        dump_list(out, static_cast<block_stmt const &>(n).stmts, child);
+        break;
+      case node_kind::label_stmt: {
+        auto &s = static_cast<label_stmt const &>(n);
+        out << ' ' << s.label << '\n';
+        dump_child(out, s.stmt.get(), child);
+        break;
+      }
+      case node_kind::goto_stmt: {
+        auto &label = static_cast<goto_stmt const &>(n).label;
+        out << (label.empty() ? "" : " ") << label << '\n';
+        break;
+      }
+      case node_kind::break_stmt: {
+        auto &label = static_cast<break_stmt const &>(n).label;
+        out << (label.empty() ? "" : " ") << label << '\n';
+        break;
+      }
+      case node_kind::continue_stmt: {
+        auto &label = static_cast<continue_stmt const &>(n).label;
+        out << (label.empty() ? "" : " ") << label << '\n';
+        break;
+      }
+      case node_kind::return_stmt:
+        out << '\n';
+        dump_child(out, static_cast<return_stmt const &>(n).exp.get(), child);
+        break;
+      case node_kind::if_stmt: {
+        auto &s = static_cast<if_stmt const &>(n);
+        out << '\n';
+        dump_child(out, s.cond.get(), child);
+        dump_child(out, s.cons.get(), child);
+        dump_child(out, s.altn.get(), child);
+        break;
+      }
+      case node_kind::switch_stmt: {
+        auto &s = static_cast<switch_stmt const &>(n);
+        out << '\n';
+        dump_child(out, s.exp.get(), child);
+        dump_list(out, s.cases, child);
+        break;
+      }
+      case node_kind::case_stmt: {
+        auto &s = static_cast<case_stmt const &>(n);
+        out << (s.is_default_case() ? " default\n" : "\n");
+        dump_child(out, s.exp.get(), child);
+        dump_list(out, s.stmts, child);
+        break;
+      }
+      case node_kind::do_stmt: {
+        auto &s = static_cast<do_stmt const &>(n);
+        out << '\n';
+        dump_child(out, s.stmt.get(), child);
+        dump_child(out, s.exp.get(), child);
+        break;
+      }
+      case node_kind::while_stmt: {
+        auto &s = static_cast<while_stmt const &>(n);
+        out << '\n';
+        dump_child(out, s.exp.get(), child);
+        dump_child(out, s.stmt.get(), child);
+        break;
+      }
+      case node_kind::for_stmt: {
+        auto &s = static_cast<for_stmt const &>(n);
+        out << '\n';
+        dump_child(out, s.init.get(), child);
+        dump_child(out, s.test.get(), child);
+        dump_child(out, s.incr.get(), child);
+        dump_child(out, s.stmt.get(), child);
+        break;
+      }
+      case node_kind::foreach_stmt: {
+        auto &s = static_cast<foreach_stmt const &>(n);
+        out << '\n';
+        dump_child(out, s.iter.get(), child);
+        dump_child(out, s.exp.get(), child);
+        dump_child(out, s.stmt.get(), child);
+        break;
+      }
+      case node_kind::let_decl: {
+        auto &d = static_cast<let_decl const &>(n);
+        out << ' ' << d.name << '\n';
+        dump_child(out, d.type.get(), child);
+        dump_child(out, d.init_exp.get(), child);
+        break;
+      }
+      case node_kind::fun_decl: {
+        auto &d = static_cast<fun_decl const &>(n);
+        out << ' ' << d.name << '\n';
+        dump_list(out, d.params, child);
+        dump_child(out, d.ret_type.get(), child);
+        dump_list(out, d.stmts(), child);
+        break;
+      }
+      case node_kind::type_decl:
+        out << ' ' << static_cast<type_decl const &>(n).name << '\n';
+        break;
+      case node_kind::type_ref:
+      case node_kind::unresolved_type_ref:
+      case node_kind::resolved_type_ref:
+        out << ' ' << static_cast<type_ref const &>(n).name << '\n';
+        break;
+      case node_kind::translation_unit: {
+        auto &tu = static_cast<translation_unit const &>(n);
+        out << ' ' << tu.range.filename.c_str() << '\n';
+        dump_list(out, tu.decls, child);
+        break;
+      }
+      case node_kind::program:
+        out << '\n';
+        dump_list(out, static_cast<program const &>(n).tus, child);
+        break;
+      case node_kind::error:
+        out << '\n';
+        break;
+    }
+  }
+
 } // namespace soda::ast
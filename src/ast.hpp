@@ -1,9 +1,16 @@
 #pragma once
 
+#include "diagnostic.hpp"
+#include "literal_pool.hpp"
 #include "operators.hpp"
 #include "source_range.hpp"
+#include "types.hpp"
 
+#include <atomic>
+#include <cstdint>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <ostream>
 #include <string>
 #include <string_view>
@@ -33,6 +40,7 @@ namespace soda::ast {
     empty_stmt,
     expr_stmt,
     block_stmt,
+    label_stmt,
     goto_stmt,
     break_stmt,
     continue_stmt,
@@ -47,7 +55,7 @@ namespace soda::ast {
     // declarations
     let_decl,
     fun_decl,
-    // ...
+    type_decl,
     // type references
     type_ref,
     unresolved_type_ref,
@@ -63,6 +71,11 @@ namespace soda::ast {
     return out << to_string(kind);
   }
 
+  class node;
+
+  // Write an indented tree representation of a node and its children.
+  void dump(std::ostream &out, node const &n, int indent = 0);
+
   //
   // Abstract base node
   //
@@ -131,11 +144,25 @@ namespace soda::ast {
   class expr : public node {
   public:
     using ptr = node::ptr<expr>;
-    using list = node::list<ptr>;
+    using list = node::list<expr>;
 
   protected:
     expr(node_kind kind, source_range range) : node{kind, std::move(range)} {
     }
+
+  public:
+    // The type of the value, set by the checker. A hash-consed literal can be
+    // checked by several threads at once, which all store the same type.
+    soda::type const *type_of() const noexcept {
+      return type_.load(std::memory_order_relaxed);
+    }
+
+    void set_type(soda::type const *type) noexcept {
+      type_.store(type, std::memory_order_relaxed);
+    }
+
+  private:
+    std::atomic<soda::type const *> type_{nullptr};
   };
 
   class atomic_expr : public expr {
@@ -146,9 +173,10 @@ namespace soda::ast {
   };
 
   class compound_expr : public expr {
-  protected:
+  public:
     operator_kind op;
 
+  protected:
     compound_expr(node_kind kind, source_range range, operator_kind op)
         : expr{kind, std::move(range)}, op{op} {
     }
@@ -164,7 +192,7 @@ namespace soda::ast {
   class stmt : public node {
   public:
     using ptr = node::ptr<stmt>;
-    using list = node::list<ptr>;
+    using list = node::list<stmt>;
 
   protected:
     stmt(node_kind kind, source_range range) : node{kind, std::move(range)} {
@@ -195,12 +223,15 @@ namespace soda::ast {
   class decl : public stmt {
   public:
     using ptr = node::ptr<decl>;
-    using list = node::list<ptr>;
+    using list = node::list<decl>;
 
     std::string name;
+    // the type of the variable or function, set by the checker, or the type
+    // named by a type_decl
+    soda::type const *canonical = nullptr;
 
   protected:
-    decl(node_kind kind, source_range range, std::string name)
+    decl(node_kind kind, source_range range, std::string name = {})
         : stmt{kind, std::move(range)}, name{std::move(name)} {
     }
   };
@@ -213,6 +244,8 @@ namespace soda::ast {
   public:
     std::string name;
     decl::ptr ref;
+    // the type denoted, set by the resolver
+    soda::type const *canonical = nullptr;
 
     type_ref(node_kind kind, source_range range, std::string name,
              decl::ptr ref = nullptr)
@@ -256,45 +289,56 @@ namespace soda::ast {
 
   class int_expr final : public atomic_expr {
   public:
-    unsigned long long int value;
+    // two's complement bits of a 64-bit signed integer; a literal above the
+    // signed range only has a meaning as the operand of a negation
+    std::uint64_t value;
 
-    int_expr(source_range range, unsigned long long int value)
+    int_expr(source_range range, std::uint64_t value)
         : atomic_expr{node_kind::int_expr, std::move(range)}, value{value} {
     }
   };
 
   class float_expr final : public atomic_expr {
   public:
-    long double value;
+    double value;
+    // only set when the literal needs more precision than a double
+    long double const *extended;
 
-    float_expr(source_range range, long double value)
-        : atomic_expr{node_kind::float_expr, std::move(range)}, value{value} {
+    float_expr(source_range range, double value,
+               long double const *extended = nullptr)
+        : atomic_expr{node_kind::float_expr, std::move(range)}, value{value},
+          extended{extended} {
+    }
+
+    long double precise_value() const noexcept {
+      return extended ? *extended : value;
     }
   };
 
   class char_expr final : public atomic_expr {
   public:
-    std::string value;
+    std::uint8_t value;
 
-    char_expr(source_range range, std::string value)
-        : atomic_expr{node_kind::char_expr, std::move(range)},
-          value{std::move(value)} {
+    char_expr(source_range range, std::uint8_t value)
+        : atomic_expr{node_kind::char_expr, std::move(range)}, value{value} {
     }
   };
 
   class string_expr final : public atomic_expr {
   public:
-    std::string value;
+    // decoded contents, owned by the translation unit's literal pool
+    std::string_view value;
 
-    string_expr(source_range range, std::string value)
-        : atomic_expr{node_kind::string_expr, std::move(range)},
-          value{std::move(value)} {
+    string_expr(source_range range, std::string_view value)
+        : atomic_expr{node_kind::string_expr, std::move(range)}, value{value} {
     }
   };
 
   class ident_expr final : public atomic_expr {
   public:
     std::string name;
+    // the declaration the name refers to, set by the resolver
+    decl *ref = nullptr;
 
     ident_expr(source_range range, std::string name)
         : atomic_expr{node_kind::ident_expr, std::move(range)},
@@ -399,6 +443,17 @@ namespace soda::ast {
     }
   };
 
+  class label_stmt final : public stmt {
+  public:
+    std::string label;
+    stmt::ptr stmt;
+
+    label_stmt(source_range range, std::string label, stmt::ptr stmt)
+        : ast::stmt{node_kind::label_stmt, std::move(range)},
+          label{std::move(label)}, stmt{std::move(stmt)} {
+    }
+  };
+
   //
   // Concrete jump statement nodes
   //
@@ -406,6 +461,8 @@ namespace soda::ast {
   class goto_stmt final : public jump_stmt {
   public:
     std::string label;
+    // set by the resolver
+    label_stmt *target = nullptr;
 
     goto_stmt(source_range range, std::string label)
         : jump_stmt{node_kind::goto_stmt, std::move(range)},
@@ -416,6 +473,8 @@ namespace soda::ast {
   class continue_stmt final : public jump_stmt {
   public:
     std::string label;
+    // the loop continued, set by the resolver
+    stmt *target = nullptr;
 
     continue_stmt(source_range range, std::string label = std::string{})
         : jump_stmt{node_kind::continue_stmt, std::move(range)},
@@ -426,6 +485,8 @@ namespace soda::ast {
   class break_stmt final : public jump_stmt {
   public:
     std::string label;
+    // the loop or switch left, set by the resolver
+    stmt *target = nullptr;
 
     break_stmt(source_range range, std::string label = std::string{})
         : jump_stmt{node_kind::break_stmt, std::move(range)},
@@ -471,7 +532,7 @@ namespace soda::ast {
     }
 
     bool is_default_case() const noexcept {
-      return exp.get() != nullptr;
+      return exp.get() == nullptr;
     }
   };
 
@@ -517,10 +578,13 @@ namespace soda::ast {
     stmt::ptr init;
     stmt::ptr test;
     stmt::ptr incr;
+    stmt::ptr stmt;
 
-    for_stmt(source_range range, stmt::ptr init, stmt::ptr test, stmt::ptr incr)
+    for_stmt(source_range range, stmt::ptr init, stmt::ptr test, stmt::ptr incr,
+             stmt::ptr stmt)
         : iter_stmt{node_kind::for_stmt, std::move(range)},
-          init{std::move(init)}, test{std::move(test)}, incr{std::move(incr)} {
+          init{std::move(init)}, test{std::move(test)}, incr{std::move(incr)},
+          stmt{std::move(stmt)} {
     }
   };
 
@@ -528,10 +592,12 @@ namespace soda::ast {
   public:
     decl::ptr iter;
     expr::ptr exp;
+    stmt::ptr stmt;
 
-    foreach_stmt(source_range range, decl::ptr iter, expr::ptr exp)
+    foreach_stmt(source_range range, decl::ptr iter, expr::ptr exp,
+                 stmt::ptr stmt)
         : iter_stmt{node_kind::foreach_stmt, std::move(range)},
-          iter{std::move(iter)}, exp{std::move(exp)} {
+          iter{std::move(iter)}, exp{std::move(exp)}, stmt{std::move(stmt)} {
     }
   };
 
@@ -541,23 +607,88 @@ namespace soda::ast {
 
   class let_decl final : public decl {
   public:
+    node::ptr<type_ref> type;
     expr::ptr init_exp;
 
-    let_decl(source_range range, std::string name, expr::ptr init_exp = nullptr)
+    let_decl(source_range range, std::string name,
+             node::ptr<type_ref> type = nullptr, expr::ptr init_exp = nullptr)
         : decl{node_kind::let_decl, std::move(range), std::move(name)},
-          init_exp{std::move(init_exp)} {
+          type{std::move(type)}, init_exp{std::move(init_exp)} {
     }
   };
 
   class fun_decl final : public decl {
   public:
+    using loader = std::function<stmt::list(diagnostics &)>;
+
     decl::list params;
-    stmt::list stmts;
+    node::ptr<type_ref> ret_type;
+
+    fun_decl(source_range range, std::string name, decl::list params,
+             node::ptr<type_ref> ret_type, stmt::list stmts)
+        : decl{node_kind::fun_decl, std::move(range), std::move(name)},
+          params{std::move(params)}, ret_type{std::move(ret_type)},
+          stmts_{std::move(stmts)}, loaded_{true} {
+    }
 
+    // The body is parsed by the loader the first time it is accessed, and
+    // its syntax errors kept for body_errors(). The loader is kept
+    // afterwards since it owns the resources (e.g. the builder and its
+    // literal pool) that the parsed body refers to.
     fun_decl(source_range range, std::string name, decl::list params,
-             stmt::list stmts)
+             node::ptr<type_ref> ret_type, loader load)
         : decl{node_kind::fun_decl, std::move(range), std::move(name)},
-          params{std::move(params)}, stmts{std::move(stmts)} {
+          params{std::move(params)}, ret_type{std::move(ret_type)},
+          load_{std::move(load)}, loaded_{false} {
+    }
+
+    stmt::list &stmts() {
+      load();
+      return stmts_;
+    }
+
+    stmt::list const &stmts() const {
+      load();
+      return stmts_;
+    }
+
+    // The syntax errors of a body parsed by the loader, which nothing has
+    // reported yet; those of a body parsed with the declaration are the
+    // parser's.
+    diagnostics const &body_errors() const {
+      load();
+      return body_errors_;
+    }
+
+    bool is_loaded() const noexcept {
+      return loaded_.load(std::memory_order_acquire);
+    }
+
+  private:
+    mutable stmt::list stmts_;
+    mutable diagnostics body_errors_;
+    loader load_;
+    mutable std::once_flag once_;
+    mutable std::atomic<bool> loaded_;
+
+    void load() const {
+      if (!is_loaded()) {
+        std::call_once(once_, [this] {
+          stmts_ = load_(body_errors_);
+          loaded_.store(true, std::memory_order_release);
+        });
+      }
+    }
+  };
+
+  // Declaration of a named type. Only the builtin types are declared this
+  // way for now; they are not part of any translation unit.
+  class type_decl final : public decl {
+  public:
+    type_decl(source_range range, std::string name,
+              soda::type const *canonical)
+        : decl{node_kind::type_decl, std::move(range), std::move(name)} {
+      this->canonical = canonical;
     }
   };
 
@@ -568,23 +699,28 @@ namespace soda::ast {
   class translation_unit final : public node {
   public:
     using ptr = node::ptr<translation_unit>;
-    using list = node::list<ptr>;
+    using list = node::list<translation_unit>;
 
     decl::list decls;
+    std::shared_ptr<literal_pool> literals;
 
-    translation_unit(std::filesystem::path fn, decl::list decls)
-        : node{node_kind::program,
+    translation_unit(std::filesystem::path fn, decl::list decls,
+                     std::shared_ptr<literal_pool> literals = nullptr)
+        : node{node_kind::translation_unit,
                source_range{std::move(fn), {0, 0, 0}, {0, 0, 0}}},
-          decls{std::move(decls)} {
+          decls{std::move(decls)}, literals{std::move(literals)} {
     }
   };
 
   class program final : public node {
   public:
     translation_unit::list tus;
+    // composite types of all units
+    std::shared_ptr<type_table> types;
 
     program(translation_unit::list tus)
-        : node{node_kind::program, {}}, tus{std::move(tus)} {
+        : node{node_kind::program, {}}, tus{std::move(tus)},
+          types{std::make_shared<type_table>()} {
     }
   };
 
@@ -0,0 +1,289 @@
+#include "backend.hpp"
+
+#include "constant.hpp"
+#include "ctfe.hpp"
+
+#include <bit>
+#include <unordered_set>
+#include <vector>
+
+namespace soda {
+
+  namespace {
+
+    using ir::opcode;
+
+    class layout_builder {
+    public:
+      layout_builder(ast::program const &prog, diagnostics &diags)
+          : prog_{prog}, diags_{diags} {
+        for (auto const &tu : prog_.tus) {
+          for (auto const &d : tu->decls) {
+            if (d->kind == ast::node_kind::let_decl) {
+              globals_.insert(d.get());
+            }
+          }
+        }
+      }
+
+      bool build(std::span<ir::function const> funs, program_layout &layout);
+
+    private:
+      ast::program const &prog_;
+      diagnostics &diags_;
+      std::unordered_set<ast::decl const *> globals_;
+      // runs the calls in initializers, and why the last one failed
+      mutable evaluator ctfe_;
+      mutable eval_status failure_ = eval_status::not_constant;
+
+      ast::let_decl const *global(ast::expr const &e) const;
+      bool fold(ast::expr const &e, constant &c, int depth) const;
+      bool evaluate_init(ast::expr const &e, global_init &init,
+                         int depth) const;
+    };
+
+    // The global e names, if it is one of the program's.
+    ast::let_decl const *layout_builder::global(ast::expr const &e) const {
+      if (e.kind != ast::node_kind::ident_expr) {
+        return nullptr;
+      }
+      auto ref = static_cast<ast::ident_expr const &>(e).ref;
+      return globals_.contains(ref) ? static_cast<ast::let_decl const *>(ref)
+                                    : nullptr;
+    }
+
+    // The value of a constant expression in a global's initializer, as the
+    // checker allows them: literals, other globals, operators and calls of
+    // functions that can be evaluated at compile time.
+    bool layout_builder::fold(ast::expr const &e, constant &c,
+                              int depth) const {
+      if (depth > 64) {
+        return false;
+      }
+      switch (e.kind) {
+        case ast::node_kind::bool_expr:
+          c = constant::of_bool(static_cast<ast::bool_expr const &>(e).value);
+          return true;
+        case ast::node_kind::int_expr:
+          c = constant::of_int(static_cast<std::int64_t>(
+              static_cast<ast::int_expr const &>(e).value));
+          return true;
+        case ast::node_kind::float_expr: {
+          auto const &n = static_cast<ast::float_expr const &>(e);
+          c = constant::of_float(n.precise_value(), n.extended != nullptr);
+          return true;
+        }
+        case ast::node_kind::ident_expr: {
+          auto let = global(e);
+          return let && let->init_exp && fold(*let->init_exp, c, depth + 1);
+        }
+        case ast::node_kind::unop_expr: {
+          auto const &n = static_cast<ast::unop_expr const &>(e);
+          constant operand;
+          return fold(*n.operand, operand, depth + 1) &&
+                 evaluate(n.op, operand, c) == eval_status::ok;
+        }
+        case ast::node_kind::binop_expr: {
+          auto const &n = static_cast<ast::binop_expr const &>(e);
+          constant lhs, rhs;
+          return fold(*n.lhs, lhs, depth + 1) &&
+                 fold(*n.rhs, rhs, depth + 1) &&
+                 evaluate(n.op, lhs, rhs, c) == eval_status::ok;
+        }
+        case ast::node_kind::call_expr: {
+          auto const &n = static_cast<ast::call_expr const &>(e);
+          auto ref = n.callee->kind == ast::node_kind::ident_expr
+                         ? static_cast<ast::ident_expr const &>(*n.callee).ref
+                         : nullptr;
+          if (!ref || ref->kind != ast::node_kind::fun_decl) {
+            return false;
+          }
+          std::vector<constant> args(n.arguments.size());
+          for (std::size_t k = 0; k < args.size(); k++) {
+            if (!fold(*n.arguments[k], args[k], depth + 1)) {
+              return false;
+            }
+          }
+          auto status =
+              ctfe_.call(static_cast<ast::fun_decl const &>(*ref), args, c);
+          if (status != eval_status::ok) {
+            failure_ = status;
+          }
+          return status == eval_status::ok && c.kind != constant::kind::none;
+        }
+        default:
+          return false;
+      }
+    }
+
+    bool layout_builder::evaluate_init(ast::expr const &e, global_init &init,
+                                       int depth) const {
+      switch (e.kind) {
+        case ast::node_kind::char_expr:
+          init.kind = global_init::kind::bits;
+          init.bits = static_cast<ast::char_expr const &>(e).value;
+          return true;
+        case ast::node_kind::string_expr:
+          init.kind = global_init::kind::string;
+          init.string = static_cast<ast::string_expr const &>(e).value;
+          return true;
+        case ast::node_kind::ident_expr: {
+          auto ref = static_cast<ast::ident_expr const &>(e).ref;
+          if (ref && ref->kind == ast::node_kind::fun_decl) {
+            init.kind = global_init::kind::function;
+            init.function = static_cast<ast::fun_decl const *>(ref);
+            return true;
+          }
+          auto let = global(e);
+          return let && let->init_exp && depth < 64 &&
+                 evaluate_init(*let->init_exp, init, depth + 1);
+        }
+        default: {
+          constant c;
+          if (!fold(e, c, depth)) {
+            return false;
+          }
+          init.kind = global_init::kind::bits;
+          switch (c.kind) {
+            case constant::kind::boolean:
+              init.bits = c.b;
+              return true;
+            case constant::kind::integer:
+              init.bits = static_cast<std::uint64_t>(c.i);
+              return true;
+            case constant::kind::floating:
+              init.bits =
+                  std::bit_cast<std::uint64_t>(static_cast<double>(c.f));
+              return true;
+            case constant::kind::none:
+              break;
+          }
+          return false;
+        }
+      }
+    }
+
+    bool layout_builder::build(std::span<ir::function const> funs,
+                               program_layout &layout) {
+      auto errors = diags_.size();
+      std::unordered_map<ast::decl const *, ir::function const *> bodies;
+      auto &main = layout.main;
+      for (auto const &f : funs) {
+        bodies.emplace(f.fun, &f);
+        if (f.fun->name == "main") {
+          main = f.fun;
+        }
+      }
+      if (!main) {
+        diags_.emplace_back(severity::error,
+                            prog_.tus.empty() ? source_range{}
+                                              : prog_.tus.front()->range,
+                            "no function 'main' to run");
+      } else if (auto t = main->canonical;
+                 !t->params.empty() ||
+                 (t->inner->kind != type_kind::int_type &&
+                  t->inner->kind != type_kind::void_type)) {
+        diags_.emplace_back(severity::error, main->range,
+                            "'main' must take no parameters and return "
+                            "'int' or nothing");
+      }
+
+      for (auto const &tu : prog_.tus) {
+        for (auto const &d : tu->decls) {
+          if (d->kind != ast::node_kind::let_decl) {
+            continue;
+          }
+          auto const &let = static_cast<ast::let_decl const &>(*d);
+          auto &init = layout.inits[&let];
+          failure_ = eval_status::not_constant;
+          if (let.init_exp && !evaluate_init(*let.init_exp, init, 0)) {
+            diags_.emplace_back(
+                severity::error, let.init_exp->range,
+                failure_ == eval_status::not_constant
+                    ? "the initializer of a global must be a constant "
+                      "expression"
+                    : std::string{to_string(failure_)});
+          }
+        }
+      }
+      if (diags_.size() != errors) {
+        return false;
+      }
+
+      std::unordered_set<ast::decl const *> reached{main};
+      std::vector<ast::decl const *> work{main};
+      while (!work.empty()) {
+        auto d = work.back();
+        work.pop_back();
+        auto reach = [&](ast::decl const *to) {
+          if (reached.insert(to).second) {
+            work.push_back(to);
+          }
+        };
+        if (d->kind == ast::node_kind::let_decl) {
+          if (auto const &init = layout.inits.at(d);
+              init.kind == global_init::kind::function) {
+            reach(init.function);
+          }
+          continue;
+        }
+        auto const &f = *bodies.at(d);
+        for (auto const &i : f.instrs) {
+          if (i.op == opcode::function || i.op == opcode::load_global ||
+              i.op == opcode::store_global) {
+            reach(f.symbols[i.imm]);
+          }
+        }
+      }
+
+      for (auto const &f : funs) {
+        if (reached.contains(f.fun)) {
+          layout.functions.push_back(&f);
+        }
+      }
+      for (auto const &tu : prog_.tus) {
+        for (auto const &d : tu->decls) {
+          if (d->kind == ast::node_kind::let_decl &&
+              reached.contains(d.get())) {
+            layout.globals.push_back(
+                static_cast<ast::let_decl const *>(d.get()));
+          }
+        }
+      }
+      return true;
+    }
+
+  } // namespace
+
+  bool lay_out(ast::program const &prog, std::span<ir::function const> funs,
+               program_layout &layout, diagnostics &diags) {
+    return layout_builder{prog, diags}.build(funs, layout);
+  }
+
+  bool may_trap(ir::function const &f, ir::value_id v) {
+    auto const &i = f.instrs[v];
+    auto ops = f.operands_of(v);
+    auto is_int = [&] { return i.type->kind == type_kind::int_type; };
+    auto constant = [&](ir::value_id op) {
+      return f.instrs[op].op == opcode::constant;
+    };
+    switch (i.op) {
+      case opcode::div:
+      case opcode::mod:
+        return is_int() && !(constant(ops[1]) &&
+                             int_value(f.instrs[ops[1]]) != 0 &&
+                             int_value(f.instrs[ops[1]]) != -1);
+      case opcode::pow:
+        return is_int() &&
+               !(constant(ops[1]) && int_value(f.instrs[ops[1]]) >= 0);
+      case opcode::lshift:
+      case opcode::rshift:
+        return !(constant(ops[1]) && f.instrs[ops[1]].imm < 64);
+      case opcode::index:
+        return !i.imm;
+      default:
+        return false;
+    }
+  }
+
+} // namespace soda
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "ast.hpp"
+#include "diagnostic.hpp"
+#include "ir.hpp"
+
+#include <cstdint>
+#include <span>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace soda {
+
+  //
+  // What the backends share
+  //
+  // A program is written whole, starting from its main. The initializer of
+  // each global must be a constant expression, a literal or a function,
+  // which is evaluated here once for every backend, running the calls in
+  // it at compile time (see ctfe.hpp). Only the functions and globals that
+  // main can reach, through calls, function values, loads and stores and
+  // the functions named by initializers, are written.
+  //
+
+  struct global_init {
+    enum class kind : std::uint8_t {
+      // zero, or the empty string for a string
+      none,
+      // a bool, char or int, or the bits of a float
+      bits,
+      string,
+      function,
+    };
+
+    enum kind kind = kind::none;
+    std::uint64_t bits = 0;
+    std::string_view string;
+    ast::fun_decl const *function = nullptr;
+  };
+
+  struct program_layout {
+    ast::fun_decl const *main = nullptr;
+    // what main can reach, in the order of the program
+    std::vector<ir::function const *> functions;
+    std::vector<ast::let_decl const *> globals;
+    std::unordered_map<ast::decl const *, global_init> inits;
+  };
+
+  // Lay out prog, whose functions are funs. A global whose initializer is
+  // not constant and a missing or ill-typed main, which must take no
+  // parameters and return int or void, are appended to diags as errors,
+  // and false is returned.
+  bool lay_out(ast::program const &prog, std::span<ir::function const> funs,
+               program_layout &layout, diagnostics &diags);
+
+  // Whether v may trap at run time: indexing unless it is known to be in
+  // bounds, division and remainder of ints unless by a constant other
+  // than 0 and -1, powers of ints unless to a constant that is not
+  // negative, and shifts unless by a constant below 64.
+  bool may_trap(ir::function const &f, ir::value_id v);
+
+} // namespace soda
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace soda {
+
+  //
+  // Dense bit sets
+  //
+  // Sets are spans of 64-bit words, so that whole rows of a bit_matrix can
+  // be combined in place. The set operations are plain loops over words
+  // without early exits, which the compiler turns into vector code; they
+  // report whether the destination changed, as iterative dataflow needs.
+  //
+
+  using bit_word = std::uint64_t;
+
+  inline constexpr std::size_t bits_per_word = 64;
+
+  constexpr std::size_t words_for(std::size_t bits) noexcept {
+    return (bits + bits_per_word - 1) / bits_per_word;
+  }
+
+  inline bool test_bit(std::span<bit_word const> set, std::size_t i) noexcept {
+    return (set[i / bits_per_word] >> (i % bits_per_word)) & 1;
+  }
+
+  inline void set_bit(std::span<bit_word> set, std::size_t i) noexcept {
+    set[i / bits_per_word] |= bit_word{1} << (i % bits_per_word);
+  }
+
+  inline void reset_bit(std::span<bit_word> set, std::size_t i) noexcept {
+    set[i / bits_per_word] &= ~(bit_word{1} << (i % bits_per_word));
+  }
+
+  // Fill the first `bits` bits, leaving the padding of the last word clear.
+  inline void fill_bits(std::span<bit_word> set, std::size_t bits) noexcept {
+    std::ranges::fill(set, ~bit_word{0});
+    if (bits % bits_per_word) {
+      set.back() = (bit_word{1} << (bits % bits_per_word)) - 1;
+    }
+  }
+
+  inline bool unite(std::span<bit_word> dst,
+                    std::span<bit_word const> src) noexcept {
+    bit_word changed = 0;
+    for (std::size_t i = 0; i < dst.size(); i++) {
+      auto w = dst[i] | src[i];
+      changed |= w ^ dst[i];
+      dst[i] = w;
+    }
+    return changed != 0;
+  }
+
+  inline bool intersect(std::span<bit_word> dst,
+                        std::span<bit_word const> src) noexcept {
+    bit_word changed = 0;
+    for (std::size_t i = 0; i < dst.size(); i++) {
+      auto w = dst[i] & src[i];
+      changed |= w ^ dst[i];
+      dst[i] = w;
+    }
+    return changed != 0;
+  }
+
+  inline void subtract(std::span<bit_word> dst,
+                       std::span<bit_word const> src) noexcept {
+    for (std::size_t i = 0; i < dst.size(); i++) {
+      dst[i] &= ~src[i];
+    }
+  }
+
+  // dst = gen | (src & ~kill), the transfer function of gen/kill problems.
+  inline bool transfer(std::span<bit_word> dst, std::span<bit_word const> src,
+                       std::span<bit_word const> gen,
+                       std::span<bit_word const> kill) noexcept {
+    bit_word changed = 0;
+    for (std::size_t i = 0; i < dst.size(); i++) {
+      auto w = gen[i] | (src[i] & ~kill[i]);
+      changed |= w ^ dst[i];
+      dst[i] = w;
+    }
+    return changed != 0;
+  }
+
+  // A set of equally sized bit sets stored back to back.
+  class bit_matrix {
+  public:
+    bit_matrix() = default;
+
+    bit_matrix(std::size_t rows, std::size_t bits)
+        : words_{words_for(bits)}, data_(rows * words_) {
+    }
+
+    std::size_t rows() const noexcept {
+      return words_ ? data_.size() / words_ : 0;
+    }
+
+    std::size_t words() const noexcept {
+      return words_;
+    }
+
+    std::span<bit_word> operator[](std::size_t row) noexcept {
+      return {data_.data() + row * words_, words_};
+    }
+
+    std::span<bit_word const> operator[](std::size_t row) const noexcept {
+      return {data_.data() + row * words_, words_};
+    }
+
+  private:
+    std::size_t words_ = 0;
+    std::vector<bit_word> data_;
+  };
+
+} // namespace soda
@@ -0,0 +1,49 @@
+#include "loops.hpp"
+#include "optimize.hpp"
+#include "rewrite.hpp"
+
+namespace soda::ir {
+
+  // A loop whose header goes on while an induction variable that starts at
+  // a constant of at least 0 and steps by 1 is below the length of an
+  // array or string has the variable in the bounds of it everywhere in the
+  // loop but the header: the loop was last entered from the header through
+  // the test, and the variable cannot wrap around before it fails. Indexing
+  // the same array with the variable there is marked as not needing a
+  // check.
+  void remove_bounds_checks(function &f, pass_stats &stats) {
+    loop_nest loops{f};
+    if (!loops.size()) {
+      return;
+    }
+    use_map uses{f};
+    auto block_of = blocks_of(f);
+    std::size_t count = 0;
+    for (std::uint32_t l = 0; l < loops.size(); l++) {
+      auto const &loop = loops[l];
+      if (loop.tested == loop_forest::no_loop || loop.test != opcode::lt ||
+          f.instrs[loop.bound].op != opcode::length) {
+        continue;
+      }
+      auto const &iv = loop.ivs[loop.tested];
+      auto const &init = f.instrs[iv.init];
+      if (iv.step != 1 || init.op != opcode::constant ||
+          int_value(init) < 0) {
+        continue;
+      }
+      auto array = f.operands_of(loop.bound)[0];
+      for (auto u : uses.users(iv.phi)) {
+        auto &i = f.instrs[u];
+        auto ops = f.operands_of(u);
+        if (i.op == opcode::index && !i.imm && ops[0] == array &&
+            ops[1] == iv.phi && block_of[u] != loop.header &&
+            loops.contains(l, block_of[u])) {
+          i.imm = 1;
+          count++;
+        }
+      }
+    }
+    stats.checks_removed += count;
+  }
+
+} // namespace soda::ir
@@ -0,0 +1,250 @@
+#include "builder.hpp"
+
+#include "utils.hpp"
+
+#include <cmath>
+
+namespace soda::ast {
+
+  // 0.0 and -0.0 must stay distinct while all NaNs are interchangeable
+  static bool same_float(long double a, long double b) {
+    return (a == b && std::signbit(a) == std::signbit(b)) ||
+           (std::isnan(a) && std::isnan(b));
+  }
+
+  // Whether diagnostics about an operation by op all point at the
+  // operation, never at an operand on its own.
+  static bool shares_operands(operator_kind op) {
+    return op <= operator_kind::log_not ||
+           (op >= operator_kind::add && op <= operator_kind::rshift);
+  }
+
+  template <typename T, typename Equal>
+  expr::ptr builder::intern(expr::ptr e, std::size_t hash, Equal &&equal) {
+    if ((count_ + 1) * 4 > table_.size() * 3) {
+      grow();
+    }
+
+    auto mask = table_.size() - 1;
+    auto i = hash & mask;
+    while (table_[i].node) {
+      if (table_[i].hash == hash) {
+        auto candidate = table_[i].node.get();
+        if (candidate->kind == e->kind &&
+            equal(static_cast<T const &>(*candidate))) {
+          stats_.created--;
+          stats_.bytes_saved += sizeof(T);
+          return table_[i].node;
+        }
+      }
+      i = (i + 1) & mask;
+    }
+
+    table_[i] = slot{hash, e};
+    count_++;
+    return e;
+  }
+
+  void builder::grow() {
+    auto old = std::move(table_);
+    table_ = std::vector<slot>(old.empty() ? 256 : old.size() * 2);
+    auto mask = table_.size() - 1;
+    for (auto &s : old) {
+      if (s.node) {
+        auto i = s.hash & mask;
+        while (table_[i].node) {
+          i = (i + 1) & mask;
+        }
+        table_[i] = std::move(s);
+      }
+    }
+  }
+
+  expr::ptr builder::share(expr::ptr e) {
+    auto hash = static_cast<std::size_t>(e->kind);
+    switch (e->kind) {
+      case node_kind::bool_expr: {
+        auto value = static_cast<bool_expr const &>(*e).value;
+        hash_combine(hash, value);
+        return intern<bool_expr>(std::move(e), hash, [&](bool_expr const &n) {
+          return n.value == value;
+        });
+      }
+      case node_kind::int_expr: {
+        auto value = static_cast<int_expr const &>(*e).value;
+        hash_combine(hash, value);
+        return intern<int_expr>(std::move(e), hash, [&](int_expr const &n) {
+          return n.value == value;
+        });
+      }
+      case node_kind::float_expr: {
+        auto const &f = static_cast<float_expr const &>(*e);
+        auto extended = f.extended != nullptr;
+        auto value = f.precise_value();
+        hash_combine(hash, f.value);
+        return intern<float_expr>(
+            std::move(e), hash, [&](float_expr const &n) {
+              return extended == (n.extended != nullptr) &&
+                     same_float(n.precise_value(), value);
+            });
+      }
+      case node_kind::char_expr: {
+        auto value = static_cast<char_expr const &>(*e).value;
+        hash_combine(hash, static_cast<std::uint32_t>(value));
+        return intern<char_expr>(std::move(e), hash, [&](char_expr const &n) {
+          return n.value == value;
+        });
+      }
+      case node_kind::string_expr: {
+        // pooled contents are unique, so their address identifies them
+        auto value = static_cast<string_expr const &>(*e).value.data();
+        hash_combine(hash, value);
+        return intern<string_expr>(
+            std::move(e), hash,
+            [&](string_expr const &n) { return n.value.data() == value; });
+      }
+      default:
+        return e;
+    }
+  }
+
+  node::ptr<bool_expr> builder::make_bool(source_range range, bool value) {
+    tally();
+    return std::make_shared<bool_expr>(std::move(range), value);
+  }
+
+  node::ptr<int_expr> builder::make_int(source_range range,
+                                        std::uint64_t value) {
+    tally();
+    return std::make_shared<int_expr>(std::move(range), value);
+  }
+
+  node::ptr<float_expr> builder::make_float(source_range range,
+                                            long double value, bool extended) {
+    tally();
+    return std::make_shared<float_expr>(
+        std::move(range), static_cast<double>(value),
+        extended ? literals_->intern_extended(value) : nullptr);
+  }
+
+  node::ptr<char_expr> builder::make_char(source_range range,
+                                         std::uint8_t value) {
+    tally();
+    return std::make_shared<char_expr>(std::move(range), value);
+  }
+
+  node::ptr<string_expr> builder::make_string(source_range range,
+                                              std::string_view value) {
+    tally();
+    return std::make_shared<string_expr>(std::move(range),
+                                         literals_->intern(value));
+  }
+
+  node::ptr<ident_expr> builder::make_ident(source_range range,
+                                            std::string name) {
+    tally();
+    return std::make_shared<ident_expr>(std::move(range), std::move(name));
+  }
+
+  node::ptr<unop_expr> builder::make_unop(source_range range, operator_kind op,
+                                          expr::ptr operand) {
+    tally();
+    if (hash_consing_ && shares_operands(op)) {
+      operand = share(std::move(operand));
+    }
+    return std::make_shared<unop_expr>(std::move(range), op,
+                                       std::move(operand));
+  }
+
+  node::ptr<binop_expr> builder::make_binop(source_range range,
+                                            operator_kind op, expr::ptr lhs,
+                                            expr::ptr rhs) {
+    tally();
+    if (hash_consing_ && shares_operands(op)) {
+      lhs = share(std::move(lhs));
+      rhs = share(std::move(rhs));
+    }
+    return std::make_shared<binop_expr>(std::move(range), op, std::move(lhs),
+                                        std::move(rhs));
+  }
+
+  node::ptr<if_expr> builder::make_if(source_range range, expr::ptr cond,
+                                      expr::ptr cons, expr::ptr altn) {
+    tally();
+    return std::make_shared<if_expr>(std::move(range), std::move(cond),
+                                     std::move(cons), std::move(altn));
+  }
+
+  node::ptr<call_expr> builder::make_call(source_range range, expr::ptr callee,
+                                          expr::list arguments) {
+    tally();
+    return std::make_shared<call_expr>(std::move(range), std::move(callee),
+                                       std::move(arguments));
+  }
+
+  bool structurally_equal(expr const *a, expr const *b) noexcept {
+    if (a == b) {
+      return true;
+    } else if (!a || !b || a->kind != b->kind) {
+      return false;
+    }
+    switch (a->kind) {
+      case node_kind::bool_expr:
+        return static_cast<bool_expr const *>(a)->value ==
+               static_cast<bool_expr const *>(b)->value;
+      case node_kind::int_expr:
+        return static_cast<int_expr const *>(a)->value ==
+               static_cast<int_expr const *>(b)->value;
+      case node_kind::float_expr:
+        return same_float(static_cast<float_expr const *>(a)->precise_value(),
+                          static_cast<float_expr const *>(b)->precise_value());
+      case node_kind::char_expr:
+        return static_cast<char_expr const *>(a)->value ==
+               static_cast<char_expr const *>(b)->value;
+      case node_kind::string_expr:
+        return static_cast<string_expr const *>(a)->value ==
+               static_cast<string_expr const *>(b)->value;
+      case node_kind::ident_expr:
+        return static_cast<ident_expr const *>(a)->name ==
+               static_cast<ident_expr const *>(b)->name;
+      case node_kind::unop_expr: {
+        auto x = static_cast<unop_expr const *>(a);
+        auto y = static_cast<unop_expr const *>(b);
+        return x->op == y->op &&
+               structurally_equal(x->operand.get(), y->operand.get());
+      }
+      case node_kind::binop_expr: {
+        auto x = static_cast<binop_expr const *>(a);
+        auto y = static_cast<binop_expr const *>(b);
+        return x->op == y->op &&
+               structurally_equal(x->lhs.get(), y->lhs.get()) &&
+               structurally_equal(x->rhs.get(), y->rhs.get());
+      }
+      case node_kind::if_expr: {
+        auto x = static_cast<if_expr const *>(a);
+        auto y = static_cast<if_expr const *>(b);
+        return structurally_equal(x->cond.get(), y->cond.get()) &&
+               structurally_equal(x->cons.get(), y->cons.get()) &&
+               structurally_equal(x->altn.get(), y->altn.get());
+      }
+      case node_kind::call_expr: {
+        auto x = static_cast<call_expr const *>(a);
+        auto y = static_cast<call_expr const *>(b);
+        if (x->arguments.size() != y->arguments.size() ||
+            !structurally_equal(x->callee.get(), y->callee.get())) {
+          return false;
+        }
+        for (std::size_t i = 0; i < x->arguments.size(); i++) {
+          if (!structurally_equal(x->arguments[i].get(),
+                                  y->arguments[i].get())) {
+            return false;
+          }
+        }
+        return true;
+      }
+      default:
+        return false;
+    }
+  }
+
+} // namespace soda::ast
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "ast.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace soda::ast {
+
+  //
+  // Expression node factory
+  //
+  // When hash-consing is enabled, literals that are operands of arithmetic,
+  // bitwise, comparison and logical operators are canonicalized so that
+  // only one node exists per distinct (kind, value), and two such operands
+  // are structurally equal exactly when they are the same node.
+  // Diagnostics about these operations point at the operation, never at an
+  // operand on its own, so the source range a shared literal keeps, that of
+  // its first occurrence, is never reported. Every other node, identifiers
+  // included, belongs to its occurrence alone: it has its own range, and
+  // the resolver binds it for its own scope. Passes must not change a
+  // literal in place, since other operations may share it.
+  //
+  // Lazily parsed function bodies are built by their unit's builder, after
+  // the declarations and possibly on several threads at once; each load
+  // holds mutex() while it parses.
+  //
+
+  class builder {
+  public:
+    struct stats {
+      std::size_t requested = 0;
+      std::size_t created = 0;
+      std::size_t bytes_saved = 0;
+    };
+
+    explicit builder(bool hash_consing = false)
+        : hash_consing_{hash_consing},
+          literals_{std::make_shared<literal_pool>()} {
+    }
+
+    bool hash_consing() const noexcept {
+      return hash_consing_;
+    }
+
+    // The pool holding string literal contents; hand it to the
+    // translation_unit built from these nodes.
+    std::shared_ptr<literal_pool> const &literals() const noexcept {
+      return literals_;
+    }
+
+    stats const &statistics() const noexcept {
+      return stats_;
+    }
+
+    std::mutex &mutex() noexcept {
+      return mutex_;
+    }
+
+    node::ptr<bool_expr> make_bool(source_range range, bool value);
+    node::ptr<int_expr> make_int(source_range range, std::uint64_t value);
+    node::ptr<float_expr> make_float(source_range range, long double value,
+                                     bool extended = false);
+    node::ptr<char_expr> make_char(source_range range, std::uint8_t value);
+    node::ptr<string_expr> make_string(source_range range,
+                                       std::string_view value);
+    node::ptr<ident_expr> make_ident(source_range range, std::string name);
+    node::ptr<unop_expr> make_unop(source_range range, operator_kind op,
+                                   expr::ptr operand);
+    node::ptr<binop_expr> make_binop(source_range range, operator_kind op,
+                                     expr::ptr lhs, expr::ptr rhs);
+    node::ptr<if_expr> make_if(source_range range, expr::ptr cond,
+                               expr::ptr cons, expr::ptr altn);
+    node::ptr<call_expr> make_call(source_range range, expr::ptr callee,
+                                   expr::list arguments);
+
+  private:
+    struct slot {
+      std::size_t hash = 0;
+      expr::ptr node;
+    };
+
+    bool hash_consing_;
+    std::shared_ptr<literal_pool> literals_;
+    stats stats_;
+    std::vector<slot> table_;
+    std::size_t count_ = 0;
+    std::mutex mutex_;
+
+    void tally() {
+      stats_.requested++;
+      stats_.created++;
+    }
+
+    // The canonical node for e if e is a literal, making e that node if it
+    // is the first of its value.
+    expr::ptr share(expr::ptr e);
+
+    template <typename T, typename Equal>
+    expr::ptr intern(expr::ptr e, std::size_t hash, Equal &&equal);
+
+    void grow();
+  };
+
+  // Deep structural comparison, ignoring source ranges. Shared literals
+  // compare equal by pointer.
+  bool structurally_equal(expr const *a, expr const *b) noexcept;
+
+} // namespace soda::ast
@@ -0,0 +1,995 @@
+#include "bytecode.hpp"
+
+#include "cfg.hpp"
+#include "switch_lowering.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <unordered_map>
+#include <utility>
+
+namespace soda::vm {
+
+  std::string_view to_string(opcode op) {
+    switch (op) {
+      case opcode::move:
+        return "move";
+      case opcode::iadd:
+        return "iadd";
+      case opcode::isub:
+        return "isub";
+      case opcode::imul:
+        return "imul";
+      case opcode::idiv:
+        return "idiv";
+      case opcode::imod:
+        return "imod";
+      case opcode::ipow:
+        return "ipow";
+      case opcode::iand:
+        return "iand";
+      case opcode::ior:
+        return "ior";
+      case opcode::ixor:
+        return "ixor";
+      case opcode::ishl:
+        return "ishl";
+      case opcode::ishr:
+        return "ishr";
+      case opcode::imulh:
+        return "imulh";
+      case opcode::ineg:
+        return "ineg";
+      case opcode::inot:
+        return "inot";
+      case opcode::lnot:
+        return "lnot";
+      case opcode::fadd:
+        return "fadd";
+      case opcode::fsub:
+        return "fsub";
+      case opcode::fmul:
+        return "fmul";
+      case opcode::fdiv:
+        return "fdiv";
+      case opcode::fmod:
+        return "fmod";
+      case opcode::fpow:
+        return "fpow";
+      case opcode::fneg:
+        return "fneg";
+      case opcode::ilt:
+        return "ilt";
+      case opcode::ile:
+        return "ile";
+      case opcode::ieq:
+        return "ieq";
+      case opcode::ine:
+        return "ine";
+      case opcode::flt:
+        return "flt";
+      case opcode::fle:
+        return "fle";
+      case opcode::feq:
+        return "feq";
+      case opcode::fne:
+        return "fne";
+      case opcode::slt:
+        return "slt";
+      case opcode::sle:
+        return "sle";
+      case opcode::seq:
+        return "seq";
+      case opcode::sne:
+        return "sne";
+      case opcode::scat:
+        return "scat";
+      case opcode::slen:
+        return "slen";
+      case opcode::alen:
+        return "alen";
+      case opcode::sindex:
+        return "sindex";
+      case opcode::aindex:
+        return "aindex";
+      case opcode::astore:
+        return "astore";
+      case opcode::gload:
+        return "gload";
+      case opcode::gstore:
+        return "gstore";
+      case opcode::call:
+        return "call";
+      case opcode::callv:
+        return "callv";
+      case opcode::ret:
+        return "ret";
+      case opcode::ret_void:
+        return "ret_void";
+      case opcode::jump:
+        return "jump";
+      case opcode::jt:
+        return "jt";
+      case opcode::jf:
+        return "jf";
+      case opcode::switch_:
+        return "switch";
+      case opcode::iadd_k:
+        return "iadd_k";
+      case opcode::imul_k:
+        return "imul_k";
+      case opcode::iand_k:
+        return "iand_k";
+      case opcode::ior_k:
+        return "ior_k";
+      case opcode::ixor_k:
+        return "ixor_k";
+      case opcode::ishl_k:
+        return "ishl_k";
+      case opcode::ishr_k:
+        return "ishr_k";
+      case opcode::ilt_k:
+        return "ilt_k";
+      case opcode::ile_k:
+        return "ile_k";
+      case opcode::igt_k:
+        return "igt_k";
+      case opcode::ige_k:
+        return "ige_k";
+      case opcode::ieq_k:
+        return "ieq_k";
+      case opcode::ine_k:
+        return "ine_k";
+      case opcode::jlt:
+        return "jlt";
+      case opcode::jle:
+        return "jle";
+      case opcode::jeq:
+        return "jeq";
+      case opcode::jne:
+        return "jne";
+      case opcode::jlt_k:
+        return "jlt_k";
+      case opcode::jle_k:
+        return "jle_k";
+      case opcode::jgt_k:
+        return "jgt_k";
+      case opcode::jge_k:
+        return "jge_k";
+      case opcode::jeq_k:
+        return "jeq_k";
+      case opcode::jne_k:
+        return "jne_k";
+    }
+    unreachable();
+  }
+
+  format format_of(opcode op) {
+    using enum field;
+    switch (op) {
+      case opcode::move:
+      case opcode::ineg:
+      case opcode::inot:
+      case opcode::lnot:
+      case opcode::fneg:
+      case opcode::slen:
+      case opcode::alen:
+        return {reg, reg, none};
+      case opcode::iadd_k:
+      case opcode::imul_k:
+      case opcode::iand_k:
+      case opcode::ior_k:
+      case opcode::ixor_k:
+      case opcode::ishl_k:
+      case opcode::ishr_k:
+      case opcode::ilt_k:
+      case opcode::ile_k:
+      case opcode::igt_k:
+      case opcode::ige_k:
+      case opcode::ieq_k:
+      case opcode::ine_k:
+        return {reg, reg, imm};
+      case opcode::gload:
+      case opcode::gstore:
+      case opcode::switch_:
+        return {reg, none, imm};
+      case opcode::call:
+        return {reg, imm, imm};
+      case opcode::callv:
+        return {reg, reg, imm};
+      case opcode::ret:
+        return {reg, none, none};
+      case opcode::ret_void:
+        return {none, none, none};
+      case opcode::jump:
+        return {none, none, target};
+      case opcode::jt:
+      case opcode::jf:
+        return {reg, none, target};
+      case opcode::jlt:
+      case opcode::jle:
+      case opcode::jeq:
+      case opcode::jne:
+        return {reg, reg, target};
+      case opcode::jlt_k:
+      case opcode::jle_k:
+      case opcode::jgt_k:
+      case opcode::jge_k:
+      case opcode::jeq_k:
+      case opcode::jne_k:
+        return {reg, target, imm};
+      default:
+        return {reg, reg, reg};
+    }
+  }
+
+  namespace {
+
+    using ir::value_id;
+
+    // Stand-ins for the registers that hold no value: the result of a call
+    // that returns nothing, and a temporary for breaking cycles of moves
+    // and for the comparisons of a switch on values that are not constant.
+    constexpr value_id discard = ir::no_value - 1;
+    constexpr value_id temporary = ir::no_value - 2;
+
+    constexpr std::uint32_t no_register =
+        std::numeric_limits<std::uint32_t>::max();
+
+    // The form of a comparison with an int immediate, which has one for
+    // every relation, as the first opcode of six in the order lt, le, gt,
+    // ge, eq, ne.
+    opcode with_immediate(opcode first, ir::opcode rel) {
+      auto offset = 0;
+      switch (rel) {
+        case ir::opcode::lt:
+          offset = 0;
+          break;
+        case ir::opcode::le:
+          offset = 1;
+          break;
+        case ir::opcode::gt:
+          offset = 2;
+          break;
+        case ir::opcode::ge:
+          offset = 3;
+          break;
+        case ir::opcode::eq:
+          offset = 4;
+          break;
+        default:
+          offset = 5;
+          break;
+      }
+      return static_cast<opcode>(static_cast<int>(first) + offset);
+    }
+
+    class compiler {
+    public:
+      compiler(program_layout const &layout, module &m,
+               bool superinstructions)
+          : layout_{layout}, m_{m}, super_{superinstructions} {
+      }
+
+      void compile();
+
+    private:
+      struct fixup {
+        std::uint32_t at;
+        std::uint32_t label;
+      };
+
+      struct stub {
+        std::uint32_t label;
+        block_id to;
+        std::vector<std::pair<value_id, value_id>> moves;
+      };
+
+      program_layout const &layout_;
+      module &m_;
+      bool super_;
+      std::unordered_map<ast::decl const *, std::uint32_t> functions_;
+      std::unordered_map<ast::decl const *, std::uint32_t> globals_;
+      std::unordered_map<std::string_view, string_object const *> strings_;
+
+      // the function being compiled
+      ir::function const *f_ = nullptr;
+      function *out_ = nullptr;
+      std::vector<std::uint32_t> uses_;
+      // int comparisons written as part of the branch on them
+      std::vector<bool> fused_;
+      std::vector<block_id> next_;
+      // the instruction each label is at: the blocks, then the stubs
+      std::vector<std::uint32_t> labels_;
+      std::vector<fixup> fixups_;
+      std::vector<stub> stubs_;
+
+      string_object const *string(std::string_view s);
+      std::uint64_t leaf_bits(value_id v);
+      bool int_constant(value_id v, std::int64_t &k) const;
+
+      void compile_function(ir::function const &f, function &out);
+      void assign_registers();
+      void emit(opcode op, std::uint32_t a = 0, std::uint32_t b = 0,
+                std::int64_t c = 0);
+      void emit_jump(opcode op, std::uint32_t a, std::uint32_t b,
+                     std::int64_t c, std::uint32_t label);
+
+      void compile_value(value_id v);
+      void int_binary(value_id v, opcode op, opcode op_k, bool commutative);
+      void compare(value_id v);
+      void jump_if(value_id cond, bool negated, std::uint32_t label);
+
+      void edge_moves(block_id b, std::size_t k,
+                      std::vector<std::pair<value_id, value_id>> &moves);
+      void parallel_move(std::vector<std::pair<value_id, value_id>> &moves);
+      std::uint32_t edge_label(block_id b, std::size_t k);
+      void write_edge(block_id b, std::size_t k);
+      void write_terminator(block_id b);
+      void write_switch(block_id b);
+    };
+
+    string_object const *compiler::string(std::string_view s) {
+      auto [it, inserted] = strings_.emplace(s, nullptr);
+      if (inserted) {
+        it->second = &m_.strings.emplace_back(
+            static_cast<std::int64_t>(s.size()), s.data());
+      }
+      return it->second;
+    }
+
+    // The bits of a constant, undef or function value.
+    std::uint64_t compiler::leaf_bits(value_id v) {
+      auto const &f = *f_;
+      auto const &i = f.instrs[v];
+      auto is_string = i.type->kind == type_kind::string_type;
+      switch (i.op) {
+        case ir::opcode::constant:
+          return is_string ? std::bit_cast<std::uintptr_t>(
+                                 string(f.strings[i.imm]))
+                           : i.imm;
+        case ir::opcode::function:
+          return functions_.at(f.symbols[i.imm]) + 1;
+        default:
+          // an undefined string is empty, so that it can still be read
+          return is_string ? std::bit_cast<std::uintptr_t>(string({})) : 0;
+      }
+    }
+
+    bool compiler::int_constant(value_id v, std::int64_t &k) const {
+      auto const &i = f_->instrs[v];
+      if (!super_ || i.op != ir::opcode::constant ||
+          i.type->kind == type_kind::float_type ||
+          i.type->kind == type_kind::string_type) {
+        return false;
+      }
+      k = ir::int_value(i);
+      return true;
+    }
+
+    void compiler::compile() {
+      for (std::uint32_t k = 0; k < layout_.functions.size(); k++) {
+        functions_.emplace(layout_.functions[k]->fun, k);
+      }
+      for (std::uint32_t k = 0; k < layout_.globals.size(); k++) {
+        globals_.emplace(layout_.globals[k], k);
+      }
+      if (layout_.main) {
+        m_.main = functions_.at(layout_.main);
+      }
+
+      for (auto let : layout_.globals) {
+        auto const &init = layout_.inits.at(let);
+        auto is_string = let->canonical->kind == type_kind::string_type;
+        std::uint64_t bits = 0;
+        switch (init.kind) {
+          case global_init::kind::none:
+            if (is_string) {
+              bits = std::bit_cast<std::uintptr_t>(string({}));
+            }
+            break;
+          case global_init::kind::bits:
+            bits = init.bits;
+            break;
+          case global_init::kind::string:
+            bits = std::bit_cast<std::uintptr_t>(string(init.string));
+            break;
+          case global_init::kind::function:
+            bits = functions_.at(init.function) + 1;
+            break;
+        }
+        m_.globals.push_back(bits);
+      }
+
+      m_.functions.resize(layout_.functions.size());
+      for (std::size_t k = 0; k < layout_.functions.size(); k++) {
+        compile_function(*layout_.functions[k], m_.functions[k]);
+        for (auto const &i : m_.functions[k].code) {
+          m_.stats.instructions++;
+          m_.stats.superinstructions += i.op >= opcode::iadd_k;
+          m_.stats.moves += i.op == opcode::move;
+        }
+      }
+    }
+
+    void compiler::compile_function(ir::function const &f, function &out) {
+      f_ = &f;
+      out_ = &out;
+      out.fun = f.fun;
+
+      auto n = f.size();
+      uses_.assign(n, 0);
+      for (auto op : f.operands) {
+        uses_[op]++;
+      }
+      fused_.assign(n, false);
+      for (block_id b = 0; b < f.blocks.size() && super_; b++) {
+        auto t = f.terminator(b);
+        if (f.instrs[t].op != ir::opcode::branch) {
+          continue;
+        }
+        auto c = f.operands_of(t)[0];
+        if (uses_[c] != 1 || !is_compare(f.instrs[c].op)) {
+          continue;
+        }
+        auto kind = f.instrs[f.operands_of(c)[0]].type->kind;
+        fused_[c] = kind != type_kind::float_type &&
+                    kind != type_kind::string_type;
+      }
+
+      auto order = reverse_postorder(f.graph, 0).rpo;
+      next_.assign(f.blocks.size(), no_block);
+      for (std::size_t k = 1; k < order.size(); k++) {
+        next_[order[k - 1]] = order[k];
+      }
+      labels_.assign(f.blocks.size(), 0);
+      fixups_.clear();
+      stubs_.clear();
+
+      for (auto b : order) {
+        labels_[b] = static_cast<std::uint32_t>(out.code.size());
+        for (auto v : f.values_of(b)) {
+          auto op = f.instrs[v].op;
+          if (!is_leaf(op) && op != ir::opcode::param &&
+              op != ir::opcode::phi && !ir::is_terminator(op) &&
+              !fused_[v]) {
+            compile_value(v);
+          }
+        }
+        write_terminator(b);
+      }
+      for (std::size_t k = 0; k < stubs_.size(); k++) {
+        labels_[stubs_[k].label] = static_cast<std::uint32_t>(out.code.size());
+        auto moves = std::move(stubs_[k].moves);
+        parallel_move(moves);
+        emit_jump(opcode::jump, 0, 0, 0, stubs_[k].to);
+      }
+
+      for (auto const &fix : fixups_) {
+        auto &i = out.code[fix.at];
+        if (format_of(i.op).b == field::target) {
+          i.b = labels_[fix.label];
+        } else {
+          i.c = labels_[fix.label];
+        }
+      }
+      for (auto &t : out.tables) {
+        for (auto &target : t.dense) {
+          target = labels_[target];
+        }
+        for (auto &target : t.targets) {
+          target = labels_[target];
+        }
+        t.fallback = labels_[t.fallback];
+      }
+      assign_registers();
+    }
+
+    // Turn the values that the register fields and argument lists name
+    // into registers: the constants first, in the order they are first
+    // used, then the parameters, then the others.
+    void compiler::assign_registers() {
+      auto const &f = *f_;
+      auto &out = *out_;
+      std::vector<std::uint32_t> regs(f.size(), no_register);
+      std::uint32_t discard_reg = no_register;
+      std::uint32_t temporary_reg = no_register;
+
+      auto each_register = [&](auto &&visit) {
+        for (auto &i : out.code) {
+          auto [a, b, c] = format_of(i.op);
+          if (a == field::reg) {
+            visit(i.a);
+          }
+          if (b == field::reg) {
+            visit(i.b);
+          }
+          if (c == field::reg) {
+            auto v = static_cast<std::uint32_t>(i.c);
+            visit(v);
+            i.c = v;
+          }
+        }
+        for (std::size_t k = 0; k < out.args.size(); k += out.args[k] + 1) {
+          for (std::size_t j = 1; j <= out.args[k]; j++) {
+            visit(out.args[k + j]);
+          }
+        }
+      };
+
+      out.constants.clear();
+      each_register([&](std::uint32_t v) {
+        if (v < f.size() && is_leaf(f.instrs[v].op) &&
+            regs[v] == no_register) {
+          regs[v] = static_cast<std::uint32_t>(out.constants.size());
+          out.constants.push_back(leaf_bits(v));
+        }
+      });
+      auto base = static_cast<std::uint32_t>(out.constants.size());
+      out.params = static_cast<std::uint32_t>(
+          f.fun->canonical->params.size());
+      auto next = base + out.params;
+      for (value_id v = 0; v < f.size(); v++) {
+        if (f.instrs[v].op == ir::opcode::param) {
+          regs[v] = base + static_cast<std::uint32_t>(f.instrs[v].imm);
+        }
+      }
+      each_register([&](std::uint32_t &v) {
+        auto &r = v == discard     ? discard_reg
+                  : v == temporary ? temporary_reg
+                                   : regs[v];
+        if (r == no_register) {
+          r = next++;
+        }
+        v = r;
+      });
+      out.registers = next;
+    }
+
+    void compiler::emit(opcode op, std::uint32_t a, std::uint32_t b,
+                        std::int64_t c) {
+      out_->code.push_back({op, a, b, c});
+    }
+
+    void compiler::emit_jump(opcode op, std::uint32_t a, std::uint32_t b,
+                             std::int64_t c, std::uint32_t label) {
+      fixups_.push_back({static_cast<std::uint32_t>(out_->code.size()), label});
+      emit(op, a, b, c);
+    }
+
+    //
+    // Instructions
+    //
+
+    void compiler::compile_value(value_id v) {
+      auto const &f = *f_;
+      auto const &i = f.instrs[v];
+      auto ops = f.operands_of(v);
+      auto kind = ops.empty() ? type_kind::void_type
+                              : f.instrs[ops[0]].type->kind;
+      auto is_float = kind == type_kind::float_type;
+      auto is_string = kind == type_kind::string_type;
+      switch (i.op) {
+        case ir::opcode::pos:
+          emit(opcode::move, v, ops[0]);
+          break;
+        case ir::opcode::neg:
+          emit(is_float ? opcode::fneg : opcode::ineg, v, ops[0]);
+          break;
+        case ir::opcode::bit_not:
+          emit(opcode::inot, v, ops[0]);
+          break;
+        case ir::opcode::log_not:
+          emit(opcode::lnot, v, ops[0]);
+          break;
+        case ir::opcode::add:
+          if (is_string) {
+            emit(opcode::scat, v, ops[0], ops[1]);
+          } else if (is_float) {
+            emit(opcode::fadd, v, ops[0], ops[1]);
+          } else {
+            int_binary(v, opcode::iadd, opcode::iadd_k, true);
+          }
+          break;
+        case ir::opcode::sub: {
+          std::int64_t k;
+          if (is_float) {
+            emit(opcode::fsub, v, ops[0], ops[1]);
+          } else if (int_constant(ops[1], k)) {
+            emit(opcode::iadd_k, v, ops[0],
+                 static_cast<std::int64_t>(0 - static_cast<std::uint64_t>(k)));
+          } else {
+            emit(opcode::isub, v, ops[0], ops[1]);
+          }
+          break;
+        }
+        case ir::opcode::mul:
+          if (is_float) {
+            emit(opcode::fmul, v, ops[0], ops[1]);
+          } else {
+            int_binary(v, opcode::imul, opcode::imul_k, true);
+          }
+          break;
+        case ir::opcode::div:
+          emit(is_float ? opcode::fdiv : opcode::idiv, v, ops[0], ops[1]);
+          break;
+        case ir::opcode::mod:
+          emit(is_float ? opcode::fmod : opcode::imod, v, ops[0], ops[1]);
+          break;
+        case ir::opcode::pow:
+          emit(is_float ? opcode::fpow : opcode::ipow, v, ops[0], ops[1]);
+          break;
+        case ir::opcode::bit_and:
+          int_binary(v, opcode::iand, opcode::iand_k, true);
+          break;
+        case ir::opcode::bit_xor:
+          int_binary(v, opcode::ixor, opcode::ixor_k, true);
+          break;
+        case ir::opcode::bit_or:
+          int_binary(v, opcode::ior, opcode::ior_k, true);
+          break;
+        case ir::opcode::lshift:
+          int_binary(v, opcode::ishl, opcode::ishl_k, false);
+          break;
+        case ir::opcode::rshift:
+          int_binary(v, opcode::ishr, opcode::ishr_k, false);
+          break;
+        case ir::opcode::lt:
+        case ir::opcode::gt:
+        case ir::opcode::le:
+        case ir::opcode::ge:
+        case ir::opcode::eq:
+        case ir::opcode::ne:
+          compare(v);
+          break;
+        case ir::opcode::index:
+          emit(is_string ? opcode::sindex : opcode::aindex, v, ops[0], ops[1]);
+          break;
+        case ir::opcode::length:
+          emit(is_string ? opcode::slen : opcode::alen, v, ops[0]);
+          break;
+        case ir::opcode::store_index:
+          emit(opcode::astore, ops[0], ops[1], ops[2]);
+          break;
+        case ir::opcode::load_global:
+          emit(opcode::gload, v, 0, globals_.at(f.symbols[i.imm]));
+          break;
+        case ir::opcode::store_global:
+          emit(opcode::gstore, ops[0], 0, globals_.at(f.symbols[i.imm]));
+          break;
+        case ir::opcode::mul_high:
+          emit(opcode::imulh, v, ops[0], ops[1]);
+          break;
+        case ir::opcode::call: {
+          auto &args = out_->args;
+          auto at = static_cast<std::int64_t>(args.size());
+          args.push_back(static_cast<std::uint32_t>(ops.size() - 1));
+          args.insert(args.end(), ops.begin() + 1, ops.end());
+          auto dest = i.type->kind == type_kind::void_type ? discard : v;
+          auto const &callee = f.instrs[ops[0]];
+          if (callee.op == ir::opcode::function) {
+            emit(opcode::call, dest, functions_.at(f.symbols[callee.imm]),
+                 at);
+          } else {
+            emit(opcode::callv, dest, ops[0], at);
+          }
+          break;
+        }
+        default:
+          unreachable();
+      }
+    }
+
+    // An operator on ints, taking an int constant as an immediate. Shifts
+    // only take counts below 64, since the others trap.
+    void compiler::int_binary(value_id v, opcode op, opcode op_k,
+                              bool commutative) {
+      auto ops = f_->operands_of(v);
+      std::int64_t k;
+      auto is_shift = op == opcode::ishl || op == opcode::ishr;
+      if (int_constant(ops[1], k) &&
+          (!is_shift || static_cast<std::uint64_t>(k) < 64)) {
+        emit(op_k, v, ops[0], k);
+      } else if (commutative && int_constant(ops[0], k)) {
+        emit(op_k, v, ops[1], k);
+      } else {
+        emit(op, v, ops[0], ops[1]);
+      }
+    }
+
+    void compiler::compare(value_id v) {
+      auto const &f = *f_;
+      auto rel = f.instrs[v].op;
+      auto ops = f.operands_of(v);
+      auto x = ops[0], y = ops[1];
+      auto kind = f.instrs[x].type->kind;
+      // lt, le, eq and ne of each kind, with greater as less mirrored
+      auto base = kind == type_kind::float_type    ? opcode::flt
+                  : kind == type_kind::string_type ? opcode::slt
+                                                   : opcode::ilt;
+      std::int64_t k;
+      if (base == opcode::ilt && int_constant(y, k)) {
+        emit(with_immediate(opcode::ilt_k, rel), v, x, k);
+        return;
+      }
+      if (base == opcode::ilt && int_constant(x, k)) {
+        emit(with_immediate(opcode::ilt_k, mirror(rel)), v, y, k);
+        return;
+      }
+      if (rel == ir::opcode::gt || rel == ir::opcode::ge) {
+        rel = mirror(rel);
+        std::swap(x, y);
+      }
+      auto offset = rel == ir::opcode::lt   ? 0
+                    : rel == ir::opcode::le ? 1
+                    : rel == ir::opcode::eq ? 2
+                                            : 3;
+      emit(static_cast<opcode>(static_cast<int>(base) + offset), v, x, y);
+    }
+
+    // Jump to label if cond, or if not cond when negated.
+    void compiler::jump_if(value_id cond, bool negated, std::uint32_t label) {
+      auto const &f = *f_;
+      if (!fused_[cond]) {
+        emit_jump(negated ? opcode::jf : opcode::jt, cond, 0, 0, label);
+        return;
+      }
+      auto rel = f.instrs[cond].op;
+      if (negated) {
+        rel = negate(rel);
+      }
+      auto ops = f.operands_of(cond);
+      auto x = ops[0], y = ops[1];
+      std::int64_t k;
+      if (int_constant(y, k)) {
+        emit_jump(with_immediate(opcode::jlt_k, rel), x, 0, k, label);
+        return;
+      }
+      if (int_constant(x, k)) {
+        emit_jump(with_immediate(opcode::jlt_k, mirror(rel)), y, 0, k, label);
+        return;
+      }
+      if (rel == ir::opcode::gt || rel == ir::opcode::ge) {
+        rel = mirror(rel);
+        std::swap(x, y);
+      }
+      auto op = rel == ir::opcode::lt   ? opcode::jlt
+                : rel == ir::opcode::le ? opcode::jle
+                : rel == ir::opcode::eq ? opcode::jeq
+                                        : opcode::jne;
+      emit_jump(op, x, y, 0, label);
+    }
+
+    //
+    // Control flow
+    //
+
+    // The assignments of the phis of the kth successor of b along its edge,
+    // as (phi, value).
+    void compiler::edge_moves(
+        block_id b, std::size_t k,
+        std::vector<std::pair<value_id, value_id>> &moves) {
+      auto const &f = *f_;
+      auto s = f.graph.succs(b)[k];
+      auto j = edge_index(f, b, k);
+      moves.clear();
+      for (auto v : f.values_of(s)) {
+        if (f.instrs[v].op != ir::opcode::phi) {
+          break;
+        }
+        if (auto value = f.operands_of(v)[j]; value != v) {
+          moves.emplace_back(v, value);
+        }
+      }
+    }
+
+    // The moves in an order that reads every register before it is
+    // written, through the temporary where they form a cycle.
+    void compiler::parallel_move(
+        std::vector<std::pair<value_id, value_id>> &moves) {
+      auto read = [&](value_id v) {
+        return std::ranges::any_of(
+            moves, [&](auto const &m) { return m.second == v; });
+      };
+      while (!moves.empty()) {
+        auto progress = false;
+        for (std::size_t k = 0; k < moves.size();) {
+          if (read(moves[k].first)) {
+            k++;
+            continue;
+          }
+          emit(opcode::move, moves[k].first, moves[k].second);
+          moves.erase(moves.begin() + static_cast<std::ptrdiff_t>(k));
+          progress = true;
+        }
+        if (!progress) {
+          auto blocked = moves.front().first;
+          emit(opcode::move, temporary, blocked);
+          for (auto &m : moves) {
+            if (m.second == blocked) {
+              m.second = temporary;
+            }
+          }
+        }
+      }
+    }
+
+    // The label to jump to for the edge to the kth successor of b: its
+    // block, or a stub with the edge's moves.
+    std::uint32_t compiler::edge_label(block_id b, std::size_t k) {
+      std::vector<std::pair<value_id, value_id>> moves;
+      edge_moves(b, k, moves);
+      auto to = f_->graph.succs(b)[k];
+      if (moves.empty()) {
+        return to;
+      }
+      auto label = static_cast<std::uint32_t>(labels_.size());
+      labels_.push_back(0);
+      stubs_.push_back({label, to, std::move(moves)});
+      return label;
+    }
+
+    // The edge to the kth successor of b, from the end of b.
+    void compiler::write_edge(block_id b, std::size_t k) {
+      std::vector<std::pair<value_id, value_id>> moves;
+      edge_moves(b, k, moves);
+      parallel_move(moves);
+      if (auto s = f_->graph.succs(b)[k]; s != next_[b]) {
+        emit_jump(opcode::jump, 0, 0, 0, s);
+      }
+    }
+
+    void compiler::write_terminator(block_id b) {
+      auto const &f = *f_;
+      auto t = f.terminator(b);
+      auto ops = f.operands_of(t);
+      auto succs = f.graph.succs(b);
+      switch (f.instrs[t].op) {
+        case ir::opcode::jump:
+          write_edge(b, 0);
+          break;
+        case ir::opcode::branch: {
+          auto const &cond = f.instrs[ops[0]];
+          if (is_leaf(cond.op)) {
+            write_edge(b, cond.op == ir::opcode::constant && cond.imm ? 0 : 1);
+            break;
+          }
+          // fall through to the first successor when it is next
+          std::vector<std::pair<value_id, value_id>> moves;
+          edge_moves(b, 0, moves);
+          if (succs[0] == next_[b] && succs[1] != next_[b] && moves.empty()) {
+            jump_if(ops[0], true, edge_label(b, 1));
+            break;
+          }
+          jump_if(ops[0], false, edge_label(b, 0));
+          write_edge(b, 1);
+          break;
+        }
+        case ir::opcode::switch_:
+          write_switch(b);
+          break;
+        case ir::opcode::ret:
+          if (ops.empty()) {
+            emit(opcode::ret_void);
+          } else {
+            emit(opcode::ret, ops[0]);
+          }
+          break;
+        default:
+          unreachable();
+      }
+    }
+
+    // A switch on constant case values through a table, directly indexed
+    // when the values are dense enough, otherwise comparing with each case
+    // value in turn.
+    void compiler::write_switch(block_id b) {
+      auto const &f = *f_;
+      auto ops = f.operands_of(f.terminator(b));
+      auto fallback = ops.size() - 1;
+      std::vector<std::int64_t> values;
+      if (!ir::case_values(f, b, values)) {
+        for (std::size_t k = 0; k < fallback; k++) {
+          if (super_) {
+            emit_jump(opcode::jeq, ops[0], ops[k + 1], 0, edge_label(b, k));
+          } else {
+            emit(opcode::ieq, temporary, ops[0], ops[k + 1]);
+            emit_jump(opcode::jt, temporary, 0, 0, edge_label(b, k));
+          }
+        }
+        write_edge(b, fallback);
+        return;
+      }
+
+      // the first of equal case values wins, like at run time
+      std::vector<std::pair<std::int64_t, std::uint32_t>> cases;
+      for (std::size_t k = 0; k < values.size(); k++) {
+        cases.emplace_back(values[k], static_cast<std::uint32_t>(k));
+      }
+      std::ranges::stable_sort(cases, {}, &std::pair<std::int64_t,
+                                                     std::uint32_t>::first);
+      auto [first, last] = std::ranges::unique(
+          cases, {}, &std::pair<std::int64_t, std::uint32_t>::first);
+      cases.erase(first, last);
+
+      switch_table table;
+      table.fallback = edge_label(b, fallback);
+      if (!cases.empty()) {
+        auto span = static_cast<std::uint64_t>(cases.back().first) -
+                    static_cast<std::uint64_t>(cases.front().first);
+        if (span <= 3 * cases.size() + 8) {
+          table.low = cases.front().first;
+          table.dense.assign(span + 1, table.fallback);
+          for (auto [value, k] : cases) {
+            table.dense[static_cast<std::uint64_t>(value) -
+                        static_cast<std::uint64_t>(table.low)] =
+                edge_label(b, k);
+          }
+        } else {
+          for (auto [value, k] : cases) {
+            table.values.push_back(value);
+            table.targets.push_back(edge_label(b, k));
+          }
+        }
+      }
+      emit(opcode::switch_, ops[0], 0,
+           static_cast<std::int64_t>(out_->tables.size()));
+      out_->tables.push_back(std::move(table));
+    }
+
+  } // namespace
+
+  void compile(program_layout const &layout, module &m,
+               bool superinstructions) {
+    compiler{layout, m, superinstructions}.compile();
+  }
+
+  void dump(std::ostream &out, module const &m) {
+    for (auto const &fn : m.functions) {
+      out << "fun " << fn.fun->name << ": " << fn.registers
+          << " registers\n";
+      for (std::size_t r = 0; r < fn.constants.size(); r++) {
+        out << "  r" << r << " = "
+            << static_cast<std::int64_t>(fn.constants[r]) << '\n';
+      }
+      for (std::size_t pc = 0; pc < fn.code.size(); pc++) {
+        auto const &i = fn.code[pc];
+        auto [a, b, c] = format_of(i.op);
+        out << "  " << pc << ": " << i.op;
+        auto separator = " ";
+        auto write = [&](field kind, std::int64_t value) {
+          if (kind == field::none) {
+            return;
+          }
+          out << separator
+              << (kind == field::reg      ? "r"
+                  : kind == field::target ? "@"
+                                          : "")
+              << value;
+          separator = ", ";
+        };
+        write(a, i.a);
+        if (i.op == opcode::call || i.op == opcode::callv) {
+          // the callee, then the arguments
+          if (i.op == opcode::call) {
+            out << ", " << m.functions[i.b].fun->name;
+          } else {
+            write(b, i.b);
+          }
+          out << " (";
+          auto k = static_cast<std::size_t>(i.c);
+          for (std::size_t j = 1; j <= fn.args[k]; j++) {
+            out << (j > 1 ? ", r" : "r") << fn.args[k + j];
+          }
+          out << ')';
+        } else {
+          write(b, i.b);
+          write(c, i.c);
+        }
+        out << '\n';
+      }
+    }
+  }
+
+} // namespace soda::vm
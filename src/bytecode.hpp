@@ -0,0 +1,234 @@
+#pragma once
+
+#include "backend.hpp"
+#include "ir.hpp"
+
+#include <cstdint>
+#include <deque>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+namespace soda::vm {
+
+  //
+  // Bytecode
+  //
+  // A program for the virtual machine is compiled from the optimized IR of
+  // the functions a program_layout names. The machine has registers rather
+  // than a stack: each function has a frame of 64-bit registers, where
+  // every IR value with a result has one of its own, and an instruction
+  // names the registers it reads and writes. The frame starts with the
+  // constants the function uses, which a call copies in, then the
+  // parameters, which the caller fills, then the other values.
+  //
+  // Registers hold the bits of a value: an int, a bool as 0 or 1, a char
+  // as its code point, a double, a pointer to a string_object or an
+  // array_object, or a function as its index in the module plus one, so
+  // that an unassigned function variable is 0.
+  //
+  // Instructions are typed: the IR's operand types choose between the int,
+  // float and string forms of an operator. Phis become moves on the edges
+  // into their blocks, written as stubs after the function's blocks for an
+  // edge that is not the only one leaving its block. Blocks are laid out in
+  // reverse postorder, leaving out jumps to the next block.
+  //
+  // Superinstructions do the work of two IR instructions in one dispatch:
+  // arithmetic and comparisons with an int constant operand take it as an
+  // immediate, and a comparison of ints used only by a branch becomes a
+  // compare-and-branch. They can be turned off to measure what they save.
+  //
+
+  enum class opcode : std::uint8_t {
+    move,
+    // ints, on registers
+    iadd,
+    isub,
+    imul,
+    idiv,
+    imod,
+    ipow,
+    iand,
+    ior,
+    ixor,
+    ishl,
+    ishr,
+    imulh,
+    ineg,
+    inot,
+    lnot,
+    // floats
+    fadd,
+    fsub,
+    fmul,
+    fdiv,
+    fmod,
+    fpow,
+    fneg,
+    // comparisons to a bool; greater is less with the operands swapped
+    ilt,
+    ile,
+    ieq,
+    ine,
+    flt,
+    fle,
+    feq,
+    fne,
+    slt,
+    sle,
+    seq,
+    sne,
+    // strings and arrays
+    scat,
+    slen,
+    alen,
+    sindex,
+    aindex,
+    astore,
+    // globals
+    gload,
+    gstore,
+    // calls, to a function of the module or to the one in a register
+    call,
+    callv,
+    ret,
+    ret_void,
+    // control flow
+    jump,
+    jt,
+    jf,
+    switch_,
+    // superinstructions: an int constant operand
+    iadd_k,
+    imul_k,
+    iand_k,
+    ior_k,
+    ixor_k,
+    ishl_k,
+    ishr_k,
+    ilt_k,
+    ile_k,
+    igt_k,
+    ige_k,
+    ieq_k,
+    ine_k,
+    // superinstructions: compare ints and branch
+    jlt,
+    jle,
+    jeq,
+    jne,
+    jlt_k,
+    jle_k,
+    jgt_k,
+    jge_k,
+    jeq_k,
+    jne_k,
+  };
+
+  inline constexpr std::size_t opcode_count =
+      static_cast<std::size_t>(opcode::jne_k) + 1;
+
+  std::string_view to_string(opcode op);
+
+  inline std::ostream &operator<<(std::ostream &out, opcode op) {
+    return out << to_string(op);
+  }
+
+  // What a field of an instruction holds: a register, an immediate, or the
+  // index of the instruction to jump to.
+  enum class field : std::uint8_t {
+    none,
+    reg,
+    imm,
+    target,
+  };
+
+  struct format {
+    field a, b, c;
+  };
+
+  format format_of(opcode op);
+
+  // The fields of each opcode:
+  //
+  //   move, unary     a = b
+  //   binary          a = b op c, with c an immediate for the _k forms
+  //   astore          a[b] = c
+  //   gload, gstore   a = global c, global c = a
+  //   call            a = function b (arguments c)
+  //   callv           a = register b (arguments c)
+  //   ret             return a
+  //   jump            to c
+  //   jt, jf          to c if a, or if not a
+  //   switch_         a through table c
+  //   jlt etc.        to c if a op b
+  //   jlt_k etc.      to b if a op c
+  //
+  // The arguments of a call are at c in function::args: their number, then
+  // their registers.
+  struct instruction {
+    opcode op = opcode::move;
+    std::uint32_t a = 0;
+    std::uint32_t b = 0;
+    std::int64_t c = 0;
+  };
+
+  // The targets of a switch on constant case values, as instruction
+  // indices: directly indexed by the value less low if dense, otherwise
+  // found by binary search in the sorted case values.
+  struct switch_table {
+    std::int64_t low = 0;
+    std::vector<std::uint32_t> dense;
+    std::vector<std::int64_t> values;
+    std::vector<std::uint32_t> targets;
+    std::uint32_t fallback = 0;
+  };
+
+  struct function {
+    ast::fun_decl const *fun = nullptr;
+    std::vector<instruction> code;
+    // the values of the first registers
+    std::vector<std::uint64_t> constants;
+    std::uint32_t params = 0;
+    std::uint32_t registers = 0;
+    std::vector<std::uint32_t> args;
+    std::vector<switch_table> tables;
+  };
+
+  // The layouts of strings and arrays, which are those of the C backend.
+  struct string_object {
+    std::int64_t length;
+    char const *data;
+  };
+
+  struct array_object {
+    std::int64_t length;
+    std::uint64_t *data;
+  };
+
+  struct compile_stats {
+    std::size_t instructions = 0;
+    std::size_t superinstructions = 0;
+    std::size_t moves = 0;
+  };
+
+  struct module {
+    std::vector<function> functions;
+    // the index of main, if the layout has one
+    std::uint32_t main = 0;
+    // the initial value of each global, in the order of the layout
+    std::vector<std::uint64_t> globals;
+    // the string constants, which registers point to
+    std::deque<string_object> strings;
+    compile_stats stats;
+  };
+
+  // Compile the functions and globals of layout, with superinstructions
+  // unless told otherwise.
+  void compile(program_layout const &layout, module &m,
+               bool superinstructions = true);
+
+  // Write the bytecode of every function, one instruction per line.
+  void dump(std::ostream &out, module const &m);
+
+} // namespace soda::vm
@@ -0,0 +1,1115 @@
+#include "c_backend.hpp"
+
+#include "backend.hpp"
+#include "switch_lowering.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace soda {
+
+  namespace {
+
+    using ir::opcode;
+    using ir::value_id;
+
+    // The runtime support of every program. It is all static inline, so
+    // that what a program does not use costs nothing and warns about
+    // nothing.
+    constexpr std::string_view prelude = R"(#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__)
+#define SODA_NORETURN __attribute__((noreturn, cold))
+#define SODA_UNLIKELY(x) __builtin_expect(!!(x), 0)
+#else
+#define SODA_NORETURN
+#define SODA_UNLIKELY(x) (x)
+#endif
+
+typedef struct soda_string {
+  int64_t length;
+  char const *data;
+} const *soda_str;
+
+typedef struct soda_array {
+  int64_t length;
+  void *data;
+} *soda_arr;
+
+static inline SODA_NORETURN void soda_trap(char const *what) {
+  fprintf(stderr, "soda: %s\n", what);
+  abort();
+}
+
+static inline int64_t soda_add(int64_t a, int64_t b) {
+  return (int64_t)((uint64_t)a + (uint64_t)b);
+}
+
+static inline int64_t soda_sub(int64_t a, int64_t b) {
+  return (int64_t)((uint64_t)a - (uint64_t)b);
+}
+
+static inline int64_t soda_mul(int64_t a, int64_t b) {
+  return (int64_t)((uint64_t)a * (uint64_t)b);
+}
+
+static inline int64_t soda_neg(int64_t a) {
+  return (int64_t)(0 - (uint64_t)a);
+}
+
+static inline int64_t soda_div(int64_t a, int64_t b) {
+  if (SODA_UNLIKELY(b == 0)) {
+    soda_trap("division by zero");
+  }
+  if (SODA_UNLIKELY(a == INT64_MIN && b == -1)) {
+    soda_trap("division overflow");
+  }
+  return a / b;
+}
+
+static inline int64_t soda_mod(int64_t a, int64_t b) {
+  if (SODA_UNLIKELY(b == 0)) {
+    soda_trap("division by zero");
+  }
+  if (SODA_UNLIKELY(a == INT64_MIN && b == -1)) {
+    soda_trap("division overflow");
+  }
+  return a % b;
+}
+
+static inline int64_t soda_pow(int64_t a, int64_t b) {
+  uint64_t base = (uint64_t)a, result = 1;
+  if (SODA_UNLIKELY(b < 0)) {
+    soda_trap("negative exponent");
+  }
+  for (; b; b >>= 1) {
+    if (b & 1) {
+      result *= base;
+    }
+    base *= base;
+  }
+  return (int64_t)result;
+}
+
+static inline int64_t soda_shl(int64_t a, int64_t b) {
+  if (SODA_UNLIKELY((uint64_t)b >= 64)) {
+    soda_trap("shift out of range");
+  }
+  return (int64_t)((uint64_t)a << b);
+}
+
+static inline int64_t soda_shr(int64_t a, int64_t b) {
+  if (SODA_UNLIKELY((uint64_t)b >= 64)) {
+    soda_trap("shift out of range");
+  }
+  return a < 0 ? ~(~a >> b) : a >> b;
+}
+
+#if defined(__SIZEOF_INT128__)
+__extension__ typedef __int128 soda_int128;
+
+static inline int64_t soda_mul_high(int64_t a, int64_t b) {
+  return (int64_t)((soda_int128)a * b >> 64);
+}
+#else
+static inline int64_t soda_mul_high(int64_t a, int64_t b) {
+  int64_t a1 = a >> 32, b1 = b >> 32;
+  uint64_t a0 = (uint32_t)a, b0 = (uint32_t)b;
+  int64_t t = a1 * (int64_t)b0 + (int64_t)(a0 * b0 >> 32);
+  int64_t w1 = (t & 0xffffffff) + (int64_t)a0 * b1;
+  return a1 * b1 + (t >> 32) + (w1 >> 32);
+}
+#endif
+
+static inline soda_str soda_str_cat(soda_str a, soda_str b) {
+  size_t length = (size_t)a->length + (size_t)b->length;
+  struct soda_string *s = malloc(sizeof *s + length);
+  char *data;
+  if (SODA_UNLIKELY(!s)) {
+    soda_trap("out of memory");
+  }
+  data = (char *)(s + 1);
+  memcpy(data, a->data, (size_t)a->length);
+  memcpy(data + a->length, b->data, (size_t)b->length);
+  s->length = (int64_t)length;
+  s->data = data;
+  return s;
+}
+
+static inline int soda_str_cmp(soda_str a, soda_str b) {
+  int64_t n = a->length < b->length ? a->length : b->length;
+  int c = memcmp(a->data, b->data, (size_t)n);
+  return c ? c : (a->length > b->length) - (a->length < b->length);
+}
+
+static inline bool soda_str_eq(soda_str a, soda_str b) {
+  return a->length == b->length &&
+         !memcmp(a->data, b->data, (size_t)a->length);
+}
+
+static inline uint32_t soda_str_at(soda_str s, int64_t i) {
+  if (SODA_UNLIKELY((uint64_t)i >= (uint64_t)s->length)) {
+    soda_trap("index out of range");
+  }
+  return (unsigned char)s->data[i];
+}
+
+static inline int64_t soda_length(soda_arr a) {
+  return a ? a->length : 0;
+}
+
+static inline void *soda_at(soda_arr a, int64_t i, size_t size) {
+  if (SODA_UNLIKELY(!a || (uint64_t)i >= (uint64_t)a->length)) {
+    soda_trap("index out of range");
+  }
+  return (char *)a->data + (size_t)i * size;
+}
+
+/* indexing known to be in bounds */
+static inline uint32_t soda_str_get(soda_str s, int64_t i) {
+  return (unsigned char)s->data[i];
+}
+
+static inline void *soda_get(soda_arr a, int64_t i, size_t size) {
+  return (char *)a->data + (size_t)i * size;
+}
+)";
+
+    bool reads_memory(opcode op) {
+      return op == opcode::index || op == opcode::load_global;
+    }
+
+    // Whether an int division by v cannot trap.
+    bool safe_divisor(ir::function const &f, value_id v) {
+      auto const &i = f.instrs[v];
+      return i.op == opcode::constant && int_value(i) != 0 &&
+             int_value(i) != -1;
+    }
+
+    void write_int(std::ostream &out, std::int64_t value, bool nested) {
+      if (value == std::numeric_limits<std::int64_t>::min()) {
+        out << "INT64_MIN";
+      } else if (value < 0 && nested) {
+        out << '(' << value << ')';
+      } else {
+        out << value;
+      }
+    }
+
+    void write_float(std::ostream &out, double value, bool nested) {
+      auto open = nested && std::signbit(value) ? "(" : "";
+      auto close = *open ? ")" : "";
+      if (std::isnan(value)) {
+        out << "NAN";
+      } else if (std::isinf(value)) {
+        out << open << (value < 0 ? "-HUGE_VAL" : "HUGE_VAL") << close;
+      } else {
+        // the shortest digits that read back as the same double
+        char buf[32];
+        auto end = std::to_chars(buf, buf + sizeof buf, value).ptr;
+        std::string_view digits{buf, end};
+        out << open << digits;
+        if (digits.find_first_of(".e") == digits.npos) {
+          out << ".0";
+        }
+        out << close;
+      }
+    }
+
+    void write_char(std::ostream &out, std::uint64_t code) {
+      if (code >= 0x20 && code < 0x7f && code != '\'' && code != '\\') {
+        out << '\'' << static_cast<char>(code) << '\'';
+      } else {
+        out << "0x" << std::hex << std::uppercase << code << std::dec
+            << std::nouppercase;
+      }
+    }
+
+    void write_string_literal(std::ostream &out, std::string_view s) {
+      static constexpr char digits[] = "01234567";
+      out << '"';
+      for (unsigned char c : s) {
+        if (c == '"' || c == '\\' || c == '?') {
+          // ? as well, so that no trigraph is formed
+          out << '\\' << c;
+        } else if (c >= 0x20 && c < 0x7f) {
+          out << c;
+        } else {
+          out << '\\' << digits[c >> 6] << digits[c >> 3 & 7]
+              << digits[c & 7];
+        }
+      }
+      out << '"';
+    }
+
+    class c_writer {
+    public:
+      c_writer(ast::program const &prog, diagnostics &diags)
+          : prog_{prog}, diags_{diags} {
+      }
+
+      bool write(std::ostream &out, std::span<ir::function const> funs);
+
+    private:
+      ast::program const &prog_;
+      diagnostics &diags_;
+      // C names of the functions and globals
+      std::unordered_map<ast::decl const *, std::string> names_;
+      std::unordered_map<type const *, std::string> fun_types_;
+      std::unordered_map<std::string_view, std::string> strings_;
+      std::ostringstream typedefs_;
+      std::ostringstream constants_;
+
+      // the function being written
+      ir::function const *f_ = nullptr;
+      std::vector<block_id> block_of_;
+      // values whose result or effect is needed
+      std::vector<bool> live_;
+      // uses by live instructions
+      std::vector<std::uint32_t> uses_;
+      // the last user of each value
+      std::vector<value_id> user_;
+      // values written into the expression of their only user
+      std::vector<bool> inlined_;
+      std::vector<bool> labelled_;
+
+      void name_symbols();
+      std::string c_type(type const *t);
+      std::string const &string_name(std::string_view s);
+      std::string initializer(ast::let_decl const &let,
+                              global_init const &init);
+
+      void write_function(std::ostream &out, ir::function const &f);
+      void write_signature(std::ostream &out, ast::fun_decl const &d);
+      void plan();
+      void write_value(std::ostream &out, value_id v, bool nested);
+      void write_operation(std::ostream &out, value_id v, bool nested);
+      void write_condition(std::ostream &out, value_id v, bool negate);
+      void write_statement(std::ostream &out, value_id v);
+      void write_terminator(std::ostream &out, block_id b);
+      void edge_copies(block_id b, std::size_t k,
+                       std::vector<std::pair<value_id, value_id>> &copies);
+      void write_edge(std::ostream &out, block_id b, std::size_t k,
+                      std::string_view indent, bool fall_through);
+      bool reads(value_id v, value_id var) const;
+    };
+
+    void c_writer::name_symbols() {
+      std::unordered_set<std::string> taken;
+      for (auto const &tu : prog_.tus) {
+        for (auto const &d : tu->decls) {
+          if (d->kind != ast::node_kind::fun_decl &&
+              d->kind != ast::node_kind::let_decl) {
+            continue;
+          }
+          auto base = (d->kind == ast::node_kind::fun_decl ? "s_" : "g_") +
+                      d->name;
+          auto name = base;
+          for (int n = 2; !taken.insert(name).second; n++) {
+            name = base + '_' + std::to_string(n);
+          }
+          names_.emplace(d.get(), std::move(name));
+        }
+      }
+    }
+
+    std::string c_writer::c_type(type const *t) {
+      switch (t->kind) {
+        case type_kind::void_type:
+          return "void";
+        case type_kind::bool_type:
+          return "bool";
+        case type_kind::char_type:
+          return "uint32_t";
+        case type_kind::int_type:
+          return "int64_t";
+        case type_kind::float_type:
+          return "double";
+        case type_kind::string_type:
+          return "soda_str";
+        case type_kind::array_type:
+          return "soda_arr";
+        case type_kind::function_type:
+          break;
+        default:
+          unreachable();
+      }
+      if (auto it = fun_types_.find(t); it != fun_types_.end()) {
+        return it->second;
+      }
+      // parameters and results of function type are declared first
+      std::string params;
+      for (auto p : t->params) {
+        params += (params.empty() ? "" : ", ") + c_type(p);
+      }
+      auto result = c_type(t->inner);
+      auto name = "soda_fn" + std::to_string(fun_types_.size());
+      typedefs_ << "typedef " << result << " (*" << name << ")("
+                << (params.empty() ? "void" : params) << ");\n";
+      return fun_types_.emplace(t, name).first->second;
+    }
+
+    std::string const &c_writer::string_name(std::string_view s) {
+      auto [it, inserted] = strings_.try_emplace(s);
+      if (inserted) {
+        it->second = "soda_str" + std::to_string(strings_.size() - 1);
+        constants_ << "static struct soda_string const " << it->second
+                   << " = {" << s.size() << ", ";
+        write_string_literal(constants_, s);
+        constants_ << "};\n";
+      }
+      return it->second;
+    }
+
+    std::string c_writer::initializer(ast::let_decl const &let,
+                                      global_init const &init) {
+      std::ostringstream out;
+      switch (init.kind) {
+        case global_init::kind::none:
+          if (let.canonical->kind == type_kind::string_type) {
+            out << '&' << string_name({});
+          }
+          break;
+        case global_init::kind::bits:
+          switch (let.canonical->kind) {
+            case type_kind::bool_type:
+              out << (init.bits ? "true" : "false");
+              break;
+            case type_kind::char_type:
+              write_char(out, init.bits);
+              break;
+            case type_kind::int_type:
+              write_int(out, static_cast<std::int64_t>(init.bits), false);
+              break;
+            case type_kind::float_type:
+              write_float(out, std::bit_cast<double>(init.bits), false);
+              break;
+            default:
+              unreachable();
+          }
+          break;
+        case global_init::kind::string:
+          out << '&' << string_name(init.string);
+          break;
+        case global_init::kind::function:
+          out << names_.at(init.function);
+          break;
+      }
+      return std::move(out).str();
+    }
+
+    bool c_writer::write(std::ostream &out,
+                         std::span<ir::function const> funs) {
+      program_layout layout;
+      if (!lay_out(prog_, funs, layout, diags_)) {
+        return false;
+      }
+      name_symbols();
+
+      std::ostringstream protos, globals, code;
+      for (auto f : layout.functions) {
+        write_signature(protos, *f->fun);
+        protos << ";\n";
+        code << '\n';
+        write_function(code, *f);
+      }
+      for (auto let : layout.globals) {
+        auto init = initializer(*let, layout.inits.at(let));
+        globals << "static " << c_type(let->canonical) << ' '
+                << names_.at(let) << (init.empty() ? "" : " = ") << init
+                << ";\n";
+      }
+
+      out << "/* Generated by sodac. */\n\n" << prelude;
+      for (auto const *section : {&typedefs_, &constants_, &protos,
+                                  &globals}) {
+        if (auto text = section->view(); !text.empty()) {
+          out << '\n' << text;
+        }
+      }
+      out << code.view() << "\nint main(void) {\n";
+      if (layout.main->canonical->inner->kind == type_kind::int_type) {
+        out << "  return (int)" << names_.at(layout.main) << "();\n";
+      } else {
+        out << "  " << names_.at(layout.main) << "();\n  return 0;\n";
+      }
+      out << "}\n";
+      return true;
+    }
+
+    void c_writer::write_signature(std::ostream &out,
+                                   ast::fun_decl const &d) {
+      auto t = d.canonical;
+      out << "static " << c_type(t->inner) << ' ' << names_.at(&d) << '(';
+      for (std::size_t k = 0; k < t->params.size(); k++) {
+        out << (k ? ", " : "") << c_type(t->params[k]) << " p" << k;
+      }
+      out << (t->params.empty() ? "void)" : ")");
+    }
+
+    // Which values are needed, how often they are used, and which are
+    // written into their user's expression.
+    void c_writer::plan() {
+      auto const &f = *f_;
+      auto n = f.size();
+      block_of_.assign(n, 0);
+      for (block_id b = 0; b < f.blocks.size(); b++) {
+        for (auto v : f.values_of(b)) {
+          block_of_[v] = b;
+        }
+      }
+
+      live_.assign(n, false);
+      std::vector<value_id> work;
+      for (value_id v = 0; v < n; v++) {
+        auto op = f.instrs[v].op;
+        if (ir::is_terminator(op) || has_effect(op) || may_trap(f, v)) {
+          live_[v] = true;
+          work.push_back(v);
+        }
+      }
+      uses_.assign(n, 0);
+      user_.assign(n, ir::no_value);
+      while (!work.empty()) {
+        auto v = work.back();
+        work.pop_back();
+        for (auto op : f.operands_of(v)) {
+          uses_[op]++;
+          user_[op] = v;
+          if (!live_[op]) {
+            live_[op] = true;
+            work.push_back(op);
+          }
+        }
+      }
+      // a switch compared with each case value in turn reads its value
+      // once per case
+      std::vector<std::int64_t> values;
+      for (block_id b = 0; b < f.blocks.size(); b++) {
+        auto t = f.terminator(b);
+        if (f.instrs[t].op == opcode::switch_ &&
+            !ir::case_values(f, b, values)) {
+          uses_[f.operands_of(t)[0]] += f.instrs[t].count;
+        }
+      }
+
+      // Walking each block backwards, a value can be written where its
+      // user is, or where that one is written in turn, as long as it does
+      // not move past an effect it could observe or reorder a trap with.
+      inlined_.assign(n, false);
+      std::vector<std::uint32_t> effects, at;
+      for (block_id b = 0; b < f.blocks.size(); b++) {
+        auto first = f.blocks[b].first;
+        auto count = f.blocks[b].count;
+        effects.assign(count + 1, 0);
+        for (std::uint32_t k = 0; k < count; k++) {
+          effects[k + 1] = effects[k] + has_effect(f.instrs[first + k].op);
+        }
+        at.resize(count);
+        auto multiway = f.graph.succs(b).size() > 1;
+        for (auto k = count; k-- > 0;) {
+          auto v = first + k;
+          auto const &i = f.instrs[v];
+          at[k] = k;
+          if (!live_[v] || uses_[v] != 1 || is_leaf(i.op) ||
+              i.op == opcode::param || has_effect(i.op) ||
+              i.op == opcode::phi || ir::is_terminator(i.op)) {
+            continue;
+          }
+          auto u = user_[v];
+          std::uint32_t pos;
+          if (f.instrs[u].op == opcode::phi) {
+            // assigned on the edge from b, only taken on some paths
+            auto ops = f.operands_of(u);
+            auto j = std::ranges::find(ops, v) - ops.begin();
+            if (f.graph.preds(block_of_[u])[j] != b ||
+                (multiway && may_trap(f, v))) {
+              continue;
+            }
+            pos = count - 1;
+          } else if (block_of_[u] == b) {
+            pos = at[u - first];
+          } else {
+            continue;
+          }
+          if ((may_trap(f, v) || reads_memory(i.op)) &&
+              effects[pos] != effects[k + 1]) {
+            continue;
+          }
+          inlined_[v] = true;
+          at[k] = pos;
+        }
+      }
+    }
+
+    void c_writer::write_function(std::ostream &out, ir::function const &f) {
+      f_ = &f;
+      plan();
+      labelled_.assign(f.blocks.size(), false);
+
+      // the blocks first, to know which are jumped to
+      std::vector<std::string> blocks(f.blocks.size());
+      for (block_id b = 0; b < f.blocks.size(); b++) {
+        std::ostringstream body;
+        for (auto v : f.values_of(b)) {
+          auto op = f.instrs[v].op;
+          if (live_[v] && !inlined_[v] && !is_leaf(op) &&
+              op != opcode::param && op != opcode::phi &&
+              !ir::is_terminator(op)) {
+            write_statement(body, v);
+          }
+        }
+        write_terminator(body, b);
+        blocks[b] = std::move(body).str();
+      }
+
+      write_signature(out, *f.fun);
+      out << " {\n";
+
+      // variables by type, in order of first definition
+      std::vector<std::pair<std::string, std::vector<value_id>>> vars;
+      for (value_id v = 0; v < f.size(); v++) {
+        auto const &i = f.instrs[v];
+        if (!live_[v] || inlined_[v] || !uses_[v] || is_leaf(i.op) ||
+            i.op == opcode::param || i.type->kind == type_kind::void_type) {
+          continue;
+        }
+        auto type = c_type(i.type);
+        auto it = std::ranges::find(vars, type,
+                                    &decltype(vars)::value_type::first);
+        if (it == vars.end()) {
+          it = vars.insert(it, {std::move(type), {}});
+        }
+        it->second.push_back(v);
+      }
+      for (auto const &[type, values] : vars) {
+        for (std::size_t k = 0; k < values.size(); k++) {
+          // at most ten to a line
+          out << (k % 10 == 0 ? "  " + type + ' ' : ", ") << 'v'
+              << values[k];
+          if (k % 10 == 9 || k + 1 == values.size()) {
+            out << ";\n";
+          }
+        }
+      }
+      // parameters left unused, or optimized away
+      std::vector<bool> used(f.fun->canonical->params.size());
+      for (value_id v = 0; v < f.size(); v++) {
+        if (f.instrs[v].op == opcode::param && uses_[v]) {
+          used[f.instrs[v].imm] = true;
+        }
+      }
+      for (std::size_t k = 0; k < used.size(); k++) {
+        if (!used[k]) {
+          out << "  (void)p" << k << ";\n";
+        }
+      }
+      for (block_id b = 0; b < f.blocks.size(); b++) {
+        if (labelled_[b]) {
+          out << "bb" << b << ":\n";
+        }
+        out << blocks[b];
+      }
+      out << "}\n";
+    }
+
+    void c_writer::write_value(std::ostream &out, value_id v, bool nested) {
+      auto const &f = *f_;
+      auto const &i = f.instrs[v];
+      switch (i.op) {
+        case opcode::param:
+          out << 'p' << i.imm;
+          return;
+        case opcode::function:
+          out << names_.at(f.symbols[i.imm]);
+          return;
+        case opcode::undef:
+        case opcode::constant: {
+          auto imm = i.op == opcode::constant ? i.imm : 0;
+          switch (i.type->kind) {
+            case type_kind::bool_type:
+              out << (imm ? "true" : "false");
+              break;
+            case type_kind::char_type:
+              write_char(out, imm);
+              break;
+            case type_kind::int_type:
+              write_int(out, static_cast<std::int64_t>(imm), nested);
+              break;
+            case type_kind::float_type:
+              write_float(out, std::bit_cast<double>(imm), nested);
+              break;
+            case type_kind::string_type:
+              out << (nested ? "(&" : "&")
+                  << string_name(i.op == opcode::constant ? f.strings[imm]
+                                                          : "")
+                  << (nested ? ")" : "");
+              break;
+            default:
+              out << "NULL";
+              break;
+          }
+          return;
+        }
+        default:
+          break;
+      }
+      if (inlined_[v]) {
+        write_operation(out, v, nested);
+      } else {
+        out << 'v' << v;
+      }
+    }
+
+    void c_writer::write_operation(std::ostream &out, value_id v,
+                                   bool nested) {
+      auto const &f = *f_;
+      auto const &i = f.instrs[v];
+      auto ops = f.operands_of(v);
+      auto kind = ops.empty() ? type_kind::void_type
+                              : f.instrs[ops[0]].type->kind;
+      auto open = nested ? "(" : "";
+      auto close = nested ? ")" : "";
+
+      auto call = [&](std::string_view callee) {
+        out << callee << '(';
+        for (std::size_t k = 0; k < ops.size(); k++) {
+          out << (k ? ", " : "");
+          write_value(out, ops[k], false);
+        }
+        out << ')';
+      };
+      auto prefix = [&](std::string_view op) {
+        out << open << op;
+        write_value(out, ops[0], true);
+        out << close;
+      };
+      auto infix = [&](std::string_view op) {
+        out << open;
+        write_value(out, ops[0], true);
+        out << ' ' << op << ' ';
+        write_value(out, ops[1], true);
+        out << close;
+      };
+      // ints through the helpers that wrap or trap, floats as they are
+      auto arithmetic = [&](std::string_view helper, std::string_view op) {
+        if (kind == type_kind::int_type) {
+          call(helper);
+        } else {
+          infix(op);
+        }
+      };
+      auto compare = [&](std::string_view op) {
+        if (kind != type_kind::string_type) {
+          infix(op);
+          return;
+        }
+        out << open;
+        call("soda_str_cmp");
+        out << ' ' << op << " 0" << close;
+      };
+
+      switch (i.op) {
+        case opcode::pos:
+          write_value(out, ops[0], nested);
+          break;
+        case opcode::neg:
+          if (kind == type_kind::int_type) {
+            call("soda_neg");
+          } else {
+            prefix("-");
+          }
+          break;
+        case opcode::bit_not:
+          prefix("~");
+          break;
+        case opcode::log_not:
+          prefix("!");
+          break;
+        case opcode::add:
+          if (kind == type_kind::string_type) {
+            call("soda_str_cat");
+          } else {
+            arithmetic("soda_add", "+");
+          }
+          break;
+        case opcode::sub:
+          arithmetic("soda_sub", "-");
+          break;
+        case opcode::mul:
+          arithmetic("soda_mul", "*");
+          break;
+        case opcode::div:
+          if (kind == type_kind::int_type && !safe_divisor(f, ops[1])) {
+            call("soda_div");
+          } else {
+            infix("/");
+          }
+          break;
+        case opcode::mod:
+          if (kind == type_kind::float_type) {
+            call("fmod");
+          } else if (!safe_divisor(f, ops[1])) {
+            call("soda_mod");
+          } else {
+            infix("%");
+          }
+          break;
+        case opcode::pow:
+          call(kind == type_kind::int_type ? "soda_pow" : "pow");
+          break;
+        case opcode::bit_and:
+          infix("&");
+          break;
+        case opcode::bit_xor:
+          infix("^");
+          break;
+        case opcode::bit_or:
+          infix("|");
+          break;
+        case opcode::lt:
+          compare("<");
+          break;
+        case opcode::gt:
+          compare(">");
+          break;
+        case opcode::le:
+          compare("<=");
+          break;
+        case opcode::ge:
+          compare(">=");
+          break;
+        case opcode::eq:
+        case opcode::ne:
+          if (kind == type_kind::string_type) {
+            out << (i.op == opcode::ne ? "!" : "");
+            call("soda_str_eq");
+          } else {
+            infix(i.op == opcode::eq ? "==" : "!=");
+          }
+          break;
+        case opcode::lshift:
+          call("soda_shl");
+          break;
+        case opcode::rshift:
+          call("soda_shr");
+          break;
+        case opcode::mul_high:
+          call("soda_mul_high");
+          break;
+        case opcode::index:
+          if (kind == type_kind::string_type) {
+            call(i.imm ? "soda_str_get" : "soda_str_at");
+          } else {
+            out << open << "*(" << c_type(i.type) << " *)"
+                << (i.imm ? "soda_get(" : "soda_at(");
+            write_value(out, ops[0], false);
+            out << ", ";
+            write_value(out, ops[1], false);
+            out << ", sizeof(" << c_type(i.type) << "))" << close;
+          }
+          break;
+        case opcode::length:
+          if (kind == type_kind::string_type) {
+            write_value(out, ops[0], true);
+            out << "->length";
+          } else {
+            call("soda_length");
+          }
+          break;
+        case opcode::load_global:
+          out << names_.at(f.symbols[i.imm]);
+          break;
+        case opcode::call:
+          write_value(out, ops[0], true);
+          ops = ops.subspan(1);
+          call("");
+          break;
+        default:
+          unreachable();
+      }
+    }
+
+    // A condition, negated by inverting its comparison if it is one that
+    // has an inverse, which those of floats do not because of NaNs.
+    void c_writer::write_condition(std::ostream &out, value_id v,
+                                   bool negate) {
+      auto const &f = *f_;
+      auto ops = f.operands_of(v);
+      if (!negate) {
+        write_value(out, v, false);
+        return;
+      }
+      std::string_view inverse;
+      switch (f.instrs[v].op) {
+        case opcode::lt:
+          inverse = ">=";
+          break;
+        case opcode::gt:
+          inverse = "<=";
+          break;
+        case opcode::le:
+          inverse = ">";
+          break;
+        case opcode::ge:
+          inverse = "<";
+          break;
+        case opcode::eq:
+          inverse = "!=";
+          break;
+        case opcode::ne:
+          inverse = "==";
+          break;
+        default:
+          break;
+      }
+      if (inlined_[v] && !inverse.empty() &&
+          f.instrs[ops[0]].type->kind != type_kind::float_type &&
+          f.instrs[ops[0]].type->kind != type_kind::string_type) {
+        write_value(out, ops[0], true);
+        out << ' ' << inverse << ' ';
+        write_value(out, ops[1], true);
+      } else {
+        out << '!';
+        write_value(out, v, true);
+      }
+    }
+
+    void c_writer::write_statement(std::ostream &out, value_id v) {
+      auto const &f = *f_;
+      auto const &i = f.instrs[v];
+      auto ops = f.operands_of(v);
+      out << "  ";
+      switch (i.op) {
+        case opcode::store_global:
+          out << names_.at(f.symbols[i.imm]) << " = ";
+          write_value(out, ops[0], false);
+          break;
+        case opcode::store_index: {
+          auto type = c_type(f.instrs[ops[2]].type);
+          out << "*(" << type << " *)soda_at(";
+          write_value(out, ops[0], false);
+          out << ", ";
+          write_value(out, ops[1], false);
+          out << ", sizeof(" << type << ")) = ";
+          write_value(out, ops[2], false);
+          break;
+        }
+        default:
+          if (uses_[v]) {
+            out << 'v' << v << " = ";
+          } else if (i.op != opcode::call) {
+            // kept for the trap
+            out << "(void)";
+          }
+          write_operation(out, v, false);
+          break;
+      }
+      out << ";\n";
+    }
+
+    bool c_writer::reads(value_id v, value_id var) const {
+      if (v == var) {
+        return true;
+      }
+      if (!inlined_[v]) {
+        return false;
+      }
+      return std::ranges::any_of(f_->operands_of(v), [&](value_id op) {
+        return reads(op, var);
+      });
+    }
+
+    // The (phi, value) assignments on the edge to the kth successor of b.
+    void c_writer::edge_copies(
+        block_id b, std::size_t k,
+        std::vector<std::pair<value_id, value_id>> &copies) {
+      auto const &f = *f_;
+      auto s = f.graph.succs(b)[k];
+      auto j = edge_index(f, b, k);
+      copies.clear();
+      for (auto v : f.values_of(s)) {
+        if (f.instrs[v].op != opcode::phi) {
+          break;
+        }
+        auto value = f.operands_of(v)[j];
+        if (live_[v] && uses_[v] && value != v) {
+          copies.emplace_back(v, value);
+        }
+      }
+    }
+
+    void c_writer::write_edge(std::ostream &out, block_id b, std::size_t k,
+                              std::string_view indent, bool fall_through) {
+      std::vector<std::pair<value_id, value_id>> copies;
+      edge_copies(b, k, copies);
+      // A phi assigned before another assignment reads it would be read
+      // too late; the values are then all taken first.
+      bool clobbers = false;
+      for (std::size_t m = 1; m < copies.size() && !clobbers; m++) {
+        for (std::size_t i = 0; i < m && !clobbers; i++) {
+          clobbers = reads(copies[m].second, copies[i].first);
+        }
+      }
+      if (clobbers) {
+        out << indent << "{\n";
+        for (std::size_t m = 0; m < copies.size(); m++) {
+          out << indent << "  " << c_type(f_->instrs[copies[m].first].type)
+              << " t" << m << " = ";
+          write_value(out, copies[m].second, false);
+          out << ";\n";
+        }
+        for (std::size_t m = 0; m < copies.size(); m++) {
+          out << indent << "  v" << copies[m].first << " = t" << m << ";\n";
+        }
+        out << indent << "}\n";
+      } else {
+        for (auto [phi, value] : copies) {
+          out << indent << 'v' << phi << " = ";
+          write_value(out, value, false);
+          out << ";\n";
+        }
+      }
+      auto s = f_->graph.succs(b)[k];
+      if (!fall_through || s != b + 1) {
+        out << indent << "goto bb" << s << ";\n";
+        labelled_[s] = true;
+      }
+    }
+
+    void c_writer::write_terminator(std::ostream &out, block_id b) {
+      auto const &f = *f_;
+      auto t = f.terminator(b);
+      auto ops = f.operands_of(t);
+      auto succs = f.graph.succs(b);
+      std::vector<std::pair<value_id, value_id>> copies;
+      switch (f.instrs[t].op) {
+        case opcode::jump:
+          write_edge(out, b, 0, "  ", true);
+          break;
+        case opcode::branch: {
+          // the condition is negated to fall through to the first
+          // successor when it is next
+          edge_copies(b, 0, copies);
+          std::size_t taken = 0;
+          out << "  if (";
+          if (succs[0] == b + 1 && succs[1] != b + 1 && copies.empty()) {
+            taken = 1;
+            edge_copies(b, 1, copies);
+          }
+          write_condition(out, ops[0], taken);
+          if (copies.empty()) {
+            out << ") goto bb" << succs[taken] << ";\n";
+            labelled_[succs[taken]] = true;
+          } else {
+            out << ") {\n";
+            write_edge(out, b, taken, "    ", false);
+            out << "  }\n";
+          }
+          write_edge(out, b, 1 - taken, "  ", true);
+          break;
+        }
+        case opcode::switch_: {
+          auto fallback = succs.size() - 1;
+          std::vector<std::int64_t> values;
+          if (!ir::case_values(f, b, values)) {
+            for (std::size_t k = 0; k < fallback; k++) {
+              out << "  if (";
+              write_value(out, ops[0], true);
+              out << " == ";
+              write_value(out, ops[k + 1], true);
+              out << ") {\n";
+              write_edge(out, b, k, "    ", false);
+              out << "  }\n";
+            }
+            write_edge(out, b, fallback, "  ", true);
+            break;
+          }
+          auto is_char = f.instrs[ops[0]].type->kind == type_kind::char_type;
+          auto write_case = [&](std::int64_t value) {
+            out << "    case ";
+            if (is_char) {
+              write_char(out, static_cast<std::uint64_t>(value));
+            } else {
+              write_int(out, value, false);
+            }
+            out << ":\n";
+          };
+          out << "  switch (";
+          write_value(out, ops[0], false);
+          out << ") {\n";
+          // Cases whose edges assign nothing share the goto of the first
+          // one to the same block, and those that go where the default
+          // does are left to it. The first of equal values wins.
+          edge_copies(b, fallback, copies);
+          auto plain_default = copies.empty();
+          std::unordered_set<std::int64_t> seen;
+          std::vector<std::pair<block_id, std::vector<std::int64_t>>> groups;
+          for (std::size_t k = 0; k < values.size(); k++) {
+            if (!seen.insert(values[k]).second) {
+              continue;
+            }
+            edge_copies(b, k, copies);
+            if (!copies.empty()) {
+              write_case(values[k]);
+              write_edge(out, b, k, "      ", false);
+            } else if (succs[k] != succs[fallback] || !plain_default) {
+              auto it = std::ranges::find(
+                  groups, succs[k], &decltype(groups)::value_type::first);
+              if (it == groups.end()) {
+                it = groups.insert(it, {succs[k], {}});
+              }
+              it->second.push_back(values[k]);
+            }
+          }
+          for (auto const &[target, group] : groups) {
+            for (auto value : group) {
+              write_case(value);
+            }
+            out << "      goto bb" << target << ";\n";
+            labelled_[target] = true;
+          }
+          out << "    default:\n";
+          write_edge(out, b, fallback, "      ", false);
+          out << "  }\n";
+          break;
+        }
+        case opcode::ret:
+          out << "  return";
+          if (!ops.empty()) {
+            out << ' ';
+            write_value(out, ops[0], false);
+          }
+          out << ";\n";
+          break;
+        default:
+          unreachable();
+      }
+    }
+
+  } // namespace
+
+  bool emit_c(std::ostream &out, ast::program const &prog,
+              std::span<ir::function const> funs, diagnostics &diags) {
+    return c_writer{prog, diags}.write(out, funs);
+  }
+
+} // namespace soda
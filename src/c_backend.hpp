@@ -0,0 +1,47 @@
+#pragma once
+
+#include "ast.hpp"
+#include "diagnostic.hpp"
+#include "ir.hpp"
+
+#include <ostream>
+#include <span>
+
+namespace soda {
+
+  //
+  // C code generation
+  //
+  // A program is written as one C translation unit from the IR of its
+  // functions, after optimization, so that the host compiler starts from
+  // code that is already simplified. Each value that is not a constant or a
+  // parameter is a local variable, assigned once per execution of its
+  // block. A pure value used once, later in its own block, is written into
+  // the expression that uses it instead, so that chains of arithmetic read
+  // as expressions rather than as one temporary per step; values that read
+  // memory or may trap are only moved past instructions without effects.
+  //
+  // Blocks are labels and edges are gotos, leaving out those to the block
+  // written next. A phi is a variable assigned on each incoming edge, with
+  // temporaries only when one of the assignments reads a phi that an
+  // earlier one overwrote. A switch on constant case values is a C switch,
+  // so the host compiler lowers it as it would its own.
+  //
+  // Integer arithmetic wraps and division by zero, out of range shifts and
+  // indexing, and negative exponents trap by aborting, all through small
+  // inline functions of a prelude written before the program. Strings are
+  // immutable and shared; concatenation allocates and never frees.
+  //
+  // The program must have a function main, taking no parameters and
+  // returning int or void, which the C main calls; its result is the exit
+  // status.
+  //
+
+  // Write the C translation unit for prog, whose functions are funs.
+  // Globals whose initializers are not constant expressions cannot be
+  // written; they and a missing or ill-typed main are appended to diags as
+  // errors, and false is returned.
+  bool emit_c(std::ostream &out, ast::program const &prog,
+              std::span<ir::function const> funs, diagnostics &diags);
+
+} // namespace soda
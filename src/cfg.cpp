@@ -0,0 +1,586 @@
+#include "cfg.hpp"
+
+#include <cassert>
+#include <initializer_list>
+#include <unordered_map>
+
+namespace soda {
+
+  //
+  // Graph algorithms
+  //
+
+  flow_graph::flow_graph(std::size_t size, std::span<edge const> edges)
+      : succ_offsets_(size + 1), pred_offsets_(size + 1),
+        succs_(edges.size()), preds_(edges.size()) {
+    for (auto [from, to] : edges) {
+      succ_offsets_[from + 1]++;
+      pred_offsets_[to + 1]++;
+    }
+    for (std::size_t b = 0; b < size; b++) {
+      succ_offsets_[b + 1] += succ_offsets_[b];
+      pred_offsets_[b + 1] += pred_offsets_[b];
+    }
+    std::vector<std::uint32_t> succ_next(succ_offsets_.begin(),
+                                         succ_offsets_.end() - 1);
+    std::vector<std::uint32_t> pred_next(pred_offsets_.begin(),
+                                         pred_offsets_.end() - 1);
+    for (auto [from, to] : edges) {
+      succs_[succ_next[from]++] = to;
+      preds_[pred_next[to]++] = from;
+    }
+  }
+
+  block_order reverse_postorder(flow_graph const &g, block_id entry) {
+    block_order order;
+    order.index.assign(g.size(), no_block);
+    if (g.size() == 0) {
+      return order;
+    }
+
+    std::vector<bool> visited(g.size());
+    std::vector<block_id> postorder;
+    postorder.reserve(g.size());
+    // blocks on the current path with the next successor to visit
+    std::vector<std::pair<block_id, std::uint32_t>> stack;
+    stack.emplace_back(entry, 0);
+    visited[entry] = true;
+    while (!stack.empty()) {
+      auto [b, next] = stack.back();
+      auto succs = g.succs(b);
+      if (next < succs.size()) {
+        stack.back().second++;
+        // The last successor is visited first. Branches list the loop exit
+        // or join block last, so it finishes before the body does and the
+        // body of every structured loop is contiguous in the order, right
+        // after its header.
+        auto s = succs[succs.size() - 1 - next];
+        if (!visited[s]) {
+          visited[s] = true;
+          stack.emplace_back(s, 0);
+        }
+      } else {
+        postorder.push_back(b);
+        stack.pop_back();
+      }
+    }
+
+    order.rpo.assign(postorder.rbegin(), postorder.rend());
+    for (std::uint32_t i = 0; i < order.rpo.size(); i++) {
+      order.index[order.rpo[i]] = i;
+    }
+    return order;
+  }
+
+  dominator_tree::dominator_tree(flow_graph const &g,
+                                 block_order const &order)
+      : idom_(g.size(), no_block), child_offsets_(g.size() + 1),
+        pre_(g.size()), post_(g.size()) {
+    if (order.rpo.empty()) {
+      return;
+    }
+    auto entry = order.rpo.front();
+    idom_[entry] = entry;
+
+    // walk up from both blocks until the paths meet; a dominator always
+    // comes earlier in reverse postorder
+    auto intersect = [&](block_id a, block_id b) {
+      while (a != b) {
+        while (order.index[a] > order.index[b]) {
+          a = idom_[a];
+        }
+        while (order.index[b] > order.index[a]) {
+          b = idom_[b];
+        }
+      }
+      return a;
+    };
+
+    for (bool changed = true; changed;) {
+      changed = false;
+      for (std::size_t i = 1; i < order.rpo.size(); i++) {
+        auto b = order.rpo[i];
+        auto idom = no_block;
+        for (auto p : g.preds(b)) {
+          if (idom_[p] == no_block) {
+            continue;
+          }
+          idom = idom == no_block ? p : intersect(p, idom);
+        }
+        if (idom_[b] != idom) {
+          idom_[b] = idom;
+          changed = true;
+        }
+      }
+    }
+
+    // children in reverse postorder
+    for (std::size_t i = 1; i < order.rpo.size(); i++) {
+      child_offsets_[idom_[order.rpo[i]] + 1]++;
+    }
+    for (std::size_t b = 0; b < g.size(); b++) {
+      child_offsets_[b + 1] += child_offsets_[b];
+    }
+    children_.resize(child_offsets_.back());
+    std::vector<std::uint32_t> next(child_offsets_.begin(),
+                                    child_offsets_.end() - 1);
+    for (std::size_t i = 1; i < order.rpo.size(); i++) {
+      auto b = order.rpo[i];
+      children_[next[idom_[b]]++] = b;
+    }
+
+    std::uint32_t clock = 0;
+    std::vector<std::pair<block_id, std::uint32_t>> stack;
+    stack.emplace_back(entry, 0);
+    pre_[entry] = clock++;
+    while (!stack.empty()) {
+      auto [b, next_child] = stack.back();
+      auto kids = children(b);
+      if (next_child < kids.size()) {
+        stack.back().second++;
+        pre_[kids[next_child]] = clock++;
+        stack.emplace_back(kids[next_child], 0);
+      } else {
+        post_[b] = clock++;
+        stack.pop_back();
+      }
+    }
+  }
+
+  loop_forest::loop_forest(flow_graph const &g, block_order const &order,
+                           dominator_tree const &dom)
+      : loop_of_(g.size(), no_loop) {
+    // the outermost loop found so far around loop l
+    auto outermost = [&](std::uint32_t l) {
+      while (loops_[l].parent != no_loop) {
+        l = loops_[l].parent;
+      }
+      return l;
+    };
+    std::vector<block_id> work;
+    for (auto h = order.rpo.rbegin(); h != order.rpo.rend(); ++h) {
+      for (auto p : g.preds(*h)) {
+        if (order.is_reachable(p) && dom.dominates(*h, p)) {
+          work.push_back(p);
+        }
+      }
+      if (work.empty()) {
+        continue;
+      }
+      auto l = static_cast<std::uint32_t>(loops_.size());
+      loops_.push_back({*h});
+      loop_of_[*h] = l;
+      while (!work.empty()) {
+        auto b = work.back();
+        work.pop_back();
+        if (b == *h) {
+          continue;
+        }
+        if (loop_of_[b] == no_loop) {
+          loop_of_[b] = l;
+        } else {
+          // a block of an inner loop: continue from that loop's header
+          auto inner = outermost(loop_of_[b]);
+          if (inner == l) {
+            continue;
+          }
+          loops_[inner].parent = l;
+          b = loops_[inner].header;
+        }
+        for (auto p : g.preds(b)) {
+          if (order.is_reachable(p)) {
+            work.push_back(p);
+          }
+        }
+      }
+    }
+    // parents are found after their children
+    for (auto l = loops_.size(); l-- > 0;) {
+      if (loops_[l].parent != no_loop) {
+        loops_[l].depth = loops_[loops_[l].parent].depth + 1;
+      }
+    }
+  }
+
+  //
+  // Building the CFG of a function
+  //
+
+  namespace {
+
+    class cfg_builder {
+    public:
+      explicit cfg_builder(function_cfg &cfg) : cfg_{cfg} {
+      }
+
+      void build(ast::fun_decl const &f);
+
+    private:
+      // a statement that break or continue can leave
+      struct jump_target {
+        ast::stmt const *stmt;
+        block_id break_to;
+        block_id continue_to;
+      };
+
+      function_cfg &cfg_;
+      std::vector<flow_graph::edge> edges_;
+      // the block being filled, or no_block after a jump
+      block_id current_ = no_block;
+      std::vector<jump_target> targets_;
+      std::unordered_map<ast::label_stmt const *, block_id> labels_;
+
+      block_id new_block() {
+        cfg_.blocks.emplace_back();
+        return static_cast<block_id>(cfg_.blocks.size() - 1);
+      }
+
+      void edge(block_id from, block_id to) {
+        edges_.emplace_back(from, to);
+      }
+
+      // Continue in block b, falling through from the current block.
+      void start(block_id b) {
+        if (current_ != no_block) {
+          edge(current_, b);
+        }
+        current_ = b;
+        auto &blk = cfg_.blocks[b];
+        assert(blk.count == 0 && "blocks are filled once");
+        blk.first = static_cast<std::uint32_t>(cfg_.items.size());
+      }
+
+      // The block being filled; code after a jump starts a new block that
+      // nothing leads to.
+      block_id current() {
+        if (current_ == no_block) {
+          start(new_block());
+        }
+        return current_;
+      }
+
+      void append(ast::node const *n) {
+        cfg_.blocks[current()].count++;
+        cfg_.items.push_back(n);
+      }
+
+      // Leave the current block, if reachable, for block b.
+      void jump(block_id b) {
+        if (current_ != no_block) {
+          edge(current_, b);
+        }
+        current_ = no_block;
+      }
+
+      // End the current block with the given statement, which leads to
+      // each of the targets.
+      void terminate(ast::stmt const &s, std::initializer_list<block_id> to) {
+        auto b = current();
+        cfg_.blocks[b].terminator = &s;
+        for (auto t : to) {
+          edge(b, t);
+        }
+        current_ = no_block;
+      }
+
+      // End the current block with the loop s, branching on cond to t or f;
+      // a literal condition only ever goes one way.
+      void branch(ast::stmt const &s, ast::expr const *cond, block_id t,
+                  block_id f) {
+        if (cond && cond->kind == ast::node_kind::bool_expr) {
+          jump(static_cast<ast::bool_expr const &>(*cond).value ? t : f);
+        } else {
+          terminate(s, {t, f});
+        }
+      }
+
+      block_id label_block(ast::label_stmt const *label) {
+        auto [it, inserted] = labels_.try_emplace(label, no_block);
+        if (inserted) {
+          it->second = new_block();
+        }
+        return it->second;
+      }
+
+      jump_target const *find_target(ast::stmt const *s) const {
+        for (auto t = targets_.rbegin(); t != targets_.rend(); ++t) {
+          if (t->stmt == s) {
+            return &*t;
+          }
+        }
+        return nullptr;
+      }
+
+      void build(ast::stmt::ptr const &s);
+      void build_switch(ast::switch_stmt const &n);
+      void build_loop_body(ast::stmt const &loop, ast::stmt::ptr const &body,
+                           block_id break_to, block_id continue_to);
+    };
+
+    void cfg_builder::build_loop_body(ast::stmt const &loop,
+                                      ast::stmt::ptr const &body,
+                                      block_id break_to,
+                                      block_id continue_to) {
+      targets_.push_back(jump_target{&loop, break_to, continue_to});
+      build(body);
+      targets_.pop_back();
+    }
+
+    void cfg_builder::build_switch(ast::switch_stmt const &n) {
+      append(n.exp.get());
+      auto dispatch = current();
+      auto end = new_block();
+      std::vector<block_id> cases;
+      bool has_default = false;
+      for (auto const &c : n.cases) {
+        if (c->kind == ast::node_kind::case_stmt) {
+          cases.push_back(new_block());
+          has_default |=
+              static_cast<ast::case_stmt const &>(*c).is_default_case();
+        }
+      }
+      cfg_.blocks[dispatch].terminator = &n;
+      for (auto c : cases) {
+        edge(dispatch, c);
+      }
+      if (!has_default) {
+        edge(dispatch, end);
+      }
+      current_ = no_block;
+
+      // cases fall through into the next one unless they jump
+      targets_.push_back(jump_target{&n, end, no_block});
+      std::size_t i = 0;
+      for (auto const &c : n.cases) {
+        if (c->kind != ast::node_kind::case_stmt) {
+          continue;
+        }
+        start(cases[i++]);
+        for (auto const &child : static_cast<ast::case_stmt &>(*c).stmts) {
+          build(child);
+        }
+      }
+      targets_.pop_back();
+      start(end);
+    }
+
+    void cfg_builder::build(ast::stmt::ptr const &s) {
+      if (!s) {
+        return;
+      }
+      switch (s->kind) {
+        case ast::node_kind::expr_stmt:
+          append(static_cast<ast::expr_stmt const &>(*s).exp.get());
+          break;
+        case ast::node_kind::let_decl:
+          append(s.get());
+          break;
+        case ast::node_kind::block_stmt:
+          for (auto const &child :
+               static_cast<ast::block_stmt const &>(*s).stmts) {
+            build(child);
+          }
+          break;
+        case ast::node_kind::label_stmt: {
+          auto &n = static_cast<ast::label_stmt const &>(*s);
+          start(label_block(&n));
+          build(n.stmt);
+          break;
+        }
+        case ast::node_kind::goto_stmt: {
+          auto &n = static_cast<ast::goto_stmt const &>(*s);
+          if (n.target) {
+            terminate(n, {label_block(n.target)});
+          } else {
+            terminate(n, {});
+          }
+          break;
+        }
+        case ast::node_kind::break_stmt: {
+          auto &n = static_cast<ast::break_stmt const &>(*s);
+          if (auto t = find_target(n.target)) {
+            terminate(n, {t->break_to});
+          } else {
+            terminate(n, {});
+          }
+          break;
+        }
+        case ast::node_kind::continue_stmt: {
+          auto &n = static_cast<ast::continue_stmt const &>(*s);
+          auto t = find_target(n.target);
+          if (t && t->continue_to != no_block) {
+            terminate(n, {t->continue_to});
+          } else {
+            terminate(n, {});
+          }
+          break;
+        }
+        case ast::node_kind::return_stmt: {
+          auto &n = static_cast<ast::return_stmt const &>(*s);
+          if (n.exp) {
+            append(n.exp.get());
+          }
+          terminate(n, {function_cfg::exit});
+          break;
+        }
+        case ast::node_kind::if_stmt: {
+          auto &n = static_cast<ast::if_stmt const &>(*s);
+          append(n.cond.get());
+          auto cons = new_block();
+          auto altn = n.altn ? new_block() : no_block;
+          auto join = new_block();
+          terminate(n, {cons, n.altn ? altn : join});
+          start(cons);
+          build(n.cons);
+          if (n.altn) {
+            jump(join);
+            start(altn);
+            build(n.altn);
+          }
+          start(join);
+          break;
+        }
+        case ast::node_kind::switch_stmt:
+          build_switch(static_cast<ast::switch_stmt const &>(*s));
+          break;
+        case ast::node_kind::do_stmt: {
+          auto &n = static_cast<ast::do_stmt const &>(*s);
+          auto body = new_block();
+          auto cond = new_block();
+          auto end = new_block();
+          start(body);
+          build_loop_body(n, n.stmt, end, cond);
+          start(cond);
+          append(n.exp.get());
+          branch(n, n.exp.get(), body, end);
+          start(end);
+          break;
+        }
+        case ast::node_kind::while_stmt: {
+          auto &n = static_cast<ast::while_stmt const &>(*s);
+          auto head = new_block();
+          auto body = new_block();
+          auto end = new_block();
+          start(head);
+          append(n.exp.get());
+          branch(n, n.exp.get(), body, end);
+          start(body);
+          build_loop_body(n, n.stmt, end, head);
+          jump(head);
+          start(end);
+          break;
+        }
+        case ast::node_kind::for_stmt: {
+          auto &n = static_cast<ast::for_stmt const &>(*s);
+          build(n.init);
+          auto head = new_block();
+          auto body = new_block();
+          auto incr = new_block();
+          auto end = new_block();
+          start(head);
+          if (n.test) {
+            build(n.test);
+            branch(n,
+                   n.test->kind == ast::node_kind::expr_stmt
+                       ? static_cast<ast::expr_stmt const &>(*n.test).exp.get()
+                       : nullptr,
+                   body, end);
+          }
+          start(body);
+          build_loop_body(n, n.stmt, end, incr);
+          start(incr);
+          build(n.incr);
+          jump(head);
+          start(end);
+          break;
+        }
+        case ast::node_kind::foreach_stmt: {
+          auto &n = static_cast<ast::foreach_stmt const &>(*s);
+          append(n.exp.get());
+          auto head = new_block();
+          auto body = new_block();
+          auto end = new_block();
+          start(head);
+          terminate(n, {body, end});
+          start(body);
+          append(&n);
+          build_loop_body(n, n.stmt, end, head);
+          jump(head);
+          start(end);
+          break;
+        }
+        default:
+          break;
+      }
+    }
+
+    void cfg_builder::build(ast::fun_decl const &f) {
+      cfg_.fun = &f;
+      auto entry = new_block();
+      auto exit = new_block();
+      assert(entry == function_cfg::entry && exit == function_cfg::exit);
+      start(entry);
+      for (auto const &s : f.stmts()) {
+        build(s);
+      }
+      // falling off the end of the body
+      cfg_.end = current_;
+      start(exit);
+      cfg_.graph = flow_graph{cfg_.blocks.size(), edges_};
+    }
+
+  } // namespace
+
+  function_cfg build_cfg(ast::fun_decl const &f) {
+    function_cfg cfg;
+    cfg_builder{cfg}.build(f);
+    return cfg;
+  }
+
+  //
+  // Dump
+  //
+
+  namespace {
+
+    void dump_blocks(std::ostream &out, char const *what,
+                     std::span<block_id const> blocks) {
+      out << ' ' << what << ':';
+      for (auto b : blocks) {
+        out << " bb" << b;
+      }
+    }
+
+  } // namespace
+
+  void dump(std::ostream &out, function_cfg const &cfg) {
+    auto order = reverse_postorder(cfg.graph, function_cfg::entry);
+    dominator_tree dom{cfg.graph, order};
+
+    out << "fun " << cfg.fun->name << ": " << cfg.size() << " blocks, "
+        << cfg.graph.edge_count() << " edges\n";
+    for (block_id b = 0; b < cfg.size(); b++) {
+      out << "  bb" << b;
+      if (b == function_cfg::entry) {
+        out << " (entry)";
+      } else if (b == function_cfg::exit) {
+        out << " (exit)";
+      }
+      if (!order.is_reachable(b)) {
+        out << " unreachable";
+      } else if (b != function_cfg::entry) {
+        out << " idom: bb" << dom.idom(b);
+      }
+      dump_blocks(out, "preds", cfg.graph.preds(b));
+      dump_blocks(out, "succs", cfg.graph.succs(b));
+      out << '\n';
+      for (auto item : cfg.items_of(b)) {
+        out << "    " << item->kind_name() << ' ' << item->range << '\n';
+      }
+      if (auto t = cfg.blocks[b].terminator) {
+        out << "    -> " << t->kind_name() << ' ' << t->range << '\n';
+      }
+    }
+  }
+
+} // namespace soda
@@ -0,0 +1,222 @@
+#pragma once
+
+#include "ast.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <ostream>
+#include <span>
+#include <utility>
+#include <vector>
+
+namespace soda {
+
+  using block_id = std::uint32_t;
+
+  inline constexpr block_id no_block = std::numeric_limits<block_id>::max();
+
+  //
+  // Flow graph
+  //
+  // The edges between densely numbered blocks, in compressed sparse row
+  // form: the successors of all blocks are stored back to back in one array
+  // and each block's are found through an offset table, and likewise for
+  // predecessors. The successors of a block keep the order in which their
+  // edges were given.
+  //
+
+  class flow_graph {
+  public:
+    using edge = std::pair<block_id, block_id>;
+
+    flow_graph() = default;
+    flow_graph(std::size_t size, std::span<edge const> edges);
+
+    std::size_t size() const noexcept {
+      return succ_offsets_.empty() ? 0 : succ_offsets_.size() - 1;
+    }
+
+    std::size_t edge_count() const noexcept {
+      return succs_.size();
+    }
+
+    std::span<block_id const> succs(block_id b) const noexcept {
+      return {succs_.data() + succ_offsets_[b],
+              succs_.data() + succ_offsets_[b + 1]};
+    }
+
+    std::span<block_id const> preds(block_id b) const noexcept {
+      return {preds_.data() + pred_offsets_[b],
+              preds_.data() + pred_offsets_[b + 1]};
+    }
+
+  private:
+    std::vector<std::uint32_t> succ_offsets_;
+    std::vector<std::uint32_t> pred_offsets_;
+    std::vector<block_id> succs_;
+    std::vector<block_id> preds_;
+  };
+
+  // The blocks reachable from the entry in reverse postorder, and the
+  // position of every block in that order (no_block if unreachable).
+  struct block_order {
+    std::vector<block_id> rpo;
+    std::vector<std::uint32_t> index;
+
+    bool is_reachable(block_id b) const noexcept {
+      return index[b] != no_block;
+    }
+  };
+
+  block_order reverse_postorder(flow_graph const &g, block_id entry);
+
+  //
+  // Dominator tree
+  //
+  // Computed with the iterative algorithm of Cooper, Harvey and Kennedy,
+  // which walks the blocks in reverse postorder until the immediate
+  // dominators settle, in two or three passes for the graphs structured
+  // code produces. The tree is then numbered in pre- and postorder so that
+  // dominance between two blocks is a constant-time check.
+  //
+
+  class dominator_tree {
+  public:
+    dominator_tree(flow_graph const &g, block_order const &order);
+
+    // The immediate dominator; the entry is its own, and unreachable blocks
+    // have none (no_block).
+    block_id idom(block_id b) const noexcept {
+      return idom_[b];
+    }
+
+    std::span<block_id const> children(block_id b) const noexcept {
+      return {children_.data() + child_offsets_[b],
+              children_.data() + child_offsets_[b + 1]};
+    }
+
+    // Whether every path from the entry to b passes through a; a block
+    // dominates itself.
+    bool dominates(block_id a, block_id b) const noexcept {
+      return idom_[a] != no_block && idom_[b] != no_block &&
+             pre_[a] <= pre_[b] && post_[b] <= post_[a];
+    }
+
+  private:
+    std::vector<block_id> idom_;
+    std::vector<std::uint32_t> child_offsets_;
+    std::vector<block_id> children_;
+    std::vector<std::uint32_t> pre_;
+    std::vector<std::uint32_t> post_;
+  };
+
+  //
+  // Natural loops
+  //
+  // A back edge leads to a block that dominates its source, the header of
+  // a loop made of the header and every block that reaches the back edge
+  // without passing through the header; back edges to one header make one
+  // loop. Loops are found innermost first, walking the headers in
+  // postorder, and a loop found inside another becomes its child. Cycles
+  // without a dominating header, which goto can create, are not loops.
+  //
+
+  class loop_forest {
+  public:
+    static constexpr std::uint32_t no_loop =
+        std::numeric_limits<std::uint32_t>::max();
+
+    struct loop {
+      block_id header;
+      // the innermost enclosing loop, or no_loop
+      std::uint32_t parent = no_loop;
+      // 1 for outermost loops
+      std::uint32_t depth = 1;
+    };
+
+    loop_forest(flow_graph const &g, block_order const &order,
+                dominator_tree const &dom);
+
+    std::size_t size() const noexcept {
+      return loops_.size();
+    }
+
+    loop const &operator[](std::uint32_t l) const noexcept {
+      return loops_[l];
+    }
+
+    // The innermost loop containing b, or no_loop.
+    std::uint32_t loop_of(block_id b) const noexcept {
+      return loop_of_[b];
+    }
+
+    // The number of loops containing b.
+    std::uint32_t depth(block_id b) const noexcept {
+      return loop_of_[b] == no_loop ? 0 : loops_[loop_of_[b]].depth;
+    }
+
+  private:
+    std::vector<loop> loops_;
+    std::vector<std::uint32_t> loop_of_;
+  };
+
+  //
+  // Control-flow graph of a function body
+  //
+  // Each block lists the AST nodes it evaluates in order: the expressions
+  // of expression statements, let_decls, conditions, switch values and
+  // returned values. A block's items are contiguous in one array, as every
+  // block is filled in one go. Expressions are not split, so the control
+  // flow inside &&, || and ?: stays within a block.
+  //
+  // Block 0 is the entry and block 1 the exit, which every return and the
+  // end of the body lead to. A block ending in a conditional branch has the
+  // true successor first and the false one second, but a loop condition
+  // that is a literal only leads where it goes, like that of for (;;), and
+  // ends no block. A switch block has one successor per case, in order,
+  // followed by the block after the switch if there is no default case. A
+  // foreach header branches out of the loop or to the body, whose first
+  // item is the foreach_stmt itself, standing for the assignment of the
+  // next element to the loop variable.
+  //
+  // Statements that follow a jump get a block of their own without
+  // predecessors, so unreachable code is still represented.
+  //
+
+  class function_cfg {
+  public:
+    struct block {
+      std::uint32_t first = 0;
+      std::uint32_t count = 0;
+      // the statement that ends the block with a jump or branch, if any
+      ast::stmt const *terminator = nullptr;
+    };
+
+    static constexpr block_id entry = 0;
+    static constexpr block_id exit = 1;
+
+    ast::fun_decl const *fun = nullptr;
+    // the block that falls off the end of the body into the exit, which is
+    // unreachable if the body always returns
+    block_id end = no_block;
+    std::vector<block> blocks;
+    std::vector<ast::node const *> items;
+    flow_graph graph;
+
+    std::size_t size() const noexcept {
+      return blocks.size();
+    }
+
+    std::span<ast::node const *const> items_of(block_id b) const noexcept {
+      return {items.data() + blocks[b].first, blocks[b].count};
+    }
+  };
+
+  // Build the CFG of a resolved function; loads its body if needed.
+  function_cfg build_cfg(ast::fun_decl const &f);
+
+  // Write the blocks of a CFG with their items, edges and dominators.
+  void dump(std::ostream &out, function_cfg const &cfg);
+
+} // namespace soda
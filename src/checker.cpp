@@ -0,0 +1,676 @@
+#include "checker.hpp"
+
+#include "constant.hpp"
+#include "parallel.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace soda {
+
+  namespace {
+
+    type const *primitive(type_kind kind) {
+      return type_table::primitive(kind);
+    }
+
+    std::string quote(type const *t) {
+      return soda::quote(to_string(*t));
+    }
+
+    bool is_error(type const *t) {
+      return t->kind == type_kind::error;
+    }
+
+    // The value of a case made of int and char literals and operators on
+    // them, which two cases must not share; other values are only known
+    // once folded or at run time.
+    bool case_value(ast::expr const &e, constant &value) {
+      switch (e.kind) {
+        case ast::node_kind::int_expr:
+          value = constant::of_int(static_cast<std::int64_t>(
+              static_cast<ast::int_expr const &>(e).value));
+          return true;
+        case ast::node_kind::char_expr:
+          value =
+              constant::of_int(static_cast<ast::char_expr const &>(e).value);
+          return true;
+        case ast::node_kind::unop_expr: {
+          auto const &n = static_cast<ast::unop_expr const &>(e);
+          constant operand;
+          return case_value(*n.operand, operand) &&
+                 evaluate(n.op, operand, value) == eval_status::ok &&
+                 value.kind == constant::kind::integer;
+        }
+        case ast::node_kind::binop_expr: {
+          auto const &n = static_cast<ast::binop_expr const &>(e);
+          constant lhs, rhs;
+          return case_value(*n.lhs, lhs) && case_value(*n.rhs, rhs) &&
+                 evaluate(n.op, lhs, rhs, value) == eval_status::ok &&
+                 value.kind == constant::kind::integer;
+        }
+        default:
+          return false;
+      }
+    }
+
+    // A case value as it would be written in a switch on t.
+    std::string case_text(type const *t, std::int64_t value) {
+      if (t->kind != type_kind::char_type) {
+        return std::to_string(value);
+      }
+      if (value >= 0x20 && value < 0x7F && value != '\\' && value != '\'') {
+        return {'\'', static_cast<char>(value), '\''};
+      }
+      char buf[24];
+      std::snprintf(buf, sizeof buf, "'\\x%02x'",
+                    static_cast<unsigned>(value));
+      return buf;
+    }
+
+    // The type of the elements visited by foreach and read by indexing.
+    type const *element_of(type const *t) {
+      if (t->kind == type_kind::array_type) {
+        return t->inner;
+      } else if (t->kind == type_kind::string_type) {
+        return primitive(type_kind::char_type);
+      }
+      return nullptr;
+    }
+
+    // The result of applying a binary operator to operands of the given
+    // types, or nullptr if it does not apply to them.
+    type const *binary_result(operator_kind op, type const *lhs,
+                              type const *rhs) {
+      if (lhs != rhs) {
+        return nullptr;
+      }
+      auto t = lhs;
+      switch (op) {
+        case operator_kind::add:
+          return t->is_numeric() || t->kind == type_kind::string_type
+                     ? t
+                     : nullptr;
+        case operator_kind::sub:
+        case operator_kind::mul:
+        case operator_kind::div:
+        case operator_kind::mod:
+        case operator_kind::pow:
+          return t->is_numeric() ? t : nullptr;
+        case operator_kind::bit_and:
+        case operator_kind::bit_xor:
+        case operator_kind::bit_or:
+          return t->kind == type_kind::int_type ||
+                         t->kind == type_kind::bool_type
+                     ? t
+                     : nullptr;
+        case operator_kind::lshift:
+        case operator_kind::rshift:
+          return t->kind == type_kind::int_type ? t : nullptr;
+        case operator_kind::log_and:
+        case operator_kind::log_or:
+          return t->kind == type_kind::bool_type ? t : nullptr;
+        case operator_kind::lt:
+        case operator_kind::gt:
+        case operator_kind::le:
+        case operator_kind::ge:
+          return t->is_numeric() || t->kind == type_kind::char_type ||
+                         t->kind == type_kind::string_type
+                     ? primitive(type_kind::bool_type)
+                     : nullptr;
+        case operator_kind::eq:
+        case operator_kind::ne:
+          return t->kind != type_kind::void_type
+                     ? primitive(type_kind::bool_type)
+                     : nullptr;
+        default:
+          return nullptr;
+      }
+    }
+
+    class checker {
+    public:
+      checker(type_table &types, diagnostics &diags)
+          : types_{types}, diags_{diags} {
+      }
+
+      std::size_t expressions() const noexcept {
+        return expressions_;
+      }
+
+      void check_signature(ast::fun_decl &f);
+      void check_body(ast::fun_decl &f);
+      void check_let(ast::let_decl &d);
+
+    private:
+      type_table &types_;
+      diagnostics &diags_;
+      // the return type of the function being checked
+      type const *result_ = nullptr;
+      std::size_t expressions_ = 0;
+
+      void error(source_range const &range, std::string message) {
+        diags_.emplace_back(severity::error, range, std::move(message));
+      }
+
+      type const *declared_type(ast::node::ptr<ast::type_ref> const &type);
+
+      type const *check(ast::expr &e);
+      type const *infer(ast::expr &e);
+      type const *infer_unop(ast::unop_expr &n);
+      type const *infer_binop(ast::binop_expr &n);
+      type const *infer_call(ast::call_expr &n);
+      bool check_assignable(ast::expr const &e);
+      void check_condition(ast::expr::ptr const &e);
+
+      void check(ast::stmt::ptr const &s);
+      void check_return(ast::return_stmt &n);
+      void check_switch(ast::switch_stmt &n);
+    };
+
+    type const *
+    checker::declared_type(ast::node::ptr<ast::type_ref> const &type) {
+      // unknown types have been reported by the resolver
+      return type->canonical ? type->canonical : primitive(type_kind::error);
+    }
+
+    //
+    // Expressions
+    //
+
+    type const *checker::check(ast::expr &e) {
+      expressions_++;
+      auto t = infer(e);
+      e.set_type(t);
+      return t;
+    }
+
+    type const *checker::infer(ast::expr &e) {
+      switch (e.kind) {
+        case ast::node_kind::bool_expr:
+          return primitive(type_kind::bool_type);
+        case ast::node_kind::int_expr:
+          return primitive(type_kind::int_type);
+        case ast::node_kind::float_expr:
+          return primitive(type_kind::float_type);
+        case ast::node_kind::char_expr:
+          return primitive(type_kind::char_type);
+        case ast::node_kind::string_expr:
+          return primitive(type_kind::string_type);
+        case ast::node_kind::ident_expr: {
+          auto &n = static_cast<ast::ident_expr &>(e);
+          if (!n.ref) {
+            // reported by the resolver
+            return primitive(type_kind::error);
+          }
+          if (!n.ref->canonical) {
+            // only globals further down have no type yet
+            if (n.ref->kind == ast::node_kind::let_decl) {
+              auto const &d = static_cast<ast::let_decl const &>(*n.ref);
+              if (d.type) {
+                return declared_type(d.type);
+              }
+            }
+            error(n.range, "type of " + soda::quote(n.name) +
+                               " is not known before its declaration");
+            return primitive(type_kind::error);
+          }
+          return n.ref->canonical;
+        }
+        case ast::node_kind::unop_expr:
+          return infer_unop(static_cast<ast::unop_expr &>(e));
+        case ast::node_kind::binop_expr:
+          return infer_binop(static_cast<ast::binop_expr &>(e));
+        case ast::node_kind::if_expr: {
+          auto &n = static_cast<ast::if_expr &>(e);
+          check_condition(n.cond);
+          auto cons = check(*n.cons);
+          auto altn = check(*n.altn);
+          if (is_error(cons) || is_error(altn)) {
+            return primitive(type_kind::error);
+          }
+          if (cons != altn) {
+            error(n.range, "branches of conditional expression have "
+                           "different types (" +
+                               quote(cons) + " and " + quote(altn) + ")");
+            return primitive(type_kind::error);
+          }
+          return cons;
+        }
+        case ast::node_kind::call_expr:
+          return infer_call(static_cast<ast::call_expr &>(e));
+        default:
+          return primitive(type_kind::error);
+      }
+    }
+
+    type const *checker::infer_unop(ast::unop_expr &n) {
+      auto t = check(*n.operand);
+      if (is_error(t)) {
+        return t;
+      }
+      bool ok = false;
+      switch (n.op) {
+        case operator_kind::pos:
+        case operator_kind::neg:
+          ok = t->is_numeric();
+          break;
+        case operator_kind::bit_not:
+          ok = t->kind == type_kind::int_type;
+          break;
+        case operator_kind::log_not:
+          ok = t->kind == type_kind::bool_type;
+          break;
+        case operator_kind::pre_inc:
+        case operator_kind::pre_dec:
+        case operator_kind::post_inc:
+        case operator_kind::post_dec:
+          ok = t->is_numeric();
+          if (ok && !check_assignable(*n.operand)) {
+            return primitive(type_kind::error);
+          }
+          break;
+        default:
+          break;
+      }
+      if (!ok) {
+        error(n.range, "invalid operand to unary " +
+                           soda::quote(spelling(n.op)) + " (" + quote(t) +
+                           ")");
+        return primitive(type_kind::error);
+      }
+      return t;
+    }
+
+    type const *checker::infer_binop(ast::binop_expr &n) {
+      auto lhs = check(*n.lhs);
+
+      if (n.op == operator_kind::member) {
+        // the right-hand side names a member rather than a value
+        auto const &name = static_cast<ast::ident_expr const &>(*n.rhs).name;
+        if (is_error(lhs)) {
+          return lhs;
+        }
+        if (element_of(lhs) && name == "length") {
+          return primitive(type_kind::int_type);
+        }
+        error(n.rhs->range,
+              quote(lhs) + " has no member " + soda::quote(name));
+        return primitive(type_kind::error);
+      }
+
+      auto rhs = check(*n.rhs);
+      if (is_error(lhs) || is_error(rhs)) {
+        return primitive(type_kind::error);
+      }
+
+      if (n.op == operator_kind::comma) {
+        return rhs;
+      }
+      if (n.op == operator_kind::index) {
+        auto element = element_of(lhs);
+        if (!element) {
+          error(n.range, "cannot index a value of type " + quote(lhs));
+          return primitive(type_kind::error);
+        }
+        if (rhs->kind != type_kind::int_type) {
+          error(n.rhs->range,
+                "index has type " + quote(rhs) + ", expected 'int'");
+          return primitive(type_kind::error);
+        }
+        return element;
+      }
+      if (is_assignment(n.op)) {
+        if (!check_assignable(*n.lhs)) {
+          return primitive(type_kind::error);
+        }
+        if (n.op == operator_kind::assign) {
+          if (lhs != rhs) {
+            error(n.range, "assigning a value of type " + quote(rhs) +
+                               " to " + quote(lhs));
+            return primitive(type_kind::error);
+          }
+          return lhs;
+        }
+        if (binary_result(assignment_operator(n.op), lhs, rhs) != lhs) {
+          error(n.range, "invalid operands to " +
+                             soda::quote(spelling(n.op)) + " (" + quote(lhs) +
+                             " and " + quote(rhs) + ")");
+          return primitive(type_kind::error);
+        }
+        return lhs;
+      }
+
+      if (auto t = binary_result(n.op, lhs, rhs)) {
+        return t;
+      }
+      error(n.range, "invalid operands to binary " +
+                         soda::quote(spelling(n.op)) + " (" + quote(lhs) +
+                         " and " + quote(rhs) + ")");
+      return primitive(type_kind::error);
+    }
+
+    type const *checker::infer_call(ast::call_expr &n) {
+      auto callee = check(*n.callee);
+      bool failed = is_error(callee);
+      if (!failed && callee->kind != type_kind::function_type) {
+        error(n.callee->range,
+              "called object of type " + quote(callee) + " is not a function");
+        failed = true;
+      }
+      if (!failed && callee->params.size() != n.arguments.size()) {
+        error(n.range, "function of type " + quote(callee) + " takes " +
+                           std::to_string(callee->params.size()) +
+                           " arguments, " +
+                           std::to_string(n.arguments.size()) + " given");
+        failed = true;
+      }
+      for (std::size_t i = 0; i < n.arguments.size(); i++) {
+        auto t = check(*n.arguments[i]);
+        if (failed || is_error(t) || is_error(callee->params[i])) {
+          continue;
+        }
+        if (t != callee->params[i]) {
+          error(n.arguments[i]->range,
+                "argument " + std::to_string(i + 1) + " has type " +
+                    quote(t) + ", expected " + quote(callee->params[i]));
+        }
+      }
+      return failed ? primitive(type_kind::error) : callee->inner;
+    }
+
+    // Variables and the elements of arrays can be assigned to.
+    bool checker::check_assignable(ast::expr const &e) {
+      if (e.kind == ast::node_kind::ident_expr) {
+        auto ref = static_cast<ast::ident_expr const &>(e).ref;
+        if (ref && ref->kind == ast::node_kind::let_decl) {
+          return true;
+        }
+      } else if (e.kind == ast::node_kind::binop_expr) {
+        auto const &n = static_cast<ast::binop_expr const &>(e);
+        auto array = n.lhs->type_of();
+        if (n.op == operator_kind::index && array &&
+            array->kind == type_kind::array_type) {
+          return true;
+        }
+      }
+      error(e.range, "expression is not assignable");
+      return false;
+    }
+
+    void checker::check_condition(ast::expr::ptr const &e) {
+      auto t = check(*e);
+      if (!is_error(t) && t->kind != type_kind::bool_type) {
+        error(e->range, "condition has type " + quote(t) + ", expected 'bool'");
+      }
+    }
+
+    //
+    // Statements
+    //
+
+    void checker::check(ast::stmt::ptr const &s) {
+      if (!s) {
+        return;
+      }
+      switch (s->kind) {
+        case ast::node_kind::expr_stmt:
+          check(*static_cast<ast::expr_stmt &>(*s).exp);
+          break;
+        case ast::node_kind::block_stmt:
+          for (auto const &child : static_cast<ast::block_stmt &>(*s).stmts) {
+            check(child);
+          }
+          break;
+        case ast::node_kind::label_stmt:
+          check(static_cast<ast::label_stmt &>(*s).stmt);
+          break;
+        case ast::node_kind::return_stmt:
+          check_return(static_cast<ast::return_stmt &>(*s));
+          break;
+        case ast::node_kind::if_stmt: {
+          auto &n = static_cast<ast::if_stmt &>(*s);
+          check_condition(n.cond);
+          check(n.cons);
+          check(n.altn);
+          break;
+        }
+        case ast::node_kind::switch_stmt:
+          check_switch(static_cast<ast::switch_stmt &>(*s));
+          break;
+        case ast::node_kind::do_stmt: {
+          auto &n = static_cast<ast::do_stmt &>(*s);
+          check(n.stmt);
+          check_condition(n.exp);
+          break;
+        }
+        case ast::node_kind::while_stmt: {
+          auto &n = static_cast<ast::while_stmt &>(*s);
+          check_condition(n.exp);
+          check(n.stmt);
+          break;
+        }
+        case ast::node_kind::for_stmt: {
+          auto &n = static_cast<ast::for_stmt &>(*s);
+          check(n.init);
+          if (n.test && n.test->kind == ast::node_kind::expr_stmt) {
+            check_condition(static_cast<ast::expr_stmt &>(*n.test).exp);
+          }
+          check(n.incr);
+          check(n.stmt);
+          break;
+        }
+        case ast::node_kind::foreach_stmt: {
+          auto &n = static_cast<ast::foreach_stmt &>(*s);
+          auto t = check(*n.exp);
+          auto element = element_of(t);
+          if (!element) {
+            if (!is_error(t)) {
+              error(n.exp->range,
+                    "cannot iterate over a value of type " + quote(t));
+            }
+            element = primitive(type_kind::error);
+          }
+          if (n.iter) {
+            n.iter->canonical = element;
+          }
+          check(n.stmt);
+          break;
+        }
+        case ast::node_kind::let_decl:
+          check_let(static_cast<ast::let_decl &>(*s));
+          break;
+        default:
+          break;
+      }
+    }
+
+    void checker::check_return(ast::return_stmt &n) {
+      if (!n.exp) {
+        if (result_->kind != type_kind::void_type && !is_error(result_)) {
+          error(n.range, "missing return value in function returning " +
+                             quote(result_));
+        }
+        return;
+      }
+      auto t = check(*n.exp);
+      if (is_error(t) || is_error(result_)) {
+        return;
+      }
+      if (result_->kind == type_kind::void_type) {
+        error(n.exp->range, "returning a value from a void function");
+      } else if (t != result_) {
+        error(n.exp->range, "returning " + quote(t) +
+                                " from a function returning " +
+                                quote(result_));
+      }
+    }
+
+    void checker::check_switch(ast::switch_stmt &n) {
+      auto t = check(*n.exp);
+      if (!is_error(t) && t->kind != type_kind::int_type &&
+          t->kind != type_kind::char_type) {
+        error(n.exp->range,
+              "switch on a value of type " + quote(t) +
+                  ", expected 'int' or 'char'");
+        t = primitive(type_kind::error);
+      }
+      std::unordered_set<std::int64_t> values;
+      bool has_default = false;
+      for (auto const &c : n.cases) {
+        if (c->kind != ast::node_kind::case_stmt) {
+          continue;
+        }
+        auto &cs = static_cast<ast::case_stmt &>(*c);
+        if (!cs.exp) {
+          if (has_default) {
+            error(cs.range, "duplicate default case");
+          }
+          has_default = true;
+        } else {
+          auto value = check(*cs.exp);
+          constant k;
+          if (!is_error(value) && !is_error(t) && value != t) {
+            error(cs.exp->range, "case value of type " + quote(value) +
+                                     " in a switch on " + quote(t));
+          } else if (case_value(*cs.exp, k) && !values.insert(k.i).second) {
+            error(cs.exp->range, "duplicate case value " + case_text(t, k.i));
+          }
+        }
+        for (auto const &child : cs.stmts) {
+          check(child);
+        }
+      }
+    }
+
+    //
+    // Declarations
+    //
+
+    void checker::check_let(ast::let_decl &d) {
+      auto init = d.init_exp ? check(*d.init_exp) : nullptr;
+      if (d.type) {
+        auto declared = declared_type(d.type);
+        if (declared->kind == type_kind::void_type) {
+          error(d.range, "variable " + soda::quote(d.name) +
+                             " declared void");
+          declared = primitive(type_kind::error);
+        } else if (init && !is_error(init) && !is_error(declared) &&
+                   init != declared) {
+          error(d.init_exp->range, "initializing " + soda::quote(d.name) +
+                                       " of type " + quote(declared) +
+                                       " with a value of type " +
+                                       quote(init));
+        }
+        d.canonical = declared;
+      } else if (init) {
+        if (init->kind == type_kind::void_type) {
+          error(d.init_exp->range, "variable " + soda::quote(d.name) +
+                                       " initialized with a void value");
+          init = primitive(type_kind::error);
+        }
+        d.canonical = init;
+      } else {
+        error(d.range, "type of " + soda::quote(d.name) +
+                           " cannot be inferred without an initializer");
+        d.canonical = primitive(type_kind::error);
+      }
+    }
+
+    void checker::check_signature(ast::fun_decl &f) {
+      std::vector<type const *> params;
+      params.reserve(f.params.size());
+      for (auto const &p : f.params) {
+        if (p->kind == ast::node_kind::let_decl) {
+          check_let(static_cast<ast::let_decl &>(*p));
+        } else {
+          p->canonical = primitive(type_kind::error);
+        }
+        params.push_back(p->canonical);
+      }
+      auto result = f.ret_type ? declared_type(f.ret_type)
+                               : primitive(type_kind::void_type);
+      f.canonical = types_.function_of(params, result);
+    }
+
+    void checker::check_body(ast::fun_decl &f) {
+      result_ = f.canonical->inner;
+      for (auto const &s : f.stmts()) {
+        check(s);
+      }
+    }
+
+  } // namespace
+
+  check_stats check(ast::program &prog, diagnostics &diags, unsigned jobs) {
+    check_stats stats;
+
+    std::vector<ast::fun_decl *> funs;
+    {
+      checker c{*prog.types, diags};
+      for (auto const &tu : prog.tus) {
+        for (auto const &d : tu->decls) {
+          if (d->kind == ast::node_kind::fun_decl) {
+            auto &f = static_cast<ast::fun_decl &>(*d);
+            c.check_signature(f);
+            funs.push_back(&f);
+          }
+        }
+      }
+      for (auto const &tu : prog.tus) {
+        for (auto const &d : tu->decls) {
+          if (d->kind == ast::node_kind::let_decl) {
+            c.check_let(static_cast<ast::let_decl &>(*d));
+          }
+        }
+      }
+      stats.expressions = c.expressions();
+    }
+
+    struct tagged {
+      std::size_t fun;
+      diagnostic diag;
+    };
+    struct worker {
+      diagnostics scratch;
+      std::vector<tagged> diags;
+      std::size_t expressions = 0;
+    };
+    std::vector<worker> workers(worker_count(funs.size(), jobs));
+
+    auto pool = parallel_for(funs.size(), jobs, [&](std::size_t w,
+                                                    std::size_t i) {
+      auto &self = workers[w];
+      checker c{*prog.types, self.scratch};
+      c.check_body(*funs[i]);
+      self.expressions += c.expressions();
+      for (auto &d : self.scratch) {
+        self.diags.push_back(tagged{i, std::move(d)});
+      }
+      self.scratch.clear();
+    });
+
+    // a function's diagnostics all come from one worker, in order
+    std::vector<tagged> merged;
+    for (auto &w : workers) {
+      stats.expressions += w.expressions;
+      std::ranges::move(w.diags, std::back_inserter(merged));
+    }
+    std::ranges::stable_sort(merged, {}, &tagged::fun);
+
+    for (auto &t : merged) {
+      diags.push_back(std::move(t.diag));
+    }
+
+    stats.functions = funs.size();
+    stats.jobs = pool.jobs;
+    stats.steals = pool.steals;
+    return stats;
+  }
+
+} // namespace soda
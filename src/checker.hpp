@@ -0,0 +1,40 @@
+#pragma once
+
+#include "ast.hpp"
+#include "diagnostic.hpp"
+
+#include <cstddef>
+
+namespace soda {
+
+  //
+  // Semantic analysis
+  //
+  // Type-checks a resolved program: sets the type of every expression and
+  // the canonical type of every variable and function, and reports
+  // operations whose operands have the wrong types. There are no implicit
+  // conversions, so the operands of a binary operator, the branches of an
+  // if_expr, and an assigned value and its target all need the same type.
+  // Expressions with an error type are not reported again.
+  //
+  // Function signatures and global variables are checked first, in source
+  // order. Function bodies only depend on those, so they are then checked
+  // concurrently on a work-stealing pool. Each worker collects diagnostics
+  // in a buffer of its own, tagged with the function they belong to, and
+  // the buffers are merged in source order, so what is reported does not
+  // depend on the number of workers or on how the functions were scheduled.
+  //
+
+  struct check_stats {
+    std::size_t functions = 0;
+    std::size_t expressions = 0;
+    std::size_t jobs = 0;
+    // shares of functions a worker took over from another
+    std::size_t steals = 0;
+  };
+
+  // jobs is the number of worker threads, 0 for one per hardware thread.
+  check_stats check(ast::program &prog, diagnostics &diags,
+                    unsigned jobs = 0);
+
+} // namespace soda
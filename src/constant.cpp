@@ -0,0 +1,277 @@
+#include "constant.hpp"
+
+#include <cmath>
+#include <limits>
+
+namespace soda {
+
+  std::string_view to_string(eval_status status) {
+    switch (status) {
+      case eval_status::ok:
+        return "ok";
+      case eval_status::not_constant:
+        return "not a constant expression";
+      case eval_status::overflow:
+        return "integer overflow in constant expression";
+      case eval_status::division_by_zero:
+        return "division by zero in constant expression";
+      case eval_status::shift_out_of_range:
+        return "shift count out of range in constant expression";
+      case eval_status::negative_exponent:
+        return "negative exponent in integer power";
+      case eval_status::step_limit:
+        return "constant evaluation takes too many steps";
+      case eval_status::memory_limit:
+        return "constant evaluation takes too much memory";
+      case eval_status::depth_limit:
+        return "constant evaluation nests calls too deeply";
+    }
+    return "unknown";
+  }
+
+  namespace {
+
+    eval_status power(std::int64_t base, std::int64_t exp,
+                      std::int64_t &result) {
+      if (exp < 0) {
+        return eval_status::negative_exponent;
+      }
+      std::int64_t acc = 1;
+      while (exp > 0) {
+        if ((exp & 1) && __builtin_mul_overflow(acc, base, &acc)) {
+          return eval_status::overflow;
+        }
+        exp >>= 1;
+        // only square when another bit needs it, so that e.g. 2**62 does
+        // not fail on a square that is never used
+        if (exp > 0 && __builtin_mul_overflow(base, base, &base)) {
+          return eval_status::overflow;
+        }
+      }
+      result = acc;
+      return eval_status::ok;
+    }
+
+    eval_status evaluate_int(operator_kind op, std::int64_t a, std::int64_t b,
+                             constant &result) {
+      std::int64_t r = 0;
+      switch (op) {
+        case operator_kind::add:
+          if (__builtin_add_overflow(a, b, &r)) {
+            return eval_status::overflow;
+          }
+          break;
+        case operator_kind::sub:
+          if (__builtin_sub_overflow(a, b, &r)) {
+            return eval_status::overflow;
+          }
+          break;
+        case operator_kind::mul:
+          if (__builtin_mul_overflow(a, b, &r)) {
+            return eval_status::overflow;
+          }
+          break;
+        case operator_kind::div:
+        case operator_kind::mod:
+          if (b == 0) {
+            return eval_status::division_by_zero;
+          }
+          // the remainder is 0, but computing it traps at run time just
+          // like the quotient
+          if (a == std::numeric_limits<std::int64_t>::min() && b == -1) {
+            return eval_status::overflow;
+          }
+          r = op == operator_kind::div ? a / b : a % b;
+          break;
+        case operator_kind::pow:
+          if (auto status = power(a, b, r); status != eval_status::ok) {
+            return status;
+          }
+          break;
+        case operator_kind::bit_and:
+          r = a & b;
+          break;
+        case operator_kind::bit_xor:
+          r = a ^ b;
+          break;
+        case operator_kind::bit_or:
+          r = a | b;
+          break;
+        case operator_kind::lshift:
+        case operator_kind::rshift:
+          if (b < 0 || b >= 64) {
+            return eval_status::shift_out_of_range;
+          }
+          // shifts operate on the bit pattern; right shifts are arithmetic
+          r = op == operator_kind::lshift
+                  ? static_cast<std::int64_t>(static_cast<std::uint64_t>(a)
+                                              << b)
+                  : a >> b;
+          break;
+        case operator_kind::lt:
+          result = constant::of_bool(a < b);
+          return eval_status::ok;
+        case operator_kind::gt:
+          result = constant::of_bool(a > b);
+          return eval_status::ok;
+        case operator_kind::le:
+          result = constant::of_bool(a <= b);
+          return eval_status::ok;
+        case operator_kind::ge:
+          result = constant::of_bool(a >= b);
+          return eval_status::ok;
+        case operator_kind::eq:
+          result = constant::of_bool(a == b);
+          return eval_status::ok;
+        case operator_kind::ne:
+          result = constant::of_bool(a != b);
+          return eval_status::ok;
+        default:
+          return eval_status::not_constant;
+      }
+      result = constant::of_int(r);
+      return eval_status::ok;
+    }
+
+    template <typename F>
+    eval_status evaluate_float(operator_kind op, F a, F b, bool extended,
+                               constant &result) {
+      F r = 0;
+      switch (op) {
+        case operator_kind::add:
+          r = a + b;
+          break;
+        case operator_kind::sub:
+          r = a - b;
+          break;
+        case operator_kind::mul:
+          r = a * b;
+          break;
+        case operator_kind::div:
+          r = a / b;
+          break;
+        case operator_kind::mod:
+          r = std::fmod(a, b);
+          break;
+        case operator_kind::pow:
+          r = std::pow(a, b);
+          break;
+        case operator_kind::lt:
+          result = constant::of_bool(a < b);
+          return eval_status::ok;
+        case operator_kind::gt:
+          result = constant::of_bool(a > b);
+          return eval_status::ok;
+        case operator_kind::le:
+          result = constant::of_bool(a <= b);
+          return eval_status::ok;
+        case operator_kind::ge:
+          result = constant::of_bool(a >= b);
+          return eval_status::ok;
+        case operator_kind::eq:
+          result = constant::of_bool(a == b);
+          return eval_status::ok;
+        case operator_kind::ne:
+          result = constant::of_bool(a != b);
+          return eval_status::ok;
+        default:
+          return eval_status::not_constant;
+      }
+      result = constant::of_float(r, extended);
+      return eval_status::ok;
+    }
+
+    eval_status evaluate_bool(operator_kind op, bool a, bool b,
+                              constant &result) {
+      switch (op) {
+        case operator_kind::log_and:
+        case operator_kind::bit_and:
+          result = constant::of_bool(a && b);
+          return eval_status::ok;
+        case operator_kind::log_or:
+        case operator_kind::bit_or:
+          result = constant::of_bool(a || b);
+          return eval_status::ok;
+        case operator_kind::bit_xor:
+        case operator_kind::ne:
+          result = constant::of_bool(a != b);
+          return eval_status::ok;
+        case operator_kind::eq:
+          result = constant::of_bool(a == b);
+          return eval_status::ok;
+        default:
+          return eval_status::not_constant;
+      }
+    }
+
+  } // namespace
+
+  eval_status evaluate(operator_kind op, constant const &operand,
+                       constant &result) {
+    switch (operand.kind) {
+      case constant::kind::integer:
+        switch (op) {
+          case operator_kind::pos:
+            result = operand;
+            return eval_status::ok;
+          case operator_kind::neg: {
+            std::int64_t r;
+            if (__builtin_sub_overflow(std::int64_t{0}, operand.i, &r)) {
+              return eval_status::overflow;
+            }
+            result = constant::of_int(r);
+            return eval_status::ok;
+          }
+          case operator_kind::bit_not:
+            result = constant::of_int(~operand.i);
+            return eval_status::ok;
+          default:
+            return eval_status::not_constant;
+        }
+      case constant::kind::floating:
+        switch (op) {
+          case operator_kind::pos:
+            result = operand;
+            return eval_status::ok;
+          case operator_kind::neg:
+            result = constant::of_float(-operand.f, operand.extended);
+            return eval_status::ok;
+          default:
+            return eval_status::not_constant;
+        }
+      case constant::kind::boolean:
+        if (op == operator_kind::log_not) {
+          result = constant::of_bool(!operand.b);
+          return eval_status::ok;
+        }
+        return eval_status::not_constant;
+      case constant::kind::none:
+        break;
+    }
+    return eval_status::not_constant;
+  }
+
+  eval_status evaluate(operator_kind op, constant const &lhs,
+                       constant const &rhs, constant &result) {
+    if (lhs.kind != rhs.kind) {
+      return eval_status::not_constant;
+    }
+    switch (lhs.kind) {
+      case constant::kind::integer:
+        return evaluate_int(op, lhs.i, rhs.i, result);
+      case constant::kind::floating:
+        if (lhs.extended || rhs.extended) {
+          return evaluate_float<long double>(op, lhs.f, rhs.f, true, result);
+        }
+        return evaluate_float<double>(op, static_cast<double>(lhs.f),
+                                      static_cast<double>(rhs.f), false,
+                                      result);
+      case constant::kind::boolean:
+        return evaluate_bool(op, lhs.b, rhs.b, result);
+      case constant::kind::none:
+        break;
+    }
+    return eval_status::not_constant;
+  }
+
+} // namespace soda
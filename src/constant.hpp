@@ -0,0 +1,78 @@
+#pragma once
+
+#include "operators.hpp"
+
+#include <cstdint>
+#include <string_view>
+
+namespace soda {
+
+  //
+  // Compile-time values and the arithmetic on them
+  //
+  // Integers are 64-bit two's complement. Overflow, division by zero and out
+  // of range shift counts are reported instead of wrapping, so that folding
+  // never changes what a program means. Floats are computed in double
+  // precision unless an operand carries extended precision, matching what
+  // the float_expr nodes can hold.
+  //
+
+  struct constant {
+    enum class kind {
+      none,
+      boolean,
+      integer,
+      floating,
+    };
+
+    enum kind kind = kind::none;
+    bool extended = false;
+    bool b = false;
+    std::int64_t i = 0;
+    long double f = 0;
+
+    static constant of_bool(bool value) {
+      constant c;
+      c.kind = kind::boolean;
+      c.b = value;
+      return c;
+    }
+
+    static constant of_int(std::int64_t value) {
+      constant c;
+      c.kind = kind::integer;
+      c.i = value;
+      return c;
+    }
+
+    static constant of_float(long double value, bool extended = false) {
+      constant c;
+      c.kind = kind::floating;
+      c.f = extended ? value : static_cast<double>(value);
+      c.extended = extended;
+      return c;
+    }
+  };
+
+  enum class eval_status {
+    ok,
+    // the operator does not apply to these operands at compile time
+    not_constant,
+    overflow,
+    division_by_zero,
+    shift_out_of_range,
+    negative_exponent,
+    // compile-time function evaluation gave up
+    step_limit,
+    memory_limit,
+    depth_limit,
+  };
+
+  std::string_view to_string(eval_status status);
+
+  eval_status evaluate(operator_kind op, constant const &operand,
+                       constant &result);
+  eval_status evaluate(operator_kind op, constant const &lhs,
+                       constant const &rhs, constant &result);
+
+} // namespace soda
@@ -0,0 +1,586 @@
+#include "ctfe.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <functional>
+
+namespace soda {
+
+  namespace {
+
+    // what a variable of a frame costs, with its share of the map
+    constexpr std::size_t variable_cost =
+        sizeof(ast::decl const *) + sizeof(constant) + 2 * sizeof(void *);
+
+    bool same(constant const &a, constant const &b) {
+      if (a.kind != b.kind || a.extended != b.extended) {
+        return false;
+      }
+      switch (a.kind) {
+        case constant::kind::boolean:
+          return a.b == b.b;
+        case constant::kind::integer:
+          return a.i == b.i;
+        case constant::kind::floating:
+          // -0.0 and 0.0 are different arguments; all NaNs are the same
+          return (a.f == b.f && std::signbit(a.f) == std::signbit(b.f)) ||
+                 (std::isnan(a.f) && std::isnan(b.f));
+        case constant::kind::none:
+          break;
+      }
+      return true;
+    }
+
+    std::size_t hash(constant const &c) {
+      switch (c.kind) {
+        case constant::kind::boolean:
+          return c.b;
+        case constant::kind::integer:
+          return std::hash<std::int64_t>{}(c.i);
+        case constant::kind::floating:
+          return std::isnan(c.f) ? 0
+                                 : std::hash<std::uint64_t>{}(
+                                       std::bit_cast<std::uint64_t>(
+                                           static_cast<double>(c.f)));
+        case constant::kind::none:
+          break;
+      }
+      return 0;
+    }
+
+    bool as_constant(ast::expr const &e, constant &c) {
+      switch (e.kind) {
+        case ast::node_kind::bool_expr:
+          c = constant::of_bool(static_cast<ast::bool_expr const &>(e).value);
+          return true;
+        case ast::node_kind::int_expr:
+          c = constant::of_int(static_cast<std::int64_t>(
+              static_cast<ast::int_expr const &>(e).value));
+          return true;
+        case ast::node_kind::float_expr: {
+          auto const &f = static_cast<ast::float_expr const &>(e);
+          c = constant::of_float(f.precise_value(), f.extended != nullptr);
+          return true;
+        }
+        default:
+          return false;
+      }
+    }
+
+    // Whether a failure only comes from the budget of the evaluation, so
+    // that the same call may still succeed on its own.
+    bool is_limit(eval_status status) {
+      return status == eval_status::step_limit ||
+             status == eval_status::memory_limit ||
+             status == eval_status::depth_limit;
+    }
+
+  } // namespace
+
+  bool evaluator::call_key::operator==(call_key const &other) const noexcept {
+    return f == other.f && std::ranges::equal(args, other.args, same);
+  }
+
+  std::size_t
+  evaluator::call_key_hash::operator()(call_key const &k) const noexcept {
+    auto h = std::hash<void const *>{}(k.f);
+    for (auto const &arg : k.args) {
+      h = h * 31 + hash(arg);
+    }
+    return h;
+  }
+
+  eval_status evaluator::call(ast::fun_decl const &f,
+                              std::span<constant const> args,
+                              constant &result) {
+    if (frames_.empty()) {
+      steps_ = 0;
+      memory_ = 0;
+    }
+    return enter(f, args, result);
+  }
+
+  eval_status evaluator::step() {
+    stats_.steps++;
+    return ++steps_ > limits_.steps ? eval_status::step_limit
+                                    : eval_status::ok;
+  }
+
+  eval_status evaluator::enter(ast::fun_decl const &f,
+                               std::span<constant const> args,
+                               constant &result) {
+    stats_.calls++;
+    // a body that is not loaded has not been checked either
+    if (!f.is_loaded() || !f.canonical || f.params.size() != args.size()) {
+      return eval_status::not_constant;
+    }
+    call_key key{&f, {args.begin(), args.end()}};
+    if (auto it = memo_.find(key); it != memo_.end()) {
+      stats_.memoized++;
+      result = it->second.result;
+      return it->second.status;
+    }
+    if (frames_.size() >= limits_.depth) {
+      return eval_status::depth_limit;
+    }
+
+    frames_.emplace_back();
+    memory_ += sizeof(frame);
+    auto status = memory_ + memo_memory_ > limits_.memory
+                      ? eval_status::memory_limit
+                      : eval_status::ok;
+    for (std::size_t k = 0; k < args.size() && status == eval_status::ok;
+         k++) {
+      status = define(*f.params[k], args[k]);
+    }
+    auto next = flow::next;
+    if (status == eval_status::ok) {
+      status = execute(f.stmts(), next);
+    }
+    if (status == eval_status::ok) {
+      if (next == flow::return_) {
+        result = returned_;
+      } else if (f.canonical->inner->kind == type_kind::void_type) {
+        result = constant{};
+      } else {
+        // falling off the end of a function with a result
+        status = eval_status::not_constant;
+      }
+    }
+    memory_ -= sizeof(frame) + frames_.back().vars.size() * variable_cost;
+    frames_.pop_back();
+
+    if (!is_limit(status)) {
+      auto cost = sizeof(call_key) + sizeof(memo) + 2 * sizeof(void *) +
+                  args.size() * sizeof(constant);
+      // forget everything rather than keep a table over the limit
+      if (memo_memory_ + cost > limits_.memory / 2) {
+        memo_.clear();
+        memo_memory_ = 0;
+      }
+      memo_.emplace(std::move(key), memo{status, result});
+      memo_memory_ += cost;
+    }
+    return status;
+  }
+
+  eval_status evaluator::define(ast::decl const &d, constant const &value) {
+    auto inserted = frames_.back().vars.insert_or_assign(&d, value).second;
+    if (inserted) {
+      memory_ += variable_cost;
+      if (memory_ + memo_memory_ > limits_.memory) {
+        return eval_status::memory_limit;
+      }
+    }
+    return eval_status::ok;
+  }
+
+  // The variable of the current frame that e names, if it is one. Nested
+  // calls add frames, so the pointer is only good until the next value.
+  constant *evaluator::variable(ast::expr const &e) {
+    if (e.kind != ast::node_kind::ident_expr || frames_.empty()) {
+      return nullptr;
+    }
+    auto &vars = frames_.back().vars;
+    auto it = vars.find(static_cast<ast::ident_expr const &>(e).ref);
+    return it != vars.end() ? &it->second : nullptr;
+  }
+
+  //
+  // Expressions
+  //
+
+  eval_status evaluator::value(ast::expr const &e, constant &result) {
+    if (auto status = step(); status != eval_status::ok) {
+      return status;
+    }
+    switch (e.kind) {
+      case ast::node_kind::bool_expr:
+      case ast::node_kind::int_expr:
+      case ast::node_kind::float_expr:
+        as_constant(e, result);
+        return eval_status::ok;
+      case ast::node_kind::ident_expr: {
+        // globals and functions are not in the frame
+        auto v = variable(e);
+        if (!v || v->kind == constant::kind::none) {
+          return eval_status::not_constant;
+        }
+        result = *v;
+        return eval_status::ok;
+      }
+      case ast::node_kind::unop_expr:
+        return unop(static_cast<ast::unop_expr const &>(e), result);
+      case ast::node_kind::binop_expr:
+        return binop(static_cast<ast::binop_expr const &>(e), result);
+      case ast::node_kind::if_expr: {
+        auto const &n = static_cast<ast::if_expr const &>(e);
+        bool cond;
+        if (auto status = condition(*n.cond, cond);
+            status != eval_status::ok) {
+          return status;
+        }
+        return value(cond ? *n.cons : *n.altn, result);
+      }
+      case ast::node_kind::call_expr:
+        return call(static_cast<ast::call_expr const &>(e), result);
+      default:
+        return eval_status::not_constant;
+    }
+  }
+
+  eval_status evaluator::unop(ast::unop_expr const &n, constant &result) {
+    switch (n.op) {
+      case operator_kind::pre_inc:
+      case operator_kind::pre_dec:
+      case operator_kind::post_inc:
+      case operator_kind::post_dec: {
+        auto v = variable(*n.operand);
+        if (!v || v->kind == constant::kind::none) {
+          return eval_status::not_constant;
+        }
+        auto one = v->kind == constant::kind::floating
+                       ? constant::of_float(1, v->extended)
+                       : constant::of_int(1);
+        auto inc =
+            n.op == operator_kind::pre_inc || n.op == operator_kind::post_inc;
+        constant updated;
+        if (auto status =
+                evaluate(inc ? operator_kind::add : operator_kind::sub, *v,
+                         one, updated);
+            status != eval_status::ok) {
+          return status;
+        }
+        result = n.op == operator_kind::pre_inc ||
+                         n.op == operator_kind::pre_dec
+                     ? updated
+                     : *v;
+        *v = updated;
+        return eval_status::ok;
+      }
+      default: {
+        constant operand;
+        if (auto status = value(*n.operand, operand);
+            status != eval_status::ok) {
+          return status;
+        }
+        return evaluate(n.op, operand, result);
+      }
+    }
+  }
+
+  eval_status evaluator::binop(ast::binop_expr const &n, constant &result) {
+    constant lhs, rhs;
+    switch (n.op) {
+      case operator_kind::assign: {
+        if (auto status = value(*n.rhs, rhs); status != eval_status::ok) {
+          return status;
+        }
+        auto v = variable(*n.lhs);
+        if (!v) {
+          return eval_status::not_constant;
+        }
+        result = *v = rhs;
+        return eval_status::ok;
+      }
+      case operator_kind::add_assign:
+      case operator_kind::sub_assign:
+      case operator_kind::mul_assign:
+      case operator_kind::div_assign:
+      case operator_kind::mod_assign:
+      case operator_kind::and_assign:
+      case operator_kind::xor_assign:
+      case operator_kind::or_assign:
+      case operator_kind::lshift_assign:
+      case operator_kind::rshift_assign: {
+        // the old value is read before the right operand runs
+        auto v = variable(*n.lhs);
+        if (!v || v->kind == constant::kind::none) {
+          return eval_status::not_constant;
+        }
+        lhs = *v;
+        if (auto status = value(*n.rhs, rhs); status != eval_status::ok) {
+          return status;
+        }
+        if (auto status =
+                evaluate(assignment_operator(n.op), lhs, rhs, result);
+            status != eval_status::ok) {
+          return status;
+        }
+        *variable(*n.lhs) = result;
+        return eval_status::ok;
+      }
+      case operator_kind::log_and:
+      case operator_kind::log_or: {
+        if (auto status = value(*n.lhs, lhs); status != eval_status::ok) {
+          return status;
+        }
+        if (lhs.kind != constant::kind::boolean) {
+          return eval_status::not_constant;
+        }
+        // the left operand is the result when it decides
+        if (lhs.b == (n.op == operator_kind::log_or)) {
+          result = lhs;
+          return eval_status::ok;
+        }
+        return value(*n.rhs, result);
+      }
+      case operator_kind::comma:
+        if (auto status = value(*n.lhs, lhs); status != eval_status::ok) {
+          return status;
+        }
+        return value(*n.rhs, result);
+      case operator_kind::member:
+      case operator_kind::index:
+        return eval_status::not_constant;
+      default:
+        if (auto status = value(*n.lhs, lhs); status != eval_status::ok) {
+          return status;
+        }
+        if (auto status = value(*n.rhs, rhs); status != eval_status::ok) {
+          return status;
+        }
+        return evaluate(n.op, lhs, rhs, result);
+    }
+  }
+
+  eval_status evaluator::call(ast::call_expr const &n, constant &result) {
+    if (n.callee->kind != ast::node_kind::ident_expr) {
+      return eval_status::not_constant;
+    }
+    auto ref = static_cast<ast::ident_expr const &>(*n.callee).ref;
+    if (!ref || ref->kind != ast::node_kind::fun_decl) {
+      return eval_status::not_constant;
+    }
+    std::vector<constant> args(n.arguments.size());
+    for (std::size_t k = 0; k < args.size(); k++) {
+      if (auto status = value(*n.arguments[k], args[k]);
+          status != eval_status::ok) {
+        return status;
+      }
+    }
+    return enter(static_cast<ast::fun_decl const &>(*ref), args, result);
+  }
+
+  eval_status evaluator::condition(ast::expr const &e, bool &result) {
+    constant c;
+    if (auto status = value(e, c); status != eval_status::ok) {
+      return status;
+    }
+    if (c.kind != constant::kind::boolean) {
+      return eval_status::not_constant;
+    }
+    result = c.b;
+    return eval_status::ok;
+  }
+
+  //
+  // Statements
+  //
+
+  eval_status evaluator::execute(ast::stmt::list const &stmts, flow &next) {
+    for (auto const &s : stmts) {
+      if (auto status = execute(s.get(), next); status != eval_status::ok) {
+        return status;
+      }
+      if (next != flow::next) {
+        break;
+      }
+    }
+    return eval_status::ok;
+  }
+
+  // Whether a loop stops after its body left by next, which goes on after
+  // the loop when it was the loop that was broken out of or continued.
+  bool evaluator::leaves(ast::stmt const &loop, flow &next) const {
+    switch (next) {
+      case flow::next:
+        return false;
+      case flow::continue_:
+      case flow::break_:
+        if (target_ != &loop) {
+          return true;
+        }
+        {
+          auto broken = next == flow::break_;
+          next = flow::next;
+          return broken;
+        }
+      case flow::return_:
+        break;
+    }
+    return true;
+  }
+
+  eval_status evaluator::execute(ast::stmt const *s, flow &next) {
+    next = flow::next;
+    if (!s) {
+      return eval_status::ok;
+    }
+    if (auto status = step(); status != eval_status::ok) {
+      return status;
+    }
+    auto status = eval_status::ok;
+    switch (s->kind) {
+      case ast::node_kind::empty_stmt:
+      case ast::node_kind::fun_decl:
+      case ast::node_kind::type_decl:
+        return eval_status::ok;
+      case ast::node_kind::expr_stmt: {
+        constant ignored;
+        return value(*static_cast<ast::expr_stmt const &>(*s).exp, ignored);
+      }
+      case ast::node_kind::let_decl: {
+        auto const &d = static_cast<ast::let_decl const &>(*s);
+        // a variable without an initializer is undefined until assigned
+        constant init;
+        if (d.init_exp) {
+          status = value(*d.init_exp, init);
+        }
+        return status == eval_status::ok ? define(d, init) : status;
+      }
+      case ast::node_kind::block_stmt:
+        return execute(static_cast<ast::block_stmt const &>(*s).stmts, next);
+      case ast::node_kind::label_stmt:
+        return execute(static_cast<ast::label_stmt const &>(*s).stmt.get(),
+                       next);
+      case ast::node_kind::break_stmt:
+        target_ = static_cast<ast::break_stmt const &>(*s).target;
+        next = flow::break_;
+        return eval_status::ok;
+      case ast::node_kind::continue_stmt:
+        target_ = static_cast<ast::continue_stmt const &>(*s).target;
+        next = flow::continue_;
+        return eval_status::ok;
+      case ast::node_kind::return_stmt: {
+        // nested calls return through returned_ too
+        constant result;
+        if (auto const &exp = static_cast<ast::return_stmt const &>(*s).exp) {
+          status = value(*exp, result);
+        }
+        returned_ = result;
+        next = flow::return_;
+        return status;
+      }
+      case ast::node_kind::if_stmt: {
+        auto const &n = static_cast<ast::if_stmt const &>(*s);
+        bool cond;
+        if (status = condition(*n.cond, cond); status != eval_status::ok) {
+          return status;
+        }
+        return execute(cond ? n.cons.get() : n.altn.get(), next);
+      }
+      case ast::node_kind::switch_stmt:
+        return execute_switch(static_cast<ast::switch_stmt const &>(*s), next);
+      case ast::node_kind::do_stmt: {
+        auto const &n = static_cast<ast::do_stmt const &>(*s);
+        for (auto cond = true; cond;) {
+          if (status = execute(n.stmt.get(), next);
+              status != eval_status::ok || leaves(n, next)) {
+            return status;
+          }
+          if (status = condition(*n.exp, cond); status != eval_status::ok) {
+            return status;
+          }
+        }
+        return eval_status::ok;
+      }
+      case ast::node_kind::while_stmt: {
+        auto const &n = static_cast<ast::while_stmt const &>(*s);
+        for (;;) {
+          bool cond;
+          if (status = condition(*n.exp, cond);
+              status != eval_status::ok || !cond) {
+            return status;
+          }
+          if (status = execute(n.stmt.get(), next);
+              status != eval_status::ok || leaves(n, next)) {
+            return status;
+          }
+        }
+      }
+      case ast::node_kind::for_stmt: {
+        auto const &n = static_cast<ast::for_stmt const &>(*s);
+        if (status = execute(n.init.get(), next); status != eval_status::ok) {
+          return status;
+        }
+        for (;;) {
+          if (n.test && n.test->kind == ast::node_kind::expr_stmt) {
+            bool cond;
+            if (status = condition(
+                    *static_cast<ast::expr_stmt const &>(*n.test).exp, cond);
+                status != eval_status::ok || !cond) {
+              return status;
+            }
+          }
+          if (status = execute(n.stmt.get(), next);
+              status != eval_status::ok || leaves(n, next)) {
+            return status;
+          }
+          if (status = execute(n.incr.get(), next);
+              status != eval_status::ok) {
+            return status;
+          }
+        }
+      }
+      default:
+        // goto, foreach over an array and error nodes
+        return eval_status::not_constant;
+    }
+  }
+
+  // Cases fall through into the next one unless they jump. The case values
+  // are all evaluated, in order, before the one that matches runs.
+  eval_status evaluator::execute_switch(ast::switch_stmt const &n,
+                                        flow &next) {
+    constant subject;
+    if (auto status = value(*n.exp, subject); status != eval_status::ok) {
+      return status;
+    }
+    auto taken = n.cases.size(), fallback = n.cases.size();
+    for (std::size_t k = 0; k < n.cases.size(); k++) {
+      if (n.cases[k]->kind != ast::node_kind::case_stmt) {
+        continue;
+      }
+      auto const &cs = static_cast<ast::case_stmt const &>(*n.cases[k]);
+      if (cs.is_default_case()) {
+        fallback = k;
+        continue;
+      }
+      constant c, equal;
+      if (auto status = value(*cs.exp, c); status != eval_status::ok) {
+        return status;
+      }
+      if (auto status = evaluate(operator_kind::eq, subject, c, equal);
+          status != eval_status::ok) {
+        return status;
+      }
+      if (equal.b && taken == n.cases.size()) {
+        taken = k;
+      }
+    }
+    if (taken == n.cases.size()) {
+      taken = fallback;
+    }
+    for (auto k = taken; k < n.cases.size(); k++) {
+      if (n.cases[k]->kind != ast::node_kind::case_stmt) {
+        continue;
+      }
+      if (auto status = execute(
+              static_cast<ast::case_stmt const &>(*n.cases[k]).stmts, next);
+          status != eval_status::ok) {
+        return status;
+      }
+      if (next == flow::break_ && target_ == &n) {
+        next = flow::next;
+        break;
+      }
+      if (next != flow::next) {
+        break;
+      }
+    }
+    return eval_status::ok;
+  }
+
+} // namespace soda
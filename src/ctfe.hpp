@@ -0,0 +1,117 @@
+#pragma once
+
+#include "ast.hpp"
+#include "constant.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+namespace soda {
+
+  //
+  // Compile-time function evaluation
+  //
+  // Runs calls of functions on constant arguments by walking their checked
+  // bodies, with every operator applied by evaluate, so that a call gives
+  // the value that folding its body by hand would. A function can be run
+  // if everything it does stays in its own frame: bool, int and float
+  // locals and parameters, the statements other than goto and foreach, and
+  // calls of functions that can be run in turn. Globals, chars, strings,
+  // arrays, function values and bodies that are not loaded yet make a call
+  // not constant, and so does reading a variable before it is assigned.
+  //
+  // Evaluation stops at a limit on steps, one per statement and operator,
+  // on the memory of the frames and memoized results, and on the depth of
+  // calls. Results, and failures other than running into a limit, are
+  // memoized by function and arguments.
+  //
+
+  struct ctfe_limits {
+    std::uint64_t steps = std::uint64_t{1} << 20;
+    std::size_t memory = std::size_t{1} << 20;
+    // calls being evaluated at once
+    std::size_t depth = 256;
+  };
+
+  struct ctfe_stats {
+    // calls evaluated, including those in evaluated bodies
+    std::size_t calls = 0;
+    // calls answered by a memoized result
+    std::size_t memoized = 0;
+    std::uint64_t steps = 0;
+  };
+
+  class evaluator {
+  public:
+    explicit evaluator(ctfe_limits const &lim = {}) : limits_{lim} {
+    }
+
+    // Evaluate f on args, leaving what it returns in result, which has no
+    // kind for a function without a result.
+    eval_status call(ast::fun_decl const &f, std::span<constant const> args,
+                     constant &result);
+
+    ctfe_stats const &statistics() const noexcept {
+      return stats_;
+    }
+
+  private:
+    enum class flow {
+      next,
+      break_,
+      continue_,
+      return_,
+    };
+
+    struct frame {
+      std::unordered_map<ast::decl const *, constant> vars;
+    };
+
+    struct call_key {
+      ast::fun_decl const *f;
+      std::vector<constant> args;
+
+      bool operator==(call_key const &other) const noexcept;
+    };
+
+    struct call_key_hash {
+      std::size_t operator()(call_key const &k) const noexcept;
+    };
+
+    struct memo {
+      eval_status status;
+      constant result;
+    };
+
+    ctfe_limits limits_;
+    ctfe_stats stats_;
+    std::unordered_map<call_key, memo, call_key_hash> memo_;
+    std::vector<frame> frames_;
+    // the budget of the outermost call being evaluated
+    std::uint64_t steps_ = 0;
+    std::size_t memory_ = 0;
+    std::size_t memo_memory_ = 0;
+    // where a break or continue goes, and what a return returns
+    ast::stmt const *target_ = nullptr;
+    constant returned_;
+
+    eval_status step();
+    eval_status enter(ast::fun_decl const &f, std::span<constant const> args,
+                      constant &result);
+    eval_status define(ast::decl const &d, constant const &value);
+    eval_status value(ast::expr const &e, constant &result);
+    eval_status unop(ast::unop_expr const &n, constant &result);
+    eval_status binop(ast::binop_expr const &n, constant &result);
+    eval_status call(ast::call_expr const &n, constant &result);
+    constant *variable(ast::expr const &e);
+    eval_status condition(ast::expr const &e, bool &result);
+    eval_status execute(ast::stmt::list const &stmts, flow &next);
+    eval_status execute(ast::stmt const *s, flow &next);
+    eval_status execute_switch(ast::switch_stmt const &n, flow &next);
+    bool leaves(ast::stmt const &loop, flow &next) const;
+  };
+
+} // namespace soda
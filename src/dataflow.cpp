@@ -0,0 +1,83 @@
+#include "dataflow.hpp"
+
+#include <algorithm>
+#include <bit>
+
+namespace soda {
+
+  dataflow_solution solve(dataflow_problem const &problem,
+                          flow_graph const &g, block_order const &order,
+                          block_id entry, block_id exit) {
+    auto forward = problem.direction == flow_direction::forward;
+    auto all = problem.meet == flow_meet::all;
+
+    dataflow_solution s{bit_matrix{g.size(), problem.bits},
+                        bit_matrix{g.size(), problem.bits}, 0};
+    // the side met from the neighbours and the side the transfer produces
+    auto &met = forward ? s.in : s.out;
+    auto &produced = forward ? s.out : s.in;
+    auto boundary_block = forward ? entry : exit;
+
+    std::vector<block_id> sequence = order.rpo;
+    if (!forward) {
+      std::ranges::reverse(sequence);
+    }
+    // an intersection starts out from the full set, so that the first
+    // visit of a loop header does not lose facts from its back edges
+    if (all) {
+      for (auto b : sequence) {
+        fill_bits(produced[b], problem.bits);
+      }
+    }
+
+    // the pending blocks by their position in the sequence; the lowest one
+    // is always evaluated next, so that an inner loop settles before the
+    // blocks after it are revisited
+    std::vector<std::size_t> position(g.size());
+    for (std::size_t i = 0; i < sequence.size(); i++) {
+      position[sequence[i]] = i;
+    }
+    std::vector<bit_word> pending(words_for(sequence.size()));
+    fill_bits(pending, sequence.size());
+    for (std::size_t word = 0; word < pending.size();) {
+      if (!pending[word]) {
+        word++;
+        continue;
+      }
+      auto i = word * bits_per_word + std::countr_zero(pending[word]);
+      reset_bit(pending, i);
+      auto b = sequence[i];
+      s.visits++;
+
+      auto in = met[b];
+      if (b == boundary_block) {
+        std::ranges::copy(problem.boundary, in.begin());
+      } else if (all) {
+        fill_bits(in, problem.bits);
+      } else {
+        std::ranges::fill(in, 0);
+      }
+      for (auto n : forward ? g.preds(b) : g.succs(b)) {
+        if (!order.is_reachable(n)) {
+          continue;
+        }
+        if (all) {
+          intersect(in, produced[n]);
+        } else {
+          unite(in, produced[n]);
+        }
+      }
+
+      if (transfer(produced[b], in, problem.gen[b], problem.kill[b])) {
+        for (auto n : forward ? g.succs(b) : g.preds(b)) {
+          if (order.is_reachable(n)) {
+            set_bit(pending, position[n]);
+            word = std::min(word, position[n] / bits_per_word);
+          }
+        }
+      }
+    }
+    return s;
+  }
+
+} // namespace soda
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "bit_vector.hpp"
+#include "cfg.hpp"
+
+#include <cstddef>
+#include <vector>
+
+namespace soda {
+
+  //
+  // Bit-vector dataflow
+  //
+  // Solves gen/kill problems over a flow graph: every block maps the set
+  // flowing into it to gen | (in & ~kill), and the sets of neighbouring
+  // blocks are combined by union (facts that hold on some path) or
+  // intersection (facts that hold on every path).
+  //
+  // The solver keeps the blocks whose input may have changed in a worklist
+  // ordered by reverse postorder for forward problems and by postorder for
+  // backward ones, and always evaluates the first of them. Most blocks so
+  // see their final input the first time round, and a loop is iterated
+  // until it settles before the blocks after it are evaluated again, which
+  // keeps functions with many loops linear rather than quadratic. Blocks
+  // that are unreachable from the entry are left out.
+  //
+
+  enum class flow_direction {
+    forward,
+    backward,
+  };
+
+  enum class flow_meet {
+    // some path
+    any,
+    // every path
+    all,
+  };
+
+  struct dataflow_problem {
+    flow_direction direction = flow_direction::forward;
+    flow_meet meet = flow_meet::any;
+    std::size_t bits = 0;
+    // one row per block
+    bit_matrix gen;
+    bit_matrix kill;
+    // the set entering the entry block (forward) or leaving the exit block
+    // (backward)
+    std::vector<bit_word> boundary;
+
+    dataflow_problem(flow_direction direction, flow_meet meet,
+                     std::size_t blocks, std::size_t bits)
+        : direction{direction}, meet{meet}, bits{bits}, gen{blocks, bits},
+          kill{blocks, bits}, boundary(words_for(bits)) {
+    }
+  };
+
+  struct dataflow_solution {
+    // the sets at the start and at the end of every block, whatever the
+    // direction of the problem
+    bit_matrix in;
+    bit_matrix out;
+    // blocks evaluated until nothing changed
+    std::size_t visits = 0;
+  };
+
+  dataflow_solution solve(dataflow_problem const &problem,
+                          flow_graph const &g, block_order const &order,
+                          block_id entry, block_id exit);
+
+} // namespace soda
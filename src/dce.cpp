@@ -0,0 +1,52 @@
+#include "backend.hpp"
+#include "optimize.hpp"
+#include "rewrite.hpp"
+
+#include <vector>
+
+namespace soda::ir {
+
+  namespace {
+
+    // Whether v must run even if its value is not used.
+    bool must_run(function const &f, value_id v) {
+      auto op = f.instrs[v].op;
+      return has_effect(op) || is_terminator(op) || may_trap(f, v);
+    }
+
+  } // namespace
+
+  // Marks what the instructions with an effect use, transitively, and
+  // drops the rest, including cycles of phis that only feed each other.
+  void dce(function &f, pass_stats &stats) {
+    std::vector<bool> live(f.size());
+    std::vector<value_id> work;
+    for (value_id v = 0; v < f.size(); v++) {
+      if (must_run(f, v)) {
+        live[v] = true;
+        work.push_back(v);
+      }
+    }
+    while (!work.empty()) {
+      auto v = work.back();
+      work.pop_back();
+      for (auto o : f.operands_of(v)) {
+        if (!live[o]) {
+          live[o] = true;
+          work.push_back(o);
+        }
+      }
+    }
+
+    rewriter rw{f};
+    for (value_id v = 0; v < f.size(); v++) {
+      if (!live[v]) {
+        rw.remove(v);
+      }
+    }
+    auto result = rw.apply();
+    stats.instrs_removed += result.instrs_removed;
+    stats.blocks_removed += result.blocks_removed;
+  }
+
+} // namespace soda::ir
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "parse_error.hpp"
+#include "source_range.hpp"
+
+#include <algorithm>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace soda {
+
+  enum class severity {
+    error,
+    warning,
+  };
+
+  inline std::string_view to_string(severity level) {
+    return level == severity::error ? "error" : "warning";
+  }
+
+  // A message reported by a pass that keeps going, as opposed to parse_error
+  // which is thrown.
+  struct diagnostic {
+    severity level;
+    source_range range;
+    std::string message;
+
+    diagnostic(severity level, source_range range, std::string message)
+        : level{level}, range{std::move(range)}, message{std::move(message)} {
+    }
+
+    explicit diagnostic(parse_error const &e)
+        : level{severity::error}, range{e.range()}, message{e.message()} {
+    }
+  };
+
+  inline std::ostream &operator<<(std::ostream &out, diagnostic const &d) {
+    return out << d.range << ": " << to_string(d.level) << ": " << d.message;
+  }
+
+  using diagnostics = std::vector<diagnostic>;
+
+  inline bool has_errors(diagnostics const &diags) {
+    return std::ranges::any_of(diags, [](diagnostic const &d) {
+      return d.level == severity::error;
+    });
+  }
+
+} // namespace soda
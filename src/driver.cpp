@@ -0,0 +1,102 @@
+#include "driver.hpp"
+
+#include "builder.hpp"
+#include "parser.hpp"
+#include "tokenizer.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iterator>
+#include <span>
+#include <spanstream>
+#include <sstream>
+#include <thread>
+
+namespace soda {
+
+  source_file read_source(std::istream &in, std::filesystem::path fn) {
+    std::stringstream ss;
+    ss << in.rdbuf();
+    return source_file{std::move(fn), std::make_shared<std::string>(ss.str())};
+  }
+
+  source_file read_source(std::filesystem::path const &fn) {
+    std::ifstream in{fn, std::ios::binary};
+    if (!in) {
+      throw parse_error{source_range{fn, {}, {}}, "cannot open file"};
+    }
+    return read_source(in, fn);
+  }
+
+  ast::translation_unit::ptr parse_source(source_file const &src,
+                                          parse_options const &opts,
+                                          diagnostics &diags) {
+    std::ispanstream stream{std::span<char const>{*src.text}};
+    tokenizer tokens{stream, src.fn};
+    auto build = std::make_shared<ast::builder>(opts.hash_consing);
+    parser p{tokens, *build};
+    if (opts.lazy) {
+      p.parse_bodies_lazily(src.text, build);
+    }
+    auto tu = p.parse_translation_unit();
+    std::ranges::move(p.take_diagnostics(), std::back_inserter(diags));
+    return tu;
+  }
+
+  parse_result parse_program(std::vector<std::filesystem::path> const &files,
+                             parse_options const &opts) {
+    std::size_t jobs = opts.jobs ? opts.jobs
+                                 : std::thread::hardware_concurrency();
+    jobs = std::clamp<std::size_t>(jobs, 1,
+                                   std::max<std::size_t>(files.size(), 1));
+
+    struct slot {
+      ast::translation_unit::ptr tu;
+      diagnostics diags;
+    };
+    std::vector<slot> slots(files.size());
+    std::atomic<std::size_t> next{0};
+
+    // workers claim the next unit in input order, so the units in flight are
+    // always a window over the inputs and large files do not serialize behind
+    // a static partition
+    auto work = [&] {
+      for (;;) {
+        auto i = next.fetch_add(1, std::memory_order_relaxed);
+        if (i >= files.size()) {
+          return;
+        }
+        try {
+          slots[i].tu = parse_source(read_source(files[i]), opts,
+                                     slots[i].diags);
+        } catch (parse_error const &e) {
+          slots[i].diags.emplace_back(e);
+        }
+      }
+    };
+
+    if (jobs == 1) {
+      work();
+    } else {
+      std::vector<std::jthread> workers;
+      workers.reserve(jobs);
+      for (std::size_t i = 0; i < jobs; i++) {
+        workers.emplace_back(work);
+      }
+    }
+
+    parse_result result;
+    ast::translation_unit::list tus;
+    tus.reserve(slots.size());
+    for (auto &s : slots) {
+      std::ranges::move(s.diags, std::back_inserter(result.diags));
+      if (s.tu) {
+        tus.push_back(std::move(s.tu));
+      }
+    }
+    result.program = std::make_shared<ast::program>(std::move(tus));
+    return result;
+  }
+
+} // namespace soda
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "ast.hpp"
+#include "diagnostic.hpp"
+
+#include <cstddef>
+#include <filesystem>
+#include <istream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace soda {
+
+  struct source_file {
+    std::filesystem::path fn;
+    std::shared_ptr<std::string const> text;
+  };
+
+  source_file read_source(std::istream &in, std::filesystem::path fn);
+  source_file read_source(std::filesystem::path const &fn);
+
+  struct parse_options {
+    bool hash_consing = false;
+    bool lazy = false;
+    // worker threads, 0 for one per hardware thread; each parses one unit
+    // at a time, so this also bounds the units in flight
+    unsigned jobs = 0;
+  };
+
+  // Parse one file. Syntax errors are appended to diags and the returned
+  // unit contains error nodes in place of the damaged constructs.
+  ast::translation_unit::ptr parse_source(source_file const &src,
+                                          parse_options const &opts,
+                                          diagnostics &diags);
+
+  struct parse_result {
+    ast::node::ptr<ast::program> program;
+    diagnostics diags;
+  };
+
+  // Parse each file into its own translation unit on a pool of workers and
+  // assemble the program in input order. Each unit has its own builder and
+  // literal pool, so workers share no allocation state. Diagnostics are
+  // reported in input order. Units with syntax errors are still part of the
+  // program; only files that cannot be read are left out.
+  parse_result parse_program(std::vector<std::filesystem::path> const &files,
+                             parse_options const &opts);
+
+} // namespace soda
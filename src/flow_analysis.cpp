@@ -0,0 +1,405 @@
+#include "flow_analysis.hpp"
+
+#include "utils.hpp"
+
+#include <algorithm>
+#include <iterator>
+#include <string>
+
+namespace soda {
+
+  //
+  // Events
+  //
+
+  std::uint32_t variable_flow::add_var(ast::decl const *d) {
+    auto [it, inserted] =
+        index_.try_emplace(d, static_cast<std::uint32_t>(vars.size()));
+    if (inserted) {
+      vars.push_back(d);
+    }
+    return it->second;
+  }
+
+  void variable_flow::add_event(enum event::kind kind, std::uint32_t var,
+                                ast::node const *node) {
+    auto def = no_var;
+    if (kind == event::kind::def || kind == event::kind::maybe_def) {
+      def = static_cast<std::uint32_t>(def_vars.size());
+      def_vars.push_back(var);
+    }
+    events_.push_back(event{kind, var, def, node});
+  }
+
+  // An assignment to target, which reads it first for compound assignments
+  // and increments.
+  void variable_flow::collect_store(ast::expr const &target, bool maybe,
+                                    bool reads) {
+    if (target.kind == ast::node_kind::ident_expr) {
+      auto const &n = static_cast<ast::ident_expr const &>(target);
+      auto var = var_of(n.ref);
+      if (var != no_var) {
+        if (reads) {
+          add_event(event::kind::use, var, &n);
+        }
+        add_event(maybe ? event::kind::maybe_def : event::kind::def, var, &n);
+      }
+      return;
+    }
+    // storing into an element reads the array
+    collect(target, maybe);
+  }
+
+  void variable_flow::collect(ast::expr const &e, bool maybe) {
+    switch (e.kind) {
+      case ast::node_kind::ident_expr: {
+        auto const &n = static_cast<ast::ident_expr const &>(e);
+        auto var = var_of(n.ref);
+        if (var != no_var) {
+          add_event(event::kind::use, var, &n);
+        }
+        break;
+      }
+      case ast::node_kind::unop_expr: {
+        auto const &n = static_cast<ast::unop_expr const &>(e);
+        switch (n.op) {
+          case operator_kind::pre_inc:
+          case operator_kind::pre_dec:
+          case operator_kind::post_inc:
+          case operator_kind::post_dec:
+            collect_store(*n.operand, maybe, true);
+            break;
+          default:
+            collect(*n.operand, maybe);
+            break;
+        }
+        break;
+      }
+      case ast::node_kind::binop_expr: {
+        auto const &n = static_cast<ast::binop_expr const &>(e);
+        if (n.op == operator_kind::assign) {
+          collect(*n.rhs, maybe);
+          collect_store(*n.lhs, maybe, false);
+        } else if (is_assignment(n.op)) {
+          // x += y reads x before y
+          if (n.lhs->kind == ast::node_kind::ident_expr) {
+            collect(*n.lhs, maybe);
+            collect(*n.rhs, maybe);
+            collect_store(*n.lhs, maybe, false);
+          } else {
+            collect(*n.lhs, maybe);
+            collect(*n.rhs, maybe);
+          }
+        } else if (n.op == operator_kind::member) {
+          collect(*n.lhs, maybe);
+        } else {
+          collect(*n.lhs, maybe);
+          collect(*n.rhs, maybe || n.op == operator_kind::log_and ||
+                              n.op == operator_kind::log_or);
+        }
+        break;
+      }
+      case ast::node_kind::if_expr: {
+        auto const &n = static_cast<ast::if_expr const &>(e);
+        collect(*n.cond, maybe);
+        collect(*n.cons, true);
+        collect(*n.altn, true);
+        break;
+      }
+      case ast::node_kind::call_expr: {
+        auto const &n = static_cast<ast::call_expr const &>(e);
+        collect(*n.callee, maybe);
+        for (auto const &arg : n.arguments) {
+          collect(*arg, maybe);
+        }
+        break;
+      }
+      default:
+        break;
+    }
+  }
+
+  variable_flow::variable_flow(function_cfg const &cfg)
+      : cfg{cfg}, order{reverse_postorder(cfg.graph, function_cfg::entry)} {
+    for (auto const &p : cfg.fun->params) {
+      add_var(p.get());
+    }
+    params = vars.size();
+    for (std::size_t i = 0; i < params; i++) {
+      def_vars.push_back(static_cast<std::uint32_t>(i));
+    }
+    // locals are numbered before any events are collected, since a goto
+    // can lead to a use before the declaration in block order
+    for (auto item : cfg.items) {
+      if (item->kind == ast::node_kind::let_decl) {
+        add_var(static_cast<ast::decl const *>(item));
+      } else if (item->kind == ast::node_kind::foreach_stmt) {
+        auto const &n = static_cast<ast::foreach_stmt const &>(*item);
+        if (n.iter) {
+          add_var(n.iter.get());
+        }
+      }
+    }
+
+    event_offsets_.reserve(cfg.size() + 1);
+    for (block_id b = 0; b < cfg.size(); b++) {
+      event_offsets_.push_back(static_cast<std::uint32_t>(events_.size()));
+      for (auto item : cfg.items_of(b)) {
+        switch (item->kind) {
+          case ast::node_kind::let_decl: {
+            auto const &d = static_cast<ast::let_decl const &>(*item);
+            auto var = var_of(&d);
+            if (d.init_exp) {
+              collect(*d.init_exp, false);
+              add_event(event::kind::def, var, &d);
+            } else {
+              add_event(event::kind::declare, var, &d);
+            }
+            break;
+          }
+          case ast::node_kind::foreach_stmt: {
+            auto const &n = static_cast<ast::foreach_stmt const &>(*item);
+            if (n.iter) {
+              add_event(event::kind::def, var_of(n.iter.get()), &n);
+            }
+            break;
+          }
+          default:
+            collect(static_cast<ast::expr const &>(*item), false);
+            break;
+        }
+      }
+    }
+    event_offsets_.push_back(static_cast<std::uint32_t>(events_.size()));
+  }
+
+  //
+  // Problems
+  //
+
+  dataflow_solution variable_flow::liveness() const {
+    dataflow_problem p{flow_direction::backward, flow_meet::any, cfg.size(),
+                       vars.size()};
+    for (block_id b = 0; b < cfg.size(); b++) {
+      // used before being redefined in the block
+      auto use = p.gen[b];
+      auto def = p.kill[b];
+      for (auto const &e : events_of(b)) {
+        switch (e.kind) {
+          case event::kind::use:
+            if (!test_bit(def, e.var)) {
+              set_bit(use, e.var);
+            }
+            break;
+          case event::kind::def:
+          case event::kind::declare:
+            set_bit(def, e.var);
+            break;
+          case event::kind::maybe_def:
+            break;
+        }
+      }
+    }
+    return solve(p, cfg.graph, order, function_cfg::entry,
+                 function_cfg::exit);
+  }
+
+  dataflow_solution variable_flow::reaching_definitions() const {
+    dataflow_problem p{flow_direction::forward, flow_meet::any, cfg.size(),
+                       def_vars.size()};
+    bit_matrix defs_of{vars.size(), def_vars.size()};
+    for (std::uint32_t d = 0; d < def_vars.size(); d++) {
+      set_bit(defs_of[def_vars[d]], d);
+    }
+    for (std::size_t d = 0; d < params; d++) {
+      set_bit(p.boundary, d);
+    }
+    for (block_id b = 0; b < cfg.size(); b++) {
+      auto gen = p.gen[b];
+      auto kill = p.kill[b];
+      for (auto const &e : events_of(b)) {
+        switch (e.kind) {
+          case event::kind::def:
+          case event::kind::declare:
+            subtract(gen, defs_of[e.var]);
+            unite(kill, defs_of[e.var]);
+            if (e.kind == event::kind::def) {
+              set_bit(gen, e.def);
+            }
+            break;
+          case event::kind::maybe_def:
+            set_bit(gen, e.def);
+            break;
+          case event::kind::use:
+            break;
+        }
+      }
+    }
+    return solve(p, cfg.graph, order, function_cfg::entry,
+                 function_cfg::exit);
+  }
+
+  dataflow_solution variable_flow::definite_assignment() const {
+    dataflow_problem p{flow_direction::forward, flow_meet::all, cfg.size(),
+                       vars.size()};
+    for (std::size_t v = 0; v < params; v++) {
+      set_bit(p.boundary, v);
+    }
+    for (block_id b = 0; b < cfg.size(); b++) {
+      auto gen = p.gen[b];
+      auto kill = p.kill[b];
+      for (auto const &e : events_of(b)) {
+        switch (e.kind) {
+          case event::kind::def:
+            set_bit(gen, e.var);
+            reset_bit(kill, e.var);
+            break;
+          case event::kind::declare:
+            reset_bit(gen, e.var);
+            set_bit(kill, e.var);
+            break;
+          case event::kind::use:
+          case event::kind::maybe_def:
+            break;
+        }
+      }
+    }
+    return solve(p, cfg.graph, order, function_cfg::entry,
+                 function_cfg::exit);
+  }
+
+  //
+  // Diagnostics
+  //
+
+  namespace {
+
+    void warn(diagnostics &diags, source_range const &range,
+              std::string message) {
+      diags.emplace_back(severity::warning, range, std::move(message));
+    }
+
+    // Replay each reachable block from the variables definitely assigned on
+    // entry, and warn about the first use of each variable that is not.
+    void check_assignment(variable_flow const &flow,
+                          dataflow_solution const &assigned,
+                          diagnostics &diags) {
+      std::vector<bit_word> current(words_for(flow.vars.size()));
+      std::vector<bit_word> reported(words_for(flow.vars.size()));
+      for (auto b : flow.order.rpo) {
+        std::ranges::copy(assigned.in[b], current.begin());
+        for (auto const &e : flow.events_of(b)) {
+          switch (e.kind) {
+            case variable_flow::event::kind::use:
+              if (!test_bit(current, e.var) && !test_bit(reported, e.var)) {
+                warn(diags, e.node->range,
+                     quote(flow.vars[e.var]->name) +
+                         " may be used before it is assigned");
+                set_bit(reported, e.var);
+              }
+              break;
+            case variable_flow::event::kind::def:
+              set_bit(current, e.var);
+              break;
+            case variable_flow::event::kind::declare:
+              reset_bit(current, e.var);
+              break;
+            case variable_flow::event::kind::maybe_def:
+              break;
+          }
+        }
+      }
+    }
+
+    source_range const &first_code(function_cfg const &cfg, block_id b) {
+      auto items = cfg.items_of(b);
+      return items.empty() ? cfg.blocks[b].terminator->range
+                           : items.front()->range;
+    }
+
+    // Warn once per unreachable region, at its first statement in source
+    // order, rather than at every block of it.
+    void check_reachability(function_cfg const &cfg, block_order const &order,
+                            diagnostics &diags) {
+      std::vector<block_id> dead;
+      for (block_id b = 0; b < cfg.size(); b++) {
+        if (!order.is_reachable(b) &&
+            (cfg.blocks[b].count || cfg.blocks[b].terminator)) {
+          dead.push_back(b);
+        }
+      }
+      if (dead.empty()) {
+        return;
+      }
+      std::ranges::sort(dead, {}, [&](block_id b) {
+        return first_code(cfg, b).start.offset;
+      });
+      std::vector<bool> covered(cfg.size());
+      std::vector<block_id> stack;
+      for (auto b : dead) {
+        if (covered[b]) {
+          continue;
+        }
+        warn(diags, first_code(cfg, b), "unreachable code");
+        covered[b] = true;
+        stack.push_back(b);
+        while (!stack.empty()) {
+          auto c = stack.back();
+          stack.pop_back();
+          for (auto s : cfg.graph.succs(c)) {
+            if (!covered[s] && !order.is_reachable(s)) {
+              covered[s] = true;
+              stack.push_back(s);
+            }
+          }
+        }
+      }
+    }
+
+    // Warn if a function that returns a value can fall off the end of its
+    // body, where it would return nothing, at the last statement.
+    void check_return(function_cfg const &cfg, block_order const &order,
+                      diagnostics &diags) {
+      auto const &f = *cfg.fun;
+      if (f.canonical->inner->kind == type_kind::void_type ||
+          cfg.end == no_block || !order.is_reachable(cfg.end)) {
+        return;
+      }
+      auto const &stmts = f.stmts();
+      warn(diags, stmts.empty() ? f.range : stmts.back()->range,
+           quote(f.name) + " can end without returning a value");
+    }
+
+  } // namespace
+
+  flow_stats check_flow(ast::program const &prog, diagnostics &diags) {
+    flow_stats stats;
+    for (auto const &tu : prog.tus) {
+      // each check warns in an order of its own
+      diagnostics warnings;
+      for (auto const &d : tu->decls) {
+        if (d->kind != ast::node_kind::fun_decl) {
+          continue;
+        }
+        auto cfg = build_cfg(static_cast<ast::fun_decl const &>(*d));
+        variable_flow flow{cfg};
+        auto assigned = flow.definite_assignment();
+        check_reachability(cfg, flow.order, warnings);
+        check_assignment(flow, assigned, warnings);
+        check_return(cfg, flow.order, warnings);
+
+        stats.functions++;
+        stats.blocks += cfg.size();
+        stats.variables += flow.vars.size();
+        stats.definitions += flow.def_vars.size();
+        stats.visits += assigned.visits;
+      }
+      std::ranges::stable_sort(warnings, {}, [](diagnostic const &d) {
+        return d.range.start.offset;
+      });
+      std::ranges::move(warnings, std::back_inserter(diags));
+    }
+    return stats;
+  }
+
+} // namespace soda
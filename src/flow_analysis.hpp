@@ -0,0 +1,104 @@
+#pragma once
+
+#include "ast.hpp"
+#include "cfg.hpp"
+#include "dataflow.hpp"
+#include "diagnostic.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+namespace soda {
+
+  //
+  // Variable dataflow of a function
+  //
+  // The local variables of a function (its parameters, lets and foreach
+  // variables) are numbered densely, parameters first, and every block's
+  // items are reduced to a sequence of events on them in evaluation order.
+  // Assignments on the right of && and || and in the branches of ?: are
+  // only possible definitions: they reach later uses but do not replace
+  // earlier definitions, and they do not make a variable definitely
+  // assigned.
+  //
+  // From the events, the usual three problems are set up and solved:
+  // liveness of variables (backward, any path), reaching definitions
+  // (forward, any path; the parameters count as defined on entry) and
+  // definite assignment (forward, every path).
+  //
+
+  class variable_flow {
+  public:
+    struct event {
+      enum class kind : std::uint8_t {
+        use,
+        def,
+        maybe_def,
+        // a let without initializer, which leaves the variable unassigned
+        declare,
+      };
+
+      enum kind kind;
+      std::uint32_t var;
+      // the definition, for def and maybe_def
+      std::uint32_t def;
+      ast::node const *node;
+    };
+
+    explicit variable_flow(function_cfg const &cfg);
+
+    function_cfg const &cfg;
+    block_order order;
+    std::vector<ast::decl const *> vars;
+    std::size_t params = 0;
+    // the variable of every definition; parameters are defined first
+    std::vector<std::uint32_t> def_vars;
+
+    static constexpr std::uint32_t no_var = ~std::uint32_t{0};
+
+    // The number of a local variable, or no_var for anything else.
+    std::uint32_t var_of(ast::decl const *d) const {
+      auto it = index_.find(d);
+      return it == index_.end() ? no_var : it->second;
+    }
+
+    std::span<event const> events_of(block_id b) const noexcept {
+      return {events_.data() + event_offsets_[b],
+              events_.data() + event_offsets_[b + 1]};
+    }
+
+    dataflow_solution liveness() const;
+    dataflow_solution reaching_definitions() const;
+    dataflow_solution definite_assignment() const;
+
+  private:
+    std::unordered_map<ast::decl const *, std::uint32_t> index_;
+    std::vector<event> events_;
+    std::vector<std::uint32_t> event_offsets_;
+
+    std::uint32_t add_var(ast::decl const *d);
+    void add_event(enum event::kind kind, std::uint32_t var,
+                   ast::node const *node);
+    void collect(ast::expr const &e, bool maybe);
+    void collect_store(ast::expr const &target, bool maybe, bool reads);
+  };
+
+  struct flow_stats {
+    std::size_t functions = 0;
+    std::size_t blocks = 0;
+    std::size_t variables = 0;
+    std::size_t definitions = 0;
+    // blocks evaluated by the solver over all problems
+    std::size_t visits = 0;
+  };
+
+  // Warn about variables that may be used before they are assigned, about
+  // unreachable code, e.g. after a return or goto, and about functions
+  // returning a value that can end without one. The warnings of each
+  // translation unit come in source order.
+  flow_stats check_flow(ast::program const &prog, diagnostics &diags);
+
+} // namespace soda
@@ -0,0 +1,330 @@
+#include "fold.hpp"
+
+#include "constant.hpp"
+#include "ctfe.hpp"
+#include "literal_pool.hpp"
+
+#include <memory>
+#include <vector>
+
+namespace soda {
+
+  namespace {
+
+    class folder {
+    public:
+      folder(literal_pool &pool, diagnostics &diags)
+          : pool_{pool}, diags_{diags} {
+      }
+
+      fold_stats const &statistics() const noexcept {
+        return stats_;
+      }
+
+      void fold(ast::decl &d, bool global = false);
+      void fold(ast::stmt::ptr &s);
+      void fold(ast::stmt::list &stmts);
+      void fold(ast::expr::ptr &e);
+
+    private:
+      literal_pool &pool_;
+      diagnostics &diags_;
+      fold_stats stats_;
+      evaluator ctfe_;
+      // where calls are evaluated: nowhere, in initializers and case
+      // values, or in the initializers of globals, whose failures are
+      // reported
+      enum class context {
+        code,
+        initializer,
+        constant,
+      } context_ = context::code;
+
+      static bool as_constant(ast::expr const &e, constant &c);
+      ast::expr::ptr make_literal(source_range range, constant const &c);
+      ast::expr::ptr make_untyped_literal(source_range range,
+                                          constant const &c);
+      void replace(ast::expr::ptr &e, ast::expr::ptr with);
+      void evaluate_call(ast::expr::ptr &e);
+      void fold_in(context c, ast::expr::ptr &e);
+      void report(ast::expr const &e, eval_status status);
+    };
+
+    bool folder::as_constant(ast::expr const &e, constant &c) {
+      switch (e.kind) {
+        case ast::node_kind::bool_expr:
+          c = constant::of_bool(static_cast<ast::bool_expr const &>(e).value);
+          return true;
+        case ast::node_kind::int_expr:
+          c = constant::of_int(static_cast<std::int64_t>(
+              static_cast<ast::int_expr const &>(e).value));
+          return true;
+        case ast::node_kind::float_expr: {
+          auto const &f = static_cast<ast::float_expr const &>(e);
+          c = constant::of_float(f.precise_value(), f.extended != nullptr);
+          return true;
+        }
+        default:
+          return false;
+      }
+    }
+
+    ast::expr::ptr folder::make_literal(source_range range,
+                                        constant const &c) {
+      auto literal = make_untyped_literal(std::move(range), c);
+      if (literal) {
+        literal->set_type(type_table::primitive(
+            c.kind == constant::kind::boolean   ? type_kind::bool_type
+            : c.kind == constant::kind::integer ? type_kind::int_type
+                                                : type_kind::float_type));
+      }
+      return literal;
+    }
+
+    ast::expr::ptr folder::make_untyped_literal(source_range range,
+                                                constant const &c) {
+      switch (c.kind) {
+        case constant::kind::boolean:
+          return std::make_shared<ast::bool_expr>(std::move(range), c.b);
+        case constant::kind::integer:
+          return std::make_shared<ast::int_expr>(
+              std::move(range), static_cast<std::uint64_t>(c.i));
+        case constant::kind::floating: {
+          auto narrow = static_cast<double>(c.f);
+          // results only stay extended when a double cannot hold them
+          auto extended = c.extended && static_cast<long double>(narrow) != c.f
+                              ? pool_.intern_extended(c.f)
+                              : nullptr;
+          return std::make_shared<ast::float_expr>(std::move(range), narrow,
+                                                   extended);
+        }
+        case constant::kind::none:
+          break;
+      }
+      return nullptr;
+    }
+
+    void folder::replace(ast::expr::ptr &e, ast::expr::ptr with) {
+      e = std::move(with);
+      stats_.folded++;
+    }
+
+    void folder::evaluate_call(ast::expr::ptr &e) {
+      auto &n = static_cast<ast::call_expr &>(*e);
+      if (n.callee->kind != ast::node_kind::ident_expr) {
+        return;
+      }
+      auto ref = static_cast<ast::ident_expr &>(*n.callee).ref;
+      if (!ref || ref->kind != ast::node_kind::fun_decl) {
+        return;
+      }
+      std::vector<constant> args(n.arguments.size());
+      for (std::size_t k = 0; k < args.size(); k++) {
+        if (!as_constant(*n.arguments[k], args[k])) {
+          return;
+        }
+      }
+      constant result;
+      auto status =
+          ctfe_.call(static_cast<ast::fun_decl &>(*ref), args, result);
+      if (status == eval_status::ok) {
+        if (result.kind != constant::kind::none) {
+          replace(e, make_literal(n.range, result));
+          stats_.evaluated++;
+        }
+      } else if (status != eval_status::not_constant &&
+                 context_ == context::constant) {
+        report(n, status);
+      }
+    }
+
+    void folder::fold_in(context c, ast::expr::ptr &e) {
+      auto outer = context_;
+      context_ = c;
+      fold(e);
+      context_ = outer;
+    }
+
+    void folder::report(ast::expr const &e, eval_status status) {
+      diags_.emplace_back(severity::error, e.range,
+                          std::string{to_string(status)});
+    }
+
+    void folder::fold(ast::expr::ptr &e) {
+      if (!e) {
+        return;
+      }
+      switch (e->kind) {
+        case ast::node_kind::unop_expr: {
+          auto &n = static_cast<ast::unop_expr &>(*e);
+          fold(n.operand);
+          constant operand, result;
+          if (!as_constant(*n.operand, operand)) {
+            break;
+          }
+          auto status = evaluate(n.op, operand, result);
+          if (status == eval_status::ok) {
+            replace(e, make_literal(n.range, result));
+          } else if (status != eval_status::not_constant) {
+            report(n, status);
+          }
+          break;
+        }
+        case ast::node_kind::binop_expr: {
+          auto &n = static_cast<ast::binop_expr &>(*e);
+          fold(n.lhs);
+          constant lhs, rhs, result;
+          auto lhs_constant = as_constant(*n.lhs, lhs);
+          // false && x and true || x do not evaluate x
+          if (lhs_constant && lhs.kind == constant::kind::boolean &&
+              ((n.op == operator_kind::log_and && !lhs.b) ||
+               (n.op == operator_kind::log_or && lhs.b))) {
+            replace(e, make_literal(n.range, lhs));
+            break;
+          }
+          fold(n.rhs);
+          if (!lhs_constant || !as_constant(*n.rhs, rhs)) {
+            break;
+          }
+          auto status = evaluate(n.op, lhs, rhs, result);
+          if (status == eval_status::ok) {
+            replace(e, make_literal(n.range, result));
+          } else if (status != eval_status::not_constant) {
+            report(n, status);
+          }
+          break;
+        }
+        case ast::node_kind::if_expr: {
+          auto &n = static_cast<ast::if_expr &>(*e);
+          fold(n.cond);
+          constant cond;
+          if (as_constant(*n.cond, cond) &&
+              cond.kind == constant::kind::boolean) {
+            auto taken = cond.b ? n.cons : n.altn;
+            fold(taken);
+            replace(e, std::move(taken));
+            break;
+          }
+          fold(n.cons);
+          fold(n.altn);
+          break;
+        }
+        case ast::node_kind::call_expr: {
+          auto &n = static_cast<ast::call_expr &>(*e);
+          fold(n.callee);
+          for (auto &arg : n.arguments) {
+            fold(arg);
+          }
+          if (context_ != context::code) {
+            evaluate_call(e);
+          }
+          break;
+        }
+        default:
+          break;
+      }
+    }
+
+    void folder::fold(ast::stmt::list &stmts) {
+      for (auto &s : stmts) {
+        fold(s);
+      }
+    }
+
+    void folder::fold(ast::stmt::ptr &s) {
+      if (!s) {
+        return;
+      }
+      switch (s->kind) {
+        case ast::node_kind::expr_stmt:
+          fold(static_cast<ast::expr_stmt &>(*s).exp);
+          break;
+        case ast::node_kind::block_stmt:
+          fold(static_cast<ast::block_stmt &>(*s).stmts);
+          break;
+        case ast::node_kind::label_stmt:
+          fold(static_cast<ast::label_stmt &>(*s).stmt);
+          break;
+        case ast::node_kind::return_stmt:
+          fold(static_cast<ast::return_stmt &>(*s).exp);
+          break;
+        case ast::node_kind::if_stmt: {
+          auto &n = static_cast<ast::if_stmt &>(*s);
+          fold(n.cond);
+          fold(n.cons);
+          fold(n.altn);
+          break;
+        }
+        case ast::node_kind::switch_stmt: {
+          auto &n = static_cast<ast::switch_stmt &>(*s);
+          fold(n.exp);
+          fold(n.cases);
+          break;
+        }
+        case ast::node_kind::case_stmt: {
+          auto &n = static_cast<ast::case_stmt &>(*s);
+          fold_in(context::initializer, n.exp);
+          fold(n.stmts);
+          break;
+        }
+        case ast::node_kind::do_stmt: {
+          auto &n = static_cast<ast::do_stmt &>(*s);
+          fold(n.stmt);
+          fold(n.exp);
+          break;
+        }
+        case ast::node_kind::while_stmt: {
+          auto &n = static_cast<ast::while_stmt &>(*s);
+          fold(n.exp);
+          fold(n.stmt);
+          break;
+        }
+        case ast::node_kind::for_stmt: {
+          auto &n = static_cast<ast::for_stmt &>(*s);
+          fold(n.init);
+          fold(n.test);
+          fold(n.incr);
+          fold(n.stmt);
+          break;
+        }
+        case ast::node_kind::foreach_stmt: {
+          auto &n = static_cast<ast::foreach_stmt &>(*s);
+          fold(n.exp);
+          fold(n.stmt);
+          break;
+        }
+        case ast::node_kind::let_decl:
+        case ast::node_kind::fun_decl:
+          fold(static_cast<ast::decl &>(*s));
+          break;
+        default:
+          break;
+      }
+    }
+
+    void folder::fold(ast::decl &d, bool global) {
+      if (d.kind == ast::node_kind::let_decl) {
+        fold_in(global ? context::constant : context::initializer,
+                static_cast<ast::let_decl &>(d).init_exp);
+      } else if (d.kind == ast::node_kind::fun_decl) {
+        auto &f = static_cast<ast::fun_decl &>(d);
+        if (f.is_loaded()) {
+          fold(f.stmts());
+        }
+      }
+    }
+
+  } // namespace
+
+  fold_stats fold_constants(ast::translation_unit &tu, diagnostics &diags) {
+    if (!tu.literals) {
+      tu.literals = std::make_shared<literal_pool>();
+    }
+    folder f{*tu.literals, diags};
+    for (auto &d : tu.decls) {
+      f.fold(*d, true);
+    }
+    return f.statistics();
+  }
+
+} // namespace soda
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "ast.hpp"
+#include "diagnostic.hpp"
+
+#include <cstddef>
+
+namespace soda {
+
+  //
+  // Constant folding
+  //
+  // Evaluates unop_expr, binop_expr and if_expr nodes whose operands are
+  // bool, int or float literals and replaces them in place with the
+  // resulting literal, bottom-up, so whole constant subtrees collapse into
+  // one node. The untaken branch of a constant if_expr, && or || is dropped
+  // without being folded, mirroring its run-time evaluation.
+  //
+  // Calls of functions on constant arguments in the initializers of lets
+  // and in case values are run at compile time (see ctfe.hpp) and replaced
+  // by what they return.
+  //
+  // Expressions that would overflow, divide by zero or shift out of range
+  // are reported as errors and left as they are, and so are calls in the
+  // initializers of globals that fail in the same ways or run into a limit
+  // of the evaluation. Function bodies that have not been loaded yet are
+  // skipped.
+  //
+
+  struct fold_stats {
+    // operator nodes replaced by a literal or a branch
+    std::size_t folded = 0;
+    // of those, calls replaced by what they return
+    std::size_t evaluated = 0;
+  };
+
+  fold_stats fold_constants(ast::translation_unit &tu, diagnostics &diags);
+
+} // namespace soda
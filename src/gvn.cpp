@@ -0,0 +1,245 @@
+#include "optimize.hpp"
+#include "rewrite.hpp"
+
+#include <bit>
+#include <utility>
+#include <vector>
+
+namespace soda::ir {
+
+  namespace {
+
+    // Whether two instructions of the same operands compute the same value.
+    // Loads and indexing read memory that stores and calls change, and two
+    // undefined values need not be equal.
+    bool is_pure(opcode op) {
+      switch (op) {
+        case opcode::neg:
+        case opcode::bit_not:
+        case opcode::log_not:
+        case opcode::add:
+        case opcode::sub:
+        case opcode::mul:
+        case opcode::div:
+        case opcode::mod:
+        case opcode::pow:
+        case opcode::bit_and:
+        case opcode::bit_xor:
+        case opcode::bit_or:
+        case opcode::lt:
+        case opcode::gt:
+        case opcode::le:
+        case opcode::ge:
+        case opcode::eq:
+        case opcode::ne:
+        case opcode::lshift:
+        case opcode::rshift:
+        case opcode::constant:
+        case opcode::function:
+        case opcode::length:
+        case opcode::mul_high:
+        case opcode::phi:
+          return true;
+        default:
+          return false;
+      }
+    }
+
+    bool is_commutative(opcode op) {
+      switch (op) {
+        case opcode::add:
+        case opcode::mul:
+        case opcode::bit_and:
+        case opcode::bit_xor:
+        case opcode::bit_or:
+        case opcode::eq:
+        case opcode::ne:
+        case opcode::mul_high:
+          return true;
+        default:
+          return false;
+      }
+    }
+
+    class numbering {
+    public:
+      explicit numbering(function &f)
+          : f_{f}, rw_{f}, block_of_{blocks_of(f)}, leader_(f.size()),
+            slots_(std::bit_ceil(2 * f.size() + 2), no_value) {
+        for (value_id v = 0; v < f.size(); v++) {
+          leader_[v] = v;
+        }
+      }
+
+      void run(pass_stats &stats);
+
+    private:
+      function &f_;
+      rewriter rw_;
+      std::vector<block_id> block_of_;
+      // the value that each value was found equal to, or itself
+      std::vector<value_id> leader_;
+      // an open-addressing set of the values available in the block being
+      // visited, hashed by what they compute
+      std::vector<value_id> slots_;
+      // the slots filled, in order, to empty them when leaving a subtree
+      std::vector<std::size_t> filled_;
+
+      std::size_t mask() const noexcept {
+        return slots_.size() - 1;
+      }
+
+      // The operands of v as their leaders, ordered if v commutes.
+      std::pair<value_id, value_id> pair_of(value_id v) const {
+        auto ops = f_.operands_of(v);
+        auto a = ops.size() > 0 ? leader_[ops[0]] : no_value;
+        auto b = ops.size() > 1 ? leader_[ops[1]] : no_value;
+        if (is_commutative(f_.instrs[v].op) && b < a) {
+          std::swap(a, b);
+        }
+        return {a, b};
+      }
+
+      std::size_t hash(value_id v) const;
+      bool equal(value_id v, value_id w) const;
+      value_id find_or_insert(value_id v);
+      value_id simplify_phi(value_id v) const;
+    };
+
+    std::size_t numbering::hash(value_id v) const {
+      auto const &i = f_.instrs[v];
+      std::uint64_t h =
+          static_cast<std::uint64_t>(i.op) * 0x9e3779b97f4a7c15ull;
+      auto mix = [&](std::uint64_t x) {
+        h = (h ^ x) * 0xff51afd7ed558ccdull;
+        h ^= h >> 29;
+      };
+      mix(reinterpret_cast<std::uintptr_t>(i.type));
+      mix(i.imm);
+      if (i.op == opcode::phi) {
+        mix(block_of_[v]);
+        for (auto o : f_.operands_of(v)) {
+          mix(leader_[o]);
+        }
+      } else {
+        auto [a, b] = pair_of(v);
+        mix(a);
+        mix(b);
+      }
+      return static_cast<std::size_t>(h);
+    }
+
+    bool numbering::equal(value_id v, value_id w) const {
+      auto const &i = f_.instrs[v];
+      auto const &j = f_.instrs[w];
+      if (i.op != j.op || i.type != j.type || i.imm != j.imm ||
+          i.count != j.count) {
+        return false;
+      }
+      if (i.op == opcode::phi) {
+        if (block_of_[v] != block_of_[w]) {
+          return false;
+        }
+        auto a = f_.operands_of(v);
+        auto b = f_.operands_of(w);
+        for (std::size_t k = 0; k < a.size(); k++) {
+          if (leader_[a[k]] != leader_[b[k]]) {
+            return false;
+          }
+        }
+        return true;
+      }
+      return pair_of(v) == pair_of(w);
+    }
+
+    value_id numbering::find_or_insert(value_id v) {
+      for (auto s = hash(v) & mask();; s = (s + 1) & mask()) {
+        if (slots_[s] == no_value) {
+          slots_[s] = v;
+          filled_.push_back(s);
+          return v;
+        }
+        if (equal(v, slots_[s])) {
+          return slots_[s];
+        }
+      }
+    }
+
+    // The value all operands of a phi other than itself are equal to, or
+    // no_value.
+    value_id numbering::simplify_phi(value_id v) const {
+      auto same = no_value;
+      for (auto o : f_.operands_of(v)) {
+        auto l = leader_[o];
+        if (l == v || l == same) {
+          continue;
+        }
+        if (same != no_value) {
+          return no_value;
+        }
+        same = l;
+      }
+      return same;
+    }
+
+    // Values are numbered in a preorder walk of the dominator tree, and
+    // the set of available values is unwound on the way back up, so a value
+    // is only ever replaced by one that dominates it. Each block's entries
+    // were added after those of its dominators, and removing them in
+    // reverse restores the probe sequences exactly.
+    void numbering::run(pass_stats &stats) {
+      auto order = reverse_postorder(f_.graph, 0);
+      dominator_tree dom{f_.graph, order};
+      // blocks on the path from the entry with the next child to visit and
+      // the number of slots filled before entering them
+      struct frame {
+        block_id b;
+        std::uint32_t next;
+        std::size_t filled;
+      };
+      std::vector<frame> stack;
+      auto enter = [&](block_id b) {
+        stack.push_back({b, 0, filled_.size()});
+        for (auto v : f_.values_of(b)) {
+          auto op = f_.instrs[v].op;
+          if (!is_pure(op)) {
+            continue;
+          }
+          auto by = op == opcode::phi ? simplify_phi(v) : no_value;
+          if (by == no_value) {
+            by = find_or_insert(v);
+          }
+          if (by != v) {
+            leader_[v] = by;
+            rw_.replace(v, by);
+            stats.values_replaced++;
+          }
+        }
+      };
+      enter(0);
+      while (!stack.empty()) {
+        auto &top = stack.back();
+        auto children = dom.children(top.b);
+        if (top.next < children.size()) {
+          enter(children[top.next++]);
+          continue;
+        }
+        while (filled_.size() > top.filled) {
+          slots_[filled_.back()] = no_value;
+          filled_.pop_back();
+        }
+        stack.pop_back();
+      }
+
+      auto result = rw_.apply();
+      stats.instrs_removed += result.instrs_removed;
+      stats.blocks_removed += result.blocks_removed;
+    }
+
+  } // namespace
+
+  void gvn(function &f, pass_stats &stats) {
+    numbering{f}.run(stats);
+  }
+
+} // namespace soda::ir
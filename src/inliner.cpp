@@ -0,0 +1,403 @@
+#include "optimize.hpp"
+#include "rewrite.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace soda::ir {
+
+  namespace {
+
+    block_id block_containing(function const &f, value_id v) {
+      auto it = std::ranges::upper_bound(f.blocks, v, {}, &block::first);
+      return static_cast<block_id>(it - f.blocks.begin() - 1);
+    }
+
+  } // namespace
+
+  // The callee's blocks go between the part of the caller's block before
+  // the call and a new block with the rest, which takes over the block's
+  // successors. Every block that follows moves up by the same amount, so
+  // the predecessors of every block stay sorted and phis need no change
+  // but for the new block replacing the old one among their predecessors.
+  void inline_call(function &caller, value_id call, function const &callee) {
+    auto b = block_containing(caller, call);
+    auto args = caller.operands_of(call).subspan(1);
+    auto m = static_cast<block_id>(callee.blocks.size());
+    auto cont = b + m + 1;
+    auto block_map = [&](block_id x) { return x <= b ? x : x + m + 1; };
+
+    std::vector<block_id> rets;
+    for (block_id y = 0; y < m; y++) {
+      if (callee.instrs[callee.terminator(y)].op == opcode::ret) {
+        rets.push_back(y);
+      }
+    }
+    assert(!rets.empty() && "inlining a function that does not return");
+    bool has_result = caller.instrs[call].type->kind != type_kind::void_type;
+    bool merge = has_result && rets.size() > 1;
+
+    // Number the callee's values after the jump that replaces the call;
+    // its parameters are the arguments.
+    std::vector<value_id> callee_ids(callee.size());
+    auto next = call + 1;
+    for (value_id y = 0; y < callee.size(); y++) {
+      auto const &i = callee.instrs[y];
+      callee_ids[y] = i.op == opcode::param ? args[i.imm] : next++;
+    }
+    auto copied = next - (call + 1);
+    auto shift = copied + (merge ? 1 : 0);
+    auto result = no_value;
+    if (merge) {
+      result = next;
+    } else if (has_result) {
+      result = callee_ids[callee.operands_of(callee.terminator(rets[0]))[0]];
+    }
+    auto value_map = [&](value_id x) {
+      if (x < call) {
+        return x;
+      }
+      assert(x != call || result != no_value);
+      return x == call ? result : x + shift;
+    };
+
+    // symbols and strings of the callee, added to the caller's
+    std::vector<std::uint32_t> symbol_ids(callee.symbols.size());
+    for (std::size_t k = 0; k < callee.symbols.size(); k++) {
+      auto it = std::ranges::find(caller.symbols, callee.symbols[k]);
+      symbol_ids[k] = static_cast<std::uint32_t>(it - caller.symbols.begin());
+      if (it == caller.symbols.end()) {
+        caller.symbols.push_back(callee.symbols[k]);
+      }
+    }
+    auto string_base = caller.strings.size();
+    caller.strings.insert(caller.strings.end(), callee.strings.begin(),
+                          callee.strings.end());
+
+    function f;
+    f.fun = caller.fun;
+    f.instrs.reserve(caller.size() + shift);
+    f.operands.reserve(caller.operands.size() + callee.operands.size());
+    auto emit_caller = [&](value_id x) {
+      auto i = caller.instrs[x];
+      auto ops = caller.operands_of(x);
+      i.first = static_cast<std::uint32_t>(f.operands.size());
+      for (auto o : ops) {
+        f.operands.push_back(value_map(o));
+      }
+      f.instrs.push_back(i);
+    };
+    auto close_block = [&](std::uint32_t first) {
+      f.blocks.push_back(
+          block{first, static_cast<std::uint32_t>(f.instrs.size()) - first});
+    };
+    auto void_type = type_table::primitive(type_kind::void_type);
+
+    for (block_id x = 0; x < b; x++) {
+      auto first = static_cast<std::uint32_t>(f.instrs.size());
+      for (auto v : caller.values_of(x)) {
+        emit_caller(v);
+      }
+      close_block(first);
+    }
+    {
+      auto first = static_cast<std::uint32_t>(f.instrs.size());
+      for (auto v = caller.blocks[b].first; v < call; v++) {
+        emit_caller(v);
+      }
+      f.instrs.push_back(instr{opcode::jump,
+                               static_cast<std::uint32_t>(f.operands.size()),
+                               0, void_type, 0});
+      close_block(first);
+    }
+    for (block_id y = 0; y < m; y++) {
+      auto first = static_cast<std::uint32_t>(f.instrs.size());
+      for (auto v : callee.values_of(y)) {
+        auto i = callee.instrs[v];
+        if (i.op == opcode::param) {
+          continue;
+        }
+        auto ops = callee.operands_of(v);
+        i.first = static_cast<std::uint32_t>(f.operands.size());
+        if (i.op == opcode::ret) {
+          i.op = opcode::jump;
+          i.count = 0;
+        } else {
+          for (auto o : ops) {
+            f.operands.push_back(callee_ids[o]);
+          }
+        }
+        if (i.op == opcode::load_global || i.op == opcode::store_global ||
+            i.op == opcode::function) {
+          i.imm = symbol_ids[i.imm];
+        } else if (i.op == opcode::constant &&
+                   i.type->kind == type_kind::string_type) {
+          i.imm += string_base;
+        }
+        f.instrs.push_back(i);
+      }
+      close_block(first);
+    }
+    {
+      auto first = static_cast<std::uint32_t>(f.instrs.size());
+      if (merge) {
+        auto i = instr{opcode::phi,
+                       static_cast<std::uint32_t>(f.operands.size()),
+                       static_cast<std::uint32_t>(rets.size()),
+                       caller.instrs[call].type, 0};
+        for (auto y : rets) {
+          f.operands.push_back(
+              callee_ids[callee.operands_of(callee.terminator(y))[0]]);
+        }
+        f.instrs.push_back(i);
+      }
+      auto const &blk = caller.blocks[b];
+      for (auto v = call + 1; v < blk.first + blk.count; v++) {
+        emit_caller(v);
+      }
+      close_block(first);
+    }
+    for (block_id x = b + 1; x < caller.blocks.size(); x++) {
+      auto first = static_cast<std::uint32_t>(f.instrs.size());
+      for (auto v : caller.values_of(x)) {
+        emit_caller(v);
+      }
+      close_block(first);
+    }
+
+    std::vector<flow_graph::edge> edges;
+    edges.reserve(caller.graph.edge_count() + callee.graph.edge_count() + 1 +
+                  rets.size());
+    auto caller_edges = [&](block_id x, block_id from) {
+      for (auto s : caller.graph.succs(x)) {
+        edges.emplace_back(from, block_map(s));
+      }
+    };
+    for (block_id x = 0; x < b; x++) {
+      caller_edges(x, x);
+    }
+    edges.emplace_back(b, b + 1);
+    for (block_id y = 0; y < m; y++) {
+      for (auto s : callee.graph.succs(y)) {
+        edges.emplace_back(b + 1 + y, b + 1 + s);
+      }
+      if (callee.instrs[callee.terminator(y)].op == opcode::ret) {
+        edges.emplace_back(b + 1 + y, cont);
+      }
+    }
+    caller_edges(b, cont);
+    for (block_id x = b + 1; x < caller.blocks.size(); x++) {
+      caller_edges(x, block_map(x));
+    }
+
+    f.graph = flow_graph{f.blocks.size(), edges};
+    f.symbols = std::move(caller.symbols);
+    f.strings = std::move(caller.strings);
+    caller = std::move(f);
+  }
+
+  namespace {
+
+    class inliner {
+    public:
+      inliner(std::span<function> funs, int level, optimize_stats &stats,
+              inline_options const &opts, diagnostics *verify)
+          : funs_{funs}, level_{level}, stats_{stats},
+            istats_{stats.inlining}, opts_{opts}, verify_{verify} {
+      }
+
+      void run();
+
+    private:
+      std::span<function> funs_;
+      int level_;
+      optimize_stats &stats_;
+      inline_stats &istats_;
+      inline_options const &opts_;
+      diagnostics *verify_;
+      std::unordered_map<ast::decl const *, std::uint32_t> index_;
+      // the strongly connected component of each function, numbered
+      // callees first
+      std::vector<std::uint32_t> scc_of_;
+      std::vector<std::vector<std::uint32_t>> sccs_;
+
+      // The function called directly by call, or funs_.size().
+      std::uint32_t callee_of(function const &f, value_id call) const {
+        auto target = f.operands_of(call)[0];
+        if (f.instrs[target].op != opcode::function) {
+          return static_cast<std::uint32_t>(funs_.size());
+        }
+        auto it = index_.find(f.symbols[f.instrs[target].imm]);
+        return it == index_.end() ? static_cast<std::uint32_t>(funs_.size())
+                                  : it->second;
+      }
+
+      void find_sccs();
+      std::size_t cost(function const &caller, value_id call,
+                       function const &callee) const;
+      void inline_into(std::uint32_t f);
+    };
+
+    // Tarjan's algorithm with an explicit stack; it completes a component
+    // only after every component it calls into, which is the order to
+    // inline in.
+    void inliner::find_sccs() {
+      auto n = static_cast<std::uint32_t>(funs_.size());
+      std::vector<std::vector<std::uint32_t>> callees(n);
+      for (std::uint32_t f = 0; f < n; f++) {
+        for (value_id v = 0; v < funs_[f].size(); v++) {
+          if (funs_[f].instrs[v].op == opcode::call) {
+            if (auto g = callee_of(funs_[f], v); g < n) {
+              callees[f].push_back(g);
+            }
+          }
+        }
+      }
+
+      constexpr auto none = std::numeric_limits<std::uint32_t>::max();
+      std::vector<std::uint32_t> index(n, none), low(n);
+      std::vector<bool> on_stack(n);
+      std::vector<std::uint32_t> stack;
+      std::vector<std::pair<std::uint32_t, std::uint32_t>> path;
+      std::uint32_t clock = 0;
+      scc_of_.assign(n, none);
+      for (std::uint32_t root = 0; root < n; root++) {
+        if (index[root] != none) {
+          continue;
+        }
+        auto visit = [&](std::uint32_t f) {
+          index[f] = low[f] = clock++;
+          stack.push_back(f);
+          on_stack[f] = true;
+          path.emplace_back(f, 0);
+        };
+        visit(root);
+        while (!path.empty()) {
+          auto [f, next] = path.back();
+          if (next < callees[f].size()) {
+            path.back().second++;
+            auto g = callees[f][next];
+            if (index[g] == none) {
+              visit(g);
+            } else if (on_stack[g]) {
+              low[f] = std::min(low[f], index[g]);
+            }
+            continue;
+          }
+          path.pop_back();
+          if (!path.empty()) {
+            auto parent = path.back().first;
+            low[parent] = std::min(low[parent], low[f]);
+          }
+          if (low[f] == index[f]) {
+            auto id = static_cast<std::uint32_t>(sccs_.size());
+            auto &scc = sccs_.emplace_back();
+            std::uint32_t g;
+            do {
+              g = stack.back();
+              stack.pop_back();
+              on_stack[g] = false;
+              scc_of_[g] = id;
+              scc.push_back(g);
+            } while (g != f);
+          }
+        }
+      }
+    }
+
+    std::size_t inliner::cost(function const &caller, value_id call,
+                              function const &callee) const {
+      auto args = caller.operands_of(call).subspan(1);
+      std::size_t size = 0, saved = 1 + args.size();
+      for (value_id y = 0; y < callee.size(); y++) {
+        auto const &i = callee.instrs[y];
+        if (i.op != opcode::param) {
+          size++;
+          continue;
+        }
+        if (caller.instrs[args[i.imm]].op == opcode::constant) {
+          // each use of a constant parameter may fold
+          saved += std::ranges::count(callee.operands, y);
+        }
+      }
+      return size > saved ? size - saved : 0;
+    }
+
+    void inliner::inline_into(std::uint32_t fi) {
+      auto &f = funs_[fi];
+      auto n = static_cast<std::uint32_t>(funs_.size());
+      auto budget = opts_.growth * f.size() + opts_.threshold;
+
+      // Calls are inlined last to first: the blocks and values before a
+      // call keep their numbers, and so do the loop depths of the blocks.
+      auto order = reverse_postorder(f.graph, 0);
+      dominator_tree dom{f.graph, order};
+      loop_forest loops{f.graph, order, dom};
+      std::vector<value_id> calls;
+      for (value_id v = 0; v < f.size(); v++) {
+        if (f.instrs[v].op == opcode::call && callee_of(f, v) < n) {
+          calls.push_back(v);
+        }
+      }
+      istats_.calls += calls.size();
+      for (auto call = calls.rbegin(); call != calls.rend(); ++call) {
+        auto g = callee_of(f, *call);
+        if (scc_of_[g] == scc_of_[fi]) {
+          istats_.recursive++;
+          continue;
+        }
+        auto const &callee = funs_[g];
+        bool returns = std::ranges::any_of(callee.blocks, [&](block const &b) {
+          return callee.instrs[b.first + b.count - 1].op == opcode::ret;
+        });
+        auto threshold = opts_.threshold;
+        if (loops.depth(block_containing(f, *call))) {
+          threshold *= opts_.loop_factor;
+        }
+        auto c = cost(f, *call, callee);
+        if (!returns || c > threshold || f.size() + c > budget) {
+          continue;
+        }
+        inline_call(f, *call, callee);
+        istats_.inlined++;
+      }
+    }
+
+    void inliner::run() {
+      for (std::uint32_t f = 0; f < funs_.size(); f++) {
+        index_.emplace(funs_[f].fun, f);
+        istats_.instrs_before += funs_[f].size();
+      }
+      find_sccs();
+      for (auto const &scc : sccs_) {
+        for (auto f : scc) {
+          auto t0 = std::chrono::steady_clock::now();
+          inline_into(f);
+          istats_.time += std::chrono::steady_clock::now() - t0;
+          if (verify_ && !verify_after("inlining", funs_[f], *verify_)) {
+            optimize(funs_[f], level_, stats_);
+          } else {
+            optimize(funs_[f], level_, stats_, verify_);
+          }
+          istats_.instrs_after += funs_[f].size();
+        }
+      }
+    }
+
+  } // namespace
+
+  void optimize(std::span<function> funs, int level, optimize_stats &stats,
+                inline_options const &opts, diagnostics *verify) {
+    if (level < max_opt_level) {
+      for (auto &f : funs) {
+        optimize(f, level, stats, verify);
+      }
+      return;
+    }
+    inliner{funs, level, stats, opts, verify}.run();
+  }
+
+} // namespace soda::ir
@@ -0,0 +1,547 @@
+#include "ir.hpp"
+
+#include "switch_lowering.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <string>
+
+namespace soda::ir {
+
+  std::string_view to_string(opcode op) {
+    if (op < opcode::param) {
+      return soda::to_string(static_cast<operator_kind>(op));
+    }
+    switch (op) {
+      case opcode::param:
+        return "param";
+      case opcode::constant:
+        return "constant";
+      case opcode::undef:
+        return "undef";
+      case opcode::load_global:
+        return "load_global";
+      case opcode::store_global:
+        return "store_global";
+      case opcode::function:
+        return "function";
+      case opcode::length:
+        return "length";
+      case opcode::store_index:
+        return "store_index";
+      case opcode::mul_high:
+        return "mul_high";
+      case opcode::phi:
+        return "phi";
+      case opcode::jump:
+        return "jump";
+      case opcode::branch:
+        return "branch";
+      case opcode::switch_:
+        return "switch";
+      case opcode::ret:
+        return "ret";
+      default:
+        unreachable();
+    }
+  }
+
+  //
+  // Dump
+  //
+
+  namespace {
+
+    void dump_constant(std::ostream &out, function const &f, instr const &i) {
+      switch (i.type->kind) {
+        case type_kind::bool_type:
+          out << (i.imm ? "true" : "false");
+          break;
+        case type_kind::int_type:
+          out << int_value(i);
+          break;
+        case type_kind::float_type:
+          out << std::setprecision(17) << float_value(i);
+          break;
+        case type_kind::char_type:
+          if (i.imm >= 0x20 && i.imm < 0x7f && i.imm != '\'' &&
+              i.imm != '\\') {
+            out << '\'' << static_cast<char>(i.imm) << '\'';
+          } else {
+            out << "U+" << std::hex << std::uppercase << std::setw(4)
+                << std::setfill('0') << i.imm << std::dec << std::setfill(' ');
+          }
+          break;
+        case type_kind::string_type:
+          out << '"';
+          for (unsigned char c : f.strings[i.imm]) {
+            if (c == '"' || c == '\\') {
+              out << '\\' << c;
+            } else if (c < 0x20 || c == 0x7f) {
+              out << "\\x" << std::hex << std::setw(2) << std::setfill('0')
+                  << static_cast<int>(c) << std::dec << std::setfill(' ');
+            } else {
+              out << c;
+            }
+          }
+          out << '"';
+          break;
+        default:
+          out << i.imm;
+          break;
+      }
+    }
+
+    void dump_instr(std::ostream &out, function const &f, block_id b,
+                    value_id v) {
+      auto const &i = f.instrs[v];
+      auto ops = f.operands_of(v);
+      auto succs = f.graph.succs(b);
+      out << "  ";
+      if (i.type->kind != type_kind::void_type) {
+        out << '%' << v << " = ";
+      }
+      out << i.op;
+      if (i.type->kind != type_kind::void_type) {
+        out << ' ' << *i.type;
+      }
+
+      auto sep = " ";
+      auto operand = [&](value_id o) {
+        out << sep << '%' << o;
+        sep = ", ";
+      };
+      switch (i.op) {
+        case opcode::param:
+          out << ' ' << i.imm;
+          break;
+        case opcode::constant:
+          out << ' ';
+          dump_constant(out, f, i);
+          break;
+        case opcode::load_global:
+        case opcode::function:
+          out << " @" << f.symbols[i.imm]->name;
+          break;
+        case opcode::store_global:
+          out << " @" << f.symbols[i.imm]->name << ", %" << ops[0];
+          break;
+        case opcode::phi: {
+          auto preds = f.graph.preds(b);
+          for (std::size_t k = 0; k < ops.size(); k++) {
+            out << sep << "[%" << ops[k] << ", bb" << preds[k] << ']';
+            sep = ", ";
+          }
+          break;
+        }
+        case opcode::index:
+          operand(ops[0]);
+          operand(ops[1]);
+          if (i.imm) {
+            out << " ; in bounds";
+          }
+          break;
+        case opcode::jump:
+          out << " bb" << succs[0];
+          break;
+        case opcode::branch:
+          operand(ops[0]);
+          out << ", bb" << succs[0] << ", bb" << succs[1];
+          break;
+        case opcode::switch_:
+          operand(ops[0]);
+          for (std::size_t k = 1; k < ops.size(); k++) {
+            out << ", [%" << ops[k] << ", bb" << succs[k - 1] << ']';
+          }
+          out << ", default bb" << succs.back();
+          if (switch_plan plan; plan_switch(f, b, plan)) {
+            out << " ; ";
+            dump(out, plan);
+          }
+          break;
+        default:
+          for (auto o : ops) {
+            operand(o);
+          }
+          break;
+      }
+      out << '\n';
+    }
+
+  } // namespace
+
+  std::size_t edge_index(function const &f, block_id b, std::size_t k) {
+    auto succs = f.graph.succs(b);
+    auto s = succs[k];
+    auto nth = std::count(succs.begin(), succs.begin() + k, s);
+    auto preds = f.graph.preds(s);
+    std::size_t j = 0;
+    for (; preds[j] != b || nth--; j++) {
+    }
+    return j;
+  }
+
+  void dump(std::ostream &out, function const &f) {
+    out << "fun " << f.fun->name << ": " << *f.fun->canonical << '\n';
+    for (block_id b = 0; b < f.blocks.size(); b++) {
+      out << "bb" << b << ':';
+      if (!f.graph.preds(b).empty()) {
+        out << " preds";
+        for (auto p : f.graph.preds(b)) {
+          out << " bb" << p;
+        }
+      }
+      out << '\n';
+      for (auto v : f.values_of(b)) {
+        dump_instr(out, f, b, v);
+      }
+    }
+  }
+
+  //
+  // Verifier
+  //
+
+  namespace {
+
+    class verifier {
+    public:
+      verifier(function const &f, diagnostics &diags)
+          : f_{f}, diags_{diags} {
+      }
+
+      bool run();
+
+    private:
+      function const &f_;
+      diagnostics &diags_;
+      bool ok_ = true;
+      std::vector<block_id> block_of_;
+
+      void fail(std::string const &message) {
+        diags_.emplace_back(severity::error, f_.fun->range,
+                            "invalid IR in " + quote(f_.fun->name) + ": " +
+                                message);
+        ok_ = false;
+      }
+
+      void fail(value_id v, std::string const &message) {
+        fail('%' + std::to_string(v) + " (" + std::string{to_string(
+                                                  f_.instrs[v].op)} +
+             "): " + message);
+      }
+
+      soda::type const *type_of(value_id v) const {
+        return f_.instrs[v].type;
+      }
+
+      bool check_layout();
+      void check_operands(block_id b, value_id v,
+                          dominator_tree const &dom);
+      void check_types(block_id b, value_id v);
+      void expect(value_id v, bool condition, char const *message) {
+        if (!condition) {
+          fail(v, message);
+        }
+      }
+    };
+
+    bool verifier::check_layout() {
+      if (f_.blocks.empty()) {
+        fail("no blocks");
+        return false;
+      }
+      if (f_.graph.size() != f_.blocks.size()) {
+        fail("the flow graph does not match the blocks");
+        return false;
+      }
+      block_of_.assign(f_.size(), no_block);
+      std::uint32_t next = 0;
+      for (block_id b = 0; b < f_.blocks.size(); b++) {
+        auto const &blk = f_.blocks[b];
+        if (blk.first != next || blk.count == 0 ||
+            blk.first + blk.count > f_.size()) {
+          fail("bb" + std::to_string(b) + " is empty or out of order");
+          return false;
+        }
+        next += blk.count;
+        bool body = false;
+        for (auto v : f_.values_of(b)) {
+          block_of_[v] = b;
+          auto op = f_.instrs[v].op;
+          if (op == opcode::phi && body) {
+            fail(v, "phi after other instructions");
+          }
+          body |= op != opcode::phi;
+          if (is_terminator(op) != (v == f_.terminator(b))) {
+            fail(v, is_terminator(op) ? "terminator in the middle of bb" +
+                                            std::to_string(b)
+                                      : "bb" + std::to_string(b) +
+                                            " does not end in a terminator");
+          }
+        }
+      }
+      if (next != f_.size()) {
+        fail("instructions outside of any block");
+        return false;
+      }
+      for (auto const &i : f_.instrs) {
+        if (i.first + i.count > f_.operands.size() || !i.type) {
+          fail("instruction with missing operands or type");
+          return false;
+        }
+      }
+      return ok_;
+    }
+
+    void verifier::check_operands(block_id b, value_id v,
+                                  dominator_tree const &dom) {
+      auto const &i = f_.instrs[v];
+      auto ops = f_.operands_of(v);
+      auto preds = f_.graph.preds(b);
+      if (i.op == opcode::phi && ops.size() != preds.size()) {
+        fail(v, "has " + std::to_string(ops.size()) + " operands for " +
+                    std::to_string(preds.size()) + " predecessors");
+        return;
+      }
+      for (std::size_t k = 0; k < ops.size(); k++) {
+        auto o = ops[k];
+        if (o >= f_.size()) {
+          fail(v, "operand %" + std::to_string(o) + " does not exist");
+          continue;
+        }
+        if (type_of(o)->kind == type_kind::void_type) {
+          fail(v, "operand %" + std::to_string(o) + " has no value");
+        }
+        // a phi operand is used at the end of its predecessor
+        auto use = i.op == opcode::phi ? preds[k] : b;
+        auto def = block_of_[o];
+        bool dominated = def == use
+                             ? i.op == opcode::phi || o < v
+                             : dom.dominates(def, use);
+        if (!dominated) {
+          fail(v, "operand %" + std::to_string(o) +
+                      " does not dominate its use");
+        }
+      }
+    }
+
+    void verifier::check_types(block_id b, value_id v) {
+      auto const &i = f_.instrs[v];
+      auto ops = f_.operands_of(v);
+      auto t = i.type;
+      auto count = [&](std::size_t n) {
+        if (ops.size() != n) {
+          fail(v, "expected " + std::to_string(n) + " operands");
+          return false;
+        }
+        return true;
+      };
+      auto is = [](soda::type const *t, type_kind kind) {
+        return t->kind == kind;
+      };
+      auto succs = f_.graph.succs(b).size();
+
+      switch (i.op) {
+        case opcode::neg:
+        case opcode::bit_not:
+        case opcode::log_not:
+          if (count(1)) {
+            expect(v, type_of(ops[0]) == t, "operand type differs");
+          }
+          break;
+        case opcode::add:
+        case opcode::sub:
+        case opcode::mul:
+        case opcode::div:
+        case opcode::mod:
+        case opcode::pow:
+        case opcode::bit_and:
+        case opcode::bit_xor:
+        case opcode::bit_or:
+        case opcode::lshift:
+        case opcode::rshift:
+          if (count(2)) {
+            expect(v, type_of(ops[0]) == t && type_of(ops[1]) == t,
+                   "operand types differ from the result");
+          }
+          break;
+        case opcode::lt:
+        case opcode::gt:
+        case opcode::le:
+        case opcode::ge:
+        case opcode::eq:
+        case opcode::ne:
+          if (count(2)) {
+            expect(v, type_of(ops[0]) == type_of(ops[1]),
+                   "operand types differ");
+            expect(v, is(t, type_kind::bool_type), "result is not a bool");
+          }
+          break;
+        case opcode::index:
+          if (count(2)) {
+            auto seq = type_of(ops[0]);
+            expect(v, is(type_of(ops[1]), type_kind::int_type),
+                   "index is not an int");
+            expect(v,
+                   is(seq, type_kind::array_type)
+                       ? seq->inner == t
+                       : is(seq, type_kind::string_type) &&
+                             is(t, type_kind::char_type),
+                   "result is not the element type");
+          }
+          break;
+        case opcode::call: {
+          auto callee = ops.empty() ? nullptr : type_of(ops[0]);
+          if (!callee || !is(callee, type_kind::function_type)) {
+            fail(v, "callee is not a function");
+            break;
+          }
+          if (count(callee->params.size() + 1)) {
+            for (std::size_t k = 0; k < callee->params.size(); k++) {
+              expect(v, type_of(ops[k + 1]) == callee->params[k],
+                     "argument type differs from the parameter");
+            }
+          }
+          expect(v, callee->inner == t, "result is not the function's");
+          break;
+        }
+        case opcode::param:
+          expect(v, b == 0 && i.imm < f_.fun->canonical->params.size() &&
+                        f_.fun->canonical->params[i.imm] == t,
+                 "not a parameter of the function");
+          count(0);
+          break;
+        case opcode::constant:
+          expect(v, t->is_primitive() && !is(t, type_kind::void_type) &&
+                        (!is(t, type_kind::string_type) ||
+                         i.imm < f_.strings.size()),
+                 "invalid constant");
+          count(0);
+          break;
+        case opcode::undef:
+          count(0);
+          break;
+        case opcode::load_global:
+        case opcode::function:
+          expect(v, i.imm < f_.symbols.size() &&
+                        f_.symbols[i.imm]->canonical == t,
+                 "type differs from the symbol's");
+          count(0);
+          break;
+        case opcode::store_global:
+          if (count(1)) {
+            expect(v, i.imm < f_.symbols.size() &&
+                          f_.symbols[i.imm]->canonical == type_of(ops[0]),
+                   "type differs from the symbol's");
+          }
+          break;
+        case opcode::length:
+          if (count(1)) {
+            expect(v, is(type_of(ops[0]), type_kind::array_type) ||
+                          is(type_of(ops[0]), type_kind::string_type),
+                   "operand is not an array or string");
+            expect(v, is(t, type_kind::int_type), "result is not an int");
+          }
+          break;
+        case opcode::store_index:
+          if (count(3)) {
+            auto array = type_of(ops[0]);
+            expect(v, is(array, type_kind::array_type) &&
+                          is(type_of(ops[1]), type_kind::int_type) &&
+                          array->inner == type_of(ops[2]),
+                   "invalid element store");
+          }
+          break;
+        case opcode::mul_high:
+          if (count(2)) {
+            expect(v, is(t, type_kind::int_type) && type_of(ops[0]) == t &&
+                          type_of(ops[1]) == t,
+                   "operands and result are not ints");
+          }
+          break;
+        case opcode::phi:
+          for (auto o : ops) {
+            expect(v, type_of(o) == t, "operand type differs");
+          }
+          break;
+        case opcode::jump:
+          count(0);
+          expect(v, succs == 1, "expected one successor");
+          break;
+        case opcode::branch:
+          if (count(1)) {
+            expect(v, is(type_of(ops[0]), type_kind::bool_type),
+                   "condition is not a bool");
+          }
+          expect(v, succs == 2, "expected two successors");
+          break;
+        case opcode::switch_:
+          if (ops.empty()) {
+            fail(v, "no value");
+            break;
+          }
+          for (auto o : ops) {
+            expect(v, type_of(o) == type_of(ops[0]),
+                   "case value type differs");
+          }
+          expect(v, succs == ops.size(),
+                 "expected one successor per case and a default");
+          break;
+        case opcode::ret: {
+          auto result = f_.fun->canonical->inner;
+          if (is(result, type_kind::void_type)) {
+            count(0);
+          } else if (count(1)) {
+            expect(v, type_of(ops[0]) == result,
+                   "type differs from the function's result");
+          }
+          expect(v, succs == 0, "has successors");
+          break;
+        }
+        default:
+          fail(v, "operation does not occur in the IR");
+          break;
+      }
+      if (!is_terminator(i.op) && succs && v == f_.terminator(b)) {
+        fail(v, "has successors");
+      }
+    }
+
+    bool verifier::run() {
+      if (!check_layout()) {
+        return false;
+      }
+      auto order = reverse_postorder(f_.graph, 0);
+      dominator_tree dom{f_.graph, order};
+      if (!f_.graph.preds(0).empty()) {
+        fail("the entry block has predecessors");
+      }
+      for (block_id b = 0; b < f_.blocks.size(); b++) {
+        if (!std::ranges::is_sorted(f_.graph.preds(b))) {
+          fail("the predecessors of bb" + std::to_string(b) +
+               " are out of order");
+        }
+      }
+      for (block_id b = 0; b < f_.blocks.size(); b++) {
+        if (!order.is_reachable(b)) {
+          fail("bb" + std::to_string(b) + " is unreachable");
+          continue;
+        }
+        for (auto v : f_.values_of(b)) {
+          check_operands(b, v, dom);
+          check_types(b, v);
+        }
+      }
+      return ok_;
+    }
+
+  } // namespace
+
+  bool verify(function const &f, diagnostics &diags) {
+    return verifier{f, diags}.run();
+  }
+
+} // namespace soda::ir
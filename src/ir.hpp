@@ -0,0 +1,262 @@
+#pragma once
+
+#include "ast.hpp"
+#include "cfg.hpp"
+#include "diagnostic.hpp"
+#include "operators.hpp"
+#include "types.hpp"
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <ostream>
+#include <ranges>
+#include <span>
+#include <string_view>
+#include <vector>
+
+namespace soda::ir {
+
+  //
+  // SSA intermediate representation
+  //
+  // A function is one array of instructions, grouped by block, and one
+  // array of operands. Every instruction defines the value numbered by its
+  // position, so a value is a 32-bit index, and its operands are a slice of
+  // the operand array. A block is a run of instructions: its phis first,
+  // then ordinary instructions, then one terminator. The edges between
+  // blocks are a flow_graph; the successors of a block are in the order of
+  // its terminator's targets and a phi has one operand per predecessor, in
+  // the order of the graph's predecessors. The edges are given block by
+  // block, so the predecessors of a block are sorted.
+  //
+  // Every block is reachable from block 0, the entry, which has no
+  // predecessors.
+  //
+
+  using value_id = std::uint32_t;
+
+  inline constexpr value_id no_value = std::numeric_limits<value_id>::max();
+
+  // The operations of operator_kind come first with the same values, so an
+  // operator converts with a cast. Assignments, increments, &&, ||, ?:, the
+  // comma and member access are lowered to other instructions and control
+  // flow and never occur.
+  enum class opcode : std::uint8_t {
+    pos,
+    neg,
+    bit_not,
+    log_not,
+    pre_inc,
+    pre_dec,
+    post_inc,
+    post_dec,
+    add,
+    sub,
+    mul,
+    div,
+    mod,
+    pow,
+    bit_and,
+    bit_xor,
+    bit_or,
+    log_and,
+    log_or,
+    lt,
+    gt,
+    le,
+    ge,
+    eq,
+    ne,
+    lshift,
+    rshift,
+    assign,
+    add_assign,
+    sub_assign,
+    mul_assign,
+    div_assign,
+    mod_assign,
+    and_assign,
+    xor_assign,
+    or_assign,
+    lshift_assign,
+    rshift_assign,
+    comma,
+    member,
+    // array or string, index; imm is 1 if the index is known to be in
+    // bounds, so it needs no check
+    index,
+    ifexpr,
+    // callee, arguments...
+    call,
+    // the parameter numbered imm
+    param,
+    // imm holds the bits of the value: an int, a bool, a code point or a
+    // double; for strings the index in function::strings
+    constant,
+    // the value of a variable before it is assigned
+    undef,
+    // the global variable function::symbols[imm]
+    load_global,
+    // value; stores into function::symbols[imm]
+    store_global,
+    // the function function::symbols[imm]
+    function,
+    // the number of elements of an array or string
+    length,
+    // array, index, value
+    store_index,
+    // the high 64 bits of the 128-bit product of two ints
+    mul_high,
+    // one operand per predecessor
+    phi,
+    // terminators
+    jump,
+    // condition; to the first successor if true, the second otherwise
+    branch,
+    // value, case values...; to the successor of the first equal case
+    // value, or to the last successor
+    switch_,
+    // the returned value, if any
+    ret,
+  };
+
+  static_assert(static_cast<int>(opcode::call) ==
+                static_cast<int>(operator_kind::call));
+
+  constexpr opcode to_opcode(operator_kind op) noexcept {
+    return static_cast<opcode>(op);
+  }
+
+  constexpr bool is_terminator(opcode op) noexcept {
+    return op >= opcode::jump;
+  }
+
+  constexpr bool is_compare(opcode op) noexcept {
+    return op >= opcode::lt && op <= opcode::ne;
+  }
+
+  // The comparison of ints that holds exactly when op does not.
+  constexpr opcode negate(opcode op) noexcept {
+    switch (op) {
+      case opcode::lt:
+        return opcode::ge;
+      case opcode::ge:
+        return opcode::lt;
+      case opcode::gt:
+        return opcode::le;
+      case opcode::le:
+        return opcode::gt;
+      case opcode::eq:
+        return opcode::ne;
+      default:
+        return opcode::eq;
+    }
+  }
+
+  // The comparison with its operands swapped.
+  constexpr opcode mirror(opcode op) noexcept {
+    switch (op) {
+      case opcode::lt:
+        return opcode::gt;
+      case opcode::gt:
+        return opcode::lt;
+      case opcode::le:
+        return opcode::ge;
+      case opcode::ge:
+        return opcode::le;
+      default:
+        return op;
+    }
+  }
+
+  // Whether op is a value that takes no computing, which backends use
+  // where it is needed instead of keeping it in a register.
+  constexpr bool is_leaf(opcode op) noexcept {
+    return op == opcode::constant || op == opcode::undef ||
+           op == opcode::function;
+  }
+
+  // Whether op changes something besides its value. Whether it may trap,
+  // which also makes it run when its value is not used, depends on its
+  // operands (see may_trap).
+  constexpr bool has_effect(opcode op) noexcept {
+    return op == opcode::call || op == opcode::store_global ||
+           op == opcode::store_index;
+  }
+
+  std::string_view to_string(opcode op);
+
+  inline std::ostream &operator<<(std::ostream &out, opcode op) {
+    return out << to_string(op);
+  }
+
+  struct instr {
+    opcode op;
+    std::uint32_t first = 0;
+    std::uint32_t count = 0;
+    // void for instructions without a result
+    soda::type const *type = nullptr;
+    std::uint64_t imm = 0;
+  };
+
+  struct block {
+    std::uint32_t first = 0;
+    std::uint32_t count = 0;
+  };
+
+  class function {
+  public:
+    ast::fun_decl const *fun = nullptr;
+    std::vector<instr> instrs;
+    std::vector<value_id> operands;
+    std::vector<block> blocks;
+    flow_graph graph;
+    // globals and functions referred to by instructions
+    std::vector<ast::decl const *> symbols;
+    std::vector<std::string_view> strings;
+
+    std::size_t size() const noexcept {
+      return instrs.size();
+    }
+
+    std::span<value_id const> operands_of(value_id v) const noexcept {
+      return {operands.data() + instrs[v].first, instrs[v].count};
+    }
+
+    // The values of the instructions of a block, in order.
+    auto values_of(block_id b) const noexcept {
+      return std::views::iota(blocks[b].first,
+                              blocks[b].first + blocks[b].count);
+    }
+
+    value_id terminator(block_id b) const noexcept {
+      return blocks[b].first + blocks[b].count - 1;
+    }
+  };
+
+  // The position of the edge from b to its kth successor among the
+  // predecessors of the successor, which is that of the operands of its
+  // phis for the edge. The successor has several edges from b if b's
+  // terminator names it more than once.
+  std::size_t edge_index(function const &f, block_id b, std::size_t k);
+
+  inline std::int64_t int_value(instr const &i) noexcept {
+    return static_cast<std::int64_t>(i.imm);
+  }
+
+  inline double float_value(instr const &i) noexcept {
+    return std::bit_cast<double>(i.imm);
+  }
+
+  // Write the function in a textual form, one instruction per line.
+  void dump(std::ostream &out, function const &f);
+
+  // Check the invariants above, that every operand is defined before it is
+  // used on every path and that the operand types fit each instruction.
+  // Violations are appended to diags as errors; returns whether there were
+  // none.
+  bool verify(function const &f, diagnostics &diags);
+
+} // namespace soda::ir
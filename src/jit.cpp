@@ -0,0 +1,660 @@
+#include "jit.hpp"
+
+#include <bit>
+#include <cstring>
+#include <span>
+
+#if SODA_VM_JIT_TARGET
+#include <sys/mman.h>
+#endif
+
+namespace soda::vm {
+
+#if SODA_VM_JIT_TARGET
+
+  namespace {
+
+    // A template is machine code as bytes, with holes for what depends on
+    // the instruction, each hole one int standing for the bytes it is
+    // patched with. rbx holds the frame, r12 the fuel and r13 where it is
+    // kept; rax, rcx, rdx and xmm0 are scratch.
+    enum hole : int {
+      // 4 bytes: the offset of register a, b or c from rbx
+      reg_a = 0x100,
+      reg_b,
+      reg_c,
+      // c, in 1, 4 or 8 bytes
+      imm8,
+      imm32,
+      imm64,
+      // 8 bytes: the address of global c
+      global,
+      // 4 bytes, relative: the instruction jumped to
+      target,
+      // 4 bytes, relative: code that leaves for the interpreter to run this
+      // instruction
+      guard,
+      // 4 bytes: the index of this instruction in the machine's code
+      pc,
+      // 4 bytes, relative: the common exit
+      leave,
+      // the switch table of c: its low value and the number of entries in
+      // 8 bytes, the fallback as a target and the jump table, relative
+      low,
+      span,
+      fallback,
+      table,
+      // 4 bytes, relative: the exit when the fuel runs out
+      no_fuel,
+    };
+
+    // clang-format off
+
+    // push rbx, r12 and r13; rbx = regs, r13 = &fuel, r12 = fuel; jmp at
+    constexpr int prologue[] = {
+      0x53, 0x41, 0x54, 0x41, 0x55,
+      0x48, 0x89, 0xFB, 0x49, 0x89, 0xD5, 0x4C, 0x8B, 0x22,
+      0xFF, 0xE6,
+    };
+    // fuel = r12; pop r13, r12 and rbx; return eax
+    constexpr int epilogue[] = {
+      0x4D, 0x89, 0x65, 0x00,
+      0x41, 0x5D, 0x41, 0x5C, 0x5B, 0xC3,
+    };
+    // r12 = 0; eax = out_of_fuel and leave
+    constexpr int starved[] = {
+      0x45, 0x31, 0xE4,
+      0xB8, 0xFF, 0xFF, 0xFF, 0xFF, 0xE9, leave,
+    };
+    // eax = pc and leave, for the interpreter to run the instruction
+    constexpr int interpret[] = {0xB8, pc, 0xE9, leave};
+    // a step for a backward jump
+    constexpr int charge[] = {0x49, 0x83, 0xEC, 0x01, 0x0F, 0x82, no_fuel};
+
+    // mov rax, [b]; op rax, [c]; mov [a], rax
+#define SODA_JIT_BINARY(...)                                                   \
+    {0x48, 0x8B, 0x83, reg_b, __VA_ARGS__, 0x48, 0x89, 0x83, reg_a}
+
+    constexpr int move[] = {0x48, 0x8B, 0x83, reg_b, 0x48, 0x89, 0x83, reg_a};
+    constexpr int iadd[] = SODA_JIT_BINARY(0x48, 0x03, 0x83, reg_c);
+    constexpr int isub[] = SODA_JIT_BINARY(0x48, 0x2B, 0x83, reg_c);
+    constexpr int imul[] = SODA_JIT_BINARY(0x48, 0x0F, 0xAF, 0x83, reg_c);
+    constexpr int iand[] = SODA_JIT_BINARY(0x48, 0x23, 0x83, reg_c);
+    constexpr int ior[] = SODA_JIT_BINARY(0x48, 0x0B, 0x83, reg_c);
+    constexpr int ixor[] = SODA_JIT_BINARY(0x48, 0x33, 0x83, reg_c);
+    // imul qword [c], for the high half in rdx
+    constexpr int imulh[] = {
+      0x48, 0x8B, 0x83, reg_b, 0x48, 0xF7, 0xAB, reg_c,
+      0x48, 0x89, 0x93, reg_a,
+    };
+    // divisors 0 and -1 are left to the interpreter, for the traps
+#define SODA_JIT_DIVIDE(result)                                                \
+    {0x48, 0x8B, 0x83, reg_b, 0x48, 0x8B, 0x8B, reg_c,                         \
+     0x48, 0x8D, 0x51, 0x01, 0x48, 0x83, 0xFA, 0x01, 0x0F, 0x86, guard,        \
+     0x48, 0x99, 0x48, 0xF7, 0xF9, 0x48, 0x89, result, reg_a}
+    constexpr int idiv[] = SODA_JIT_DIVIDE(0x83);
+    constexpr int imod[] = SODA_JIT_DIVIDE(0x93);
+    // counts of 64 and up are left to the interpreter
+#define SODA_JIT_SHIFT(op)                                                     \
+    {0x48, 0x8B, 0x8B, reg_c, 0x48, 0x83, 0xF9, 0x40, 0x0F, 0x83, guard,       \
+     0x48, 0x8B, 0x83, reg_b, 0x48, 0xD3, op, 0x48, 0x89, 0x83, reg_a}
+    constexpr int ishl[] = SODA_JIT_SHIFT(0xE0);
+    constexpr int ishr[] = SODA_JIT_SHIFT(0xF8);
+    constexpr int ineg[] = SODA_JIT_BINARY(0x48, 0xF7, 0xD8);
+    constexpr int inot[] = SODA_JIT_BINARY(0x48, 0xF7, 0xD0);
+    constexpr int lnot[] =
+        SODA_JIT_BINARY(0x48, 0x85, 0xC0, 0x0F, 0x94, 0xC0, 0x0F, 0xB6, 0xC0);
+
+    // with an immediate, in 32 bits or through rcx
+    constexpr int iadd_k[] = SODA_JIT_BINARY(0x48, 0x05, imm32);
+    constexpr int imul_k[] = SODA_JIT_BINARY(0x48, 0x69, 0xC0, imm32);
+    constexpr int iand_k[] = SODA_JIT_BINARY(0x48, 0x25, imm32);
+    constexpr int ior_k[] = SODA_JIT_BINARY(0x48, 0x0D, imm32);
+    constexpr int ixor_k[] = SODA_JIT_BINARY(0x48, 0x35, imm32);
+    constexpr int iadd_k64[] =
+        SODA_JIT_BINARY(0x48, 0xB9, imm64, 0x48, 0x01, 0xC8);
+    constexpr int imul_k64[] =
+        SODA_JIT_BINARY(0x48, 0xB9, imm64, 0x48, 0x0F, 0xAF, 0xC1);
+    constexpr int iand_k64[] =
+        SODA_JIT_BINARY(0x48, 0xB9, imm64, 0x48, 0x21, 0xC8);
+    constexpr int ior_k64[] =
+        SODA_JIT_BINARY(0x48, 0xB9, imm64, 0x48, 0x09, 0xC8);
+    constexpr int ixor_k64[] =
+        SODA_JIT_BINARY(0x48, 0xB9, imm64, 0x48, 0x31, 0xC8);
+    constexpr int ishl_k[] = SODA_JIT_BINARY(0x48, 0xC1, 0xE0, imm8);
+    constexpr int ishr_k[] = SODA_JIT_BINARY(0x48, 0xC1, 0xF8, imm8);
+
+    // a = b cc c: cmp, setcc al, movzx eax, al
+#define SODA_JIT_COMPARE(cc)                                                   \
+    SODA_JIT_BINARY(0x48, 0x3B, 0x83, reg_c, 0x0F, cc, 0xC0, 0x0F, 0xB6, 0xC0)
+#define SODA_JIT_COMPARE_K(cc)                                                 \
+    SODA_JIT_BINARY(0x48, 0x3D, imm32, 0x0F, cc, 0xC0, 0x0F, 0xB6, 0xC0)
+#define SODA_JIT_COMPARE_K64(cc)                                               \
+    SODA_JIT_BINARY(0x48, 0xB9, imm64, 0x48, 0x39, 0xC8, 0x0F, cc, 0xC0,       \
+                    0x0F, 0xB6, 0xC0)
+    constexpr int ilt[] = SODA_JIT_COMPARE(0x9C);
+    constexpr int ile[] = SODA_JIT_COMPARE(0x9E);
+    constexpr int ieq[] = SODA_JIT_COMPARE(0x94);
+    constexpr int ine[] = SODA_JIT_COMPARE(0x95);
+    constexpr int ilt_k[] = SODA_JIT_COMPARE_K(0x9C);
+    constexpr int ile_k[] = SODA_JIT_COMPARE_K(0x9E);
+    constexpr int igt_k[] = SODA_JIT_COMPARE_K(0x9F);
+    constexpr int ige_k[] = SODA_JIT_COMPARE_K(0x9D);
+    constexpr int ieq_k[] = SODA_JIT_COMPARE_K(0x94);
+    constexpr int ine_k[] = SODA_JIT_COMPARE_K(0x95);
+    constexpr int ilt_k64[] = SODA_JIT_COMPARE_K64(0x9C);
+    constexpr int ile_k64[] = SODA_JIT_COMPARE_K64(0x9E);
+    constexpr int igt_k64[] = SODA_JIT_COMPARE_K64(0x9F);
+    constexpr int ige_k64[] = SODA_JIT_COMPARE_K64(0x9D);
+    constexpr int ieq_k64[] = SODA_JIT_COMPARE_K64(0x94);
+    constexpr int ine_k64[] = SODA_JIT_COMPARE_K64(0x95);
+
+    // movsd xmm0, [b]; op xmm0, [c]; movsd [a], xmm0
+#define SODA_JIT_FLOAT(op)                                                     \
+    {0xF2, 0x0F, 0x10, 0x83, reg_b, 0xF2, 0x0F, op, 0x83, reg_c,               \
+     0xF2, 0x0F, 0x11, 0x83, reg_a}
+    constexpr int fadd[] = SODA_JIT_FLOAT(0x58);
+    constexpr int fsub[] = SODA_JIT_FLOAT(0x5C);
+    constexpr int fmul[] = SODA_JIT_FLOAT(0x59);
+    constexpr int fdiv[] = SODA_JIT_FLOAT(0x5E);
+    // btc rax, 63
+    constexpr int fneg[] = SODA_JIT_BINARY(0x48, 0x0F, 0xBA, 0xF8, 0x3F);
+    // less is c above b, so that unordered is false: ucomisd xmm0, [b]
+#define SODA_JIT_FLOAT_LESS(cc)                                                \
+    {0xF2, 0x0F, 0x10, 0x83, reg_c, 0x66, 0x0F, 0x2E, 0x83, reg_b,             \
+     0x0F, cc, 0xC0, 0x0F, 0xB6, 0xC0, 0x48, 0x89, 0x83, reg_a}
+    constexpr int flt[] = SODA_JIT_FLOAT_LESS(0x97);
+    constexpr int fle[] = SODA_JIT_FLOAT_LESS(0x93);
+    // equal is zero and not parity; sete/setnp and, setne/setp or
+#define SODA_JIT_FLOAT_EQUAL(cc, parity, combine)                              \
+    {0xF2, 0x0F, 0x10, 0x83, reg_b, 0x66, 0x0F, 0x2E, 0x83, reg_c,             \
+     0x0F, cc, 0xC0, 0x0F, parity, 0xC1, combine, 0xC8,                        \
+     0x0F, 0xB6, 0xC0, 0x48, 0x89, 0x83, reg_a}
+    constexpr int feq[] = SODA_JIT_FLOAT_EQUAL(0x94, 0x9B, 0x20);
+    constexpr int fne[] = SODA_JIT_FLOAT_EQUAL(0x95, 0x9A, 0x08);
+
+    // strings and arrays, with bounds checks left to the interpreter
+    constexpr int slen[] = SODA_JIT_BINARY(0x48, 0x8B, 0x00);
+    constexpr int alen[] =
+        SODA_JIT_BINARY(0x48, 0x85, 0xC0, 0x74, 0x03, 0x48, 0x8B, 0x00);
+    constexpr int sindex[] = SODA_JIT_BINARY(
+        0x48, 0x8B, 0x8B, reg_c, 0x48, 0x3B, 0x08, 0x0F, 0x83, guard,
+        0x48, 0x8B, 0x40, 0x08, 0x0F, 0xB6, 0x04, 0x08);
+    constexpr int aindex[] = SODA_JIT_BINARY(
+        0x48, 0x85, 0xC0, 0x0F, 0x84, guard,
+        0x48, 0x8B, 0x8B, reg_c, 0x48, 0x3B, 0x08, 0x0F, 0x83, guard,
+        0x48, 0x8B, 0x40, 0x08, 0x48, 0x8B, 0x04, 0xC8);
+    constexpr int astore[] = {
+      0x48, 0x8B, 0x83, reg_a, 0x48, 0x85, 0xC0, 0x0F, 0x84, guard,
+      0x48, 0x8B, 0x8B, reg_b, 0x48, 0x3B, 0x08, 0x0F, 0x83, guard,
+      0x48, 0x8B, 0x40, 0x08, 0x48, 0x8B, 0x93, reg_c,
+      0x48, 0x89, 0x14, 0xC8,
+    };
+
+    // mov rax, &global
+    constexpr int gload[] = {
+      0x48, 0xB8, global, 0x48, 0x8B, 0x00, 0x48, 0x89, 0x83, reg_a,
+    };
+    constexpr int gstore[] = {
+      0x48, 0x8B, 0x8B, reg_a, 0x48, 0xB8, global, 0x48, 0x89, 0x08,
+    };
+
+    constexpr int jump[] = {0xE9, target};
+    constexpr int jt[] = {
+      0x48, 0x8B, 0x83, reg_a, 0x48, 0x85, 0xC0, 0x0F, 0x85, target,
+    };
+    constexpr int jf[] = {
+      0x48, 0x8B, 0x83, reg_a, 0x48, 0x85, 0xC0, 0x0F, 0x84, target,
+    };
+#define SODA_JIT_BRANCH(cc)                                                    \
+    {0x48, 0x8B, 0x83, reg_a, 0x48, 0x3B, 0x83, reg_b, 0x0F, cc, target}
+#define SODA_JIT_BRANCH_K(cc)                                                  \
+    {0x48, 0x8B, 0x83, reg_a, 0x48, 0x3D, imm32, 0x0F, cc, target}
+#define SODA_JIT_BRANCH_K64(cc)                                                \
+    {0x48, 0x8B, 0x83, reg_a, 0x48, 0xB9, imm64, 0x48, 0x39, 0xC8,             \
+     0x0F, cc, target}
+    constexpr int jlt[] = SODA_JIT_BRANCH(0x8C);
+    constexpr int jle[] = SODA_JIT_BRANCH(0x8E);
+    constexpr int jeq[] = SODA_JIT_BRANCH(0x84);
+    constexpr int jne[] = SODA_JIT_BRANCH(0x85);
+    constexpr int jlt_k[] = SODA_JIT_BRANCH_K(0x8C);
+    constexpr int jle_k[] = SODA_JIT_BRANCH_K(0x8E);
+    constexpr int jgt_k[] = SODA_JIT_BRANCH_K(0x8F);
+    constexpr int jge_k[] = SODA_JIT_BRANCH_K(0x8D);
+    constexpr int jeq_k[] = SODA_JIT_BRANCH_K(0x84);
+    constexpr int jne_k[] = SODA_JIT_BRANCH_K(0x85);
+    constexpr int jlt_k64[] = SODA_JIT_BRANCH_K64(0x8C);
+    constexpr int jle_k64[] = SODA_JIT_BRANCH_K64(0x8E);
+    constexpr int jgt_k64[] = SODA_JIT_BRANCH_K64(0x8F);
+    constexpr int jge_k64[] = SODA_JIT_BRANCH_K64(0x8D);
+    constexpr int jeq_k64[] = SODA_JIT_BRANCH_K64(0x84);
+    constexpr int jne_k64[] = SODA_JIT_BRANCH_K64(0x85);
+
+    // a dense switch: rax = a - low; if (rax >= span) goto fallback; a
+    // step; jmp [table + rax * 8]
+    constexpr int dense_switch[] = {
+      0x48, 0x8B, 0x83, reg_a, 0x48, 0xB9, low, 0x48, 0x29, 0xC8,
+      0x48, 0xB9, span, 0x48, 0x39, 0xC8, 0x0F, 0x83, fallback,
+      0x49, 0x83, 0xEC, 0x01, 0x0F, 0x82, no_fuel,
+      0x48, 0x8D, 0x0D, table, 0xFF, 0x24, 0xC1,
+    };
+
+#undef SODA_JIT_BRANCH_K64
+#undef SODA_JIT_BRANCH_K
+#undef SODA_JIT_BRANCH
+#undef SODA_JIT_FLOAT_EQUAL
+#undef SODA_JIT_FLOAT_LESS
+#undef SODA_JIT_FLOAT
+#undef SODA_JIT_COMPARE_K64
+#undef SODA_JIT_COMPARE_K
+#undef SODA_JIT_COMPARE
+#undef SODA_JIT_SHIFT
+#undef SODA_JIT_DIVIDE
+#undef SODA_JIT_BINARY
+
+    // clang-format on
+
+    bool is_imm32(std::int64_t k) {
+      return k >= std::numeric_limits<std::int32_t>::min() &&
+             k <= std::numeric_limits<std::int32_t>::max();
+    }
+
+    // The template for i, or none if the interpreter runs it.
+    std::span<int const> template_of(function const &fn,
+                                     instruction const &i) {
+      auto near = is_imm32(i.c);
+      switch (i.op) {
+      case opcode::move:
+        return move;
+      case opcode::iadd:
+        return iadd;
+      case opcode::isub:
+        return isub;
+      case opcode::imul:
+        return imul;
+      case opcode::idiv:
+        return idiv;
+      case opcode::imod:
+        return imod;
+      case opcode::iand:
+        return iand;
+      case opcode::ior:
+        return ior;
+      case opcode::ixor:
+        return ixor;
+      case opcode::ishl:
+        return ishl;
+      case opcode::ishr:
+        return ishr;
+      case opcode::imulh:
+        return imulh;
+      case opcode::ineg:
+        return ineg;
+      case opcode::inot:
+        return inot;
+      case opcode::lnot:
+        return lnot;
+      case opcode::fadd:
+        return fadd;
+      case opcode::fsub:
+        return fsub;
+      case opcode::fmul:
+        return fmul;
+      case opcode::fdiv:
+        return fdiv;
+      case opcode::fneg:
+        return fneg;
+      case opcode::ilt:
+        return ilt;
+      case opcode::ile:
+        return ile;
+      case opcode::ieq:
+        return ieq;
+      case opcode::ine:
+        return ine;
+      case opcode::flt:
+        return flt;
+      case opcode::fle:
+        return fle;
+      case opcode::feq:
+        return feq;
+      case opcode::fne:
+        return fne;
+      case opcode::slen:
+        return slen;
+      case opcode::alen:
+        return alen;
+      case opcode::sindex:
+        return sindex;
+      case opcode::aindex:
+        return aindex;
+      case opcode::astore:
+        return astore;
+      case opcode::gload:
+        return gload;
+      case opcode::gstore:
+        return gstore;
+      case opcode::jump:
+        return jump;
+      case opcode::jt:
+        return jt;
+      case opcode::jf:
+        return jf;
+      case opcode::switch_:
+        if (fn.tables[static_cast<std::size_t>(i.c)].dense.empty()) {
+          return {};
+        }
+        return dense_switch;
+      case opcode::iadd_k:
+        return near ? std::span<int const>{iadd_k} : iadd_k64;
+      case opcode::imul_k:
+        return near ? std::span<int const>{imul_k} : imul_k64;
+      case opcode::iand_k:
+        return near ? std::span<int const>{iand_k} : iand_k64;
+      case opcode::ior_k:
+        return near ? std::span<int const>{ior_k} : ior_k64;
+      case opcode::ixor_k:
+        return near ? std::span<int const>{ixor_k} : ixor_k64;
+      case opcode::ishl_k:
+        return ishl_k;
+      case opcode::ishr_k:
+        return ishr_k;
+      case opcode::ilt_k:
+        return near ? std::span<int const>{ilt_k} : ilt_k64;
+      case opcode::ile_k:
+        return near ? std::span<int const>{ile_k} : ile_k64;
+      case opcode::igt_k:
+        return near ? std::span<int const>{igt_k} : igt_k64;
+      case opcode::ige_k:
+        return near ? std::span<int const>{ige_k} : ige_k64;
+      case opcode::ieq_k:
+        return near ? std::span<int const>{ieq_k} : ieq_k64;
+      case opcode::ine_k:
+        return near ? std::span<int const>{ine_k} : ine_k64;
+      case opcode::jlt:
+        return jlt;
+      case opcode::jle:
+        return jle;
+      case opcode::jeq:
+        return jeq;
+      case opcode::jne:
+        return jne;
+      case opcode::jlt_k:
+        return near ? std::span<int const>{jlt_k} : jlt_k64;
+      case opcode::jle_k:
+        return near ? std::span<int const>{jle_k} : jle_k64;
+      case opcode::jgt_k:
+        return near ? std::span<int const>{jgt_k} : jgt_k64;
+      case opcode::jge_k:
+        return near ? std::span<int const>{jge_k} : jge_k64;
+      case opcode::jeq_k:
+        return near ? std::span<int const>{jeq_k} : jeq_k64;
+      case opcode::jne_k:
+        return near ? std::span<int const>{jne_k} : jne_k64;
+      default:
+        // calls, returns, string operations, powers and float remainders
+        return {};
+      }
+    }
+
+    // Code written to a buffer, with the relative references into it
+    // resolved at the end.
+    class assembler {
+    public:
+      std::vector<std::uint8_t> code;
+
+      std::size_t here() const {
+        return code.size();
+      }
+
+      void bytes(std::uint64_t value, int n) {
+        for (int k = 0; k < n; k++) {
+          code.push_back(static_cast<std::uint8_t>(value >> (8 * k)));
+        }
+      }
+
+      // A 4-byte reference to an offset not known yet, by key.
+      void refer(std::uint64_t key) {
+        fixups_.push_back({here(), key});
+        bytes(0, 4);
+      }
+
+      template <typename Resolve> void resolve(Resolve &&offset_of) {
+        for (auto [at, key] : fixups_) {
+          auto rel = static_cast<std::int64_t>(offset_of(key)) -
+                     static_cast<std::int64_t>(at + 4);
+          std::memcpy(code.data() + at, &rel, 4);
+        }
+      }
+
+    private:
+      struct fixup {
+        std::size_t at;
+        std::uint64_t key;
+      };
+      std::vector<fixup> fixups_;
+    };
+
+    // What a reference is to: the kind in the high bits, an instruction or
+    // table in the low.
+    enum class ref : std::uint64_t {
+      label,
+      charge,
+      guard,
+      table,
+      leave,
+      no_fuel,
+    };
+
+    std::uint64_t key(ref kind, std::size_t n = 0) {
+      return static_cast<std::uint64_t>(kind) << 32 | n;
+    }
+
+  } // namespace
+
+  std::unique_ptr<native_function>
+  native_function::compile(function const &fn, std::uint32_t start,
+                           std::uint64_t *globals) {
+    // every register must be within a 32-bit displacement of rbx
+    if (fn.registers >= std::numeric_limits<std::int32_t>::max() / 8) {
+      return nullptr;
+    }
+    std::unique_ptr<native_function> native{new native_function};
+    native->start_ = start;
+    auto const n = fn.code.size();
+    assembler as;
+    std::vector<std::size_t> labels(n), charges(n), guards(n);
+    std::vector<bool> charged(n), guarded(n);
+    std::vector<std::size_t> tables(fn.tables.size());
+    std::vector<bool> used_tables(fn.tables.size());
+    std::vector<bool> interpreted(n);
+
+    auto copy = [&](std::span<int const> t, std::size_t at,
+                    instruction const &i) {
+      auto fb = format_of(i.op).b;
+      for (auto x : t) {
+        switch (x) {
+        case reg_a:
+          as.bytes(std::uint64_t{i.a} * 8, 4);
+          break;
+        case reg_b:
+          as.bytes(std::uint64_t{i.b} * 8, 4);
+          break;
+        case reg_c:
+          as.bytes(static_cast<std::uint64_t>(i.c) * 8, 4);
+          break;
+        case imm8:
+          as.bytes(static_cast<std::uint64_t>(i.c), 1);
+          break;
+        case imm32:
+          as.bytes(static_cast<std::uint64_t>(i.c), 4);
+          break;
+        case imm64:
+          as.bytes(static_cast<std::uint64_t>(i.c), 8);
+          break;
+        case global:
+          as.bytes(std::bit_cast<std::uintptr_t>(globals + i.c), 8);
+          break;
+        case target:
+        case fallback: {
+          auto to = x == fallback
+                        ? fn.tables[static_cast<std::size_t>(i.c)].fallback
+                    : fb == field::target ? i.b
+                                          : static_cast<std::uint32_t>(i.c);
+          // a backward jump takes a step, on the way
+          if (to <= at) {
+            charged[to] = true;
+            as.refer(key(ref::charge, to));
+          } else {
+            as.refer(key(ref::label, to));
+          }
+          break;
+        }
+        case guard:
+          guarded[at] = true;
+          as.refer(key(ref::guard, at));
+          break;
+        case pc:
+          as.bytes(start + at, 4);
+          break;
+        case leave:
+          as.refer(key(ref::leave));
+          break;
+        case low:
+          as.bytes(static_cast<std::uint64_t>(
+                       fn.tables[static_cast<std::size_t>(i.c)].low),
+                   8);
+          break;
+        case span:
+          as.bytes(fn.tables[static_cast<std::size_t>(i.c)].dense.size(), 8);
+          break;
+        case table:
+          used_tables[static_cast<std::size_t>(i.c)] = true;
+          as.refer(key(ref::table, static_cast<std::size_t>(i.c)));
+          break;
+        case no_fuel:
+          as.refer(key(ref::no_fuel));
+          break;
+        default:
+          as.code.push_back(static_cast<std::uint8_t>(x));
+          break;
+        }
+      }
+    };
+
+    copy(prologue, 0, {});
+    auto const leave_at = as.here();
+    copy(epilogue, 0, {});
+    auto const no_fuel_at = as.here();
+    copy(starved, 0, {});
+
+    for (std::size_t at = 0; at < n; at++) {
+      auto const &i = fn.code[at];
+      labels[at] = as.here();
+      auto t = template_of(fn, i);
+      interpreted[at] = t.empty();
+      copy(t.empty() ? std::span<int const>{interpret} : t, at, i);
+    }
+
+    // the steps of backward jumps, the exits of checks, and the tables
+    for (std::size_t at = 0; at < n; at++) {
+      if (charged[at]) {
+        charges[at] = as.here();
+        copy(charge, at, {});
+        as.code.push_back(0xE9);
+        as.refer(key(ref::label, at));
+      }
+      if (guarded[at]) {
+        guards[at] = as.here();
+        copy(interpret, at, {});
+      }
+    }
+    as.bytes(0, static_cast<int>(-as.here() & 7));
+    std::vector<std::pair<std::size_t, std::uint32_t>> entries;
+    for (std::size_t t = 0; t < fn.tables.size(); t++) {
+      if (used_tables[t]) {
+        tables[t] = as.here();
+        for (auto to : fn.tables[t].dense) {
+          entries.emplace_back(as.here(), to);
+          as.bytes(0, 8);
+        }
+      }
+    }
+
+    as.resolve([&](std::uint64_t k) {
+      auto index = static_cast<std::size_t>(k & 0xffffffff);
+      switch (static_cast<ref>(k >> 32)) {
+      case ref::label:
+        return labels[index];
+      case ref::charge:
+        return charges[index];
+      case ref::guard:
+        return guards[index];
+      case ref::table:
+        return tables[index];
+      case ref::leave:
+        return leave_at;
+      case ref::no_fuel:
+        return no_fuel_at;
+      }
+      return std::size_t{0};
+    });
+
+    auto size = as.here();
+    auto memory = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+      return nullptr;
+    }
+    auto base = static_cast<std::uint8_t *>(memory);
+    for (auto [at, to] : entries) {
+      auto address = std::bit_cast<std::uintptr_t>(base + labels[to]);
+      std::memcpy(as.code.data() + at, &address, 8);
+    }
+    std::memcpy(base, as.code.data(), size);
+    if (mprotect(memory, size, PROT_READ | PROT_EXEC)) {
+      munmap(memory, size);
+      return nullptr;
+    }
+    native->memory_ = memory;
+    native->size_ = size;
+    native->at_.resize(n);
+    for (std::size_t at = 0; at < n; at++) {
+      if (!interpreted[at]) {
+        native->at_[at] = base + labels[at];
+      }
+    }
+    return native;
+  }
+
+  native_function::~native_function() {
+    if (memory_) {
+      munmap(memory_, size_);
+    }
+  }
+
+  std::uint32_t native_function::run(void const *at, std::uint64_t *regs,
+                                     std::uint64_t &fuel) const {
+    using entry = std::uint32_t (*)(std::uint64_t *, void const *,
+                                    std::uint64_t *);
+    return reinterpret_cast<entry>(memory_)(regs, at, &fuel);
+  }
+
+#else
+
+  std::unique_ptr<native_function>
+  native_function::compile(function const &, std::uint32_t,
+                           std::uint64_t *) {
+    return nullptr;
+  }
+
+  native_function::~native_function() = default;
+
+  std::uint32_t native_function::run(void const *, std::uint64_t *,
+                                     std::uint64_t &) const {
+    return out_of_fuel;
+  }
+
+#endif
+
+} // namespace soda::vm
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "bytecode.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#if defined(__x86_64__) && defined(__linux__)
+#define SODA_VM_JIT_TARGET 1
+#else
+#define SODA_VM_JIT_TARGET 0
+#endif
+
+namespace soda::vm {
+
+  //
+  // Template JIT
+  //
+  // A function the machine runs often is translated to x86-64 machine code
+  // by copying a template per instruction, machine code assembled by hand
+  // with holes for its registers, immediates and jump targets, which are
+  // patched as it is copied. The code works on the frame in memory, each
+  // register at a fixed offset from rbx, so that a value is never in a
+  // machine register from one instruction to the next and native code and
+  // the interpreter see the same state at every instruction boundary.
+  //
+  // That makes leaving native code cheap: an instruction without a
+  // template (calls, returns, string operations and the rare arithmetic)
+  // returns the index of the instruction to the interpreter, which runs it
+  // and, at the next instruction with native code, enters again. Checks
+  // that would trap, such as a division by zero, leave the same way, and
+  // the interpreter runs the instruction again to trap with its message.
+  //
+  // Native code takes a step for every backward jump and every switch, as
+  // the interpreter does at jumps, from fuel the interpreter hands it, so
+  // that a limit on steps still stops a loop.
+  //
+  // Code is written to a buffer, copied into memory mapped for it, which
+  // is then made executable and not writable.
+  //
+
+  inline constexpr bool jit_available = SODA_VM_JIT_TARGET;
+
+  class native_function {
+  public:
+    // What run returns when the fuel runs out.
+    static constexpr std::uint32_t out_of_fuel =
+        std::numeric_limits<std::uint32_t>::max();
+
+    // Translate fn, whose first instruction is start in the machine's
+    // code, with its globals at globals. Null where there is no JIT, or
+    // if the memory cannot be mapped.
+    static std::unique_ptr<native_function>
+    compile(function const &fn, std::uint32_t start, std::uint64_t *globals);
+
+    ~native_function();
+
+    native_function(native_function const &) = delete;
+    native_function &operator=(native_function const &) = delete;
+
+    // Where native code for the instruction at pc starts, or null if the
+    // interpreter runs it.
+    void const *at(std::uint32_t pc) const noexcept {
+      return at_[pc - start_];
+    }
+
+    // Run from at, with the frame at regs, until an instruction for the
+    // interpreter, whose pc is returned, or until fuel runs out.
+    std::uint32_t run(void const *at, std::uint64_t *regs,
+                      std::uint64_t &fuel) const;
+
+    // The bytes of machine code.
+    std::size_t size() const noexcept {
+      return size_;
+    }
+
+  private:
+    void *memory_ = nullptr;
+    std::size_t size_ = 0;
+    std::uint32_t start_ = 0;
+    std::vector<void const *> at_;
+
+    native_function() = default;
+  };
+
+} // namespace soda::vm
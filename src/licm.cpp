@@ -0,0 +1,151 @@
+#include "backend.hpp"
+#include "loops.hpp"
+#include "optimize.hpp"
+#include "rewrite.hpp"
+
+#include <algorithm>
+#include <vector>
+
+namespace soda::ir {
+
+  namespace {
+
+    // Whether v computes the same value wherever its operands are the
+    // same, without trapping, so it can run before the loop even when the
+    // loop would not have run it. Loads of globals also depend on what the
+    // loop stores.
+    bool is_movable(function const &f, value_id v) {
+      switch (f.instrs[v].op) {
+        case opcode::neg:
+        case opcode::bit_not:
+        case opcode::log_not:
+        case opcode::add:
+        case opcode::sub:
+        case opcode::mul:
+        case opcode::div:
+        case opcode::mod:
+        case opcode::pow:
+        case opcode::bit_and:
+        case opcode::bit_xor:
+        case opcode::bit_or:
+        case opcode::lt:
+        case opcode::gt:
+        case opcode::le:
+        case opcode::ge:
+        case opcode::eq:
+        case opcode::ne:
+        case opcode::lshift:
+        case opcode::rshift:
+        case opcode::length:
+        case opcode::mul_high:
+        case opcode::load_global:
+          return !may_trap(f, v);
+        default:
+          return false;
+      }
+    }
+
+    // What the instructions of a loop write: the globals it stores and
+    // whether it calls anything, which may store any of them.
+    struct loop_writes {
+      bool calls = false;
+      std::vector<ast::decl const *> globals;
+    };
+
+  } // namespace
+
+  // Visits the loop blocks in reverse postorder, so operands come before
+  // their users, and moves each movable instruction whose operands are
+  // defined outside a loop, or were moved out of it, to the preheader of
+  // the outermost such loop. Constant operands are copied along, as the
+  // backends want them next to their users.
+  void hoist_invariants(function &f, pass_stats &stats) {
+    loop_nest loops{f};
+    if (!loops.size()) {
+      return;
+    }
+    auto size = static_cast<value_id>(f.size());
+    auto block_of = blocks_of(f);
+    std::vector<loop_writes> writes(loops.size());
+    for (value_id v = 0; v < size; v++) {
+      auto const &i = f.instrs[v];
+      if (i.op != opcode::call && i.op != opcode::store_global) {
+        continue;
+      }
+      for (auto l = loops.loop_of(block_of[v]); l != loop_forest::no_loop;
+           l = loops[l].parent) {
+        if (i.op == opcode::call) {
+          writes[l].calls = true;
+        } else {
+          writes[l].globals.push_back(f.symbols[i.imm]);
+        }
+      }
+    }
+
+    rewriter rw{f};
+    // where each value is, once moved, and its copy in the preheader
+    std::vector<block_id> home = block_of;
+    std::vector<value_id> moved(size, no_value);
+    std::vector<value_id> ops;
+    std::size_t count = 0;
+    auto invariant = [&](value_id v, std::uint32_t l) {
+      auto const &i = f.instrs[v];
+      auto const &stored = writes[l].globals;
+      if (i.op == opcode::load_global &&
+          (writes[l].calls ||
+           std::ranges::find(stored, f.symbols[i.imm]) != stored.end())) {
+        return false;
+      }
+      return std::ranges::none_of(f.operands_of(v), [&](value_id o) {
+        return f.instrs[o].op != opcode::constant &&
+               loops.contains(l, home[o]);
+      });
+    };
+
+    for (auto b : loops.order().rpo) {
+      if (loops.loop_of(b) == loop_forest::no_loop) {
+        continue;
+      }
+      for (auto v : f.values_of(b)) {
+        if (!is_movable(f, v)) {
+          continue;
+        }
+        auto target = loop_forest::no_loop;
+        for (auto l = loops.loop_of(b); l != loop_forest::no_loop &&
+                                        loops[l].preheader != no_block &&
+                                        invariant(v, l);
+             l = loops[l].parent) {
+          target = l;
+        }
+        if (target == loop_forest::no_loop) {
+          continue;
+        }
+
+        auto pre = loops[target].preheader;
+        auto end = f.terminator(pre);
+        auto i = f.instrs[v];
+        ops.assign(f.operands_of(v).begin(), f.operands_of(v).end());
+        for (auto &o : ops) {
+          if (moved[o] != no_value) {
+            o = moved[o];
+          } else if (loops.contains(target, home[o])) {
+            o = rw.insert(end, opcode::constant, f.instrs[o].type, {},
+                          f.instrs[o].imm);
+          }
+        }
+        moved[v] = rw.insert(end, i.op, i.type, ops, i.imm);
+        home[v] = pre;
+        rw.replace(v, moved[v]);
+        count++;
+      }
+    }
+    if (!count) {
+      return;
+    }
+    stats.values_replaced += count;
+    auto result = rw.apply();
+    stats.instrs_removed += result.instrs_removed;
+    stats.blocks_removed += result.blocks_removed;
+  }
+
+} // namespace soda::ir
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+
+namespace soda {
+
+  //
+  // Deduplicated storage for literal payloads of a translation unit
+  //
+  // String literal nodes reference their decoded contents in the pool and
+  // floating-point literal nodes only refer to it when their value cannot be
+  // represented as a double. The pool must outlive every node referencing
+  // it, which is why the translation unit owns it.
+  //
+
+  class literal_pool {
+  public:
+    literal_pool() = default;
+
+    std::string_view intern(std::string_view s) {
+      if (auto found = strings_.find(s); found != strings_.end()) {
+        return *found;
+      }
+      bytes_ += s.size();
+      return *strings_.emplace(s).first;
+    }
+
+    long double const *intern_extended(long double value) {
+      return &extended_.emplace_back(value);
+    }
+
+    std::size_t size() const noexcept {
+      return strings_.size();
+    }
+
+    std::size_t bytes() const noexcept {
+      return bytes_;
+    }
+
+  private:
+    struct string_hash {
+      using is_transparent = void;
+
+      std::size_t operator()(std::string_view s) const noexcept {
+        return std::hash<std::string_view>{}(s);
+      }
+    };
+
+    std::unordered_set<std::string, string_hash, std::equal_to<>> strings_;
+    std::deque<long double> extended_;
+    std::size_t bytes_ = 0;
+
+    literal_pool(literal_pool const &) = delete;
+    literal_pool &operator=(literal_pool const &) = delete;
+  };
+
+} // namespace soda
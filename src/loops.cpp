@@ -0,0 +1,260 @@
+#include "loops.hpp"
+#include "rewrite.hpp"
+
+#include <algorithm>
+
+namespace soda::ir {
+
+  namespace {
+
+    bool int_constant(function const &f, value_id v, std::int64_t &value) {
+      auto const &i = f.instrs[v];
+      value = int_value(i);
+      return i.op == opcode::constant && i.type->kind == type_kind::int_type;
+    }
+
+  } // namespace
+
+  bool trip_count(opcode op, std::int64_t init, std::int64_t step,
+                  std::int64_t bound, std::uint64_t &count) {
+    constexpr auto min = std::numeric_limits<std::int64_t>::min();
+    constexpr auto max = std::numeric_limits<std::int64_t>::max();
+    // the arithmetic below is on the bits, which wraps
+    auto bits = [](std::int64_t x) {
+      return static_cast<std::uint64_t>(x);
+    };
+    if (op == opcode::le || op == opcode::ge) {
+      if (bound == (op == opcode::le ? max : min)) {
+        // always true
+        return false;
+      }
+      bound += op == opcode::le ? 1 : -1;
+      op = op == opcode::le ? opcode::lt : opcode::gt;
+    }
+    count = 0;
+    switch (op) {
+      case opcode::lt: {
+        if (init >= bound) {
+          return true;
+        }
+        if (step <= 0) {
+          return false;
+        }
+        auto s = bits(step);
+        count = (bits(bound) - bits(init) - 1) / s + 1;
+        // the last value that passes the test must step without wrapping
+        auto last = static_cast<std::int64_t>(bits(init) + (count - 1) * s);
+        return last <= max - step;
+      }
+      case opcode::gt: {
+        if (init <= bound) {
+          return true;
+        }
+        if (step >= 0) {
+          return false;
+        }
+        auto s = 0 - bits(step);
+        count = (bits(init) - bits(bound) - 1) / s + 1;
+        auto last = static_cast<std::int64_t>(bits(init) - (count - 1) * s);
+        return last >= static_cast<std::int64_t>(bits(min) + s);
+      }
+      case opcode::eq:
+        // a step other than 0 leaves the bound at once
+        count = init == bound;
+        return init != bound || step != 0;
+      case opcode::ne: {
+        if (init == bound) {
+          return true;
+        }
+        // the bound must be met exactly, going toward it
+        if (step > 0 && init < bound) {
+          auto d = bits(bound) - bits(init);
+          count = d / bits(step);
+          return d % bits(step) == 0;
+        }
+        if (step < 0 && init > bound) {
+          auto d = bits(init) - bits(bound);
+          count = d / (0 - bits(step));
+          return d % (0 - bits(step)) == 0;
+        }
+        return false;
+      }
+      default:
+        return false;
+    }
+  }
+
+  bool straight_run(function const &f, loop_info const &loop,
+                    std::vector<block_id> &run) {
+    auto const &g = f.graph;
+    if (loop.body == no_block || loop.latch == no_block) {
+      return false;
+    }
+    run.assign(1, loop.body);
+    while (run.back() != loop.latch && run.size() < loop.blocks.size() &&
+           g.succs(run.back()).size() == 1 &&
+           f.instrs[f.terminator(run.back())].op == opcode::jump) {
+      run.push_back(g.succs(run.back())[0]);
+    }
+    if (run.back() != loop.latch || run.size() + 1 != loop.blocks.size() ||
+        f.instrs[f.terminator(loop.latch)].op != opcode::jump) {
+      return false;
+    }
+    return std::ranges::all_of(
+        run, [&](block_id b) { return g.preds(b).size() == 1; });
+  }
+
+  loop_nest::loop_nest(function const &f)
+      : order_{reverse_postorder(f.graph, 0)}, dom_{f.graph, order_},
+        forest_{f.graph, order_, dom_}, loops_(forest_.size()),
+        block_of_{blocks_of(f)} {
+    auto const &g = f.graph;
+    for (std::uint32_t l = 0; l < loops_.size(); l++) {
+      auto &loop = loops_[l];
+      loop.header = forest_[l].header;
+      loop.parent = forest_[l].parent;
+      loop.depth = forest_[l].depth;
+      if (loop.parent != loop_forest::no_loop) {
+        loops_[loop.parent].innermost = false;
+      }
+    }
+    for (block_id b = 0; b < g.size(); b++) {
+      for (auto l = forest_.loop_of(b); l != loop_forest::no_loop;
+           l = loops_[l].parent) {
+        loops_[l].blocks.push_back(b);
+      }
+    }
+
+    for (std::uint32_t l = 0; l < loops_.size(); l++) {
+      auto &loop = loops_[l];
+      std::size_t entries = 0, back = 0;
+      for (auto p : g.preds(loop.header)) {
+        if (contains(l, p)) {
+          loop.latch = p;
+          back++;
+        } else {
+          loop.preheader = p;
+          entries++;
+        }
+      }
+      if (back != 1) {
+        loop.latch = no_block;
+      }
+      if (entries != 1 || g.succs(loop.preheader).size() != 1 ||
+          f.instrs[f.terminator(loop.preheader)].op != opcode::jump) {
+        loop.preheader = no_block;
+      }
+      for (auto b : loop.blocks) {
+        for (auto s : g.succs(b)) {
+          if (!contains(l, s)) {
+            loop.exits.push_back(s);
+          }
+        }
+      }
+      std::ranges::sort(loop.exits);
+      auto [end, last] = std::ranges::unique(loop.exits);
+      loop.exits.erase(end, last);
+      find_induction_variables(f, loop);
+      find_test(f, l);
+    }
+  }
+
+  void loop_nest::find_induction_variables(function const &f,
+                                           loop_info &loop) {
+    if (loop.preheader == no_block || loop.latch == no_block) {
+      return;
+    }
+    auto preds = f.graph.preds(loop.header);
+    std::size_t entry = 0, latch = 0;
+    for (std::size_t k = 0; k < preds.size(); k++) {
+      (preds[k] == loop.preheader ? entry : latch) = k;
+    }
+    for (auto p : f.values_of(loop.header)) {
+      auto const &i = f.instrs[p];
+      if (i.op != opcode::phi) {
+        break;
+      }
+      auto ops = f.operands_of(p);
+      auto next = ops[latch];
+      auto args = f.operands_of(next);
+      std::int64_t c;
+      if (i.type->kind != type_kind::int_type ||
+          (f.instrs[next].op != opcode::add &&
+           f.instrs[next].op != opcode::sub)) {
+        continue;
+      }
+      if (args[0] == p && int_constant(f, args[1], c)) {
+        if (f.instrs[next].op == opcode::sub) {
+          c = static_cast<std::int64_t>(0 - static_cast<std::uint64_t>(c));
+        }
+      } else if (f.instrs[next].op != opcode::add || args[1] != p ||
+                 !int_constant(f, args[0], c)) {
+        continue;
+      }
+      loop.ivs.push_back({p, ops[entry], next, c});
+    }
+  }
+
+  void loop_nest::find_test(function const &f, std::uint32_t l) {
+    auto &loop = loops_[l];
+    auto h = loop.header;
+    auto t = f.terminator(h);
+    auto succs = f.graph.succs(h);
+    if (f.instrs[t].op != opcode::branch ||
+        contains(l, succs[0]) == contains(l, succs[1])) {
+      return;
+    }
+    auto inside = contains(l, succs[0]);
+    loop.body = succs[inside ? 0 : 1];
+
+    auto cond = f.operands_of(t)[0];
+    auto op = f.instrs[cond].op;
+    if (!is_compare(op)) {
+      return;
+    }
+    auto args = f.operands_of(cond);
+    auto invariant = [&](value_id v) {
+      return f.instrs[v].op == opcode::constant ||
+             !contains(l, block_of_[v]);
+    };
+    for (std::uint32_t k = 0; k < loop.ivs.size(); k++) {
+      auto const &iv = loop.ivs[k];
+      if (args[0] == iv.phi && invariant(args[1])) {
+        loop.bound = args[1];
+      } else if (args[1] == iv.phi && invariant(args[0])) {
+        loop.bound = args[0];
+        op = mirror(op);
+      } else {
+        continue;
+      }
+      loop.tested = k;
+      // the loop goes on while the comparison holds, or while it fails
+      loop.test = inside ? op : negate(op);
+      break;
+    }
+    if (loop.tested == loop_forest::no_loop) {
+      return;
+    }
+
+    // only the header may leave the loop
+    for (auto b : loop.blocks) {
+      if (b != h && f.instrs[f.terminator(b)].op == opcode::ret) {
+        return;
+      }
+      for (auto s : f.graph.succs(b)) {
+        if (b != h && !contains(l, s)) {
+          return;
+        }
+      }
+    }
+    auto const &iv = loop.ivs[loop.tested];
+    std::int64_t init, bound;
+    std::uint64_t count;
+    if (int_constant(f, iv.init, init) &&
+        int_constant(f, loop.bound, bound) &&
+        trip_count(loop.test, init, iv.step, bound, count)) {
+      loop.trip_count = count;
+    }
+  }
+
+} // namespace soda::ir
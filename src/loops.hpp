@@ -0,0 +1,124 @@
+#pragma once
+
+#include "ir.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace soda::ir {
+
+  //
+  // Loop analysis
+  //
+  // The natural loops of a function (see loop_forest) with what the loop
+  // passes need to know about them: their blocks; the preheader, the one
+  // block outside a loop that enters it, which leads nowhere else, so code
+  // placed at its end runs once before the loop; the latch, the one block
+  // inside that goes back to the header; and the blocks the loop exits to.
+  //
+  // A basic induction variable is an int phi in the header of a loop with
+  // a preheader and a latch, which the latch brings a constant step
+  // further by adding or subtracting. When the header is the only way out
+  // of the loop and ends in a branch on a comparison of such a variable
+  // with a constant, and the variable starts at a constant, the number of
+  // times the loop goes around follows from the start, the step and the
+  // bound, unless the variable would wrap around before the test fails.
+  //
+
+  struct induction_variable {
+    value_id phi = no_value;
+    // the value from the preheader, and the value from the latch
+    value_id init = no_value;
+    value_id next = no_value;
+    std::int64_t step = 0;
+  };
+
+  struct loop_info {
+    static constexpr std::uint64_t unknown =
+        std::numeric_limits<std::uint64_t>::max();
+
+    block_id header = no_block;
+    block_id preheader = no_block;
+    block_id latch = no_block;
+    // the innermost enclosing loop, or loop_forest::no_loop
+    std::uint32_t parent = loop_forest::no_loop;
+    std::uint32_t depth = 1;
+    bool innermost = true;
+    // in order
+    std::vector<block_id> blocks;
+    std::vector<block_id> exits;
+    std::vector<induction_variable> ivs;
+    // for a header that tests whether to go around: the successor inside
+    // the loop, and, if the test compares an induction variable with a
+    // constant or a value from outside, the index in ivs of the variable,
+    // the
+    // comparison that holds while the loop goes on and its right operand
+    block_id body = no_block;
+    std::uint32_t tested = loop_forest::no_loop;
+    opcode test = opcode::ne;
+    value_id bound = no_value;
+    // how often the header goes on to the body
+    std::uint64_t trip_count = unknown;
+  };
+
+  class loop_nest {
+  public:
+    explicit loop_nest(function const &f);
+
+    std::size_t size() const noexcept {
+      return loops_.size();
+    }
+
+    loop_info const &operator[](std::uint32_t l) const noexcept {
+      return loops_[l];
+    }
+
+    std::uint32_t loop_of(block_id b) const noexcept {
+      return forest_.loop_of(b);
+    }
+
+    // Whether loop l contains block b, directly or in an inner loop.
+    bool contains(std::uint32_t l, block_id b) const noexcept {
+      for (auto k = forest_.loop_of(b); k != loop_forest::no_loop;
+           k = loops_[k].parent) {
+        if (k == l) {
+          return true;
+        }
+      }
+      return false;
+    }
+
+    block_order const &order() const noexcept {
+      return order_;
+    }
+
+    dominator_tree const &dominators() const noexcept {
+      return dom_;
+    }
+
+  private:
+    block_order order_;
+    dominator_tree dom_;
+    loop_forest forest_;
+    std::vector<loop_info> loops_;
+    std::vector<block_id> block_of_;
+
+    void find_induction_variables(function const &f, loop_info &loop);
+    void find_test(function const &f, std::uint32_t l);
+  };
+
+  // How often a loop that goes on while an int starting at init and moving
+  // by step compares with bound as op does goes around, or false if that
+  // is not known or the int would wrap around first.
+  bool trip_count(opcode op, std::int64_t init, std::int64_t step,
+                  std::int64_t bound, std::uint64_t &count);
+
+  // The blocks of a loop after its header, from the body to the latch, if
+  // they are a run of blocks each jumping to the next with no other way
+  // in. Returns false otherwise.
+  bool straight_run(function const &f, loop_info const &loop,
+                    std::vector<block_id> &run);
+
+} // namespace soda::ir
@@ -0,0 +1,1081 @@
+#include "lower.hpp"
+
+#include "utils.hpp"
+
+#include <bit>
+#include <cassert>
+#include <initializer_list>
+#include <span>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace soda {
+
+  namespace {
+
+    using ir::no_value;
+    using ir::opcode;
+    using ir::value_id;
+
+    type const *primitive(type_kind kind) {
+      return type_table::primitive(kind);
+    }
+
+    // An open-addressing map from nonzero 64-bit keys to values, for the
+    // lookups of variable definitions that lowering does for most
+    // instructions it emits.
+    class definition_map {
+    public:
+      value_id find(std::uint64_t key) const noexcept {
+        for (auto i = slot(key);; i = (i + 1) & mask()) {
+          if (slots_[i].key == key) {
+            return slots_[i].value;
+          }
+          if (slots_[i].key == 0) {
+            return no_value;
+          }
+        }
+      }
+
+      void set(std::uint64_t key, value_id value) {
+        if (2 * (size_ + 1) > slots_.size()) {
+          grow();
+        }
+        auto i = slot(key);
+        while (slots_[i].key != key && slots_[i].key != 0) {
+          i = (i + 1) & mask();
+        }
+        size_ += slots_[i].key == 0;
+        slots_[i] = {key, value};
+      }
+
+    private:
+      struct entry {
+        std::uint64_t key = 0;
+        value_id value = no_value;
+      };
+
+      std::vector<entry> slots_ = std::vector<entry>(64);
+      std::size_t size_ = 0;
+
+      std::size_t mask() const noexcept {
+        return slots_.size() - 1;
+      }
+
+      std::size_t slot(std::uint64_t key) const noexcept {
+        return (key * 0x9e3779b97f4a7c15ull >> 32) & mask();
+      }
+
+      void grow() {
+        auto old = std::exchange(slots_, std::vector<entry>(2 * slots_.size()));
+        size_ = 0;
+        for (auto const &e : old) {
+          if (e.key != 0) {
+            set(e.key, e.value);
+          }
+        }
+      }
+    };
+
+    class lowerer {
+    public:
+      explicit lowerer(ast::fun_decl const &f) : fun_{f} {
+      }
+
+      ir::function run();
+
+    private:
+      using var_id = std::uint32_t;
+
+      struct block_state {
+        std::vector<value_id> phis;
+        // the other instructions, a slice of body_: a block is filled in
+        // one go, so its instructions are emitted back to back
+        std::uint32_t first = 0;
+        std::uint32_t count = 0;
+        std::vector<block_id> preds;
+        // each successor with the position of this block among its
+        // predecessors, in the order of the terminator's targets
+        std::vector<std::pair<block_id, std::uint32_t>> succs;
+        // phis that wait for the predecessors to be known
+        std::vector<std::pair<var_id, value_id>> incomplete;
+        bool sealed = false;
+        // the lookup that last passed through the block
+        std::uint32_t visited = 0;
+      };
+
+      // a statement that break or continue can leave
+      struct jump_target {
+        ast::stmt const *stmt;
+        block_id break_to;
+        block_id continue_to;
+      };
+
+      // a variable or array element being assigned
+      struct place {
+        ast::decl const *decl = nullptr;
+        value_id array = no_value;
+        value_id index = no_value;
+        soda::type const *type = nullptr;
+      };
+
+      // a phi whose operands are still being looked up
+      struct lookup_frame {
+        block_id b;
+        value_id phi;
+        std::uint32_t next;
+      };
+
+      ast::fun_decl const &fun_;
+      std::vector<ir::instr> instrs_;
+      std::vector<value_id> operands_;
+      // the operands of the phis, which grow as lookups proceed; a phi's
+      // first field indexes this
+      std::vector<std::vector<value_id>> phi_operands_;
+      // the value that replaces a trivial phi
+      std::vector<value_id> replaced_;
+      // undefined values found by lookups, placed at the start of the entry
+      // block
+      std::vector<value_id> undefs_;
+      std::vector<value_id> body_;
+      std::vector<block_state> blocks_;
+      block_id current_ = no_block;
+      std::vector<jump_target> targets_;
+      std::unordered_map<ast::label_stmt const *, block_id> labels_;
+
+      std::unordered_map<ast::decl const *, var_id> vars_;
+      std::vector<type const *> var_types_;
+      // the value of a variable at the end of a block, keyed by both
+      definition_map defs_;
+      std::vector<lookup_frame> lookups_;
+      std::uint32_t lookup_count_ = 0;
+
+      std::unordered_map<ast::decl const *, std::uint32_t> symbol_index_;
+      std::vector<ast::decl const *> symbols_;
+      std::vector<std::string_view> strings_;
+
+      //
+      // Instructions and blocks
+      //
+
+      value_id make(opcode op, type const *type,
+                    std::span<value_id const> operands,
+                    std::uint64_t imm = 0) {
+        auto v = static_cast<value_id>(instrs_.size());
+        auto first = static_cast<std::uint32_t>(operands_.size());
+        auto count = static_cast<std::uint32_t>(operands.size());
+        instrs_.push_back(ir::instr{op, first, count, type, imm});
+        operands_.insert(operands_.end(), operands.begin(), operands.end());
+        replaced_.push_back(no_value);
+        return v;
+      }
+
+      value_id emit(opcode op, type const *type,
+                    std::span<value_id const> operands,
+                    std::uint64_t imm = 0) {
+        auto b = current();
+        auto v = make(op, type, operands, imm);
+        auto &state = blocks_[b];
+        if (state.count == 0) {
+          state.first = static_cast<std::uint32_t>(body_.size());
+        }
+        assert(state.first + state.count == body_.size() &&
+               "a block filled in two parts");
+        ++state.count;
+        body_.push_back(v);
+        return v;
+      }
+
+      value_id emit(opcode op, type const *type,
+                    std::initializer_list<value_id> operands = {},
+                    std::uint64_t imm = 0) {
+        return emit(op, type, std::span{operands.begin(), operands.size()},
+                    imm);
+      }
+
+      value_id constant(type const *type, std::uint64_t bits) {
+        return emit(opcode::constant, type, {}, bits);
+      }
+
+      // An undefined value for a lookup in block b. Only the entry and
+      // unreachable blocks have no predecessors, and the latter are dropped
+      // with their instructions, so only the entry needs the value.
+      value_id undef(type const *type, block_id b = 0) {
+        auto v = make(opcode::undef, type, {});
+        if (b == 0) {
+          undefs_.push_back(v);
+        }
+        return v;
+      }
+
+      std::uint32_t symbol(ast::decl const *d) {
+        auto [it, inserted] = symbol_index_.try_emplace(
+            d, static_cast<std::uint32_t>(symbols_.size()));
+        if (inserted) {
+          symbols_.push_back(d);
+        }
+        return it->second;
+      }
+
+      block_id new_block() {
+        blocks_.emplace_back();
+        return static_cast<block_id>(blocks_.size() - 1);
+      }
+
+      void edge(block_id from, block_id to) {
+        assert(!blocks_[to].sealed && "predecessors of a sealed block");
+        blocks_[from].succs.emplace_back(
+            to, static_cast<std::uint32_t>(blocks_[to].preds.size()));
+        blocks_[to].preds.push_back(from);
+      }
+
+      // Leave the current block, if reachable, for block b.
+      void jump(block_id b) {
+        if (current_ != no_block) {
+          emit(opcode::jump, primitive(type_kind::void_type));
+          edge(current_, b);
+          current_ = no_block;
+        }
+      }
+
+      void branch(value_id cond, block_id t, block_id f) {
+        auto b = current();
+        emit(opcode::branch, primitive(type_kind::void_type), {cond});
+        edge(b, t);
+        edge(b, f);
+        current_ = no_block;
+      }
+
+      // Continue in block b, falling through from the current block.
+      void start(block_id b) {
+        jump(b);
+        current_ = b;
+      }
+
+      // The block being filled; code after a jump starts a new block that
+      // nothing leads to.
+      block_id current() {
+        if (current_ == no_block) {
+          current_ = new_block();
+          seal(current_);
+        }
+        return current_;
+      }
+
+      block_id label_block(ast::label_stmt const *label) {
+        auto [it, inserted] = labels_.try_emplace(label, no_block);
+        if (inserted) {
+          it->second = new_block();
+        }
+        return it->second;
+      }
+
+      jump_target const *find_target(ast::stmt const *s) const {
+        for (auto t = targets_.rbegin(); t != targets_.rend(); ++t) {
+          if (t->stmt == s) {
+            return &*t;
+          }
+        }
+        return nullptr;
+      }
+
+      //
+      // SSA construction
+      //
+
+      var_id variable(ast::decl const *d) {
+        auto [it, inserted] =
+            vars_.try_emplace(d, static_cast<var_id>(var_types_.size()));
+        if (inserted) {
+          var_types_.push_back(d->canonical);
+        }
+        return it->second;
+      }
+
+      var_id temporary(type const *type) {
+        var_types_.push_back(type);
+        return static_cast<var_id>(var_types_.size() - 1);
+      }
+
+      // never 0, which marks a free slot
+      static std::uint64_t key(var_id v, block_id b) {
+        return (std::uint64_t{v} + 1) << 32 | b;
+      }
+
+      value_id resolve(value_id v) {
+        auto root = v;
+        while (replaced_[root] != no_value) {
+          root = replaced_[root];
+        }
+        while (replaced_[v] != no_value) {
+          v = std::exchange(replaced_[v], root);
+        }
+        return root;
+      }
+
+      void write(var_id v, block_id b, value_id value) {
+        defs_.set(key(v, b), value);
+      }
+
+      value_id new_phi(block_id b, type const *type) {
+        auto v = make(opcode::phi, type, {});
+        instrs_[v].first = static_cast<std::uint32_t>(phi_operands_.size());
+        phi_operands_.emplace_back();
+        blocks_[b].phis.push_back(v);
+        return v;
+      }
+
+      value_id remove_trivial_phi(value_id phi);
+      value_id read(var_id v, block_id b);
+      void seal(block_id b);
+
+      // A phi in join with the value coming from each predecessor.
+      value_id merge(block_id join, type const *type,
+                     std::initializer_list<std::pair<block_id, value_id>> in);
+
+      //
+      // Expressions and statements
+      //
+
+      value_id value(ast::expr const &e);
+      value_id unop(ast::unop_expr const &n);
+      value_id binop(ast::binop_expr const &n);
+      value_id short_circuit(ast::binop_expr const &n);
+      value_id select(ast::if_expr const &n);
+      void condition(ast::expr const &e, block_id t, block_id f);
+
+      place locate(ast::expr const &target);
+      value_id load(place const &p);
+      void store(place const &p, value_id value);
+
+      void lower(ast::stmt::ptr const &s);
+      void lower_loop_body(ast::stmt const &loop, ast::stmt::ptr const &body,
+                           block_id break_to, block_id continue_to);
+      void lower_switch(ast::switch_stmt const &n);
+      void lower_foreach(ast::foreach_stmt const &n);
+
+      ir::function finish();
+    };
+
+    // A phi whose operands are all the same value, or itself, stands for
+    // that value.
+    value_id lowerer::remove_trivial_phi(value_id phi) {
+      auto same = no_value;
+      for (auto &o : phi_operands_[instrs_[phi].first]) {
+        o = resolve(o);
+        if (o == same || o == phi) {
+          continue;
+        }
+        if (same != no_value) {
+          return phi;
+        }
+        same = o;
+      }
+      if (same == no_value) {
+        // only reached through itself
+        same = undef(instrs_[phi].type);
+      }
+      replaced_[phi] = same;
+      return same;
+    }
+
+    // The value of v at the end of b. This is the recursive lookup of the
+    // algorithm with an explicit stack, as chains of predecessors can be as
+    // long as the function.
+    value_id lowerer::read(var_id v, block_id b) {
+      auto base = lookups_.size();
+      auto stamp = ++lookup_count_;
+      auto type = var_types_[v];
+      auto result = no_value;
+      for (;;) {
+        if (result == no_value) {
+          if (auto def = defs_.find(key(v, b)); def != no_value) {
+            result = resolve(def);
+          } else if (auto &blk = blocks_[b]; !blk.sealed) {
+            result = new_phi(b, type);
+            blk.incomplete.emplace_back(v, result);
+            write(v, b, result);
+          } else if (blk.preds.empty()) {
+            result = undef(type, b);
+            write(v, b, result);
+          } else if (blk.preds.size() == 1) {
+            if (blk.visited == stamp) {
+              // a cycle of single predecessors, which the entry cannot
+              // reach
+              result = undef(type);
+            } else {
+              blk.visited = stamp;
+              lookups_.push_back({b, no_value, 0});
+              b = blk.preds[0];
+              continue;
+            }
+          } else {
+            auto phi = new_phi(b, type);
+            write(v, b, phi);
+            lookups_.push_back({b, phi, 0});
+            b = blk.preds[0];
+            continue;
+          }
+        }
+
+        if (lookups_.size() == base) {
+          return result;
+        }
+        auto &frame = lookups_.back();
+        if (frame.phi == no_value) {
+          write(v, frame.b, result);
+          lookups_.pop_back();
+          continue;
+        }
+        phi_operands_[instrs_[frame.phi].first].push_back(result);
+        auto const &preds = blocks_[frame.b].preds;
+        if (++frame.next < preds.size()) {
+          b = preds[frame.next];
+          result = no_value;
+          continue;
+        }
+        result = remove_trivial_phi(frame.phi);
+        write(v, frame.b, result);
+        lookups_.pop_back();
+      }
+    }
+
+    // All predecessors of b are known: complete its phis.
+    void lowerer::seal(block_id b) {
+      blocks_[b].sealed = true;
+      auto incomplete = std::move(blocks_[b].incomplete);
+      for (auto [v, phi] : incomplete) {
+        for (std::size_t k = 0; k < blocks_[b].preds.size(); k++) {
+          auto value = read(v, blocks_[b].preds[k]);
+          phi_operands_[instrs_[phi].first].push_back(value);
+        }
+        remove_trivial_phi(phi);
+      }
+    }
+
+    value_id lowerer::merge(
+        block_id join, type const *type,
+        std::initializer_list<std::pair<block_id, value_id>> in) {
+      auto phi = new_phi(join, type);
+      for (auto p : blocks_[join].preds) {
+        for (auto [from, value] : in) {
+          if (from == p) {
+            phi_operands_[instrs_[phi].first].push_back(value);
+          }
+        }
+      }
+      return remove_trivial_phi(phi);
+    }
+
+    //
+    // Expressions
+    //
+
+    value_id lowerer::value(ast::expr const &e) {
+      auto type = e.type_of();
+      switch (e.kind) {
+        case ast::node_kind::bool_expr:
+          return constant(type, static_cast<ast::bool_expr const &>(e).value);
+        case ast::node_kind::int_expr:
+          return constant(type, static_cast<ast::int_expr const &>(e).value);
+        case ast::node_kind::float_expr:
+          return constant(type, std::bit_cast<std::uint64_t>(
+                                    static_cast<ast::float_expr const &>(e)
+                                        .value));
+        case ast::node_kind::char_expr:
+          return constant(type, static_cast<ast::char_expr const &>(e).value);
+        case ast::node_kind::string_expr:
+          strings_.push_back(static_cast<ast::string_expr const &>(e).value);
+          return constant(type, strings_.size() - 1);
+        case ast::node_kind::ident_expr: {
+          auto const &n = static_cast<ast::ident_expr const &>(e);
+          if (n.ref->kind == ast::node_kind::fun_decl) {
+            return emit(opcode::function, type, {}, symbol(n.ref));
+          }
+          return load(locate(n));
+        }
+        case ast::node_kind::unop_expr:
+          return unop(static_cast<ast::unop_expr const &>(e));
+        case ast::node_kind::binop_expr:
+          return binop(static_cast<ast::binop_expr const &>(e));
+        case ast::node_kind::if_expr:
+          return select(static_cast<ast::if_expr const &>(e));
+        case ast::node_kind::call_expr: {
+          auto const &n = static_cast<ast::call_expr const &>(e);
+          std::vector<value_id> operands;
+          operands.reserve(n.arguments.size() + 1);
+          operands.push_back(value(*n.callee));
+          for (auto const &arg : n.arguments) {
+            operands.push_back(value(*arg));
+          }
+          return emit(opcode::call, type, operands);
+        }
+        default:
+          unreachable();
+      }
+    }
+
+    value_id lowerer::unop(ast::unop_expr const &n) {
+      auto type = n.type_of();
+      switch (n.op) {
+        case operator_kind::pos:
+          return value(*n.operand);
+        case operator_kind::pre_inc:
+        case operator_kind::pre_dec:
+        case operator_kind::post_inc:
+        case operator_kind::post_dec: {
+          auto p = locate(*n.operand);
+          auto old = load(p);
+          auto one = type->kind == type_kind::float_type
+                         ? constant(type, std::bit_cast<std::uint64_t>(1.0))
+                         : constant(type, 1);
+          auto inc = n.op == operator_kind::pre_inc ||
+                     n.op == operator_kind::post_inc;
+          auto updated =
+              emit(inc ? opcode::add : opcode::sub, type, {old, one});
+          store(p, updated);
+          return n.op == operator_kind::pre_inc ||
+                         n.op == operator_kind::pre_dec
+                     ? updated
+                     : old;
+        }
+        default:
+          return emit(ir::to_opcode(n.op), type, {value(*n.operand)});
+      }
+    }
+
+    value_id lowerer::binop(ast::binop_expr const &n) {
+      auto type = n.type_of();
+      switch (n.op) {
+        case operator_kind::assign: {
+          auto p = locate(*n.lhs);
+          auto v = value(*n.rhs);
+          store(p, v);
+          return v;
+        }
+        case operator_kind::add_assign:
+        case operator_kind::sub_assign:
+        case operator_kind::mul_assign:
+        case operator_kind::div_assign:
+        case operator_kind::mod_assign:
+        case operator_kind::and_assign:
+        case operator_kind::xor_assign:
+        case operator_kind::or_assign:
+        case operator_kind::lshift_assign:
+        case operator_kind::rshift_assign: {
+          auto p = locate(*n.lhs);
+          auto old = load(p);
+          auto rhs = value(*n.rhs);
+          auto v = emit(ir::to_opcode(assignment_operator(n.op)), type,
+                        {old, rhs});
+          store(p, v);
+          return v;
+        }
+        case operator_kind::log_and:
+        case operator_kind::log_or:
+          return short_circuit(n);
+        case operator_kind::comma:
+          value(*n.lhs);
+          return value(*n.rhs);
+        case operator_kind::member:
+          // length is the only member
+          return emit(opcode::length, type, {value(*n.lhs)});
+        default: {
+          auto lhs = value(*n.lhs);
+          auto rhs = value(*n.rhs);
+          return emit(ir::to_opcode(n.op), type, {lhs, rhs});
+        }
+      }
+    }
+
+    value_id lowerer::short_circuit(ast::binop_expr const &n) {
+      auto rhs_block = new_block();
+      auto join = new_block();
+      auto lhs = value(*n.lhs);
+      auto lhs_end = current();
+      // the left operand is the result when it decides
+      if (n.op == operator_kind::log_and) {
+        branch(lhs, rhs_block, join);
+      } else {
+        branch(lhs, join, rhs_block);
+      }
+      seal(rhs_block);
+      start(rhs_block);
+      auto rhs = value(*n.rhs);
+      auto rhs_end = current();
+      jump(join);
+      seal(join);
+      start(join);
+      return merge(join, n.type_of(), {{lhs_end, lhs}, {rhs_end, rhs}});
+    }
+
+    value_id lowerer::select(ast::if_expr const &n) {
+      auto cons_block = new_block();
+      auto altn_block = new_block();
+      auto join = new_block();
+      condition(*n.cond, cons_block, altn_block);
+      seal(cons_block);
+      seal(altn_block);
+      start(cons_block);
+      auto cons = value(*n.cons);
+      auto cons_end = current();
+      jump(join);
+      start(altn_block);
+      auto altn = value(*n.altn);
+      auto altn_end = current();
+      jump(join);
+      seal(join);
+      start(join);
+      return merge(join, n.type_of(), {{cons_end, cons}, {altn_end, altn}});
+    }
+
+    // Branch to t if e is true and to f otherwise, short-circuiting && and
+    // || into branches rather than computing their value.
+    void lowerer::condition(ast::expr const &e, block_id t, block_id f) {
+      if (e.kind == ast::node_kind::bool_expr) {
+        jump(static_cast<ast::bool_expr const &>(e).value ? t : f);
+        return;
+      }
+      if (e.kind == ast::node_kind::unop_expr) {
+        auto const &n = static_cast<ast::unop_expr const &>(e);
+        if (n.op == operator_kind::log_not) {
+          condition(*n.operand, f, t);
+          return;
+        }
+      }
+      if (e.kind == ast::node_kind::binop_expr) {
+        auto const &n = static_cast<ast::binop_expr const &>(e);
+        if (n.op == operator_kind::log_and || n.op == operator_kind::log_or) {
+          auto rhs_block = new_block();
+          if (n.op == operator_kind::log_and) {
+            condition(*n.lhs, rhs_block, f);
+          } else {
+            condition(*n.lhs, t, rhs_block);
+          }
+          seal(rhs_block);
+          start(rhs_block);
+          condition(*n.rhs, t, f);
+          return;
+        }
+      }
+      branch(value(e), t, f);
+    }
+
+    // Evaluate the array and index of an element being assigned, once.
+    lowerer::place lowerer::locate(ast::expr const &target) {
+      place p;
+      p.type = target.type_of();
+      if (target.kind == ast::node_kind::ident_expr) {
+        p.decl = static_cast<ast::ident_expr const &>(target).ref;
+      } else {
+        auto const &n = static_cast<ast::binop_expr const &>(target);
+        p.array = value(*n.lhs);
+        p.index = value(*n.rhs);
+      }
+      return p;
+    }
+
+    value_id lowerer::load(place const &p) {
+      if (!p.decl) {
+        return emit(opcode::index, p.type, {p.array, p.index});
+      }
+      if (auto it = vars_.find(p.decl); it != vars_.end()) {
+        return read(it->second, current());
+      }
+      return emit(opcode::load_global, p.type, {}, symbol(p.decl));
+    }
+
+    void lowerer::store(place const &p, value_id value) {
+      auto void_type = primitive(type_kind::void_type);
+      if (!p.decl) {
+        emit(opcode::store_index, void_type, {p.array, p.index, value});
+      } else if (auto it = vars_.find(p.decl); it != vars_.end()) {
+        write(it->second, current(), value);
+      } else {
+        emit(opcode::store_global, void_type, {value}, symbol(p.decl));
+      }
+    }
+
+    //
+    // Statements
+    //
+
+    void lowerer::lower_loop_body(ast::stmt const &loop,
+                                  ast::stmt::ptr const &body,
+                                  block_id break_to, block_id continue_to) {
+      targets_.push_back(jump_target{&loop, break_to, continue_to});
+      lower(body);
+      targets_.pop_back();
+    }
+
+    void lowerer::lower_switch(ast::switch_stmt const &n) {
+      std::vector<value_id> operands{value(*n.exp)};
+      std::vector<block_id> cases;
+      auto end = new_block();
+      auto fallback = end;
+      for (auto const &c : n.cases) {
+        if (c->kind != ast::node_kind::case_stmt) {
+          continue;
+        }
+        auto const &cs = static_cast<ast::case_stmt const &>(*c);
+        cases.push_back(new_block());
+        if (cs.is_default_case()) {
+          fallback = cases.back();
+        } else {
+          operands.push_back(value(*cs.exp));
+        }
+      }
+
+      auto dispatch = current();
+      emit(opcode::switch_, primitive(type_kind::void_type), operands);
+      std::size_t i = 0;
+      for (auto const &c : n.cases) {
+        if (c->kind == ast::node_kind::case_stmt) {
+          if (!static_cast<ast::case_stmt const &>(*c).is_default_case()) {
+            edge(dispatch, cases[i]);
+          }
+          i++;
+        }
+      }
+      edge(dispatch, fallback);
+      current_ = no_block;
+
+      // cases fall through into the next one unless they jump
+      targets_.push_back(jump_target{&n, end, no_block});
+      i = 0;
+      for (auto const &c : n.cases) {
+        if (c->kind != ast::node_kind::case_stmt) {
+          continue;
+        }
+        start(cases[i]);
+        seal(cases[i++]);
+        for (auto const &child : static_cast<ast::case_stmt &>(*c).stmts) {
+          lower(child);
+        }
+      }
+      targets_.pop_back();
+      start(end);
+      seal(end);
+    }
+
+    // foreach (x: a) s walks a hidden index i over a:
+    //
+    //   i = 0; head: if (i < a.length) { x = a[i]; s; next: i++; goto head; }
+    void lowerer::lower_foreach(ast::foreach_stmt const &n) {
+      auto int_type = primitive(type_kind::int_type);
+      auto array = value(*n.exp);
+      auto length = emit(opcode::length, int_type, {array});
+      auto index = temporary(int_type);
+      write(index, current(), constant(int_type, 0));
+
+      auto head = new_block();
+      auto body = new_block();
+      auto next = new_block();
+      auto end = new_block();
+      start(head);
+      auto i = read(index, head);
+      branch(emit(opcode::lt, primitive(type_kind::bool_type), {i, length}),
+             body, end);
+      seal(body);
+      start(body);
+      // the test above keeps the index in bounds
+      auto element = emit(opcode::index, n.iter->canonical, {array, i}, 1);
+      write(variable(n.iter.get()), body, element);
+      lower_loop_body(n, n.stmt, end, next);
+      start(next);
+      seal(next);
+      write(index, next,
+            emit(opcode::add, int_type,
+                 {read(index, next), constant(int_type, 1)}));
+      jump(head);
+      seal(head);
+      seal(end);
+      start(end);
+    }
+
+    void lowerer::lower(ast::stmt::ptr const &s) {
+      if (!s) {
+        return;
+      }
+      switch (s->kind) {
+        case ast::node_kind::expr_stmt:
+          value(*static_cast<ast::expr_stmt const &>(*s).exp);
+          break;
+        case ast::node_kind::let_decl: {
+          auto const &d = static_cast<ast::let_decl const &>(*s);
+          auto init = d.init_exp ? value(*d.init_exp)
+                                 : emit(opcode::undef, d.canonical);
+          write(variable(&d), current(), init);
+          break;
+        }
+        case ast::node_kind::block_stmt:
+          for (auto const &child :
+               static_cast<ast::block_stmt const &>(*s).stmts) {
+            lower(child);
+          }
+          break;
+        case ast::node_kind::label_stmt: {
+          // sealed at the end, as gotos can lead to it from anywhere
+          auto const &n = static_cast<ast::label_stmt const &>(*s);
+          start(label_block(&n));
+          lower(n.stmt);
+          break;
+        }
+        case ast::node_kind::goto_stmt:
+          jump(label_block(static_cast<ast::goto_stmt const &>(*s).target));
+          break;
+        case ast::node_kind::break_stmt:
+          jump(find_target(static_cast<ast::break_stmt const &>(*s).target)
+                   ->break_to);
+          break;
+        case ast::node_kind::continue_stmt:
+          jump(find_target(static_cast<ast::continue_stmt const &>(*s).target)
+                   ->continue_to);
+          break;
+        case ast::node_kind::return_stmt: {
+          auto const &n = static_cast<ast::return_stmt const &>(*s);
+          auto void_type = primitive(type_kind::void_type);
+          if (n.exp) {
+            emit(opcode::ret, void_type, {value(*n.exp)});
+          } else {
+            emit(opcode::ret, void_type);
+          }
+          current_ = no_block;
+          break;
+        }
+        case ast::node_kind::if_stmt: {
+          auto const &n = static_cast<ast::if_stmt const &>(*s);
+          auto cons = new_block();
+          auto altn = n.altn ? new_block() : no_block;
+          auto join = new_block();
+          condition(*n.cond, cons, n.altn ? altn : join);
+          seal(cons);
+          start(cons);
+          lower(n.cons);
+          jump(join);
+          if (n.altn) {
+            seal(altn);
+            start(altn);
+            lower(n.altn);
+            jump(join);
+          }
+          seal(join);
+          start(join);
+          break;
+        }
+        case ast::node_kind::switch_stmt:
+          lower_switch(static_cast<ast::switch_stmt const &>(*s));
+          break;
+        case ast::node_kind::do_stmt: {
+          auto const &n = static_cast<ast::do_stmt const &>(*s);
+          auto body = new_block();
+          auto cond = new_block();
+          auto end = new_block();
+          start(body);
+          lower_loop_body(n, n.stmt, end, cond);
+          start(cond);
+          seal(cond);
+          condition(*n.exp, body, end);
+          seal(body);
+          seal(end);
+          start(end);
+          break;
+        }
+        case ast::node_kind::while_stmt: {
+          auto const &n = static_cast<ast::while_stmt const &>(*s);
+          auto head = new_block();
+          auto body = new_block();
+          auto end = new_block();
+          start(head);
+          condition(*n.exp, body, end);
+          seal(body);
+          start(body);
+          lower_loop_body(n, n.stmt, end, head);
+          jump(head);
+          seal(head);
+          seal(end);
+          start(end);
+          break;
+        }
+        case ast::node_kind::for_stmt: {
+          auto const &n = static_cast<ast::for_stmt const &>(*s);
+          lower(n.init);
+          auto head = new_block();
+          auto body = new_block();
+          auto incr = new_block();
+          auto end = new_block();
+          start(head);
+          if (n.test && n.test->kind == ast::node_kind::expr_stmt) {
+            condition(*static_cast<ast::expr_stmt const &>(*n.test).exp, body,
+                      end);
+          } else {
+            jump(body);
+          }
+          seal(body);
+          start(body);
+          lower_loop_body(n, n.stmt, end, incr);
+          start(incr);
+          seal(incr);
+          lower(n.incr);
+          jump(head);
+          seal(head);
+          seal(end);
+          start(end);
+          break;
+        }
+        case ast::node_kind::foreach_stmt:
+          lower_foreach(static_cast<ast::foreach_stmt const &>(*s));
+          break;
+        default:
+          break;
+      }
+    }
+
+    ir::function lowerer::run() {
+      auto entry = new_block();
+      seal(entry);
+      current_ = entry;
+      for (std::size_t i = 0; i < fun_.params.size(); i++) {
+        auto const &p = *fun_.params[i];
+        write(variable(&p), entry, emit(opcode::param, p.canonical, {}, i));
+      }
+      for (auto const &s : fun_.stmts()) {
+        lower(s);
+      }
+      // falling off the end of the body
+      if (current_ != no_block) {
+        auto result = fun_.canonical->inner;
+        auto void_type = primitive(type_kind::void_type);
+        if (result->kind == type_kind::void_type) {
+          emit(opcode::ret, void_type);
+        } else {
+          emit(opcode::ret, void_type, {emit(opcode::undef, result)});
+        }
+        current_ = no_block;
+      }
+      for (auto const &[label, b] : labels_) {
+        seal(b);
+      }
+      return finish();
+    }
+
+    // Lay out the reachable blocks in the order they were created, with
+    // their phis first, and number the values by their position.
+    ir::function lowerer::finish() {
+      std::vector<block_id> block_ids(blocks_.size(), no_block);
+      {
+        std::vector<block_id> stack{0};
+        block_ids[0] = 0;
+        while (!stack.empty()) {
+          auto b = stack.back();
+          stack.pop_back();
+          for (auto [s, slot] : blocks_[b].succs) {
+            if (block_ids[s] == no_block) {
+              block_ids[s] = 0;
+              stack.push_back(s);
+            }
+          }
+        }
+      }
+      std::vector<block_id> reachable;
+      for (block_id b = 0; b < blocks_.size(); b++) {
+        if (block_ids[b] != no_block) {
+          block_ids[b] = static_cast<block_id>(reachable.size());
+          reachable.push_back(b);
+        }
+      }
+
+      // The edges, and the phi operands reordered to match the predecessors
+      // in the graph, without those of unreachable predecessors.
+      std::vector<flow_graph::edge> edges;
+      std::vector<std::vector<std::uint32_t>> slots(blocks_.size());
+      for (auto b : reachable) {
+        for (auto [s, slot] : blocks_[b].succs) {
+          edges.emplace_back(block_ids[b], block_ids[s]);
+          slots[s].push_back(slot);
+        }
+      }
+      std::vector<value_id> reordered;
+      for (auto b : reachable) {
+        for (auto phi : blocks_[b].phis) {
+          auto &ops = phi_operands_[instrs_[phi].first];
+          reordered.clear();
+          for (auto slot : slots[b]) {
+            reordered.push_back(ops[slot]);
+          }
+          ops.swap(reordered);
+        }
+      }
+      // without their unreachable predecessors more phis can be trivial, as
+      // can phis that depend on trivial ones
+      for (bool changed = true; changed;) {
+        changed = false;
+        for (auto b : reachable) {
+          for (auto phi : blocks_[b].phis) {
+            if (replaced_[phi] == no_value &&
+                remove_trivial_phi(phi) != phi) {
+              changed = true;
+            }
+          }
+        }
+      }
+
+      std::vector<value_id> value_ids(instrs_.size(), no_value);
+      std::vector<value_id> order;
+      order.reserve(instrs_.size());
+      ir::function f;
+      f.fun = &fun_;
+      for (auto b : reachable) {
+        auto first = static_cast<std::uint32_t>(order.size());
+        auto place = [&](value_id v) {
+          value_ids[v] = static_cast<value_id>(order.size());
+          order.push_back(v);
+        };
+        for (auto phi : blocks_[b].phis) {
+          if (replaced_[phi] == no_value) {
+            place(phi);
+          }
+        }
+        if (b == 0) {
+          for (auto v : undefs_) {
+            place(v);
+          }
+        }
+        auto const &state = blocks_[b];
+        for (auto i = state.first; i != state.first + state.count; ++i) {
+          place(body_[i]);
+        }
+        f.blocks.push_back(ir::block{
+            first, static_cast<std::uint32_t>(order.size()) - first});
+      }
+
+      f.instrs.reserve(order.size());
+      f.operands.reserve(operands_.size());
+      for (auto v : order) {
+        auto i = instrs_[v];
+        std::span<value_id const> ops =
+            i.op == opcode::phi
+                ? std::span<value_id const>{phi_operands_[i.first]}
+                : std::span<value_id const>{operands_.data() + i.first,
+                                            i.count};
+        i.first = static_cast<std::uint32_t>(f.operands.size());
+        i.count = static_cast<std::uint32_t>(ops.size());
+        for (auto o : ops) {
+          f.operands.push_back(value_ids[resolve(o)]);
+        }
+        f.instrs.push_back(i);
+      }
+      f.graph = flow_graph{f.blocks.size(), edges};
+      f.symbols = std::move(symbols_);
+      f.strings = std::move(strings_);
+      return f;
+    }
+
+  } // namespace
+
+  ir::function lower(ast::fun_decl const &f) {
+    return lowerer{f}.run();
+  }
+
+} // namespace soda
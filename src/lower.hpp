@@ -0,0 +1,29 @@
+#pragma once
+
+#include "ast.hpp"
+#include "ir.hpp"
+
+namespace soda {
+
+  //
+  // Lowering to SSA form
+  //
+  // Translates the body of a checked function into IR in one pass, with the
+  // SSA construction of Braun et al.: a local variable's value is looked up
+  // in the block being filled and, if it is not assigned there, in its
+  // predecessors, placing a phi where several values meet. A block's
+  // predecessors are only final once the statement around it has been
+  // lowered (and for labels, once the whole body has), so lookups in
+  // earlier blocks leave their phis incomplete until then. Phis that turn
+  // out to merge a single value are replaced by it, which leaves minimal
+  // SSA form for the structured parts of a function.
+  //
+  // && and || become branches, and so does ?:, with a phi for their value.
+  // A foreach loop walks an index over the array. Code that cannot be
+  // reached from the entry is dropped.
+  //
+
+  // The function must have been type-checked without errors.
+  ir::function lower(ast::fun_decl const &f);
+
+} // namespace soda
@@ -1,20 +1,926 @@
 #include "soda.hpp"
 
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <random>
+#include <span>
+#include <spanstream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
 
-int main(int argc, char **argv) {
+namespace {
+
+  enum class action {
+    check,
+    tokens,
+    ast,
+    cfg,
+    ir,
+    c,
+    assembly,
+    build,
+    bytecode,
+    run,
+    bench,
+  };
+
+  enum class backend {
+    c,
+    x86_64,
+  };
+
+  struct options {
+    action act = action::check;
+    soda::parse_options parse;
+    bool fold = false;
+    int opt_level = 0;
+    bool verify_ir = false;
+    std::vector<std::filesystem::path> files;
+    // the executable to build, or the file with --emit-c or --emit-asm
+    std::filesystem::path output;
+    enum backend backend = backend::c;
+    soda::x86_options x86;
+  };
+
+  void usage(std::ostream &out, char const *prog) {
+    out << "usage: " << prog << " [options] [file...]\n"
+        << "\n"
+        << "options:\n"
+        << "  -t, --tokens     print the token stream\n"
+        << "  -a, --ast        print the syntax tree\n"
+        << "      --cfg        print the control-flow graph of each function\n"
+        << "      --ir         print the SSA form of each function\n"
+        << "      --emit-c     print the program as C\n"
+        << "      --emit-asm   print the program as x86-64 assembly\n"
+        << "      --bytecode   print the program as bytecode\n"
+        << "      --run        run the program on the virtual machine\n"
+        << "  -o FILE          build an executable, or with --emit-c or\n"
+        << "                   --emit-asm, write the code to FILE\n"
+        << "      --backend B  build through c, compiled with $CC (default\n"
+        << "                   cc), or x86-64, assembled with $AS (default\n"
+        << "                   as) and linked with $CC\n"
+        << "      --vectors V  vectorize loops in x86-64 code with none,\n"
+        << "                   sse2, or avx2 where the processor has it\n"
+        << "                   (default)\n"
+        << "      --hash-cons  share structurally identical expressions\n"
+        << "      --lazy       parse function bodies on demand\n"
+        << "      --fold       fold constant expressions\n"
+        << "  -O0, -O1, -O2    IR optimization level (default -O0)\n"
+        << "      --verify-ir  verify the IR after lowering, inlining and\n"
+        << "                   every optimization pass\n"
+        << "  -j N             use N worker threads\n"
+        << "      --bench      measure tokenizer and parser throughput\n"
+        << "  -h, --help       show this help\n";
+  }
 
-  if (argc < 2) {
-    for (auto const &tok : soda::tokenizer(std::cin)) {
+  void dump_tokens(soda::tokenizer &tokens) {
+    for (auto const &tok : tokens) {
       std::cout << tok << std::endl;
     }
-  } else {
-    for (int i = 1; i < argc; i++) {
-      for (auto const &tok : soda::tokenizer(argv[i])) {
-        std::cout << tok << std::endl;
+  }
+
+  void dump_cfgs(soda::ast::program const &prog) {
+    for (auto const &tu : prog.tus) {
+      for (auto const &d : tu->decls) {
+        if (d->kind == soda::ast::node_kind::fun_decl) {
+          soda::dump(std::cout,
+                     soda::build_cfg(static_cast<soda::ast::fun_decl &>(*d)));
+        }
+      }
+    }
+  }
+
+  // Lower and optimize every function; only for programs without errors.
+  // With --verify-ir, each step's invalid IR is reported to diags.
+  std::vector<soda::ir::function>
+  lower_program(options const &opts, soda::ast::program const &prog,
+                soda::diagnostics &diags) {
+    std::vector<soda::ir::function> funs;
+    auto valid = true;
+    for (auto const &tu : prog.tus) {
+      for (auto const &d : tu->decls) {
+        if (d->kind == soda::ast::node_kind::fun_decl) {
+          funs.push_back(soda::lower(static_cast<soda::ast::fun_decl &>(*d)));
+          if (opts.verify_ir) {
+            valid &= soda::ir::verify_after("lowering", funs.back(), diags);
+          }
+        }
+      }
+    }
+    soda::ir::optimize_stats stats;
+    soda::ir::optimize(funs, opts.opt_level, stats, {},
+                       opts.verify_ir && valid ? &diags : nullptr);
+    return funs;
+  }
+
+  void dump_ir(options const &opts, soda::ast::program const &prog,
+               soda::diagnostics &diags) {
+    for (auto const &f : lower_program(opts, prog, diags)) {
+      soda::ir::verify(f, diags);
+      soda::ir::dump(std::cout, f);
+    }
+  }
+
+  // A word for a POSIX shell.
+  std::string quote(std::string_view word) {
+    std::string quoted = "'";
+    for (auto c : word) {
+      quoted += c == '\'' ? "'\\''" : std::string(1, c);
+    }
+    return quoted + "'";
+  }
+
+  // Run a shell command, reporting what failed if it does.
+  bool run_tool(std::string const &command, std::string_view what) {
+    if (std::system(command.c_str())) {
+      std::cerr << "sodac: the " << what << " failed: " << command << '\n';
+      return false;
+    }
+    return true;
+  }
+
+  // Print the bytecode of the program, or for action::run, run its main
+  // on the virtual machine. Returns the exit status: that of main, or
+  // that of abort on a trap, as for an executable built from it.
+  int interpret(options const &opts, soda::ast::program const &prog,
+                soda::diagnostics &diags) {
+    auto funs = lower_program(opts, prog, diags);
+    soda::program_layout layout;
+    if (soda::has_errors(diags) || !soda::lay_out(prog, funs, layout, diags)) {
+      return 1;
+    }
+    soda::vm::module m;
+    soda::vm::compile(layout, m);
+    if (opts.act == action::bytecode) {
+      soda::vm::dump(std::cout, m);
+      return 0;
+    }
+    std::uint64_t result = 0;
+    std::string_view message;
+    switch (soda::vm::run_main(m, result, message)) {
+    case soda::vm::status::ok:
+      return static_cast<int>(result & 0xff);
+    case soda::vm::status::trap:
+      std::cerr << "soda: " << message << '\n';
+      break;
+    default:
+      std::cerr << "soda: out of memory\n";
+      break;
+    }
+    return 134;
+  }
+
+  // Write the program as C or assembly to the output, or to stdout, or
+  // for action::build, build it into the output: from C with the C
+  // compiler named by $CC, with the flags in $CFLAGS, -O2 by default, or
+  // from assembly with the assembler named by $AS, linking with $CC.
+  // The bytecode and run actions go to interpret instead. Returns the exit
+  // status.
+  int generate(options const &opts, soda::ast::program const &prog,
+               soda::diagnostics &diags) {
+    if (opts.act == action::bytecode || opts.act == action::run) {
+      return interpret(opts, prog, diags);
+    }
+    auto funs = lower_program(opts, prog, diags);
+    if (soda::has_errors(diags)) {
+      return 1;
+    }
+    auto assembly = opts.act == action::assembly ||
+                    (opts.act == action::build &&
+                     opts.backend == backend::x86_64);
+    std::ostringstream code;
+    if (!(assembly ? soda::emit_x86(code, prog, funs, diags, opts.x86)
+                   : soda::emit_c(code, prog, funs, diags))) {
+      return 1;
+    }
+    if (opts.act != action::build && opts.output.empty()) {
+      std::cout << code.view();
+      return 0;
+    }
+    auto file = opts.output;
+    if (opts.act == action::build) {
+      file = std::filesystem::temp_directory_path() /
+             ("sodac-" + std::to_string(std::random_device{}()) +
+              (assembly ? ".s" : ".c"));
+    }
+    std::ofstream{file} << code.view();
+    if (opts.act != action::build) {
+      return 0;
+    }
+    auto tool = [](char const *var, char const *fallback) {
+      auto value = std::getenv(var);
+      return std::string{value && *value ? value : fallback};
+    };
+    auto ok = true;
+    auto output = quote(opts.output.native());
+    if (assembly) {
+      auto object = file;
+      object.replace_extension(".o");
+      ok = run_tool(tool("AS", "as") + " -o " + quote(object.native()) + ' ' +
+                        quote(file.native()),
+                    "assembler") &&
+           run_tool(tool("CC", "cc") + " -o " + output + ' ' +
+                        quote(object.native()) + " -lm",
+                    "linker");
+      std::filesystem::remove(object);
+    } else {
+      auto cflags = std::getenv("CFLAGS");
+      ok = run_tool(tool("CC", "cc") + ' ' + (cflags ? cflags : "-O2") +
+                        " -o " + output + ' ' + quote(file.native()) + " -lm",
+                    "C compiler");
+    }
+    std::filesystem::remove(file);
+    return ok ? 0 : 1;
+  }
+
+  void report(soda::diagnostics const &diags) {
+    for (auto const &d : diags) {
+      std::cerr << d << std::endl;
+    }
+  }
+
+  //
+  // Benchmarks
+  //
+  // Each phase of --bench works on a fresh program of its own, parsed and
+  // analyzed as far as the phase needs, and most report the best time of
+  // a few rounds.
+  //
+
+  using seconds = std::chrono::duration<double>;
+
+  constexpr int bench_rounds = 5;
+
+  // Times what a round of a benchmark does between start() and stop(), so
+  // that neither its setup nor the destruction of what it builds counts.
+  class stopwatch {
+  public:
+    using clock = std::chrono::steady_clock;
+
+    void start() {
+      start_ = clock::now();
+    }
+
+    void stop() {
+      stop_ = clock::now();
+    }
+
+    seconds elapsed() const {
+      return stop_ - start_;
+    }
+
+  private:
+    clock::time_point start_;
+    clock::time_point stop_;
+  };
+
+  // The shortest time of bench_rounds rounds, each a call of round with a
+  // stopwatch to start and stop around what it times.
+  template <typename Round>
+  seconds best_time(Round &&round) {
+    auto best = seconds::max();
+    for (int i = 0; i < bench_rounds; i++) {
+      stopwatch watch;
+      round(watch);
+      best = std::min(best, watch.elapsed());
+    }
+    return best;
+  }
+
+  enum class stage {
+    parsed,
+    resolved,
+    checked,
+  };
+
+  // A fresh program of the source, taken up to the stage.
+  soda::parse_result bench_program(options const &opts,
+                                   soda::source_file const &in, stage upto) {
+    soda::parse_result result;
+    result.program =
+        std::make_shared<soda::ast::program>(soda::ast::translation_unit::list{
+            soda::parse_source(in, opts.parse, result.diags)});
+    if (upto >= stage::resolved) {
+      soda::resolve(*result.program, result.diags);
+    }
+    if (upto >= stage::checked) {
+      soda::check(*result.program, result.diags, opts.parse.jobs);
+    }
+    return result;
+  }
+
+  // The functions of a program of one unit.
+  auto fun_decls(soda::ast::program const &prog) {
+    return prog.tus.front()->decls |
+           std::views::filter([](soda::ast::decl::ptr const &d) {
+             return d->kind == soda::ast::node_kind::fun_decl;
+           }) |
+           std::views::transform([](soda::ast::decl::ptr const &d) -> auto & {
+             return static_cast<soda::ast::fun_decl &>(*d);
+           });
+  }
+
+  // Lexing and parsing from memory, so that parser overhead over raw
+  // tokenization can be tracked.
+  void bench_parse(options const &opts, soda::source_file const &in) {
+    double mb = in.text->size() / (1024.0 * 1024.0);
+
+    std::size_t ntokens = 0;
+    auto lex = best_time([&](stopwatch &watch) {
+      std::ispanstream stream{std::span<char const>{*in.text}};
+      soda::tokenizer tokens{stream, in.fn};
+      watch.start();
+      ntokens = 0;
+      while (tokens.next().kind != soda::token::kind::end) {
+        ntokens++;
       }
+      watch.stop();
+    });
+
+    std::size_t nerrors = 0;
+    auto parse = best_time([&](stopwatch &watch) {
+      watch.start();
+      soda::diagnostics diags;
+      auto tu = soda::parse_source(in, opts.parse, diags);
+      nerrors = diags.size();
+      watch.stop();
+    });
+
+    std::cout << in.fn.c_str() << ": " << in.text->size() << " bytes, "
+              << ntokens << " tokens\n"
+              << "  tokenize: " << lex.count() * 1000 << " ms ("
+              << mb / lex.count() << " MB/s)\n"
+              << "  parse:    " << parse.count() * 1000 << " ms ("
+              << mb / parse.count() << " MB/s, " << parse / lex
+              << "x tokenize, " << nerrors << " errors)\n";
+  }
+
+  // Name resolution, and type checking with one worker and with all of
+  // them.
+  void bench_check(options const &opts, soda::source_file const &in) {
+    soda::resolve_stats resolved;
+    std::size_t ntypes = 0;
+    auto resolve = best_time([&](stopwatch &watch) {
+      auto [prog, diags] = bench_program(opts, in, stage::parsed);
+      watch.start();
+      resolved = soda::resolve(*prog, diags);
+      watch.stop();
+      ntypes = prog->types->size();
+    });
+    std::cout << "  resolve:  " << resolve.count() * 1000 << " ms ("
+              << resolved.lookups << " lookups, " << ntypes
+              << " composite types)\n";
+
+    auto time_check = [&](unsigned jobs, soda::check_stats &stats) {
+      return best_time([&](stopwatch &watch) {
+        auto [prog, diags] = bench_program(opts, in, stage::resolved);
+        watch.start();
+        stats = soda::check(*prog, diags, jobs);
+        watch.stop();
+      });
+    };
+    soda::check_stats serial_stats, parallel_stats;
+    auto serial = time_check(1, serial_stats);
+    auto parallel = time_check(opts.parse.jobs, parallel_stats);
+    std::cout << "  check:    " << serial.count() * 1000 << " ms ("
+              << serial_stats.functions << " functions, "
+              << serial_stats.expressions << " expressions)\n"
+              << "            " << parallel.count() * 1000 << " ms with "
+              << parallel_stats.jobs << " jobs (" << serial / parallel
+              << "x speedup, " << parallel_stats.steals << " steals)\n";
+  }
+
+  // Control-flow graphs with dominators of all functions, and liveness,
+  // reaching definitions and definite assignment over them.
+  void bench_flow(options const &opts, soda::source_file const &in) {
+    auto prog = bench_program(opts, in, stage::resolved).program;
+
+    std::size_t nblocks = 0, nedges = 0, nfuns = 0;
+    auto cfg = best_time([&](stopwatch &watch) {
+      nblocks = nedges = nfuns = 0;
+      watch.start();
+      for (auto &f : fun_decls(*prog)) {
+        auto cfg = soda::build_cfg(f);
+        auto order = soda::reverse_postorder(cfg.graph, cfg.entry);
+        soda::dominator_tree dom{cfg.graph, order};
+        nfuns++;
+        nblocks += cfg.size();
+        nedges += cfg.graph.edge_count();
+      }
+      watch.stop();
+    });
+    std::cout << "  cfg:      " << cfg.count() * 1000 << " ms (" << nfuns
+              << " functions, " << nblocks << " blocks, " << nedges
+              << " edges, " << cfg.count() * 1e9 / std::max(nblocks, 1ul)
+              << " ns/block)\n";
+
+    // including building the CFGs
+    soda::flow_stats flow;
+    auto analysis = best_time([&](stopwatch &watch) {
+      flow = {};
+      watch.start();
+      for (auto &f : fun_decls(*prog)) {
+        auto cfg = soda::build_cfg(f);
+        soda::variable_flow vf{cfg};
+        flow.functions++;
+        flow.blocks += cfg.size();
+        flow.variables += vf.vars.size();
+        flow.definitions += vf.def_vars.size();
+        flow.visits += vf.liveness().visits;
+        flow.visits += vf.reaching_definitions().visits;
+        flow.visits += vf.definite_assignment().visits;
+      }
+      watch.stop();
+    });
+    std::cout << "  flow:     " << analysis.count() * 1000 << " ms ("
+              << flow.variables << " variables, " << flow.definitions
+              << " definitions, " << flow.visits << " block visits, "
+              << analysis.count() * 1e9 / std::max(flow.blocks, 1ul)
+              << " ns/block)\n";
+  }
+
+  // Lowering of all functions to SSA form, and verifying the result.
+  // Returns the number of instructions, or 0 if the program has errors.
+  std::size_t bench_lower(options const &opts, soda::source_file const &in) {
+    auto [prog, diags] = bench_program(opts, in, stage::checked);
+    if (soda::has_errors(diags)) {
+      return 0;
+    }
+
+    std::vector<soda::ir::function> funs;
+    auto lower = best_time([&](stopwatch &watch) {
+      std::vector<soda::ir::function> lowered;
+      watch.start();
+      for (auto &f : fun_decls(*prog)) {
+        lowered.push_back(soda::lower(f));
+      }
+      watch.stop();
+      funs = std::move(lowered);
+    });
+    auto verify = best_time([&](stopwatch &watch) {
+      soda::diagnostics errors;
+      watch.start();
+      for (auto const &f : funs) {
+        soda::ir::verify(f, errors);
+      }
+      watch.stop();
+    });
+
+    std::size_t ninstrs = 0, nphis = 0;
+    for (auto const &f : funs) {
+      ninstrs += f.size();
+      nphis += std::ranges::count(f.instrs, soda::ir::opcode::phi,
+                                  &soda::ir::instr::op);
+    }
+    if (ninstrs) {
+      std::cout << "  lower:    " << lower.count() * 1000 << " ms ("
+                << ninstrs << " instructions, " << nphis << " phis, "
+                << lower.count() * 1e9 / ninstrs
+                << " ns/instruction; verified in " << verify.count() * 1000
+                << " ms)\n";
+    }
+    return ninstrs;
+  }
+
+  // The passes of the optimization level over freshly lowered functions,
+  // each timed over all rounds, of a program of ninstrs instructions.
+  void bench_optimize(options const &opts, soda::source_file const &in,
+                      std::size_t ninstrs) {
+    auto prog = bench_program(opts, in, stage::checked).program;
+    soda::ir::optimize_stats stats;
+    std::size_t nleft = 0;
+    for (int i = 0; i < bench_rounds; i++) {
+      std::vector<soda::ir::function> funs;
+      for (auto &f : fun_decls(*prog)) {
+        funs.push_back(soda::lower(f));
+      }
+      soda::ir::optimize(funs, opts.opt_level, stats);
+      nleft = 0;
+      for (auto const &f : funs) {
+        nleft += f.size();
+      }
+    }
+    std::cout << "  -O" << opts.opt_level << ":      " << nleft
+              << " instructions left of " << ninstrs << "\n";
+    if (auto const &is = stats.inlining; is.calls) {
+      std::cout << "    inline: " << is.time.count() * 1000 / bench_rounds
+                << " ms (" << is.inlined / bench_rounds << " of "
+                << is.calls / bench_rounds << " calls inlined, "
+                << is.recursive / bench_rounds << " recursive; "
+                << is.instrs_before / bench_rounds << " -> "
+                << is.instrs_after / bench_rounds << " instructions)\n";
+    }
+    // a pass that runs more than once is shown once, with its totals
+    std::array<bool, soda::ir::pass_count> shown{};
+    for (auto p : soda::ir::pipeline(opts.opt_level)) {
+      if (std::exchange(shown[static_cast<std::size_t>(p)], true)) {
+        continue;
+      }
+      auto const &ps = stats[p];
+      std::cout << "    " << soda::ir::to_string(p) << ": "
+                << ps.time.count() * 1000 / bench_rounds << " ms ("
+                << ps.values_replaced / bench_rounds << " values replaced, "
+                << ps.branches_folded / bench_rounds << " branches folded, "
+                << ps.instrs_removed / bench_rounds << " instructions and "
+                << ps.blocks_removed / bench_rounds << " blocks removed";
+      if (ps.checks_removed) {
+        std::cout << ", " << ps.checks_removed / bench_rounds
+                  << " bounds checks removed";
+      }
+      std::cout << ")\n";
+    }
+  }
+
+  // Dispatch through the planned clusters of every switch against a chain
+  // of comparisons, on each case value and the value after it.
+  void bench_switches(options const &opts, soda::source_file const &in) {
+    auto prog = bench_program(opts, in, stage::checked).program;
+    std::vector<soda::ir::switch_plan> plans;
+    std::vector<std::vector<std::int64_t>> cases;
+    std::array<std::size_t, 3> nclusters{};
+    std::size_t ncases = 0, depth = 0;
+    for (auto &fun : fun_decls(*prog)) {
+      auto f = soda::lower(fun);
+      for (soda::block_id b = 0; b < f.blocks.size(); b++) {
+        soda::ir::switch_plan plan;
+        std::vector<std::int64_t> values;
+        if (f.instrs[f.terminator(b)].op == soda::ir::opcode::switch_ &&
+            soda::ir::case_values(f, b, values) &&
+            soda::ir::plan_switch(f, b, plan)) {
+          for (auto const &c : plan.clusters) {
+            nclusters[static_cast<std::size_t>(c.kind)]++;
+          }
+          ncases += values.size();
+          depth = std::max(depth, plan.depth());
+          plans.push_back(std::move(plan));
+          cases.push_back(std::move(values));
+        }
+      }
+    }
+    if (plans.empty()) {
+      return;
+    }
+
+    // (switch, value) pairs, shuffled so that neither way of dispatching
+    // is helped by predictable branches
+    std::vector<std::pair<std::uint32_t, std::int64_t>> probes;
+    for (std::uint32_t k = 0; k < cases.size(); k++) {
+      for (auto v : cases[k]) {
+        probes.emplace_back(k, v);
+        probes.emplace_back(k, v + 1);
+      }
+    }
+    std::ranges::shuffle(probes, std::minstd_rand{});
+    auto repeat = 1 + (1 << 16) / probes.size();
+    // keeps the dispatches from being optimized away
+    std::uint64_t volatile sink = 0;
+    auto dispatch = [&](auto &&target) {
+      std::uint64_t sum = 0;
+      auto best = best_time([&](stopwatch &watch) {
+        watch.start();
+        for (std::size_t r = 0; r < repeat; r++) {
+          for (auto [k, v] : probes) {
+            sum += target(k, v);
+          }
+        }
+        watch.stop();
+      });
+      sink = sum;
+      return best.count() * 1e9 / (repeat * probes.size());
+    };
+    auto planned = dispatch([&](std::uint32_t k, std::int64_t v) {
+      return plans[k].target(v);
+    });
+    auto chained = dispatch([&](std::uint32_t k, std::int64_t v) {
+      auto it = std::ranges::find(cases[k], v);
+      return static_cast<std::uint32_t>(it - cases[k].begin());
+    });
+    auto clusters = [&](soda::ir::cluster_kind kind) {
+      return nclusters[static_cast<std::size_t>(kind)];
+    };
+    std::cout << "  switch:   " << planned << " ns/dispatch (" << plans.size()
+              << " switches, " << ncases << " cases in "
+              << clusters(soda::ir::cluster_kind::table) << " tables, "
+              << clusters(soda::ir::cluster_kind::bits) << " bit tests and "
+              << clusters(soda::ir::cluster_kind::range)
+              << " ranges, depth up to " << depth << "; chained compares "
+              << chained << " ns)\n";
+  }
+
+  // Code generation by each backend from the same optimized IR, and one
+  // run of main on the virtual machine, interpreted with and without
+  // superinstructions, and with hot functions translated by the JIT.
+  void bench_codegen(options const &opts, soda::source_file const &in) {
+    auto [prog, diags] = bench_program(opts, in, stage::checked);
+    auto funs = lower_program(opts, *prog, diags);
+
+    auto emit = [&](auto &&backend, std::size_t &bytes) {
+      auto ok = true;
+      auto best = best_time([&](stopwatch &watch) {
+        std::ostringstream code;
+        soda::diagnostics errors;
+        watch.start();
+        ok = ok && backend(code, *prog, funs, errors);
+        watch.stop();
+        bytes = code.view().size();
+      });
+      return ok ? best : seconds::zero();
+    };
+    std::size_t c_bytes = 0, asm_bytes = 0;
+    auto c_time = emit(soda::emit_c, c_bytes);
+    auto asm_time = emit(
+        [&](std::ostream &out, soda::ast::program const &prog,
+            std::span<soda::ir::function const> funs,
+            soda::diagnostics &diags) {
+          return soda::emit_x86(out, prog, funs, diags, opts.x86);
+        },
+        asm_bytes);
+    if (c_time.count() && asm_time.count()) {
+      auto n = static_cast<double>(funs.size());
+      std::cout << "  emit C:   " << c_time.count() * 1000 << " ms ("
+                << n / c_time.count() << " functions/s, " << c_bytes
+                << " bytes)\n"
+                << "  emit asm: " << asm_time.count() * 1000 << " ms ("
+                << n / asm_time.count() << " functions/s, " << asm_bytes
+                << " bytes)\n";
+    }
+
+    soda::program_layout layout;
+    if (!soda::lay_out(*prog, funs, layout, diags)) {
+      return;
+    }
+    auto interpreted = seconds::zero();
+    for (auto jit : {false, true}) {
+      for (auto super : {true, false}) {
+        if (jit && (!super || !soda::vm::jit_available)) {
+          continue;
+        }
+        soda::vm::module m;
+        stopwatch compile, run;
+        compile.start();
+        soda::vm::compile(layout, m, super);
+        compile.stop();
+        soda::vm::machine vm{m, {}, {.jit = jit}};
+        std::uint64_t result;
+        run.start();
+        auto status = vm.call(m.main, {}, result);
+        run.stop();
+        std::cout << (jit     ? "  vm jit:   "
+                      : super ? "  vm:       "
+                              : "  vm plain: ")
+                  << compile.elapsed().count() * 1000 << " ms to compile ("
+                  << m.stats.instructions << " instructions, "
+                  << m.stats.superinstructions << " super), "
+                  << run.elapsed().count() * 1000 << " ms to run (";
+        if (jit) {
+          std::cout << vm.compiled() << " functions compiled, "
+                    << interpreted / run.elapsed() << "x speedup";
+        } else {
+          std::cout << vm.executed() << " executed, "
+                    << static_cast<double>(vm.executed()) /
+                           run.elapsed().count()
+                    << " instructions/s";
+        }
+        std::cout << (status == soda::vm::status::ok ? "" : ", trapped")
+                  << ")\n";
+        if (super && !jit) {
+          interpreted = run.elapsed();
+        }
+      }
+    }
+  }
+
+  // Constant folding, of programs resolved and checked so that calls can
+  // be evaluated.
+  void bench_fold(options const &opts, soda::source_file const &in) {
+    soda::fold_stats stats;
+    auto fold = best_time([&](stopwatch &watch) {
+      auto [prog, diags] = bench_program(opts, in, stage::checked);
+      watch.start();
+      stats = soda::fold_constants(*prog->tus.front(), diags);
+      watch.stop();
+    });
+    std::cout << "  fold:     " << fold.count() * 1000 << " ms ("
+              << stats.folded << " nodes folded, " << stats.evaluated
+              << " calls evaluated)\n";
+  }
+
+  // Parsing all the inputs into one program with one job and with all.
+  void bench_parse_program(options const &opts) {
+    auto time_program = [&](unsigned jobs) {
+      auto popts = opts.parse;
+      popts.jobs = jobs;
+      stopwatch watch;
+      watch.start();
+      auto result = soda::parse_program(opts.files, popts);
+      watch.stop();
+      return watch.elapsed();
+    };
+    auto jobs = opts.parse.jobs ? opts.parse.jobs
+                                : std::thread::hardware_concurrency();
+    auto serial = time_program(1);
+    auto parallel = time_program(jobs);
+    std::cout << "program (" << opts.files.size() << " files):\n"
+              << "  1 job:  " << serial.count() * 1000 << " ms\n"
+              << "  " << jobs << " jobs: " << parallel.count() * 1000
+              << " ms (" << serial / parallel << "x speedup)\n";
+  }
+
+  // Times each phase of the compiler on each input, and parsing them all
+  // as one program.
+  void bench(options const &opts) {
+    for (auto const &fn : opts.files) {
+      auto in = soda::read_source(fn);
+      bench_parse(opts, in);
+      bench_check(opts, in);
+      bench_flow(opts, in);
+      if (auto ninstrs = bench_lower(opts, in)) {
+        if (opts.opt_level) {
+          bench_optimize(opts, in, ninstrs);
+        }
+        bench_switches(opts, in);
+        bench_codegen(opts, in);
+      }
+      if (opts.fold) {
+        bench_fold(opts, in);
+      }
+    }
+    if (opts.files.size() > 1) {
+      bench_parse_program(opts);
+    }
+  }
+
+  // Semantic passes run on the parsed program, in order.
+  void analyze(options const &opts, soda::ast::program &prog,
+               soda::diagnostics &diags) {
+    soda::resolve(prog, diags);
+    soda::check(prog, diags, opts.parse.jobs);
+    // flow warnings on ill-typed code are mostly noise
+    if (!soda::has_errors(diags)) {
+      soda::check_flow(prog, diags);
+    }
+    if (opts.fold) {
+      for (auto const &tu : prog.tus) {
+        soda::fold_constants(*tu, diags);
+      }
+    }
+  }
+
+  int run(options const &opts) {
+    if (opts.act == action::tokens) {
+      for (auto const &fn : opts.files) {
+        soda::tokenizer tokens{fn};
+        dump_tokens(tokens);
+      }
+      return 0;
+    }
+    auto result = soda::parse_program(opts.files, opts.parse);
+    analyze(opts, *result.program, result.diags);
+    if (opts.act == action::ir && !soda::has_errors(result.diags)) {
+      dump_ir(opts, *result.program, result.diags);
+    }
+    if (opts.act >= action::c && opts.act <= action::run &&
+        !soda::has_errors(result.diags)) {
+      auto status = generate(opts, *result.program, result.diags);
+      report(result.diags);
+      return status;
+    }
+    report(result.diags);
+    if (opts.act == action::ast) {
+      soda::ast::dump(std::cout, *result.program);
+    } else if (opts.act == action::cfg) {
+      dump_cfgs(*result.program);
+    }
+    return soda::has_errors(result.diags) ? 1 : 0;
+  }
+
+} // namespace
+
+int main(int argc, char **argv) {
+
+  options opts;
+  for (int i = 1; i < argc; i++) {
+    auto arg = argv[i];
+    if (!std::strcmp(arg, "-t") || !std::strcmp(arg, "--tokens")) {
+      opts.act = action::tokens;
+    } else if (!std::strcmp(arg, "-a") || !std::strcmp(arg, "--ast")) {
+      opts.act = action::ast;
+    } else if (!std::strcmp(arg, "--cfg")) {
+      opts.act = action::cfg;
+    } else if (!std::strcmp(arg, "--ir")) {
+      opts.act = action::ir;
+    } else if (!std::strcmp(arg, "--emit-c")) {
+      opts.act = action::c;
+    } else if (!std::strcmp(arg, "--emit-asm")) {
+      opts.act = action::assembly;
+    } else if (!std::strcmp(arg, "--bytecode")) {
+      opts.act = action::bytecode;
+    } else if (!std::strcmp(arg, "--run")) {
+      opts.act = action::run;
+    } else if (!std::strcmp(arg, "--backend") && i + 1 < argc &&
+               (!std::strcmp(argv[i + 1], "c") ||
+                !std::strcmp(argv[i + 1], "x86-64"))) {
+      opts.backend = *argv[++i] == 'c' ? backend::c : backend::x86_64;
+    } else if (!std::strcmp(arg, "--vectors") && i + 1 < argc &&
+               (!std::strcmp(argv[i + 1], "none") ||
+                !std::strcmp(argv[i + 1], "sse2") ||
+                !std::strcmp(argv[i + 1], "avx2"))) {
+      auto isa = argv[++i];
+      opts.x86.vectors = *isa == 'n'               ? soda::vector_isa::none
+                         : !std::strcmp(isa, "sse2") ? soda::vector_isa::sse2
+                                                     : soda::vector_isa::avx2;
+    } else if (!std::strcmp(arg, "-o") && i + 1 < argc) {
+      opts.output = argv[++i];
+    } else if (!std::strcmp(arg, "--bench")) {
+      opts.act = action::bench;
+    } else if (!std::strcmp(arg, "--lazy")) {
+      opts.parse.lazy = true;
+    } else if (!std::strcmp(arg, "--fold")) {
+      opts.fold = true;
+    } else if (!std::strcmp(arg, "--verify-ir")) {
+      opts.verify_ir = true;
+    } else if (!std::strcmp(arg, "--hash-cons")) {
+      opts.parse.hash_consing = true;
+    } else if (arg[0] == '-' && arg[1] == 'O' && arg[2] >= '0' &&
+               arg[2] <= '0' + soda::ir::max_opt_level && !arg[3]) {
+      opts.opt_level = arg[2] - '0';
+    } else if (!std::strcmp(arg, "-j") && i + 1 < argc) {
+      opts.parse.jobs = std::atoi(argv[++i]);
+    } else if (!std::strcmp(arg, "-h") || !std::strcmp(arg, "--help")) {
+      usage(std::cout, argv[0]);
+      return 0;
+    } else if (arg[0] == '-' && arg[1] != '\0') {
+      std::cerr << argv[0] << ": unknown option '" << arg << "'\n";
+      usage(std::cerr, argv[0]);
+      return 1;
+    } else {
+      opts.files.emplace_back(arg);
+    }
+  }
+
+  if (!opts.output.empty() && opts.act == action::check) {
+    opts.act = action::build;
+  }
+
+  if (opts.act == action::bench) {
+    bench(opts);
+    return 0;
+  }
+
+  if (opts.files.empty()) {
+    try {
+      auto in = soda::read_source(std::cin, {});
+      if (opts.act == action::tokens) {
+        std::ispanstream stream{std::span<char const>{*in.text}};
+        soda::tokenizer tokens{stream};
+        dump_tokens(tokens);
+        return 0;
+      }
+      soda::diagnostics diags;
+      auto tu = soda::parse_source(in, opts.parse, diags);
+      soda::ast::program prog{{tu}};
+      analyze(opts, prog, diags);
+      if (opts.act == action::ir && !soda::has_errors(diags)) {
+        dump_ir(opts, prog, diags);
+      }
+      if (opts.act >= action::c && opts.act <= action::run &&
+          !soda::has_errors(diags)) {
+        auto status = generate(opts, prog, diags);
+        report(diags);
+        return status;
+      }
+      report(diags);
+      if (opts.act == action::ast) {
+        soda::ast::dump(std::cout, *tu);
+      } else if (opts.act == action::cfg) {
+        dump_cfgs(prog);
+      }
+      if (soda::has_errors(diags)) {
+        return 1;
+      }
+    } catch (soda::parse_error const &e) {
+      std::cerr << e.what() << std::endl;
+      return 1;
+    }
+    return 0;
+  }
+
+  for (auto const &fn : opts.files) {
+    if (!std::filesystem::exists(fn)) {
+      std::cerr << argv[0] << ": " << fn.c_str() << ": no such file\n";
+      return 1;
     }
   }
 
-  return 0;
+  return run(opts);
 }
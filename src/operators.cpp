@@ -99,4 +99,97 @@ namespace soda {
     return "unknown_op";
   }
 
+  std::string_view spelling(operator_kind op) {
+    switch (op) {
+      case operator_kind::pos:
+        return "+";
+      case operator_kind::neg:
+        return "-";
+      case operator_kind::bit_not:
+        return "~";
+      case operator_kind::log_not:
+        return "!";
+      case operator_kind::pre_inc:
+        return "++";
+      case operator_kind::pre_dec:
+        return "--";
+      case operator_kind::post_inc:
+        return "++";
+      case operator_kind::post_dec:
+        return "--";
+      case operator_kind::add:
+        return "+";
+      case operator_kind::sub:
+        return "-";
+      case operator_kind::mul:
+        return "*";
+      case operator_kind::div:
+        return "/";
+      case operator_kind::mod:
+        return "%";
+      case operator_kind::pow:
+        return "**";
+      case operator_kind::bit_and:
+        return "&";
+      case operator_kind::bit_xor:
+        return "^";
+      case operator_kind::bit_or:
+        return "|";
+      case operator_kind::log_and:
+        return "&&";
+      case operator_kind::log_or:
+        return "||";
+      case operator_kind::lt:
+        return "<";
+      case operator_kind::gt:
+        return ">";
+      case operator_kind::le:
+        return "<=";
+      case operator_kind::ge:
+        return ">=";
+      case operator_kind::eq:
+        return "==";
+      case operator_kind::ne:
+        return "!=";
+      case operator_kind::lshift:
+        return "<<";
+      case operator_kind::rshift:
+        return ">>";
+      case operator_kind::assign:
+        return "=";
+      case operator_kind::add_assign:
+        return "+=";
+      case operator_kind::sub_assign:
+        return "-=";
+      case operator_kind::mul_assign:
+        return "*=";
+      case operator_kind::div_assign:
+        return "/=";
+      case operator_kind::mod_assign:
+        return "%=";
+      case operator_kind::and_assign:
+        return "&=";
+      case operator_kind::xor_assign:
+        return "^=";
+      case operator_kind::or_assign:
+        return "|=";
+      case operator_kind::lshift_assign:
+        return "<<=";
+      case operator_kind::rshift_assign:
+        return ">>=";
+      case operator_kind::comma:
+        return ",";
+      case operator_kind::member:
+        return ".";
+      case operator_kind::index:
+        return "[]";
+      case operator_kind::ifexpr:
+        return "?:";
+      case operator_kind::call:
+        return "()";
+    }
+    unreachable();
+    return "?";
+  }
+
 } // namespace soda
@@ -57,6 +57,124 @@ namespace soda {
 
   std::string_view to_string(operator_kind op);
 
+  // The operator as written in source, e.g. "+=" for add_assign.
+  std::string_view spelling(operator_kind op);
+
+  enum class associativity {
+    left,
+    right,
+  };
+
+  // Binding strength of an operator, higher binds tighter.
+  constexpr int precedence(operator_kind op) noexcept {
+    switch (op) {
+      case operator_kind::call:
+      case operator_kind::index:
+      case operator_kind::member:
+      case operator_kind::post_inc:
+      case operator_kind::post_dec:
+        return 17;
+      case operator_kind::pow:
+        return 16;
+      case operator_kind::pos:
+      case operator_kind::neg:
+      case operator_kind::bit_not:
+      case operator_kind::log_not:
+      case operator_kind::pre_inc:
+      case operator_kind::pre_dec:
+        return 15;
+      case operator_kind::mul:
+      case operator_kind::div:
+      case operator_kind::mod:
+        return 13;
+      case operator_kind::add:
+      case operator_kind::sub:
+        return 12;
+      case operator_kind::lshift:
+      case operator_kind::rshift:
+        return 11;
+      case operator_kind::lt:
+      case operator_kind::gt:
+      case operator_kind::le:
+      case operator_kind::ge:
+        return 10;
+      case operator_kind::eq:
+      case operator_kind::ne:
+        return 9;
+      case operator_kind::bit_and:
+        return 8;
+      case operator_kind::bit_xor:
+        return 7;
+      case operator_kind::bit_or:
+        return 6;
+      case operator_kind::log_and:
+        return 5;
+      case operator_kind::log_or:
+        return 4;
+      case operator_kind::ifexpr:
+        return 3;
+      case operator_kind::assign:
+      case operator_kind::add_assign:
+      case operator_kind::sub_assign:
+      case operator_kind::mul_assign:
+      case operator_kind::div_assign:
+      case operator_kind::mod_assign:
+      case operator_kind::and_assign:
+      case operator_kind::xor_assign:
+      case operator_kind::or_assign:
+      case operator_kind::lshift_assign:
+      case operator_kind::rshift_assign:
+        return 2;
+      case operator_kind::comma:
+        return 1;
+    }
+    return 0;
+  }
+
+  constexpr associativity associativity_of(operator_kind op) noexcept {
+    switch (precedence(op)) {
+      case 16: // pow
+      case 15: // prefix
+      case 3:  // ifexpr
+      case 2:  // assignment
+        return associativity::right;
+      default:
+        return associativity::left;
+    }
+  }
+
+  constexpr bool is_assignment(operator_kind op) noexcept {
+    return op >= operator_kind::assign && op <= operator_kind::rshift_assign;
+  }
+
+  // The binary operation applied by a compound assignment, e.g. add for +=.
+  constexpr operator_kind assignment_operator(operator_kind op) noexcept {
+    switch (op) {
+      case operator_kind::add_assign:
+        return operator_kind::add;
+      case operator_kind::sub_assign:
+        return operator_kind::sub;
+      case operator_kind::mul_assign:
+        return operator_kind::mul;
+      case operator_kind::div_assign:
+        return operator_kind::div;
+      case operator_kind::mod_assign:
+        return operator_kind::mod;
+      case operator_kind::and_assign:
+        return operator_kind::bit_and;
+      case operator_kind::xor_assign:
+        return operator_kind::bit_xor;
+      case operator_kind::or_assign:
+        return operator_kind::bit_or;
+      case operator_kind::lshift_assign:
+        return operator_kind::lshift;
+      case operator_kind::rshift_assign:
+        return operator_kind::rshift;
+      default:
+        return op;
+    }
+  }
+
   inline std::ostream &operator<<(std::ostream &out, operator_kind op) {
     return out << to_string(op);
   }
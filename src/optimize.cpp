@@ -0,0 +1,104 @@
+#include "optimize.hpp"
+
+#include "utils.hpp"
+
+#include <algorithm>
+
+namespace soda::ir {
+
+  std::string_view to_string(pass p) {
+    switch (p) {
+      case pass::sccp:
+        return "sccp";
+      case pass::strength:
+        return "strength";
+      case pass::gvn:
+        return "gvn";
+      case pass::dce:
+        return "dce";
+      case pass::cfg:
+        return "cfg";
+      case pass::licm:
+        return "licm";
+      case pass::unroll:
+        return "unroll";
+      case pass::bounds:
+        return "bounds";
+      default:
+        unreachable();
+    }
+  }
+
+  std::span<pass const> pipeline(int level) {
+    static constexpr pass o1[] = {pass::sccp, pass::strength, pass::licm,
+                                  pass::dce, pass::cfg};
+    static constexpr pass o2[] = {pass::sccp, pass::unroll, pass::sccp,
+                                  pass::strength, pass::gvn, pass::licm,
+                                  pass::bounds, pass::dce, pass::cfg};
+    switch (std::clamp(level, 0, max_opt_level)) {
+      case 0:
+        return {};
+      case 1:
+        return o1;
+      default:
+        return o2;
+    }
+  }
+
+  void run_pass(pass p, function &f, pass_stats &stats) {
+    auto t0 = std::chrono::steady_clock::now();
+    switch (p) {
+      case pass::sccp:
+        sccp(f, stats);
+        break;
+      case pass::strength:
+        reduce_strength(f, stats);
+        break;
+      case pass::gvn:
+        gvn(f, stats);
+        break;
+      case pass::dce:
+        dce(f, stats);
+        break;
+      case pass::cfg:
+        simplify_cfg(f, stats);
+        break;
+      case pass::licm:
+        hoist_invariants(f, stats);
+        break;
+      case pass::unroll:
+        unroll_loops(f, stats);
+        break;
+      case pass::bounds:
+        remove_bounds_checks(f, stats);
+        break;
+    }
+    stats.time += std::chrono::steady_clock::now() - t0;
+    stats.runs++;
+  }
+
+  bool verify_after(std::string_view what, function const &f,
+                    diagnostics &diags) {
+    auto first = diags.size();
+    if (verify(f, diags)) {
+      return true;
+    }
+    for (auto i = first; i < diags.size(); i++) {
+      diags[i].message += " (after ";
+      diags[i].message += what;
+      diags[i].message += ')';
+    }
+    return false;
+  }
+
+  void optimize(function &f, int level, optimize_stats &stats,
+                diagnostics *verify) {
+    for (auto p : pipeline(level)) {
+      run_pass(p, f, stats[p]);
+      if (verify && !verify_after(to_string(p), f, *verify)) {
+        verify = nullptr;
+      }
+    }
+  }
+
+} // namespace soda::ir
@@ -0,0 +1,176 @@
+#pragma once
+
+#include "ir.hpp"
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+namespace soda::ir {
+
+  //
+  // Optimization passes
+  //
+  // Each pass walks the function with worklists over flat per-value and
+  // per-block tables and then rebuilds it with a rewriter:
+  //
+  // - sccp, sparse conditional constant propagation (Wegman and Zadeck),
+  //   replaces values that are constant on every executable path by
+  //   constants and branches with a known direction by jumps, dropping the
+  //   blocks that are then unreachable. It evaluates with the arithmetic of
+  //   constant.hpp, so operations that overflow or divide by zero are left
+  //   for run time.
+  // - strength replaces integer multiplications of induction variables in
+  //   loops by additions, and operations with a constant right operand by
+  //   cheaper ones: powers up to 64 by chains of multiplications, and
+  //   multiplication, division and remainder by shifts and masks for
+  //   powers of two and by a high multiplication otherwise. Integer
+  //   arithmetic wraps at run time, so the results are exact; division by
+  //   0 or -1 may trap and is left alone.
+  // - gvn numbers values in dominator tree order (Briggs, Cooper and
+  //   Simpson), replacing each pure computation with an equal one that
+  //   dominates it, and phis that merge equal values.
+  // - dce removes instructions whose values are not used by anything with
+  //   an effect: control flow, calls, stores, and operations that may trap
+  //   at run time, which are indexing, and division or exponentiation of
+  //   ints and shifts unless their right operand is a safe constant.
+  // - cfg merges each block that ends in a jump with its successor if it
+  //   is the only predecessor, which folded branches and inlining leave
+  //   many of.
+  //
+  // The loop passes work on the loops found by loop_nest (see loops.hpp):
+  //
+  // - licm moves computations whose operands do not change in a loop to
+  //   its preheader, out of as many enclosing loops as it can, if they
+  //   cannot trap; loads of globals move out of loops that neither store
+  //   them nor call anything.
+  // - unroll copies the body of a small innermost loop with a constant
+  //   trip count of at most 16 once per iteration and drops the loop.
+  // - bounds marks indexing by an induction variable that the loop test
+  //   keeps below the length of the indexed value as in bounds, which the
+  //   backends then do not check. Lowering marks the indexing of foreach
+  //   loops that way already.
+  //
+
+  enum class pass : std::uint8_t {
+    sccp,
+    strength,
+    gvn,
+    dce,
+    cfg,
+    licm,
+    unroll,
+    bounds,
+  };
+
+  inline constexpr std::size_t pass_count = 8;
+
+  std::string_view to_string(pass p);
+
+  struct pass_stats {
+    std::size_t runs = 0;
+    std::chrono::duration<double> time{};
+    std::size_t instrs_removed = 0;
+    std::size_t blocks_removed = 0;
+    // values replaced by a constant (sccp), a cheaper computation
+    // (strength), an equal value (gvn) or a copy before the loop (licm)
+    std::size_t values_replaced = 0;
+    // branches and switches turned into jumps, one per unrolled loop for
+    // unroll
+    std::size_t branches_folded = 0;
+    // indexing marked as in bounds
+    std::size_t checks_removed = 0;
+  };
+
+  //
+  // Inlining
+  //
+  // At -O2 direct calls are inlined across the whole program before each
+  // function is simplified. Functions are visited bottom-up over the
+  // strongly connected components of the call graph, so a callee is
+  // already inlined into and simplified when its size is weighed, and
+  // calls within a component, that is recursive calls, are left alone.
+  //
+  // A call costs the callee's instructions other than its parameters,
+  // less the call and its arguments, and less the uses of each parameter
+  // whose argument is a constant, as those are likely to fold away. Calls
+  // up to the threshold are inlined, with more room inside loops, as long
+  // as the caller stays within its growth limit.
+  //
+
+  struct inline_options {
+    std::size_t threshold = 30;
+    // the threshold is multiplied by this inside loops
+    std::size_t loop_factor = 2;
+    // a function may grow to this many times its size plus the threshold
+    std::size_t growth = 3;
+  };
+
+  struct inline_stats {
+    std::chrono::duration<double> time{};
+    // direct calls to functions of the program
+    std::size_t calls = 0;
+    std::size_t inlined = 0;
+    // calls within a strongly connected component
+    std::size_t recursive = 0;
+    std::size_t instrs_before = 0;
+    std::size_t instrs_after = 0;
+  };
+
+  // Replace call, a direct call in caller, with a copy of the callee's
+  // body, which must return.
+  void inline_call(function &caller, value_id call, function const &callee);
+
+  struct optimize_stats {
+    std::array<pass_stats, pass_count> passes{};
+    inline_stats inlining;
+
+    pass_stats &operator[](pass p) noexcept {
+      return passes[static_cast<std::size_t>(p)];
+    }
+
+    pass_stats const &operator[](pass p) const noexcept {
+      return passes[static_cast<std::size_t>(p)];
+    }
+  };
+
+  inline constexpr int max_opt_level = 2;
+
+  // The passes run at an optimization level: none at 0, sccp, strength,
+  // licm, dce and cfg at 1, and unroll, gvn and bounds as well at 2, where
+  // sccp runs again after unroll to fold the unrolled iterations. A pass
+  // may appear more than once.
+  std::span<pass const> pipeline(int level);
+
+  void sccp(function &f, pass_stats &stats);
+  void reduce_strength(function &f, pass_stats &stats);
+  void gvn(function &f, pass_stats &stats);
+  void dce(function &f, pass_stats &stats);
+  void simplify_cfg(function &f, pass_stats &stats);
+  void hoist_invariants(function &f, pass_stats &stats);
+  void unroll_loops(function &f, pass_stats &stats);
+  void remove_bounds_checks(function &f, pass_stats &stats);
+
+  void run_pass(pass p, function &f, pass_stats &stats);
+
+  // Verify f as ir::verify does, saying in each error that the IR became
+  // invalid in the step named what.
+  bool verify_after(std::string_view what, function const &f,
+                    diagnostics &diags);
+
+  // Run the pipeline of a level over f, adding to stats. With verify, f is
+  // verified after every pass, until the first one that breaks it, and the
+  // errors are appended to *verify.
+  void optimize(function &f, int level, optimize_stats &stats,
+                diagnostics *verify = nullptr);
+
+  // Optimize the functions of a program, inlining calls among them first
+  // at -O2, and verifying each function after inlining as well.
+  void optimize(std::span<function> funs, int level, optimize_stats &stats,
+                inline_options const &opts = {},
+                diagnostics *verify = nullptr);
+
+} // namespace soda::ir
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+namespace soda {
+
+  //
+  // Work-stealing loop
+  //
+  // Calls body(worker, i) for every i in [0, n) on `jobs` threads. Each
+  // worker starts out owning an equal contiguous share of the indices and
+  // takes them from the front, so it walks neighbouring items in order. A
+  // worker that runs out steals the back half of another worker's remaining
+  // share, which evens out shares whose items differ widely in cost without
+  // any central queue.
+  //
+  // A share is a [begin, end) pair packed into one atomic word: the owner
+  // advances begin and thieves lower end, both by compare-and-swap, so an
+  // index is handed out exactly once.
+  //
+
+  struct parallel_stats {
+    std::size_t jobs = 0;
+    // shares taken from another worker
+    std::size_t steals = 0;
+  };
+
+  // The number of workers parallel_for uses for n items, so that callers can
+  // set up per-worker state; jobs is 0 for one per hardware thread.
+  inline std::size_t worker_count(std::size_t n, unsigned jobs) {
+    std::size_t njobs = jobs ? jobs : std::thread::hardware_concurrency();
+    return std::clamp<std::size_t>(njobs, 1, std::max<std::size_t>(n, 1));
+  }
+
+  template <typename Body>
+  parallel_stats parallel_for(std::size_t n, unsigned jobs, Body &&body) {
+    auto njobs = worker_count(n, jobs);
+
+    if (njobs == 1) {
+      for (std::size_t i = 0; i < n; i++) {
+        body(std::size_t{0}, i);
+      }
+      return parallel_stats{1, 0};
+    }
+
+    using word = std::uint64_t;
+    auto pack = [](word begin, word end) { return begin | end << 32; };
+    auto begin_of = [](word w) { return w & 0xffffffff; };
+    auto end_of = [](word w) { return w >> 32; };
+
+    struct alignas(64) share {
+      std::atomic<word> range;
+    };
+    std::vector<share> shares(njobs);
+    for (std::size_t w = 0; w < njobs; w++) {
+      shares[w].range.store(pack(n * w / njobs, n * (w + 1) / njobs),
+                            std::memory_order_relaxed);
+    }
+    std::atomic<std::size_t> steals{0};
+
+    auto take = [&](std::size_t self, std::size_t &index) {
+      auto &range = shares[self].range;
+      auto r = range.load(std::memory_order_acquire);
+      while (begin_of(r) < end_of(r)) {
+        if (range.compare_exchange_weak(r, pack(begin_of(r) + 1, end_of(r)),
+                                        std::memory_order_acq_rel)) {
+          index = begin_of(r);
+          return true;
+        }
+      }
+      return false;
+    };
+
+    auto steal = [&](std::size_t self) {
+      for (std::size_t k = 1; k < njobs; k++) {
+        auto &victim = shares[(self + k) % njobs].range;
+        auto r = victim.load(std::memory_order_acquire);
+        while (begin_of(r) < end_of(r)) {
+          auto mid = end_of(r) - (end_of(r) - begin_of(r) + 1) / 2;
+          if (victim.compare_exchange_weak(r, pack(begin_of(r), mid),
+                                           std::memory_order_acq_rel)) {
+            shares[self].range.store(pack(mid, end_of(r)),
+                                     std::memory_order_release);
+            steals.fetch_add(1, std::memory_order_relaxed);
+            return true;
+          }
+        }
+      }
+      return false;
+    };
+
+    // nothing is ever added to a share, so once every share is empty all
+    // indices have been handed out
+    auto work = [&](std::size_t self) {
+      std::size_t index;
+      do {
+        while (take(self, index)) {
+          body(self, index);
+        }
+      } while (steal(self));
+    };
+
+    {
+      std::vector<std::jthread> workers;
+      workers.reserve(njobs - 1);
+      for (std::size_t w = 1; w < njobs; w++) {
+        workers.emplace_back(work, w);
+      }
+      work(0);
+    }
+    return parallel_stats{njobs, steals.load()};
+  }
+
+} // namespace soda
@@ -35,7 +35,7 @@ namespace soda {
     static std::string format_error(source_range const &range,
                                     std::string const &message) {
       std::stringstream ss;
-      ss << range << ": error:" << message;
+      ss << range << ": error: " << message;
       return ss.str();
     }
   };
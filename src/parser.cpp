@@ -0,0 +1,925 @@
+#include "parser.hpp"
+
+#include "utils.hpp"
+
+#include <array>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <spanstream>
+#include <sstream>
+
+namespace soda {
+
+  //
+  // Operator tables
+  //
+  // Both tables are indexed by token kind and built at compile time from the
+  // operator_kind precedence and associativity, so the expression loop is a
+  // single array load per token.
+  //
+
+  namespace {
+
+    constexpr std::optional<operator_kind>
+    prefix_operator(enum token::kind k) noexcept {
+      switch (k) {
+        case token::kind::plus:
+          return operator_kind::pos;
+        case token::kind::dash:
+          return operator_kind::neg;
+        case token::kind::tilde:
+          return operator_kind::bit_not;
+        case token::kind::exclamation:
+          return operator_kind::log_not;
+        case token::kind::inc:
+          return operator_kind::pre_inc;
+        case token::kind::dec:
+          return operator_kind::pre_dec;
+        default:
+          return std::nullopt;
+      }
+    }
+
+    constexpr std::optional<operator_kind>
+    infix_operator(enum token::kind k) noexcept {
+      switch (k) {
+        case token::kind::inc:
+          return operator_kind::post_inc;
+        case token::kind::dec:
+          return operator_kind::post_dec;
+        case token::kind::plus:
+          return operator_kind::add;
+        case token::kind::dash:
+          return operator_kind::sub;
+        case token::kind::asterisk:
+          return operator_kind::mul;
+        case token::kind::slash:
+          return operator_kind::div;
+        case token::kind::percent:
+          return operator_kind::mod;
+        case token::kind::pow:
+          return operator_kind::pow;
+        case token::kind::ampersand:
+          return operator_kind::bit_and;
+        case token::kind::caret:
+          return operator_kind::bit_xor;
+        case token::kind::pipe:
+          return operator_kind::bit_or;
+        case token::kind::log_and:
+          return operator_kind::log_and;
+        case token::kind::log_or:
+          return operator_kind::log_or;
+        case token::kind::langle:
+          return operator_kind::lt;
+        case token::kind::rangle:
+          return operator_kind::gt;
+        case token::kind::le:
+          return operator_kind::le;
+        case token::kind::ge:
+          return operator_kind::ge;
+        case token::kind::eq:
+          return operator_kind::eq;
+        case token::kind::ne:
+          return operator_kind::ne;
+        case token::kind::lshift:
+          return operator_kind::lshift;
+        case token::kind::rshift:
+          return operator_kind::rshift;
+        case token::kind::equal:
+          return operator_kind::assign;
+        case token::kind::add_assign:
+          return operator_kind::add_assign;
+        case token::kind::sub_assign:
+          return operator_kind::sub_assign;
+        case token::kind::mul_assign:
+          return operator_kind::mul_assign;
+        case token::kind::div_assign:
+          return operator_kind::div_assign;
+        case token::kind::mod_assign:
+          return operator_kind::mod_assign;
+        case token::kind::and_assign:
+          return operator_kind::and_assign;
+        case token::kind::xor_assign:
+          return operator_kind::xor_assign;
+        case token::kind::or_assign:
+          return operator_kind::or_assign;
+        case token::kind::lshift_assign:
+          return operator_kind::lshift_assign;
+        case token::kind::rshift_assign:
+          return operator_kind::rshift_assign;
+        case token::kind::comma:
+          return operator_kind::comma;
+        case token::kind::dot:
+          return operator_kind::member;
+        case token::kind::lbracket:
+          return operator_kind::index;
+        case token::kind::question:
+          return operator_kind::ifexpr;
+        case token::kind::lparen:
+          return operator_kind::call;
+        default:
+          return std::nullopt;
+      }
+    }
+
+    struct op_entry {
+      operator_kind op = operator_kind::pos;
+      int prec = 0; // 0 when the token is not an operator in this position
+    };
+
+    constexpr std::size_t op_table_size =
+        static_cast<std::size_t>(token::kind::kw_while) + 1;
+
+    template <typename Lookup>
+    constexpr auto make_op_table(Lookup lookup) {
+      std::array<op_entry, op_table_size> tab{};
+      for (std::size_t i = 0; i < tab.size(); i++) {
+        if (auto op = lookup(static_cast<enum token::kind>(i))) {
+          tab[i] = op_entry{*op, precedence(*op)};
+        }
+      }
+      return tab;
+    }
+
+    constexpr auto prefix_table = make_op_table(prefix_operator);
+    constexpr auto infix_table = make_op_table(infix_operator);
+
+    constexpr op_entry lookup(auto const &tab, enum token::kind k) noexcept {
+      auto i = static_cast<std::size_t>(k);
+      return i < tab.size() ? tab[i] : op_entry{};
+    }
+
+    static_assert(lookup(infix_table, token::kind::asterisk).prec >
+                  lookup(infix_table, token::kind::plus).prec);
+    static_assert(lookup(infix_table, token::kind::pow).prec >
+                  lookup(prefix_table, token::kind::dash).prec);
+    static_assert(lookup(infix_table, token::kind::comma).prec == 1);
+    static_assert(lookup(infix_table, token::kind::error).prec == 0);
+
+  } // namespace
+
+  //
+  // Token handling
+  //
+
+  parser::parser(tokenizer &tokens, ast::builder &build)
+      : tokens_{tokens}, build_{build} {
+    skip_error_tokens();
+  }
+
+  void parser::advance() {
+    prev_end_ = tok().range.end;
+    tokens_.advance();
+    skip_error_tokens();
+  }
+
+  // Malformed tokens are reported and dropped; the parser then sees the
+  // tokens around them as if they were adjacent.
+  void parser::skip_error_tokens() {
+    while (tok().kind == kind::error) {
+      report(tok().range, tok().text);
+      tokens_.advance();
+    }
+  }
+
+  // While in panic mode nothing is accepted, so the damaged construct
+  // unwinds to its statement without consuming input.
+
+  bool parser::accept(kind k) {
+    if (!panic_ && tok().kind == k) {
+      advance();
+      return true;
+    }
+    return false;
+  }
+
+  bool parser::expect(kind k, char const *what) {
+    if (panic_ || tok().kind != k) {
+      error(what);
+      return false;
+    }
+    advance();
+    return true;
+  }
+
+  std::string parser::expect_ident(char const *what) {
+    if (panic_ || tok().kind != kind::ident) {
+      error(what);
+      return {};
+    }
+    auto name = tok().text;
+    advance();
+    return name;
+  }
+
+  void parser::error(char const *expected) {
+    if (panic_) {
+      return;
+    }
+    std::stringstream ss;
+    ss << "expected " << expected << " but found ";
+    if (tok().kind == kind::end) {
+      ss << "end of input";
+    } else {
+      ss << "'" << tok().text << "'";
+    }
+    report(tok().range, ss.str());
+    panic_ = true;
+    panic_offset_ = tok().range.start.offset;
+  }
+
+  void parser::report(source_range range, std::string message) {
+    diags_.emplace_back(severity::error, std::move(range), std::move(message));
+  }
+
+  //
+  // Error recovery
+  //
+
+  namespace {
+
+    bool starts_stmt(enum token::kind k) noexcept {
+      switch (k) {
+        case token::kind::kw_break:
+        case token::kind::kw_case:
+        case token::kind::kw_continue:
+        case token::kind::kw_default:
+        case token::kind::kw_do:
+        case token::kind::kw_for:
+        case token::kind::kw_foreach:
+        case token::kind::kw_fun:
+        case token::kind::kw_goto:
+        case token::kind::kw_if:
+        case token::kind::kw_let:
+        case token::kind::kw_return:
+        case token::kind::kw_switch:
+        case token::kind::kw_while:
+          return true;
+        default:
+          return false;
+      }
+    }
+
+  } // namespace
+
+  // Skip to a synchronization point and replace the construct started at
+  // start with an error node. Recovery stops after a ';' or a block.
+  // Statements also stop before a '}', so that the enclosing block can
+  // close, and before a statement keyword; top-level declarations only stop
+  // early at 'let' or 'fun'. A keyword that itself caused the error is
+  // consumed, so the caller's loop always makes progress; a '{' that did is
+  // kept, so that its block is skipped whole.
+  template <typename T>
+  ast::node::ptr<T> parser::recover(source_position start, bool top_level) {
+    auto message = diags_.empty() ? std::string{"syntax error"}
+                                  : diags_.back().message;
+    if (!at(kind::end) && !at(kind::lbrace) &&
+        tok().range.start.offset == panic_offset_ &&
+        (top_level || starts_stmt(tok().kind))) {
+      advance();
+    }
+    for (;;) {
+      auto k = tok().kind;
+      if (k == kind::end) {
+        break;
+      } else if (k == kind::semicolon) {
+        advance();
+        break;
+      } else if (k == kind::lbrace) {
+        // a block ends the damaged construct; skip it whole so that its
+        // closing brace does not end the enclosing one
+        for (int depth = 0;;) {
+          if (at(kind::lbrace)) {
+            depth++;
+          } else if (at(kind::rbrace) && --depth == 0) {
+            advance();
+            break;
+          } else if (at(kind::end)) {
+            break;
+          }
+          advance();
+        }
+        break;
+      } else if (top_level ? k == kind::kw_let || k == kind::kw_fun
+                           : k == kind::rbrace || starts_stmt(k)) {
+        break;
+      }
+      advance();
+    }
+    panic_ = false;
+    return std::make_shared<ast::error_node<T>>(range_from(start),
+                                                std::move(message));
+  }
+
+  source_range parser::range_from(source_position start) {
+    return source_range{tok().range.filename, start, prev_end_};
+  }
+
+  //
+  // Declarations
+  //
+
+  ast::translation_unit::ptr parser::parse_translation_unit() {
+    auto fn = tok().range.filename;
+    ast::decl::list decls;
+    while (!at(kind::end)) {
+      decls.push_back(parse_decl());
+    }
+    return std::make_shared<ast::translation_unit>(
+        std::move(fn), std::move(decls), build_.literals());
+  }
+
+  ast::decl::ptr parser::parse_decl() {
+    auto start = tok().range.start;
+    auto decl = parse_decl_unchecked();
+    if (panic_) {
+      return recover<ast::decl>(start, true);
+    }
+    return decl;
+  }
+
+  ast::decl::ptr parser::parse_decl_unchecked() {
+    if (at(kind::kw_let)) {
+      return parse_let_decl();
+    } else if (at(kind::kw_fun)) {
+      return parse_fun_decl();
+    }
+    error("declaration");
+    return nullptr;
+  }
+
+  ast::node::ptr<ast::let_decl> parser::parse_let_decl() {
+    auto start = tok().range.start;
+    expect(kind::kw_let, "'let'");
+    auto name = expect_ident("variable name");
+    ast::node::ptr<ast::type_ref> type;
+    if (accept(kind::colon)) {
+      type = parse_type();
+    }
+    ast::expr::ptr init;
+    if (accept(kind::equal)) {
+      init = parse_expr(precedence(operator_kind::assign));
+    }
+    expect(kind::semicolon, "';'");
+    return std::make_shared<ast::let_decl>(range_from(start), std::move(name),
+                                           std::move(type), std::move(init));
+  }
+
+  ast::node::ptr<ast::let_decl> parser::parse_param() {
+    auto start = tok().range.start;
+    auto name = expect_ident("parameter name");
+    expect(kind::colon, "':'");
+    auto type = parse_type();
+    return std::make_shared<ast::let_decl>(range_from(start), std::move(name),
+                                           std::move(type));
+  }
+
+  ast::node::ptr<ast::fun_decl> parser::parse_fun_decl() {
+    auto start = tok().range.start;
+    expect(kind::kw_fun, "'fun'");
+    auto name = expect_ident("function name");
+    expect(kind::lparen, "'('");
+    ast::decl::list params;
+    if (!at(kind::rparen)) {
+      do {
+        params.push_back(parse_param());
+      } while (accept(kind::comma));
+    }
+    expect(kind::rparen, "')'");
+    ast::node::ptr<ast::type_ref> ret_type;
+    if (accept(kind::colon)) {
+      ret_type = parse_type();
+    }
+    if (panic_) {
+      // recovery skips the body as a whole, so that its statements are not
+      // taken for declarations
+      return nullptr;
+    }
+    if (lazy_source_ && at(kind::lbrace)) {
+      if (auto load = skip_fun_body()) {
+        return std::make_shared<ast::fun_decl>(
+            range_from(start), std::move(name), std::move(params),
+            std::move(ret_type), std::move(load));
+      }
+    }
+    auto stmts = parse_block_body();
+    return std::make_shared<ast::fun_decl>(range_from(start), std::move(name),
+                                           std::move(params),
+                                           std::move(ret_type),
+                                           std::move(stmts));
+  }
+
+  ast::fun_decl::loader parser::skip_fun_body() {
+    auto const &src = *lazy_source_;
+    auto open = tok().range.start;
+    auto pos = open;
+    auto i = open.offset;
+    auto n = src.size();
+
+    // mirrors the tokenizer's position tracking, including \r\n
+    auto bump = [&] {
+      if (src[i] == '\r' && i + 1 < n && src[i + 1] == '\n') {
+        i++, pos.offset++;
+      }
+      if (src[i] == '\n' || src[i] == '\r') {
+        pos.line++, pos.column = 0;
+      } else {
+        pos.column++;
+      }
+      i++, pos.offset++;
+    };
+
+    int depth = 0;
+    while (i < n) {
+      auto ch = src[i];
+      if (ch == '{') {
+        depth++;
+      } else if (ch == '}') {
+        if (--depth == 0) {
+          bump();
+          break;
+        }
+      } else if (ch == '"' || ch == '\'') {
+        bump();
+        while (i < n && src[i] != ch) {
+          if (src[i] == '\\' && i + 1 < n) {
+            bump();
+          }
+          bump();
+        }
+      } else if (ch == '/' && i + 1 < n && src[i + 1] == '/') {
+        while (i < n && src[i] != '\n' && src[i] != '\r') {
+          bump();
+        }
+        continue;
+      } else if (ch == '/' && i + 1 < n && src[i + 1] == '*') {
+        bump(), bump();
+        int comment_depth = 1;
+        while (i < n && comment_depth > 0) {
+          if (src[i] == '/' && i + 1 < n && src[i + 1] == '*') {
+            bump(), comment_depth++;
+          } else if (src[i] == '*' && i + 1 < n && src[i + 1] == '/') {
+            bump(), comment_depth--;
+          }
+          bump();
+        }
+        continue;
+      }
+      if (i < n) {
+        bump();
+      }
+    }
+    if (depth != 0) {
+      // parse the body now, which reports where it actually goes wrong
+      return nullptr;
+    }
+
+    auto close = pos;
+    tokens_.seek(close);
+    prev_end_ = close;
+    skip_error_tokens();
+
+    // the body's literals go to the unit's pool and are shared with the
+    // rest of the unit
+    return [source = lazy_source_, build = lazy_build_,
+            fn = tok().range.filename, open,
+            close](soda::diagnostics &diags) {
+      std::ispanstream in{std::span<char const>{
+          source->data() + open.offset, close.offset - open.offset}};
+      tokenizer tokens{in, fn, open};
+      std::scoped_lock lock{build->mutex()};
+      parser p{tokens, *build};
+      auto stmts = p.parse_fun_body();
+      diags = p.take_diagnostics();
+      return stmts;
+    };
+  }
+
+  ast::stmt::list parser::parse_fun_body() {
+    auto stmts = parse_block_body();
+    if (!at(kind::end)) {
+      error("end of function body");
+      auto start = tok().range.start;
+      while (!at(kind::end)) {
+        advance();
+      }
+      stmts.push_back(recover<ast::stmt>(start, false));
+    }
+    return stmts;
+  }
+
+  ast::node::ptr<ast::type_ref> parser::parse_type() {
+    auto start = tok().range.start;
+    auto name = expect_ident("type name");
+    while (accept(kind::lbracket)) {
+      expect(kind::rbracket, "']'");
+      name += "[]";
+    }
+    return std::make_shared<ast::unresolved_type_ref>(range_from(start),
+                                                      std::move(name));
+  }
+
+  //
+  // Statements
+  //
+
+  ast::stmt::ptr parser::parse_stmt() {
+    auto start = tok().range.start;
+    if (panic_) {
+      // an enclosing construct failed just before this statement, e.g. at a
+      // missing ')' after an if condition
+      return recover<ast::stmt>(start, false);
+    }
+    auto stmt = parse_stmt_unchecked();
+    if (panic_) {
+      return recover<ast::stmt>(start, false);
+    }
+    return stmt;
+  }
+
+  ast::stmt::ptr parser::parse_stmt_unchecked() {
+    switch (tok().kind) {
+      case kind::semicolon: {
+        auto range = tok().range;
+        advance();
+        return std::make_shared<ast::empty_stmt>(std::move(range));
+      }
+      case kind::lbrace:
+        return parse_block_stmt();
+      case kind::kw_goto:
+      case kind::kw_break:
+      case kind::kw_continue:
+      case kind::kw_return:
+        return parse_jump_stmt();
+      case kind::kw_if:
+        return parse_if_stmt();
+      case kind::kw_switch:
+        return parse_switch_stmt();
+      case kind::kw_do:
+        return parse_do_stmt();
+      case kind::kw_while:
+        return parse_while_stmt();
+      case kind::kw_for:
+        return parse_for_stmt();
+      case kind::kw_foreach:
+        return parse_foreach_stmt();
+      case kind::kw_let:
+        return parse_let_decl();
+      case kind::kw_case:
+      case kind::kw_default:
+      case kind::kw_fun:
+        error("statement");
+        return nullptr;
+      default:
+        return parse_expr_or_label_stmt();
+    }
+  }
+
+  ast::stmt::ptr parser::parse_block_stmt() {
+    auto start = tok().range.start;
+    auto stmts = parse_block_body();
+    return std::make_shared<ast::block_stmt>(range_from(start),
+                                             std::move(stmts));
+  }
+
+  ast::stmt::list parser::parse_block_body() {
+    expect(kind::lbrace, "'{'");
+    ast::stmt::list stmts;
+    while (!at(kind::rbrace) && !at(kind::end)) {
+      stmts.push_back(parse_stmt());
+    }
+    expect(kind::rbrace, "'}'");
+    return stmts;
+  }
+
+  ast::stmt::ptr parser::parse_jump_stmt() {
+    auto start = tok().range.start;
+    auto jump = tok().kind;
+    advance();
+    switch (jump) {
+      case kind::kw_goto: {
+        auto label = expect_ident("label");
+        expect(kind::semicolon, "';'");
+        return std::make_shared<ast::goto_stmt>(range_from(start),
+                                                std::move(label));
+      }
+      case kind::kw_break:
+      case kind::kw_continue: {
+        std::string label;
+        if (at(kind::ident)) {
+          label = expect_ident("label");
+        }
+        expect(kind::semicolon, "';'");
+        if (jump == kind::kw_break) {
+          return std::make_shared<ast::break_stmt>(range_from(start),
+                                                   std::move(label));
+        }
+        return std::make_shared<ast::continue_stmt>(range_from(start),
+                                                    std::move(label));
+      }
+      default: {
+        ast::expr::ptr exp;
+        if (!at(kind::semicolon)) {
+          exp = parse_expr();
+        }
+        expect(kind::semicolon, "';'");
+        return std::make_shared<ast::return_stmt>(range_from(start),
+                                                  std::move(exp));
+      }
+    }
+  }
+
+  ast::stmt::ptr parser::parse_if_stmt() {
+    auto start = tok().range.start;
+    expect(kind::kw_if, "'if'");
+    expect(kind::lparen, "'('");
+    auto cond = parse_expr();
+    expect(kind::rparen, "')'");
+    auto cons = parse_stmt();
+    ast::stmt::ptr altn;
+    if (accept(kind::kw_else)) {
+      altn = parse_stmt();
+    }
+    return std::make_shared<ast::if_stmt>(range_from(start), std::move(cond),
+                                          std::move(cons), std::move(altn));
+  }
+
+  ast::stmt::ptr parser::parse_switch_stmt() {
+    auto start = tok().range.start;
+    expect(kind::kw_switch, "'switch'");
+    expect(kind::lparen, "'('");
+    auto exp = parse_expr();
+    expect(kind::rparen, "')'");
+    expect(kind::lbrace, "'{'");
+    ast::stmt::list cases;
+    while (!at(kind::rbrace) && !at(kind::end)) {
+      auto case_start = tok().range.start;
+      auto c = parse_case_stmt();
+      cases.push_back(panic_ ? recover<ast::stmt>(case_start, false)
+                             : std::move(c));
+    }
+    expect(kind::rbrace, "'}'");
+    return std::make_shared<ast::switch_stmt>(range_from(start),
+                                              std::move(exp), std::move(cases));
+  }
+
+  ast::stmt::ptr parser::parse_case_stmt() {
+    auto start = tok().range.start;
+    ast::expr::ptr exp;
+    if (accept(kind::kw_case)) {
+      exp = parse_expr();
+    } else if (!accept(kind::kw_default)) {
+      error("'case' or 'default'");
+      return nullptr;
+    }
+    expect(kind::colon, "':'");
+    ast::stmt::list stmts;
+    while (!at(kind::kw_case) && !at(kind::kw_default) &&
+           !at(kind::rbrace) && !at(kind::end)) {
+      stmts.push_back(parse_stmt());
+    }
+    return std::make_shared<ast::case_stmt>(range_from(start), std::move(exp),
+                                            std::move(stmts));
+  }
+
+  ast::stmt::ptr parser::parse_do_stmt() {
+    auto start = tok().range.start;
+    expect(kind::kw_do, "'do'");
+    auto body = parse_stmt();
+    expect(kind::kw_while, "'while'");
+    expect(kind::lparen, "'('");
+    auto exp = parse_expr();
+    expect(kind::rparen, "')'");
+    expect(kind::semicolon, "';'");
+    return std::make_shared<ast::do_stmt>(range_from(start), std::move(body),
+                                          std::move(exp));
+  }
+
+  ast::stmt::ptr parser::parse_while_stmt() {
+    auto start = tok().range.start;
+    expect(kind::kw_while, "'while'");
+    expect(kind::lparen, "'('");
+    auto exp = parse_expr();
+    expect(kind::rparen, "')'");
+    auto body = parse_stmt();
+    return std::make_shared<ast::while_stmt>(range_from(start), std::move(exp),
+                                             std::move(body));
+  }
+
+  ast::stmt::ptr parser::parse_for_stmt() {
+    auto start = tok().range.start;
+    expect(kind::kw_for, "'for'");
+    expect(kind::lparen, "'('");
+
+    ast::stmt::ptr init;
+    if (at(kind::kw_let)) {
+      init = parse_let_decl();
+    } else if (!accept(kind::semicolon)) {
+      auto init_start = tok().range.start;
+      auto exp = parse_expr();
+      init = std::make_shared<ast::expr_stmt>(range_from(init_start),
+                                              std::move(exp));
+      expect(kind::semicolon, "';'");
+    }
+
+    ast::stmt::ptr test;
+    if (!at(kind::semicolon)) {
+      auto test_start = tok().range.start;
+      auto exp = parse_expr();
+      test = std::make_shared<ast::expr_stmt>(range_from(test_start),
+                                              std::move(exp));
+    }
+    expect(kind::semicolon, "';'");
+
+    ast::stmt::ptr incr;
+    if (!at(kind::rparen)) {
+      auto incr_start = tok().range.start;
+      auto exp = parse_expr();
+      incr = std::make_shared<ast::expr_stmt>(range_from(incr_start),
+                                              std::move(exp));
+    }
+    expect(kind::rparen, "')'");
+
+    auto body = parse_stmt();
+    return std::make_shared<ast::for_stmt>(range_from(start), std::move(init),
+                                           std::move(test), std::move(incr),
+                                           std::move(body));
+  }
+
+  ast::stmt::ptr parser::parse_foreach_stmt() {
+    auto start = tok().range.start;
+    expect(kind::kw_foreach, "'foreach'");
+    expect(kind::lparen, "'('");
+    auto iter_start = tok().range.start;
+    auto name = expect_ident("loop variable");
+    auto iter = std::make_shared<ast::let_decl>(range_from(iter_start),
+                                                std::move(name));
+    expect(kind::colon, "':'");
+    auto exp = parse_expr();
+    expect(kind::rparen, "')'");
+    auto body = parse_stmt();
+    return std::make_shared<ast::foreach_stmt>(range_from(start),
+                                               std::move(iter), std::move(exp),
+                                               std::move(body));
+  }
+
+  ast::stmt::ptr parser::parse_expr_or_label_stmt() {
+    auto start = tok().range.start;
+    // an identifier followed by a colon is a label
+    if (at(kind::ident) && tokens_.peek(1).kind == kind::colon) {
+      auto label = tok().text;
+      advance();
+      advance();
+      auto stmt = parse_stmt();
+      return std::make_shared<ast::label_stmt>(
+          range_from(start), std::move(label), std::move(stmt));
+    }
+    auto exp = parse_expr();
+    expect(kind::semicolon, "';'");
+    return std::make_shared<ast::expr_stmt>(range_from(start), std::move(exp));
+  }
+
+  //
+  // Expressions
+  //
+
+  ast::expr::ptr parser::parse_expr() {
+    return parse_expr(precedence(operator_kind::comma));
+  }
+
+  ast::expr::ptr parser::parse_expr(int min_prec) {
+    auto start = tok().range.start;
+    auto lhs = parse_prefix();
+    for (;;) {
+      if (panic_) {
+        return lhs;
+      }
+      auto entry = lookup(infix_table, tok().kind);
+      if (entry.prec == 0 || entry.prec < min_prec) {
+        return lhs;
+      }
+      lhs = parse_infix(std::move(lhs), entry.op, start);
+    }
+  }
+
+  ast::expr::ptr parser::parse_prefix() {
+    auto start = tok().range.start;
+    if (auto entry = lookup(prefix_table, tok().kind); entry.prec != 0) {
+      advance();
+      auto operand = parse_expr(entry.prec);
+      return build_.make_unop(range_from(start), entry.op, std::move(operand));
+    } else if (accept(kind::lparen)) {
+      auto exp = parse_expr();
+      expect(kind::rparen, "')'");
+      return exp;
+    } else if (at(kind::ident)) {
+      auto range = tok().range;
+      auto name = tok().text;
+      advance();
+      return build_.make_ident(std::move(range), std::move(name));
+    }
+    return parse_literal();
+  }
+
+  ast::expr::ptr parser::parse_infix(ast::expr::ptr lhs, operator_kind op,
+                                     source_position start) {
+    advance();
+    switch (op) {
+      case operator_kind::post_inc:
+      case operator_kind::post_dec:
+        return build_.make_unop(range_from(start), op, std::move(lhs));
+      case operator_kind::call: {
+        ast::expr::list args;
+        if (!at(kind::rparen)) {
+          do {
+            args.push_back(parse_expr(precedence(operator_kind::assign)));
+          } while (accept(kind::comma));
+        }
+        expect(kind::rparen, "')'");
+        return build_.make_call(range_from(start), std::move(lhs),
+                                std::move(args));
+      }
+      case operator_kind::index: {
+        auto index = parse_expr();
+        expect(kind::rbracket, "']'");
+        return build_.make_binop(range_from(start), op, std::move(lhs),
+                                 std::move(index));
+      }
+      case operator_kind::member: {
+        auto range = tok().range;
+        auto name = expect_ident("member name");
+        auto member = build_.make_ident(std::move(range), std::move(name));
+        return build_.make_binop(range_from(start), op, std::move(lhs),
+                                 std::move(member));
+      }
+      case operator_kind::ifexpr: {
+        auto cons = parse_expr();
+        expect(kind::colon, "':'");
+        auto altn = parse_expr(precedence(op));
+        return build_.make_if(range_from(start), std::move(lhs),
+                              std::move(cons), std::move(altn));
+      }
+      default: {
+        auto prec = precedence(op);
+        if (associativity_of(op) == associativity::left) {
+          prec++;
+        }
+        auto rhs = parse_expr(prec);
+        return build_.make_binop(range_from(start), op, std::move(lhs),
+                                 std::move(rhs));
+      }
+    }
+  }
+
+  ast::expr::ptr parser::parse_literal() {
+    auto range = tok().range;
+    // the literal decoders throw on malformed literals, which only costs an
+    // unwind on that (rare) path
+    try {
+      switch (tok().kind) {
+        case kind::kw_true:
+        case kind::kw_false: {
+          auto value = at(kind::kw_true);
+          advance();
+          return build_.make_bool(std::move(range), value);
+        }
+        case kind::int_lit: {
+          auto value = parse_int(range, tok().text);
+          advance();
+          return build_.make_int(std::move(range), value);
+        }
+        case kind::float_lit: {
+          auto value = parse_float(range, tok().text);
+          auto extended = requires_extended_precision(tok().text, value);
+          advance();
+          return build_.make_float(std::move(range), value, extended);
+        }
+        case kind::char_lit: {
+          auto value = decode_char(range, tok().text);
+          advance();
+          return build_.make_char(std::move(range), value);
+        }
+        case kind::string_lit: {
+          auto value = decode_string(range, tok().text);
+          advance();
+          return build_.make_string(std::move(range), value);
+        }
+        default:
+          error("expression");
+          return std::make_shared<ast::error_node<ast::expr>>(
+              std::move(range), diags_.back().message);
+      }
+    } catch (parse_error const &e) {
+      if (!panic_) {
+        diags_.emplace_back(e);
+        panic_ = true;
+        panic_offset_ = range.start.offset;
+      }
+      advance();
+      return std::make_shared<ast::error_node<ast::expr>>(std::move(range),
+                                                          e.message());
+    }
+  }
+
+} // namespace soda
@@ -0,0 +1,126 @@
+#pragma once
+
+#include "ast.hpp"
+#include "builder.hpp"
+#include "diagnostic.hpp"
+#include "token_cursor.hpp"
+#include "tokenizer.hpp"
+
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace soda {
+
+  //
+  // Recursive-descent parser with a Pratt expression core
+  //
+  // The parser reads tokens through a token_cursor, so it can look a few
+  // tokens ahead (or speculate and rewind) without re-lexing, and never
+  // copies tokens; text is only copied out of a token when a node needs to
+  // own it.
+  //
+  // Syntax errors do not unwind. The first error in a statement or
+  // declaration is recorded in diagnostics() and puts the parser into panic
+  // mode, in which further expectations fail silently until the enclosing
+  // statement or declaration resynchronizes at a ';', a '}' or a keyword
+  // that starts a statement. The damaged construct is replaced by an
+  // error_node, so one pass yields every diagnostic and a usable tree.
+  //
+  // In lazy mode function bodies are skipped by brace matching over the raw
+  // source and only parsed when fun_decl::stmts() is first accessed, so
+  // declaration-level parsing does not build (or lex) the bodies. Syntax
+  // errors in such a body are found once it is loaded and kept in its
+  // fun_decl::body_errors(), which the resolver reports as it first walks
+  // the body.
+  //
+
+  class parser {
+  public:
+    parser(tokenizer &tokens, ast::builder &build);
+
+    // Skip function bodies and parse them on demand. The source must be the
+    // complete text the tokenizer is reading, and build the builder this
+    // parser was given, which the bodies are built with and keep alive.
+    void parse_bodies_lazily(std::shared_ptr<std::string const> source,
+                             std::shared_ptr<ast::builder> build) {
+      assert(build.get() == &build_);
+      lazy_source_ = std::move(source);
+      lazy_build_ = std::move(build);
+    }
+
+    ast::translation_unit::ptr parse_translation_unit();
+    ast::stmt::list parse_fun_body();
+
+    ast::decl::ptr parse_decl();
+    ast::stmt::ptr parse_stmt();
+    ast::expr::ptr parse_expr();
+
+    soda::diagnostics const &diagnostics() const noexcept {
+      return diags_;
+    }
+
+    soda::diagnostics take_diagnostics() noexcept {
+      return std::move(diags_);
+    }
+
+  private:
+    token_cursor tokens_;
+    ast::builder &build_;
+    source_position prev_end_;
+    soda::diagnostics diags_;
+    bool panic_ = false;
+    std::size_t panic_offset_ = 0;
+    std::shared_ptr<std::string const> lazy_source_;
+    std::shared_ptr<ast::builder> lazy_build_;
+
+    using kind = enum token::kind;
+
+    token const &tok() {
+      return tokens_.peek();
+    }
+    void advance();
+    void skip_error_tokens();
+    bool at(kind k) {
+      return tok().kind == k;
+    }
+    bool accept(kind k);
+    bool expect(kind k, char const *what);
+    std::string expect_ident(char const *what);
+    void error(char const *expected);
+    void report(source_range range, std::string message);
+    template <typename T>
+    ast::node::ptr<T> recover(source_position start, bool top_level);
+
+    source_range range_from(source_position start);
+
+    ast::node::ptr<ast::let_decl> parse_let_decl();
+    ast::node::ptr<ast::let_decl> parse_param();
+    ast::node::ptr<ast::fun_decl> parse_fun_decl();
+    ast::node::ptr<ast::type_ref> parse_type();
+    ast::fun_decl::loader skip_fun_body();
+
+    ast::decl::ptr parse_decl_unchecked();
+    ast::stmt::ptr parse_stmt_unchecked();
+    ast::stmt::ptr parse_block_stmt();
+    ast::stmt::list parse_block_body();
+    ast::stmt::ptr parse_jump_stmt();
+    ast::stmt::ptr parse_if_stmt();
+    ast::stmt::ptr parse_switch_stmt();
+    ast::stmt::ptr parse_case_stmt();
+    ast::stmt::ptr parse_do_stmt();
+    ast::stmt::ptr parse_while_stmt();
+    ast::stmt::ptr parse_for_stmt();
+    ast::stmt::ptr parse_foreach_stmt();
+    ast::stmt::ptr parse_expr_or_label_stmt();
+
+    ast::expr::ptr parse_expr(int min_prec);
+    ast::expr::ptr parse_prefix();
+    ast::expr::ptr parse_infix(ast::expr::ptr lhs, operator_kind op,
+                               source_position start);
+    ast::expr::ptr parse_literal();
+  };
+
+} // namespace soda
@@ -0,0 +1,486 @@
+#include "resolver.hpp"
+
+#include "symbol.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace soda {
+
+  namespace {
+
+    constexpr std::array builtin_type_names{
+        "bool", "char", "float", "int", "string", "void",
+    };
+
+    std::vector<ast::decl::ptr> const &builtin_types() {
+      static auto const types = [] {
+        std::vector<ast::decl::ptr> types;
+        for (auto name : builtin_type_names) {
+          types.push_back(std::make_shared<ast::type_decl>(
+              source_range{"<builtin>", {}, {}}, name,
+              type_table::primitive(name)));
+        }
+        return types;
+      }();
+      return types;
+    }
+
+    class resolver {
+    public:
+      resolver(type_table &types, diagnostics &diags)
+          : type_table_{types}, diags_{diags} {
+        for (auto const &type : builtin_types()) {
+          auto sym = intern(type->name);
+          types_[sym] = type;
+        }
+      }
+
+      resolve_stats const &statistics() const noexcept {
+        return stats_;
+      }
+
+      void resolve(ast::program &prog);
+
+    private:
+      struct binding {
+        ast::decl *decl = nullptr;
+        std::uint32_t depth = 0;
+      };
+
+      struct undo {
+        symbol sym;
+        binding previous;
+      };
+
+      // an enclosing statement that break or continue can refer to
+      struct jump_target {
+        ast::stmt *stmt;
+        bool is_loop;
+        std::vector<symbol> labels;
+      };
+
+      type_table &type_table_;
+      diagnostics &diags_;
+      resolve_stats stats_;
+      symbol_table symbols_;
+
+      // per symbol: innermost value binding, builtin type and label of the
+      // current function
+      std::vector<binding> values_;
+      std::vector<ast::decl::ptr> types_;
+      std::vector<ast::label_stmt *> labels_;
+
+      std::vector<undo> undo_log_;
+      std::vector<std::size_t> scopes_;
+
+      std::vector<jump_target> targets_;
+      std::vector<symbol> pending_labels_;
+      std::vector<symbol> function_labels_;
+      std::vector<ast::goto_stmt *> gotos_;
+
+      symbol intern(std::string_view name) {
+        auto sym = symbols_.intern(name);
+        if (sym >= values_.size()) {
+          values_.resize(symbols_.size());
+          types_.resize(symbols_.size());
+          labels_.resize(symbols_.size());
+        }
+        return sym;
+      }
+
+      std::uint32_t depth() const noexcept {
+        return static_cast<std::uint32_t>(scopes_.size());
+      }
+
+      void push_scope() {
+        scopes_.push_back(undo_log_.size());
+      }
+
+      void pop_scope() {
+        auto mark = scopes_.back();
+        scopes_.pop_back();
+        while (undo_log_.size() > mark) {
+          auto &u = undo_log_.back();
+          values_[u.sym] = u.previous;
+          undo_log_.pop_back();
+        }
+      }
+
+      void error(source_range const &range, std::string message) {
+        diags_.emplace_back(severity::error, range, std::move(message));
+      }
+
+      void declare(ast::decl &d);
+      ast::decl *lookup(std::string_view name);
+
+      void bind(ast::expr &e);
+      void resolve(ast::expr::ptr &e);
+      void resolve(ast::node::ptr<ast::type_ref> &type);
+      void resolve(ast::stmt::ptr &s);
+      void resolve_scoped(ast::stmt::ptr &s);
+      void resolve_loop(ast::stmt &loop, ast::stmt::ptr &body,
+                        std::vector<symbol> labels);
+      void resolve_jump(ast::stmt &s, std::string const &label, bool is_break,
+                        ast::stmt *&target);
+      void resolve_let(ast::let_decl &d);
+      void resolve_fun(ast::fun_decl &f);
+    };
+
+    void resolver::declare(ast::decl &d) {
+      auto sym = intern(d.name);
+      auto &b = values_[sym];
+      if (b.decl && b.depth == depth()) {
+        error(d.range, "redefinition of " + quote(d.name));
+        return;
+      }
+      undo_log_.push_back(undo{sym, b});
+      b = binding{&d, depth()};
+    }
+
+    ast::decl *resolver::lookup(std::string_view name) {
+      stats_.lookups++;
+      return values_[intern(name)].decl;
+    }
+
+    //
+    // Expressions
+    //
+
+    // Bind the names in an expression tree.
+    void resolver::bind(ast::expr &e) {
+      switch (e.kind) {
+        case ast::node_kind::ident_expr: {
+          auto &n = static_cast<ast::ident_expr &>(e);
+          n.ref = lookup(n.name);
+          if (!n.ref) {
+            error(n.range, "use of undeclared identifier " + quote(n.name));
+          }
+          break;
+        }
+        case ast::node_kind::unop_expr:
+          bind(*static_cast<ast::unop_expr &>(e).operand);
+          break;
+        case ast::node_kind::binop_expr: {
+          auto &n = static_cast<ast::binop_expr &>(e);
+          bind(*n.lhs);
+          // the right-hand side of a member access names a field, not a
+          // variable
+          if (n.op != operator_kind::member) {
+            bind(*n.rhs);
+          }
+          break;
+        }
+        case ast::node_kind::if_expr: {
+          auto &n = static_cast<ast::if_expr &>(e);
+          bind(*n.cond);
+          bind(*n.cons);
+          bind(*n.altn);
+          break;
+        }
+        case ast::node_kind::call_expr: {
+          auto &n = static_cast<ast::call_expr &>(e);
+          bind(*n.callee);
+          for (auto &arg : n.arguments) {
+            bind(*arg);
+          }
+          break;
+        }
+        default:
+          break;
+      }
+    }
+
+    void resolver::resolve(ast::expr::ptr &e) {
+      if (e) {
+        bind(*e);
+      }
+    }
+
+    void resolver::resolve(ast::node::ptr<ast::type_ref> &type) {
+      if (!type || type->is_resolved()) {
+        return;
+      }
+      std::string_view name = type->name;
+      std::size_t rank = 0;
+      while (name.ends_with("[]")) {
+        name.remove_suffix(2);
+        rank++;
+      }
+      auto const &decl = types_[intern(name)];
+      if (!decl) {
+        error(type->range, "unknown type " + quote(name));
+        return;
+      }
+      auto canonical = static_cast<ast::type_decl const &>(*decl).canonical;
+      for (; rank > 0; rank--) {
+        canonical = type_table_.array_of(canonical);
+      }
+      type = std::make_shared<ast::resolved_type_ref>(type->range, type->name,
+                                                      decl);
+      type->canonical = canonical;
+    }
+
+    //
+    // Statements
+    //
+
+    // Sub-statements that are not blocks still get a scope of their own, so
+    // that e.g. the let in "if (c) let x = 1;" does not leak.
+    void resolver::resolve_scoped(ast::stmt::ptr &s) {
+      push_scope();
+      resolve(s);
+      pop_scope();
+    }
+
+    void resolver::resolve_loop(ast::stmt &loop, ast::stmt::ptr &body,
+                                std::vector<symbol> labels) {
+      targets_.push_back(jump_target{&loop, true, std::move(labels)});
+      resolve_scoped(body);
+      targets_.pop_back();
+    }
+
+    void resolver::resolve_jump(ast::stmt &s, std::string const &label,
+                                bool is_break, ast::stmt *&target) {
+      auto what = is_break ? "break" : "continue";
+      if (label.empty()) {
+        for (auto t = targets_.rbegin(); t != targets_.rend(); ++t) {
+          if (is_break || t->is_loop) {
+            target = t->stmt;
+            return;
+          }
+        }
+        error(s.range, std::string{what} +
+                           (is_break ? " outside of a loop or switch"
+                                     : " outside of a loop"));
+        return;
+      }
+      auto sym = intern(label);
+      for (auto t = targets_.rbegin(); t != targets_.rend(); ++t) {
+        for (auto l : t->labels) {
+          if (l != sym) {
+            continue;
+          }
+          if (!is_break && !t->is_loop) {
+            error(s.range, "cannot continue " + quote(label) +
+                               ", which is not a loop");
+            return;
+          }
+          target = t->stmt;
+          return;
+        }
+      }
+      error(s.range, std::string{what} + " to " + quote(label) +
+                         ", which is not an enclosing statement");
+    }
+
+    void resolver::resolve(ast::stmt::ptr &s) {
+      if (!s) {
+        return;
+      }
+      // labels apply to the statement they prefix, and only matter for
+      // loops and switches
+      std::vector<symbol> labels;
+      if (s->kind != ast::node_kind::label_stmt) {
+        labels.swap(pending_labels_);
+      }
+
+      switch (s->kind) {
+        case ast::node_kind::expr_stmt:
+          resolve(static_cast<ast::expr_stmt &>(*s).exp);
+          break;
+        case ast::node_kind::block_stmt:
+          push_scope();
+          for (auto &child : static_cast<ast::block_stmt &>(*s).stmts) {
+            resolve(child);
+          }
+          pop_scope();
+          break;
+        case ast::node_kind::label_stmt: {
+          auto &n = static_cast<ast::label_stmt &>(*s);
+          auto sym = intern(n.label);
+          if (labels_[sym]) {
+            error(n.range, "redefinition of label " + quote(n.label));
+          } else {
+            labels_[sym] = &n;
+            function_labels_.push_back(sym);
+          }
+          pending_labels_.push_back(sym);
+          resolve(n.stmt);
+          pending_labels_.clear();
+          break;
+        }
+        case ast::node_kind::goto_stmt:
+          gotos_.push_back(&static_cast<ast::goto_stmt &>(*s));
+          break;
+        case ast::node_kind::break_stmt: {
+          auto &n = static_cast<ast::break_stmt &>(*s);
+          resolve_jump(n, n.label, true, n.target);
+          break;
+        }
+        case ast::node_kind::continue_stmt: {
+          auto &n = static_cast<ast::continue_stmt &>(*s);
+          resolve_jump(n, n.label, false, n.target);
+          break;
+        }
+        case ast::node_kind::return_stmt:
+          resolve(static_cast<ast::return_stmt &>(*s).exp);
+          break;
+        case ast::node_kind::if_stmt: {
+          auto &n = static_cast<ast::if_stmt &>(*s);
+          resolve(n.cond);
+          resolve_scoped(n.cons);
+          resolve_scoped(n.altn);
+          break;
+        }
+        case ast::node_kind::switch_stmt: {
+          auto &n = static_cast<ast::switch_stmt &>(*s);
+          resolve(n.exp);
+          targets_.push_back(jump_target{&n, false, std::move(labels)});
+          // the cases share one scope, as in C
+          push_scope();
+          for (auto &c : n.cases) {
+            if (c->kind != ast::node_kind::case_stmt) {
+              continue;
+            }
+            auto &cs = static_cast<ast::case_stmt &>(*c);
+            resolve(cs.exp);
+            for (auto &child : cs.stmts) {
+              resolve(child);
+            }
+          }
+          pop_scope();
+          targets_.pop_back();
+          break;
+        }
+        case ast::node_kind::do_stmt: {
+          auto &n = static_cast<ast::do_stmt &>(*s);
+          resolve_loop(n, n.stmt, std::move(labels));
+          resolve(n.exp);
+          break;
+        }
+        case ast::node_kind::while_stmt: {
+          auto &n = static_cast<ast::while_stmt &>(*s);
+          resolve(n.exp);
+          resolve_loop(n, n.stmt, std::move(labels));
+          break;
+        }
+        case ast::node_kind::for_stmt: {
+          auto &n = static_cast<ast::for_stmt &>(*s);
+          push_scope();
+          resolve(n.init);
+          resolve(n.test);
+          resolve(n.incr);
+          resolve_loop(n, n.stmt, std::move(labels));
+          pop_scope();
+          break;
+        }
+        case ast::node_kind::foreach_stmt: {
+          auto &n = static_cast<ast::foreach_stmt &>(*s);
+          resolve(n.exp);
+          push_scope();
+          if (n.iter) {
+            declare(*n.iter);
+          }
+          resolve_loop(n, n.stmt, std::move(labels));
+          pop_scope();
+          break;
+        }
+        case ast::node_kind::let_decl:
+          resolve_let(static_cast<ast::let_decl &>(*s));
+          declare(static_cast<ast::decl &>(*s));
+          break;
+        default:
+          break;
+      }
+    }
+
+    //
+    // Declarations
+    //
+
+    // The initializer is resolved before the name is declared, so in
+    // "let x = x + 1;" the x on the right refers to an outer x.
+    void resolver::resolve_let(ast::let_decl &d) {
+      resolve(d.type);
+      resolve(d.init_exp);
+    }
+
+    void resolver::resolve_fun(ast::fun_decl &f) {
+      push_scope();
+      for (auto &p : f.params) {
+        if (p->kind == ast::node_kind::let_decl) {
+          resolve_let(static_cast<ast::let_decl &>(*p));
+          declare(*p);
+        }
+      }
+      resolve(f.ret_type);
+      // a body parsed lazily is loaded here, the first pass to walk it
+      std::ranges::copy(f.body_errors(), std::back_inserter(diags_));
+      // the body shares the parameters' scope, so a local cannot redeclare
+      // a parameter
+      for (auto &s : f.stmts()) {
+        resolve(s);
+      }
+      pop_scope();
+
+      for (auto g : gotos_) {
+        auto target = labels_[intern(g->label)];
+        if (!target) {
+          error(g->range, "use of undeclared label " + quote(g->label));
+        }
+        g->target = target;
+      }
+      gotos_.clear();
+      for (auto sym : function_labels_) {
+        labels_[sym] = nullptr;
+      }
+      function_labels_.clear();
+    }
+
+    void resolver::resolve(ast::program &prog) {
+      push_scope();
+      for (auto &tu : prog.tus) {
+        for (auto &d : tu->decls) {
+          if (!d->is_error_node()) {
+            declare(*d);
+          }
+        }
+      }
+      for (auto &tu : prog.tus) {
+        for (auto &d : tu->decls) {
+          if (d->kind == ast::node_kind::let_decl) {
+            resolve_let(static_cast<ast::let_decl &>(*d));
+          } else if (d->kind == ast::node_kind::fun_decl) {
+            resolve_fun(static_cast<ast::fun_decl &>(*d));
+          }
+        }
+      }
+      pop_scope();
+    }
+
+  } // namespace
+
+  resolve_stats resolve(ast::program &prog, diagnostics &diags) {
+    resolver r{*prog.types, diags};
+    r.resolve(prog);
+    return r.statistics();
+  }
+
+  ast::decl::ptr builtin_type(std::string_view name) {
+    for (auto const &type : builtin_types()) {
+      if (type->name == name) {
+        return type;
+      }
+    }
+    return nullptr;
+  }
+
+} // namespace soda
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "ast.hpp"
+#include "diagnostic.hpp"
+
+#include <cstddef>
+#include <string_view>
+
+namespace soda {
+
+  //
+  // Name resolution
+  //
+  // A single walk over the program that binds every ident_expr to its
+  // declaration, goto statements to their label and break/continue
+  // statements to the loop or switch they leave, and rewrites each
+  // unresolved_type_ref into a resolved_type_ref.
+  //
+  // Scoping follows the usual block structure: top-level declarations of
+  // all translation units are visible everywhere, a let is visible from the
+  // end of its own declaration to the end of its block, and labels are
+  // visible throughout their function. Types live in a namespace of their
+  // own, which for now only holds the builtin types.
+  //
+  // Names are interned to dense symbols, and the innermost binding of every
+  // symbol is kept in one flat array indexed by symbol, with an undo log to
+  // restore shadowed bindings when a scope closes. A lookup is thus a
+  // single array access no matter how deeply scopes nest.
+  //
+  // Lazily parsed function bodies are loaded.
+  //
+
+  struct resolve_stats {
+    std::size_t lookups = 0;
+  };
+
+  resolve_stats resolve(ast::program &prog, diagnostics &diags);
+
+  // The declaration of a builtin type, e.g. "int", or nullptr.
+  ast::decl::ptr builtin_type(std::string_view name);
+
+} // namespace soda
@@ -0,0 +1,239 @@
+#include "rewrite.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <numeric>
+#include <span>
+
+namespace soda::ir {
+
+  edge_map::edge_map(flow_graph const &g)
+      : succ_base_(g.size() + 1), pred_base_(g.size() + 1),
+        in_(g.edge_count()) {
+    for (block_id b = 0; b < g.size(); b++) {
+      succ_base_[b + 1] = succ_base_[b] +
+                          static_cast<std::uint32_t>(g.succs(b).size());
+      pred_base_[b + 1] = pred_base_[b] +
+                          static_cast<std::uint32_t>(g.preds(b).size());
+    }
+    // Predecessors are sorted and edges from one block keep their order,
+    // so visiting the edges in order fills each block's predecessors in
+    // order.
+    std::vector<std::uint32_t> next(pred_base_.begin(), pred_base_.end() - 1);
+    for (block_id b = 0; b < g.size(); b++) {
+      auto succs = g.succs(b);
+      for (std::size_t i = 0; i < succs.size(); i++) {
+        in_[next[succs[i]]++] = out(b, i);
+      }
+    }
+  }
+
+  use_map::use_map(function const &f) : offsets_(f.size() + 1) {
+    for (value_id v = 0; v < f.size(); v++) {
+      for (auto o : f.operands_of(v)) {
+        offsets_[o + 1]++;
+      }
+    }
+    for (std::size_t v = 0; v < f.size(); v++) {
+      offsets_[v + 1] += offsets_[v];
+    }
+    users_.resize(offsets_.back());
+    std::vector<std::uint32_t> next(offsets_.begin(), offsets_.end() - 1);
+    for (value_id v = 0; v < f.size(); v++) {
+      for (auto o : f.operands_of(v)) {
+        users_[next[o]++] = v;
+      }
+    }
+  }
+
+  std::vector<block_id> blocks_of(function const &f) {
+    std::vector<block_id> result(f.size());
+    for (block_id b = 0; b < f.blocks.size(); b++) {
+      for (auto v : f.values_of(b)) {
+        result[v] = b;
+      }
+    }
+    return result;
+  }
+
+  rewriter::rewriter(function &f)
+      : f_{f}, edges_{f.graph}, replacement_(f.size()),
+        edge_removed_(edges_.size()), size_{f.size()} {
+    std::iota(replacement_.begin(), replacement_.end(), value_id{0});
+  }
+
+  void rewriter::fold_branch(block_id b, std::size_t i) {
+    auto &term = f_.instrs[f_.terminator(b)];
+    term.op = opcode::jump;
+    term.count = 0;
+    for (std::size_t k = 0; k < f_.graph.succs(b).size(); k++) {
+      if (k != i) {
+        remove_edge(edges_.out(b, k));
+      }
+    }
+  }
+
+  value_id rewriter::insert(value_id before, opcode op,
+                            soda::type const *type,
+                            std::span<value_id const> operands,
+                            std::uint64_t imm) {
+    auto v = static_cast<value_id>(f_.size());
+    f_.instrs.push_back(
+        instr{op, static_cast<std::uint32_t>(f_.operands.size()),
+              static_cast<std::uint32_t>(operands.size()), type, imm});
+    f_.operands.insert(f_.operands.end(), operands.begin(), operands.end());
+    replacement_.push_back(v);
+    inserted_.emplace_back(before, v);
+    changed_ = true;
+    return v;
+  }
+
+  value_id rewriter::resolve(value_id v) const {
+    while (v != no_value && replacement_[v] != v) {
+      v = replacement_[v];
+    }
+    return v;
+  }
+
+  rewrite_stats rewriter::apply() {
+    if (!changed_) {
+      return {};
+    }
+    auto const &g = f_.graph;
+
+    // the blocks still reachable, numbered in their old order
+    std::vector<block_id> block_ids(f_.blocks.size(), no_block);
+    {
+      std::vector<block_id> stack{0};
+      block_ids[0] = 0;
+      while (!stack.empty()) {
+        auto b = stack.back();
+        stack.pop_back();
+        auto succs = g.succs(b);
+        for (std::size_t i = 0; i < succs.size(); i++) {
+          if (!edge_removed_[edges_.out(b, i)] &&
+              block_ids[succs[i]] == no_block) {
+            block_ids[succs[i]] = 0;
+            stack.push_back(succs[i]);
+          }
+        }
+      }
+    }
+    std::vector<block_id> kept;
+    for (block_id b = 0; b < f_.blocks.size(); b++) {
+      if (block_ids[b] != no_block) {
+        block_ids[b] = static_cast<block_id>(kept.size());
+        kept.push_back(b);
+      }
+    }
+    auto live_in = [&](block_id b, std::size_t k) {
+      return !edge_removed_[edges_.in(b, k)] &&
+             block_ids[g.preds(b)[k]] != no_block;
+    };
+
+    // Phis of a single value, once the dropped edges are gone, stand for
+    // that value. It dominates the predecessors it comes from, and so the
+    // phi's block.
+    for (auto b : kept) {
+      for (auto v : f_.values_of(b)) {
+        if (f_.instrs[v].op != opcode::phi || replacement_[v] != v) {
+          continue;
+        }
+        auto ops = f_.operands_of(v);
+        auto same = no_value;
+        bool single = true;
+        for (std::size_t k = 0; k < ops.size() && single; k++) {
+          auto o = live_in(b, k) ? resolve(ops[k]) : v;
+          if (o != v && o != same) {
+            single = same == no_value;
+            same = o;
+          }
+        }
+        if (single && same != no_value) {
+          replacement_[v] = same;
+        }
+      }
+    }
+
+    rewrite_stats stats;
+    stats.blocks_removed = f_.blocks.size() - kept.size();
+    std::ranges::stable_sort(inserted_, {}, [](auto const &p) {
+      return p.first;
+    });
+    std::vector<value_id> value_ids(f_.size(), no_value);
+    std::vector<value_id> order;
+    order.reserve(f_.size());
+    std::vector<block> blocks;
+    blocks.reserve(kept.size());
+    std::size_t kept_values = 0;
+    for (auto b : kept) {
+      auto first = static_cast<std::uint32_t>(order.size());
+      // phis first, then the instructions that were changed from phis
+      for (bool phis : {true, false}) {
+        auto emit = [&](value_id v) {
+          if ((f_.instrs[v].op == opcode::phi) == phis &&
+              replacement_[v] == v) {
+            value_ids[v] = static_cast<value_id>(order.size());
+            order.push_back(v);
+          }
+        };
+        for (auto v : f_.values_of(b)) {
+          if (!inserted_.empty()) {
+            auto [from, to] = std::ranges::equal_range(
+                inserted_, v, {}, [](auto const &p) { return p.first; });
+            for (auto it = from; it != to; it++) {
+              emit(it->second);
+            }
+          }
+          auto size = order.size();
+          emit(v);
+          kept_values += order.size() - size;
+        }
+      }
+      blocks.push_back(
+          block{first, static_cast<std::uint32_t>(order.size()) - first});
+    }
+    stats.instrs_removed = size_ - kept_values;
+
+    std::vector<instr> instrs;
+    instrs.reserve(order.size());
+    std::vector<value_id> operands;
+    operands.reserve(f_.operands.size());
+    for (block_id b = 0; b < kept.size(); b++) {
+      for (auto v : std::span{order}.subspan(blocks[b].first,
+                                             blocks[b].count)) {
+        auto i = f_.instrs[v];
+        auto ops = f_.operands_of(v);
+        i.first = static_cast<std::uint32_t>(operands.size());
+        for (std::size_t k = 0; k < ops.size(); k++) {
+          if (i.op != opcode::phi || live_in(kept[b], k)) {
+            auto o = resolve(ops[k]);
+            assert(o != no_value && value_ids[o] != no_value &&
+                   "use of a dropped value");
+            operands.push_back(value_ids[o]);
+          }
+        }
+        i.count = static_cast<std::uint32_t>(operands.size()) - i.first;
+        instrs.push_back(i);
+      }
+    }
+
+    std::vector<flow_graph::edge> edges;
+    edges.reserve(g.edge_count());
+    for (auto b : kept) {
+      auto succs = g.succs(b);
+      for (std::size_t i = 0; i < succs.size(); i++) {
+        if (!edge_removed_[edges_.out(b, i)]) {
+          edges.emplace_back(block_ids[b], block_ids[succs[i]]);
+        }
+      }
+    }
+
+    f_.instrs = std::move(instrs);
+    f_.operands = std::move(operands);
+    f_.blocks = std::move(blocks);
+    f_.graph = flow_graph{f_.blocks.size(), edges};
+    return stats;
+  }
+
+} // namespace soda::ir
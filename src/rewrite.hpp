@@ -0,0 +1,152 @@
+#pragma once
+
+#include "ir.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <utility>
+#include <vector>
+
+namespace soda::ir {
+
+  //
+  // Edge numbering
+  //
+  // Numbers the edges of a function's graph block by block in the order of
+  // the successors, and finds the edge behind each predecessor of a block,
+  // that is behind each phi operand, so that passes can keep per-edge
+  // state in flat arrays.
+  //
+
+  class edge_map {
+  public:
+    explicit edge_map(flow_graph const &g);
+
+    std::size_t size() const noexcept {
+      return in_.size();
+    }
+
+    // The edge to the i-th successor of b.
+    std::uint32_t out(block_id b, std::size_t i) const noexcept {
+      return succ_base_[b] + static_cast<std::uint32_t>(i);
+    }
+
+    // The edge from the k-th predecessor of b.
+    std::uint32_t in(block_id b, std::size_t k) const noexcept {
+      return in_[pred_base_[b] + k];
+    }
+
+  private:
+    std::vector<std::uint32_t> succ_base_;
+    std::vector<std::uint32_t> pred_base_;
+    std::vector<std::uint32_t> in_;
+  };
+
+  //
+  // Def-use chains
+  //
+  // The users of every value back to back in one array, like the edges of
+  // a flow_graph; a user appears once per operand that refers to the value.
+  //
+
+  class use_map {
+  public:
+    explicit use_map(function const &f);
+
+    std::span<value_id const> users(value_id v) const noexcept {
+      return {users_.data() + offsets_[v], users_.data() + offsets_[v + 1]};
+    }
+
+  private:
+    std::vector<std::uint32_t> offsets_;
+    std::vector<value_id> users_;
+  };
+
+  // The block of every value.
+  std::vector<block_id> blocks_of(function const &f);
+
+  //
+  // Rewriting
+  //
+  // Passes record what to replace, drop, insert and disconnect, changing
+  // instructions in place where that keeps their number and position, and
+  // then rebuild the function in one go: the blocks still reachable from
+  // the entry are kept in order, phis lose the operands of dropped edges
+  // and phis left with a single value are replaced by it. Values are
+  // renumbered, so value ids held by a pass are stale afterwards.
+  //
+  // Inserted instructions are appended to the function right away and
+  // numbered after the existing ones until the rebuild puts them in place,
+  // which invalidates references to instructions and operands.
+  //
+
+  struct rewrite_stats {
+    std::size_t instrs_removed = 0;
+    std::size_t blocks_removed = 0;
+  };
+
+  class rewriter {
+  public:
+    explicit rewriter(function &f);
+
+    function &target() const noexcept {
+      return f_;
+    }
+
+    edge_map const &edges() const noexcept {
+      return edges_;
+    }
+
+    // Make the uses of v use by instead, and drop v.
+    void replace(value_id v, value_id by) {
+      replacement_[v] = by;
+      changed_ = true;
+    }
+
+    // Drop v, which must not be used by anything that is kept.
+    void remove(value_id v) {
+      replacement_[v] = no_value;
+      changed_ = true;
+    }
+
+    void remove_edge(std::uint32_t e) {
+      edge_removed_[e] = true;
+      changed_ = true;
+    }
+
+    // Turn v into a constant of its type.
+    void set_constant(value_id v, std::uint64_t bits) {
+      f_.instrs[v] = instr{opcode::constant, 0, 0, f_.instrs[v].type, bits};
+      changed_ = true;
+    }
+
+    // Turn the branch or switch ending b into a jump to its i-th successor.
+    void fold_branch(block_id b, std::size_t i);
+
+    // Add an instruction right before v, and after what was inserted
+    // before v earlier; phis go among the phis of v's block. The operands
+    // must not be a view of the function's own.
+    value_id insert(value_id before, opcode op, soda::type const *type,
+                    std::span<value_id const> operands,
+                    std::uint64_t imm = 0);
+
+    // Rebuild the function, unless nothing was recorded.
+    rewrite_stats apply();
+
+  private:
+    function &f_;
+    edge_map edges_;
+    // each value itself, the value replacing it or no_value if dropped
+    std::vector<value_id> replacement_;
+    std::vector<bool> edge_removed_;
+    // the inserted values after the value they go before
+    std::vector<std::pair<value_id, value_id>> inserted_;
+    // the number of values before any insertion
+    std::size_t size_;
+    bool changed_ = false;
+
+    value_id resolve(value_id v) const;
+  };
+
+} // namespace soda::ir
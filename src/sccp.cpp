@@ -0,0 +1,291 @@
+#include "constant.hpp"
+#include "optimize.hpp"
+#include "rewrite.hpp"
+
+#include <bit>
+#include <vector>
+
+namespace soda::ir {
+
+  namespace {
+
+    // A value is unknown until an executable instruction defines it, and
+    // can then only become a constant and then varying.
+    enum class lattice : std::uint8_t {
+      unknown,
+      constant,
+      varying,
+    };
+
+    bool to_constant(soda::type const *t, std::uint64_t bits, constant &c) {
+      switch (t->kind) {
+        case type_kind::bool_type:
+          c = constant::of_bool(bits != 0);
+          return true;
+        // chars compare as their code points
+        case type_kind::char_type:
+        case type_kind::int_type:
+          c = constant::of_int(static_cast<std::int64_t>(bits));
+          return true;
+        case type_kind::float_type:
+          c = constant::of_float(std::bit_cast<double>(bits));
+          return true;
+        default:
+          return false;
+      }
+    }
+
+    bool from_constant(constant const &c, soda::type const *t,
+                       std::uint64_t &bits) {
+      switch (t->kind) {
+        case type_kind::bool_type:
+          bits = c.b;
+          return c.kind == constant::kind::boolean;
+        case type_kind::int_type:
+          bits = static_cast<std::uint64_t>(c.i);
+          return c.kind == constant::kind::integer;
+        case type_kind::float_type:
+          bits = std::bit_cast<std::uint64_t>(static_cast<double>(c.f));
+          return c.kind == constant::kind::floating;
+        default:
+          return false;
+      }
+    }
+
+    class propagator {
+    public:
+      explicit propagator(function &f)
+          : f_{f}, rw_{f}, uses_{f}, block_of_{blocks_of(f)},
+            state_(f.size()), bits_(f.size()),
+            executable_(f.blocks.size()),
+            edge_executable_(rw_.edges().size()) {
+      }
+
+      void run(pass_stats &stats);
+
+    private:
+      function &f_;
+      rewriter rw_;
+      use_map uses_;
+      std::vector<block_id> block_of_;
+      std::vector<lattice> state_;
+      std::vector<std::uint64_t> bits_;
+      std::vector<bool> executable_;
+      std::vector<bool> edge_executable_;
+      // blocks with a newly executable edge into them
+      std::vector<block_id> flow_work_;
+      // values whose users need another look
+      std::vector<value_id> value_work_;
+
+      void set(value_id v, lattice s, std::uint64_t bits = 0) {
+        if (s == lattice::constant && state_[v] == lattice::constant &&
+            bits != bits_[v]) {
+          s = lattice::varying;
+        }
+        if (s > state_[v]) {
+          state_[v] = s;
+          bits_[v] = bits;
+          value_work_.push_back(v);
+        }
+      }
+
+      void mark_edge(block_id b, std::size_t i) {
+        auto e = rw_.edges().out(b, i);
+        if (!edge_executable_[e]) {
+          edge_executable_[e] = true;
+          flow_work_.push_back(f_.graph.succs(b)[i]);
+        }
+      }
+
+      void mark_edges(block_id b) {
+        for (std::size_t i = 0; i < f_.graph.succs(b).size(); i++) {
+          mark_edge(b, i);
+        }
+      }
+
+      void visit(value_id v);
+      void visit_phi(value_id v);
+      void visit_terminator(value_id v);
+      void evaluate(value_id v);
+    };
+
+    void propagator::visit(value_id v) {
+      auto op = f_.instrs[v].op;
+      if (op == opcode::phi) {
+        visit_phi(v);
+      } else if (is_terminator(op)) {
+        visit_terminator(v);
+      } else if (state_[v] != lattice::varying) {
+        evaluate(v);
+      }
+    }
+
+    // The meet of the operands coming in over executable edges.
+    void propagator::visit_phi(value_id v) {
+      auto b = block_of_[v];
+      auto ops = f_.operands_of(v);
+      for (std::size_t k = 0; k < ops.size(); k++) {
+        if (edge_executable_[rw_.edges().in(b, k)] &&
+            state_[ops[k]] != lattice::unknown) {
+          set(v, state_[ops[k]], bits_[ops[k]]);
+        }
+      }
+    }
+
+    void propagator::visit_terminator(value_id v) {
+      auto b = block_of_[v];
+      auto ops = f_.operands_of(v);
+      switch (f_.instrs[v].op) {
+        case opcode::jump:
+          mark_edge(b, 0);
+          break;
+        case opcode::branch:
+          if (state_[ops[0]] == lattice::constant) {
+            mark_edge(b, bits_[ops[0]] ? 0 : 1);
+          } else if (state_[ops[0]] == lattice::varying) {
+            mark_edges(b);
+          }
+          break;
+        case opcode::switch_: {
+          if (state_[ops[0]] == lattice::varying) {
+            mark_edges(b);
+            break;
+          }
+          if (state_[ops[0]] == lattice::unknown) {
+            break;
+          }
+          // the first case equal to the value, unless a case before it is
+          // not known to differ
+          std::size_t k = 1;
+          for (; k < ops.size(); k++) {
+            if (state_[ops[k]] == lattice::unknown) {
+              return;
+            }
+            if (state_[ops[k]] == lattice::varying) {
+              mark_edges(b);
+              return;
+            }
+            if (bits_[ops[k]] == bits_[ops[0]]) {
+              break;
+            }
+          }
+          mark_edge(b, k - 1);
+          break;
+        }
+        default:
+          break;
+      }
+    }
+
+    void propagator::evaluate(value_id v) {
+      auto const &i = f_.instrs[v];
+      if (i.op == opcode::constant) {
+        constant c;
+        set(v, to_constant(i.type, i.imm, c) ? lattice::constant
+                                              : lattice::varying,
+            i.imm);
+        return;
+      }
+      auto ops = f_.operands_of(v);
+      if (i.op >= opcode::param || ops.empty() || ops.size() > 2) {
+        set(v, lattice::varying);
+        return;
+      }
+      constant operands[2];
+      for (std::size_t k = 0; k < ops.size(); k++) {
+        if (state_[ops[k]] == lattice::unknown) {
+          return;
+        }
+        if (state_[ops[k]] == lattice::varying ||
+            !to_constant(f_.instrs[ops[k]].type, bits_[ops[k]],
+                         operands[k])) {
+          set(v, lattice::varying);
+          return;
+        }
+      }
+      auto op = static_cast<operator_kind>(i.op);
+      constant result;
+      auto status =
+          ops.size() == 1
+              ? soda::evaluate(op, operands[0], result)
+              : soda::evaluate(op, operands[0], operands[1], result);
+      std::uint64_t bits = 0;
+      // what cannot be computed now is left to run time
+      if (status == eval_status::ok && from_constant(result, i.type, bits)) {
+        set(v, lattice::constant, bits);
+      } else {
+        set(v, lattice::varying);
+      }
+    }
+
+    void propagator::run(pass_stats &stats) {
+      executable_[0] = true;
+      for (auto v : f_.values_of(0)) {
+        visit(v);
+      }
+      while (!flow_work_.empty() || !value_work_.empty()) {
+        while (!value_work_.empty()) {
+          auto v = value_work_.back();
+          value_work_.pop_back();
+          for (auto u : uses_.users(v)) {
+            if (executable_[block_of_[u]]) {
+              visit(u);
+            }
+          }
+        }
+        if (!flow_work_.empty()) {
+          auto b = flow_work_.back();
+          flow_work_.pop_back();
+          if (!executable_[b]) {
+            executable_[b] = true;
+            for (auto v : f_.values_of(b)) {
+              visit(v);
+            }
+          } else {
+            for (auto v : f_.values_of(b)) {
+              if (f_.instrs[v].op != opcode::phi) {
+                break;
+              }
+              visit_phi(v);
+            }
+          }
+        }
+      }
+
+      for (block_id b = 0; b < f_.blocks.size(); b++) {
+        if (!executable_[b]) {
+          continue;
+        }
+        for (auto v : f_.values_of(b)) {
+          if (state_[v] == lattice::constant &&
+              f_.instrs[v].op != opcode::constant) {
+            rw_.set_constant(v, bits_[v]);
+            stats.values_replaced++;
+          }
+        }
+        auto op = f_.instrs[f_.terminator(b)].op;
+        auto succs = f_.graph.succs(b).size();
+        std::size_t taken = 0, count = 0;
+        for (std::size_t k = 0; k < succs; k++) {
+          if (edge_executable_[rw_.edges().out(b, k)]) {
+            taken = k;
+            count++;
+          }
+        }
+        if ((op == opcode::branch || op == opcode::switch_) && count == 1) {
+          rw_.fold_branch(b, taken);
+          stats.branches_folded++;
+        }
+      }
+      auto result = rw_.apply();
+      stats.instrs_removed += result.instrs_removed;
+      stats.blocks_removed += result.blocks_removed;
+    }
+
+  } // namespace
+
+  void sccp(function &f, pass_stats &stats) {
+    propagator{f}.run(stats);
+  }
+
+} // namespace soda::ir
@@ -0,0 +1,129 @@
+#include "optimize.hpp"
+
+#include <algorithm>
+#include <numeric>
+#include <vector>
+
+namespace soda::ir {
+
+  // A block that jumps to a block with no other predecessor is merged with
+  // it, repeatedly, so each chain of blocks becomes one block numbered
+  // after its head. Merging can reorder the predecessors of the blocks
+  // after a chain, so their phi operands are sorted along with them.
+  void simplify_cfg(function &f, pass_stats &stats) {
+    auto const &g = f.graph;
+    auto n = static_cast<block_id>(f.blocks.size());
+    // the block merged into the end of each block
+    std::vector<block_id> next(n, no_block);
+    std::vector<bool> merged(n);
+    for (block_id b = 0; b < n; b++) {
+      auto succs = g.succs(b);
+      if (succs.size() == 1 && succs[0] != 0 && succs[0] != b &&
+          g.preds(succs[0]).size() == 1 &&
+          f.instrs[f.terminator(b)].op == opcode::jump) {
+        next[b] = succs[0];
+        merged[succs[0]] = true;
+      }
+    }
+    if (std::ranges::find(merged, true) == merged.end()) {
+      return;
+    }
+
+    // New block numbers, and the values of the phis in merged blocks,
+    // which have a single operand.
+    std::vector<block_id> block_ids(n, no_block);
+    std::vector<block_id> heads;
+    std::vector<value_id> replacement(f.size());
+    std::iota(replacement.begin(), replacement.end(), value_id{0});
+    for (block_id h = 0; h < n; h++) {
+      if (merged[h]) {
+        continue;
+      }
+      for (auto b = h; b != no_block; b = next[b]) {
+        block_ids[b] = static_cast<block_id>(heads.size());
+        for (auto v : f.values_of(b)) {
+          if (b != h && f.instrs[v].op == opcode::phi) {
+            replacement[v] = f.operands_of(v)[0];
+          }
+        }
+      }
+      heads.push_back(h);
+    }
+    auto resolve = [&](value_id v) {
+      while (replacement[v] != v) {
+        v = replacement[v];
+      }
+      return v;
+    };
+
+    // the instructions kept, in their new order
+    std::vector<value_id> value_ids(f.size(), no_value);
+    std::vector<value_id> order;
+    order.reserve(f.size());
+    std::vector<block> blocks;
+    blocks.reserve(heads.size());
+    for (auto h : heads) {
+      auto first = static_cast<std::uint32_t>(order.size());
+      for (auto b = h; b != no_block; b = next[b]) {
+        for (auto v : f.values_of(b)) {
+          if (replacement[v] != v ||
+              (next[b] != no_block && v == f.terminator(b))) {
+            continue;
+          }
+          value_ids[v] = static_cast<value_id>(order.size());
+          order.push_back(v);
+        }
+      }
+      blocks.push_back(
+          block{first, static_cast<std::uint32_t>(order.size()) - first});
+    }
+
+    std::vector<instr> instrs;
+    instrs.reserve(order.size());
+    std::vector<value_id> operands;
+    operands.reserve(f.operands.size());
+    std::vector<std::uint32_t> perm;
+    for (block_id nb = 0; nb < heads.size(); nb++) {
+      // the phis of a head take their operands in the order of the new
+      // predecessors
+      auto preds = g.preds(heads[nb]);
+      perm.resize(preds.size());
+      std::iota(perm.begin(), perm.end(), 0u);
+      std::ranges::stable_sort(perm, {}, [&](std::uint32_t k) {
+        return block_ids[preds[k]];
+      });
+      for (auto pos = blocks[nb].first;
+           pos != blocks[nb].first + blocks[nb].count; pos++) {
+        auto v = order[pos];
+        auto i = f.instrs[v];
+        auto ops = f.operands_of(v);
+        i.first = static_cast<std::uint32_t>(operands.size());
+        for (std::size_t k = 0; k < ops.size(); k++) {
+          auto o = ops[i.op == opcode::phi ? perm[k] : k];
+          operands.push_back(value_ids[resolve(o)]);
+        }
+        instrs.push_back(i);
+      }
+    }
+
+    std::vector<flow_graph::edge> edges;
+    edges.reserve(g.edge_count());
+    for (block_id nb = 0; nb < heads.size(); nb++) {
+      auto tail = heads[nb];
+      while (next[tail] != no_block) {
+        tail = next[tail];
+      }
+      for (auto s : g.succs(tail)) {
+        edges.emplace_back(nb, block_ids[s]);
+      }
+    }
+
+    stats.instrs_removed += f.size() - order.size();
+    stats.blocks_removed += n - heads.size();
+    f.instrs = std::move(instrs);
+    f.operands = std::move(operands);
+    f.blocks = std::move(blocks);
+    f.graph = flow_graph{f.blocks.size(), edges};
+  }
+
+} // namespace soda::ir
@@ -1,8 +1,39 @@
 #pragma once
 
+#include "arena.hpp"
 #include "ast.hpp"
+#include "bit_vector.hpp"
+#include "builder.hpp"
+#include "bytecode.hpp"
+#include "backend.hpp"
+#include "c_backend.hpp"
+#include "cfg.hpp"
+#include "checker.hpp"
+#include "constant.hpp"
+#include "ctfe.hpp"
+#include "dataflow.hpp"
+#include "diagnostic.hpp"
+#include "driver.hpp"
+#include "flow_analysis.hpp"
+#include "fold.hpp"
+#include "ir.hpp"
+#include "literal_pool.hpp"
+#include "loops.hpp"
+#include "lower.hpp"
 #include "operators.hpp"
+#include "optimize.hpp"
+#include "parallel.hpp"
 #include "parse_error.hpp"
+#include "parser.hpp"
+#include "resolver.hpp"
+#include "rewrite.hpp"
 #include "source_range.hpp"
+#include "switch_lowering.hpp"
+#include "symbol.hpp"
+#include "token_cursor.hpp"
 #include "tokenizer.hpp"
+#include "types.hpp"
 #include "utils.hpp"
+#include "vectorize.hpp"
+#include "vm.hpp"
+#include "x86_backend.hpp"
@@ -0,0 +1,409 @@
+#include "optimize.hpp"
+#include "rewrite.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <utility>
+#include <vector>
+
+namespace soda::ir {
+
+  namespace {
+
+    // The magic multiplier and shift that divide by d, which is at least 3
+    // and not a power of two, with a high multiplication (Granlund and
+    // Montgomery; Warren, Hacker's Delight, 10-4).
+    void signed_magic(std::uint64_t d, std::int64_t &magic,
+                      unsigned &shift) {
+      constexpr auto two63 = std::uint64_t{1} << 63;
+      auto anc = two63 - 1 - two63 % d;
+      unsigned p = 63;
+      auto q1 = two63 / anc;
+      auto r1 = two63 - q1 * anc;
+      auto q2 = two63 / d;
+      auto r2 = two63 - q2 * d;
+      std::uint64_t delta;
+      do {
+        p++;
+        q1 *= 2;
+        r1 *= 2;
+        if (r1 >= anc) {
+          q1++;
+          r1 -= anc;
+        }
+        q2 *= 2;
+        r2 *= 2;
+        if (r2 >= d) {
+          q2++;
+          r2 -= d;
+        }
+        delta = d - r2;
+      } while (q1 < delta || (q1 == delta && r1 == 0));
+      magic = static_cast<std::int64_t>(q2 + 1);
+      shift = p - 64;
+    }
+
+    class reducer {
+    public:
+      explicit reducer(function &f)
+          : f_{f}, rw_{f}, size_{static_cast<value_id>(f.size())},
+            reduced_(f.size()) {
+      }
+
+      void run(pass_stats &stats);
+
+    private:
+      function &f_;
+      rewriter rw_;
+      // the values before any insertion
+      value_id size_;
+      std::vector<bool> reduced_;
+      std::size_t count_ = 0;
+
+      bool int_operand(value_id v, std::int64_t &value) const {
+        auto const &i = f_.instrs[v];
+        value = int_value(i);
+        return i.op == opcode::constant &&
+               i.type->kind == type_kind::int_type;
+      }
+
+      bool float_operand(value_id v, double &value) const {
+        auto const &i = f_.instrs[v];
+        value = float_value(i);
+        return i.op == opcode::constant &&
+               i.type->kind == type_kind::float_type;
+      }
+
+      value_id emit(value_id before, opcode op, soda::type const *type,
+                    value_id a, value_id b) {
+        value_id ops[] = {a, b};
+        return rw_.insert(before, op, type, ops);
+      }
+
+      value_id emit(value_id before, opcode op, soda::type const *type,
+                    value_id a) {
+        return rw_.insert(before, op, type, std::span{&a, 1});
+      }
+
+      value_id constant(value_id before, soda::type const *type,
+                        std::uint64_t bits) {
+        return rw_.insert(before, opcode::constant, type, {}, bits);
+      }
+
+      void replace(value_id v, value_id by) {
+        rw_.replace(v, by);
+        reduced_[v] = true;
+        count_++;
+      }
+
+      void reduce_loops();
+      void reduce(value_id v);
+      value_id power(value_id v, value_id x, std::uint64_t e);
+      value_id divide(value_id v, value_id x, std::uint64_t d);
+    };
+
+    // A basic induction variable is a phi in a loop header that each back
+    // edge brings a constant step further. Each product of one with a
+    // constant becomes a phi of its own that starts at the product of the
+    // initial values and moves by the product of the steps, so the
+    // multiplications in the loop become additions on the back edges.
+    void reducer::reduce_loops() {
+      auto const &g = f_.graph;
+      auto order = reverse_postorder(g, 0);
+      dominator_tree dom{g, order};
+      loop_forest loops{g, order, dom};
+      if (!loops.size()) {
+        return;
+      }
+      use_map uses{f_};
+      auto block_of = blocks_of(f_);
+      auto in_loop = [&](block_id b, std::uint32_t l) {
+        for (auto k = loops.loop_of(b); k != loop_forest::no_loop;
+             k = loops[k].parent) {
+          if (k == l) {
+            return true;
+          }
+        }
+        return false;
+      };
+
+      std::vector<value_id> ops;
+      std::vector<std::int64_t> steps;
+      std::vector<bool> back;
+      for (std::uint32_t l = 0; l < loops.size(); l++) {
+        auto h = loops[l].header;
+        auto preds = g.preds(h);
+        back.assign(preds.size(), false);
+        for (std::size_t k = 0; k < preds.size(); k++) {
+          back[k] = in_loop(preds[k], l);
+        }
+        for (auto p : f_.values_of(h)) {
+          if (f_.instrs[p].op != opcode::phi) {
+            break;
+          }
+          if (f_.instrs[p].type->kind != type_kind::int_type) {
+            continue;
+          }
+          ops.assign(f_.operands_of(p).begin(), f_.operands_of(p).end());
+          steps.assign(preds.size(), 0);
+          bool basic = true;
+          for (std::size_t k = 0; k < preds.size() && basic; k++) {
+            if (!back[k]) {
+              continue;
+            }
+            auto const &i = f_.instrs[ops[k]];
+            auto next = f_.operands_of(ops[k]);
+            std::int64_t c;
+            if (i.op == opcode::add && next[0] == p &&
+                int_operand(next[1], c)) {
+              steps[k] = c;
+            } else if (i.op == opcode::add && next[1] == p &&
+                       int_operand(next[0], c)) {
+              steps[k] = c;
+            } else if (i.op == opcode::sub && next[0] == p &&
+                       int_operand(next[1], c)) {
+              steps[k] = static_cast<std::int64_t>(
+                  0 - static_cast<std::uint64_t>(c));
+            } else {
+              basic = false;
+            }
+          }
+          if (!basic) {
+            continue;
+          }
+
+          // the phi made for each factor
+          std::vector<std::pair<std::int64_t, value_id>> made;
+          for (auto u : uses.users(p)) {
+            auto next = f_.operands_of(u);
+            std::int64_t m;
+            // multiplications by powers of two are as cheap as additions
+            if (u >= size_ || reduced_[u] || f_.instrs[u].op != opcode::mul ||
+                !in_loop(block_of[u], l) ||
+                !int_operand(next[next[0] == p ? 1 : 0], m) ||
+                std::has_single_bit(static_cast<std::uint64_t>(m)) ||
+                std::has_single_bit(0 - static_cast<std::uint64_t>(m)) ||
+                m == 0) {
+              continue;
+            }
+            auto t = f_.instrs[u].type;
+            auto it = std::ranges::find(made, m, [](auto const &x) {
+              return x.first;
+            });
+            if (it != made.end()) {
+              replace(u, it->second);
+              continue;
+            }
+            auto um = static_cast<std::uint64_t>(m);
+            std::vector<value_id> inputs(preds.size(), p);
+            auto q = rw_.insert(p, opcode::phi, t, inputs);
+            for (std::size_t k = 0; k < preds.size(); k++) {
+              auto end = f_.terminator(preds[k]);
+              std::int64_t init;
+              if (back[k]) {
+                auto step = static_cast<std::uint64_t>(steps[k]) * um;
+                inputs[k] = emit(end, opcode::add, t, q,
+                                 constant(end, t, step));
+              } else if (int_operand(ops[k], init)) {
+                inputs[k] = constant(
+                    end, t, static_cast<std::uint64_t>(init) * um);
+              } else {
+                inputs[k] = emit(end, opcode::mul, t, ops[k],
+                                 constant(end, t, um));
+              }
+            }
+            std::ranges::copy(inputs,
+                              f_.operands.begin() + f_.instrs[q].first);
+            made.emplace_back(m, q);
+            replace(u, q);
+          }
+        }
+      }
+    }
+
+    // x to the power e, at least 1, by squaring from the top bit down, so
+    // every partial product is a smaller power and overflows only if the
+    // result does.
+    value_id reducer::power(value_id v, value_id x, std::uint64_t e) {
+      auto t = f_.instrs[v].type;
+      auto r = x;
+      for (int bit = std::bit_width(e) - 2; bit >= 0; bit--) {
+        r = emit(v, opcode::mul, t, r, r);
+        if (e >> bit & 1) {
+          r = emit(v, opcode::mul, t, r, x);
+        }
+      }
+      return r;
+    }
+
+    // x divided by d, at least 2, truncating.
+    value_id reducer::divide(value_id v, value_id x, std::uint64_t d) {
+      auto t = f_.instrs[v].type;
+      auto sign = emit(v, opcode::rshift, t, x, constant(v, t, 63));
+      if (std::has_single_bit(d)) {
+        // round negative dividends up by adding d - 1
+        auto bias = emit(v, opcode::bit_and, t, sign, constant(v, t, d - 1));
+        auto sum = emit(v, opcode::add, t, x, bias);
+        return emit(v, opcode::rshift, t, sum,
+                    constant(v, t, std::countr_zero(d)));
+      }
+      std::int64_t magic;
+      unsigned shift;
+      signed_magic(d, magic, shift);
+      auto q = emit(v, opcode::mul_high, t, x,
+                    constant(v, t, static_cast<std::uint64_t>(magic)));
+      if (magic < 0) {
+        q = emit(v, opcode::add, t, q, x);
+      }
+      if (shift) {
+        q = emit(v, opcode::rshift, t, q, constant(v, t, shift));
+      }
+      // round toward zero: add one for negative dividends
+      return emit(v, opcode::sub, t, q, sign);
+    }
+
+    void reducer::reduce(value_id v) {
+      auto i = f_.instrs[v];
+      auto t = i.type;
+      auto ops = f_.operands_of(v);
+      value_id x = ops[0], y = ops.size() > 1 ? ops[1] : no_value;
+      std::int64_t c;
+      double k;
+      bool is_int = t->kind == type_kind::int_type;
+      bool is_float = t->kind == type_kind::float_type;
+      switch (i.op) {
+        case opcode::pow:
+          if (is_int && int_operand(y, c) && c >= 0 && c <= 64) {
+            replace(v, c ? power(v, x, static_cast<std::uint64_t>(c))
+                         : constant(v, t, 1));
+          } else if (is_float && float_operand(y, k) &&
+                     (k == 0 || k == 1 || k == 2)) {
+            // exact, unlike longer chains
+            if (k == 0) {
+              replace(v, constant(v, t, std::bit_cast<std::uint64_t>(1.0)));
+            } else if (k == 1) {
+              replace(v, x);
+            } else {
+              replace(v, emit(v, opcode::mul, t, x, x));
+            }
+          }
+          break;
+        case opcode::mul:
+          if (is_int) {
+            if (int_operand(x, c)) {
+              std::swap(x, y);
+            } else if (!int_operand(y, c)) {
+              break;
+            }
+            auto uc = static_cast<std::uint64_t>(c);
+            if (c == 0 || c == 1) {
+              replace(v, c ? x : y);
+            } else if (c == -1) {
+              replace(v, emit(v, opcode::neg, t, x));
+            } else if (std::has_single_bit(uc)) {
+              replace(v, emit(v, opcode::lshift, t, x,
+                              constant(v, t, std::countr_zero(uc))));
+            } else if (std::has_single_bit(0 - uc)) {
+              auto shifted = emit(v, opcode::lshift, t, x,
+                                  constant(v, t, std::countr_zero(0 - uc)));
+              replace(v, emit(v, opcode::neg, t, shifted));
+            }
+          } else if (is_float) {
+            if (float_operand(x, k)) {
+              std::swap(x, y);
+            } else if (!float_operand(y, k)) {
+              break;
+            }
+            if (k == 2) {
+              replace(v, emit(v, opcode::add, t, x, x));
+            }
+          }
+          break;
+        // by 0 and -1 division traps, and is left alone
+        case opcode::div:
+          if (is_int && int_operand(y, c) && c != 0 && c != -1) {
+            if (c == 1) {
+              replace(v, x);
+              break;
+            }
+            auto d = c < 0 ? 0 - static_cast<std::uint64_t>(c)
+                           : static_cast<std::uint64_t>(c);
+            auto q = divide(v, x, d);
+            replace(v, c < 0 ? emit(v, opcode::neg, t, q) : q);
+          } else if (is_float && float_operand(y, k)) {
+            // the reciprocal of a power of two is exact
+            int exp;
+            auto r = 1 / k;
+            if (std::isnormal(k) && std::isnormal(r) &&
+                std::abs(std::frexp(k, &exp)) == 0.5) {
+              replace(v, emit(v, opcode::mul, t, x,
+                              constant(v, t, std::bit_cast<std::uint64_t>(
+                                                 r))));
+            }
+          }
+          break;
+        // the remainder takes the sign of the dividend only
+        case opcode::mod:
+          if (is_int && int_operand(y, c) && c != 0 && c != -1) {
+            auto d = c < 0 ? 0 - static_cast<std::uint64_t>(c)
+                           : static_cast<std::uint64_t>(c);
+            if (d == 1) {
+              replace(v, constant(v, t, 0));
+            } else if (std::has_single_bit(d)) {
+              auto sign = emit(v, opcode::rshift, t, x, constant(v, t, 63));
+              auto bias =
+                  emit(v, opcode::bit_and, t, sign, constant(v, t, d - 1));
+              auto sum = emit(v, opcode::add, t, x, bias);
+              auto low =
+                  emit(v, opcode::bit_and, t, sum, constant(v, t, d - 1));
+              replace(v, emit(v, opcode::sub, t, low, bias));
+            } else {
+              auto q = divide(v, x, d);
+              auto product = emit(v, opcode::mul, t, q, constant(v, t, d));
+              replace(v, emit(v, opcode::sub, t, x, product));
+            }
+          }
+          break;
+        default:
+          break;
+      }
+    }
+
+    void reducer::run(pass_stats &stats) {
+      // most functions have nothing to reduce
+      bool any = false, muls = false;
+      for (auto const &i : f_.instrs) {
+        if (i.op == opcode::mul || i.op == opcode::div ||
+            i.op == opcode::mod || i.op == opcode::pow) {
+          auto ops = f_.operands.data() + i.first;
+          bool right = f_.instrs[ops[1]].op == opcode::constant;
+          bool left = f_.instrs[ops[0]].op == opcode::constant;
+          any |= right || (i.op == opcode::mul && left);
+          muls |= i.op == opcode::mul && (left || right);
+        }
+      }
+      if (!any) {
+        return;
+      }
+      if (muls) {
+        reduce_loops();
+      }
+      for (value_id v = 0; v < size_; v++) {
+        if (!reduced_[v]) {
+          reduce(v);
+        }
+      }
+      stats.values_replaced += count_;
+      auto result = rw_.apply();
+      stats.instrs_removed += result.instrs_removed;
+      stats.blocks_removed += result.blocks_removed;
+    }
+
+  } // namespace
+
+  void reduce_strength(function &f, pass_stats &stats) {
+    reducer{f}.run(stats);
+  }
+
+} // namespace soda::ir
@@ -0,0 +1,288 @@
+#include "switch_lowering.hpp"
+
+#include "utils.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <functional>
+#include <limits>
+
+namespace soda::ir {
+
+  std::string_view to_string(cluster_kind kind) {
+    switch (kind) {
+      case cluster_kind::range:
+        return "range";
+      case cluster_kind::table:
+        return "table";
+      case cluster_kind::bits:
+        return "bits";
+      default:
+        unreachable();
+    }
+  }
+
+  std::uint32_t switch_plan::target(std::int64_t value) const noexcept {
+    auto it = std::ranges::lower_bound(clusters, value, {},
+                                       &switch_cluster::high);
+    if (it == clusters.end() || value < it->low) {
+      return fallback;
+    }
+    auto offset = static_cast<std::uint64_t>(value) -
+                  static_cast<std::uint64_t>(it->low);
+    switch (it->kind) {
+      case cluster_kind::range:
+        return it->first;
+      case cluster_kind::table:
+        return table[it->first + offset];
+      case cluster_kind::bits:
+        for (auto k = it->first; k != it->first + it->count; k++) {
+          if (tests[k].mask >> offset & 1) {
+            return tests[k].target;
+          }
+        }
+        return fallback;
+      default:
+        unreachable();
+    }
+  }
+
+  std::size_t switch_plan::depth() const noexcept {
+    return std::bit_width(clusters.size());
+  }
+
+  namespace {
+
+    struct case_range {
+      std::int64_t low;
+      std::int64_t high;
+      std::uint32_t target;
+    };
+
+    struct segment {
+      std::size_t start = 0;
+      cluster_kind kind = cluster_kind::range;
+    };
+
+    // The number of values in [low, high] less one, which cannot overflow.
+    std::uint64_t span(std::int64_t low, std::int64_t high) {
+      return static_cast<std::uint64_t>(high) -
+             static_cast<std::uint64_t>(low);
+    }
+
+    // Whether bit tests pay off over comparing each range of a cluster
+    // with these many targets and comparisons, as in LLVM.
+    bool worth_bit_tests(std::size_t targets, std::size_t compares) {
+      switch (targets) {
+        case 1:
+          return compares >= 3;
+        case 2:
+          return compares >= 5;
+        case 3:
+          return compares >= 6;
+        default:
+          return false;
+      }
+    }
+
+    // The block that b leads to through blocks that only jump, like
+    // those of cases that fall through without statements, unless that
+    // would bypass a phi.
+    block_id destination(function const &f, block_id b) {
+      for (std::size_t n = 0; n < f.blocks.size(); n++) {
+        if (f.blocks[b].count != 1 ||
+            f.instrs[f.terminator(b)].op != opcode::jump) {
+          break;
+        }
+        auto next = f.graph.succs(b)[0];
+        if (f.instrs[f.blocks[next].first].op == opcode::phi) {
+          break;
+        }
+        b = next;
+      }
+      return b;
+    }
+
+  } // namespace
+
+  bool case_values(function const &f, block_id b,
+                   std::vector<std::int64_t> &values) {
+    auto ops = f.operands_of(f.terminator(b));
+    values.clear();
+    for (auto v : ops.subspan(1)) {
+      // negative literals are negated constants until sccp runs
+      auto const &i = f.instrs[v];
+      if (i.op == opcode::constant) {
+        values.push_back(int_value(i));
+      } else if (i.op == opcode::neg &&
+                 f.instrs[f.operands_of(v)[0]].op == opcode::constant &&
+                 int_value(f.instrs[f.operands_of(v)[0]]) !=
+                     std::numeric_limits<std::int64_t>::min()) {
+        values.push_back(-int_value(f.instrs[f.operands_of(v)[0]]));
+      } else {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool plan_switch(function const &f, block_id b, switch_plan &plan,
+                   switch_options const &opts) {
+    std::vector<std::int64_t> values;
+    if (!case_values(f, b, values)) {
+      return false;
+    }
+    std::vector<block_id> succs;
+    for (auto s : f.graph.succs(b)) {
+      succs.push_back(destination(f, s));
+    }
+    plan = switch_plan{};
+    plan.fallback = static_cast<std::uint32_t>(succs.size() - 1);
+
+    std::vector<case_range> cases;
+    cases.reserve(values.size());
+    for (std::size_t k = 0; k < values.size(); k++) {
+      cases.push_back(case_range{values[k], values[k],
+                                 static_cast<std::uint32_t>(k)});
+    }
+    std::ranges::stable_sort(cases, {}, &case_range::low);
+    auto [first, last] = std::ranges::unique(
+        cases, {}, [](case_range const &c) { return c.low; });
+    cases.erase(first, last);
+    std::erase_if(cases, [&](case_range const &c) {
+      return succs[c.target] == succs[plan.fallback];
+    });
+
+    // runs of consecutive values with the same target
+    std::vector<case_range> ranges;
+    for (auto const &c : cases) {
+      if (!ranges.empty() &&
+          ranges.back().high != std::numeric_limits<std::int64_t>::max() &&
+          ranges.back().high + 1 == c.low &&
+          succs[ranges.back().target] == succs[c.target]) {
+        ranges.back().high = c.low;
+      } else {
+        ranges.push_back(c);
+      }
+    }
+
+    // The fewest clusters covering the first i ranges, and the last of
+    // them. A cluster spans at most a table or a word, so each range is
+    // only tried with the ranges that follow it closely.
+    auto n = ranges.size();
+    auto limit = std::max<std::uint64_t>(opts.max_table_size, 64);
+    std::vector<std::size_t> cost(n + 1,
+                                  std::numeric_limits<std::size_t>::max());
+    std::vector<segment> last_segment(n + 1);
+    cost[0] = 0;
+    for (std::size_t i = 0; i < n; i++) {
+      if (cost[i] + 1 < cost[i + 1]) {
+        cost[i + 1] = cost[i] + 1;
+        last_segment[i + 1] = segment{i, cluster_kind::range};
+      }
+      std::uint64_t values = span(ranges[i].low, ranges[i].high) + 1;
+      std::size_t compares = ranges[i].low == ranges[i].high ? 1 : 2;
+      block_id targets[3] = {succs[ranges[i].target]};
+      std::size_t ntargets = 1;
+      for (auto j = i + 1; j < n; j++) {
+        auto width = span(ranges[i].low, ranges[j].high);
+        if (width >= limit) {
+          break;
+        }
+        values += span(ranges[j].low, ranges[j].high) + 1;
+        compares += ranges[j].low == ranges[j].high ? 1 : 2;
+        auto t = succs[ranges[j].target];
+        if (ntargets <= 3 &&
+            std::find(targets, targets + ntargets, t) == targets + ntargets) {
+          if (ntargets < 3) {
+            targets[ntargets] = t;
+          }
+          ntargets++;
+        }
+        if (cost[i] + 1 >= cost[j + 1]) {
+          continue;
+        }
+        if (width < 64 && worth_bit_tests(ntargets, compares)) {
+          cost[j + 1] = cost[i] + 1;
+          last_segment[j + 1] = segment{i, cluster_kind::bits};
+        } else if (values >= opts.min_table_cases &&
+                   width < opts.max_table_size &&
+                   values * 100 >= opts.min_density * (width + 1)) {
+          cost[j + 1] = cost[i] + 1;
+          last_segment[j + 1] = segment{i, cluster_kind::table};
+        }
+      }
+    }
+
+    std::vector<std::pair<std::size_t, std::size_t>> bounds;
+    for (auto end = n; end; end = last_segment[end].start) {
+      bounds.emplace_back(last_segment[end].start, end);
+    }
+    std::ranges::reverse(bounds);
+    for (auto [start, end] : bounds) {
+      auto const &low = ranges[start];
+      auto const &high = ranges[end - 1];
+      auto kind = last_segment[end].kind;
+      switch_cluster c{kind, low.low, high.high, 0};
+      switch (kind) {
+        case cluster_kind::range:
+          c.first = low.target;
+          break;
+        case cluster_kind::table:
+          c.first = static_cast<std::uint32_t>(plan.table.size());
+          plan.table.resize(plan.table.size() + span(c.low, c.high) + 1,
+                            plan.fallback);
+          for (auto k = start; k < end; k++) {
+            std::fill_n(plan.table.begin() + c.first +
+                            span(c.low, ranges[k].low),
+                        span(ranges[k].low, ranges[k].high) + 1,
+                        ranges[k].target);
+          }
+          break;
+        case cluster_kind::bits: {
+          c.first = static_cast<std::uint32_t>(plan.tests.size());
+          for (auto k = start; k < end; k++) {
+            auto bits = std::uint64_t{2} << span(ranges[k].low,
+                                                 ranges[k].high);
+            auto mask = (bits - 1) << span(c.low, ranges[k].low);
+            auto it = std::ranges::find_if(
+                plan.tests.begin() + c.first, plan.tests.end(),
+                [&](bit_test const &t) {
+                  return succs[t.target] == succs[ranges[k].target];
+                });
+            if (it == plan.tests.end()) {
+              plan.tests.push_back(bit_test{mask, ranges[k].target});
+            } else {
+              it->mask |= mask;
+            }
+          }
+          c.count = static_cast<std::uint32_t>(plan.tests.size()) - c.first;
+          // the target with the most values is tested first
+          std::ranges::sort(plan.tests.begin() + c.first, plan.tests.end(),
+                            std::greater{}, [](bit_test const &t) {
+                              return std::popcount(t.mask);
+                            });
+          break;
+        }
+      }
+      plan.clusters.push_back(c);
+    }
+    return true;
+  }
+
+  void dump(std::ostream &out, switch_plan const &plan) {
+    if (plan.clusters.empty()) {
+      out << "default only";
+      return;
+    }
+    auto sep = "";
+    for (auto const &c : plan.clusters) {
+      out << sep << to_string(c.kind) << ' ' << c.low;
+      if (c.high != c.low) {
+        out << ".." << c.high;
+      }
+      sep = ", ";
+    }
+  }
+
+} // namespace soda::ir
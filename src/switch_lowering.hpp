@@ -0,0 +1,97 @@
+#pragma once
+
+#include "ir.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+namespace soda::ir {
+
+  //
+  // Switch lowering
+  //
+  // A switch whose case values are all constants is dispatched through
+  // clusters rather than a chain of comparisons. Its cases are sorted and
+  // runs of consecutive values with the same target, looking through the
+  // empty blocks of cases that fall through, are merged into ranges,
+  // which are then partitioned into the fewest clusters, each one of:
+  //
+  // - a range of values with a single target, tested with one or two
+  //   comparisons;
+  // - a jump table indexed by the value less the cluster's low value, if
+  //   enough of the cases are dense enough;
+  // - a set of bit tests, if the cluster spans less than a word and has
+  //   at most three targets, testing one bit of a mask per target after a
+  //   shift by the value's offset.
+  //
+  // The clusters are disjoint and sorted, so a binary search over them is
+  // a balanced tree of comparisons with a depth logarithmic in their
+  // number, and values between them go to the default.
+  //
+
+  struct switch_options {
+    // the fewest case values that make a jump table
+    std::size_t min_table_cases = 4;
+    // the lowest percentage of a table's entries that are not the default
+    std::size_t min_density = 40;
+    std::size_t max_table_size = 4096;
+  };
+
+  enum class cluster_kind : std::uint8_t {
+    range,
+    table,
+    bits,
+  };
+
+  std::string_view to_string(cluster_kind kind);
+
+  struct switch_cluster {
+    cluster_kind kind;
+    std::int64_t low;
+    std::int64_t high;
+    // range: the successor index; table and bits: the first entry or test
+    std::uint32_t first;
+    // the number of tests of bits, otherwise unused
+    std::uint32_t count = 0;
+  };
+
+  struct bit_test {
+    // bit i set for the value low + i
+    std::uint64_t mask;
+    std::uint32_t target;
+  };
+
+  struct switch_plan {
+    std::vector<switch_cluster> clusters;
+    // the successor index for each value of every table, back to back
+    std::vector<std::uint32_t> table;
+    std::vector<bit_test> tests;
+    // the successor index of the default
+    std::uint32_t fallback = 0;
+
+    // The successor index the switch goes to for value.
+    std::uint32_t target(std::int64_t value) const noexcept;
+
+    // The levels of the search tree over the clusters.
+    std::size_t depth() const noexcept;
+  };
+
+  // The case values of the switch ending b, in order. Returns false if one
+  // is not a constant.
+  bool case_values(function const &f, block_id b,
+                   std::vector<std::int64_t> &values);
+
+  // Plan the dispatch of the switch ending b. Returns false, leaving plan
+  // unspecified, if a case value is not a constant. The checker rejects
+  // equal case values written with literals, but one folded from a call
+  // may still equal another; the first of them wins, like at run time.
+  bool plan_switch(function const &f, block_id b, switch_plan &plan,
+                   switch_options const &opts = {});
+
+  // Write the clusters of a plan on one line, without a newline.
+  void dump(std::ostream &out, switch_plan const &plan);
+
+} // namespace soda::ir
@@ -0,0 +1,44 @@
+#include "symbol.hpp"
+
+#include <functional>
+
+namespace soda {
+
+  symbol symbol_table::intern(std::string_view name) {
+    auto hash = static_cast<std::uint32_t>(std::hash<std::string_view>{}(name));
+    auto mask = slots_.size() - 1;
+    for (auto i = hash & mask;; i = (i + 1) & mask) {
+      auto &s = slots_[i];
+      if (s.id == empty) {
+        auto id = static_cast<symbol>(names_.size());
+        names_.push_back(storage_.emplace_back(name));
+        s = slot{hash, id};
+        // keep the load factor at or below one half
+        if (names_.size() * 2 > slots_.size()) {
+          grow();
+        }
+        return id;
+      }
+      if (s.hash == hash && names_[s.id] == name) {
+        return s.id;
+      }
+    }
+  }
+
+  void symbol_table::grow() {
+    std::vector<slot> slots(slots_.size() * 2);
+    auto mask = slots.size() - 1;
+    for (auto const &s : slots_) {
+      if (s.id == empty) {
+        continue;
+      }
+      auto i = s.hash & mask;
+      while (slots[i].id != empty) {
+        i = (i + 1) & mask;
+      }
+      slots[i] = s;
+    }
+    slots_ = std::move(slots);
+  }
+
+} // namespace soda
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace soda {
+
+  // Dense id of an interned name; ids are assigned from 0 in order of first
+  // appearance, so they can index flat per-symbol arrays.
+  using symbol = std::uint32_t;
+
+  //
+  // Name interner
+  //
+  // An open-addressed table with linear probing over (hash, id) slots. The
+  // names themselves are stored once, in insertion order, and never move.
+  //
+
+  class symbol_table {
+  public:
+    symbol_table() : slots_(64) {
+    }
+
+    symbol intern(std::string_view name);
+
+    std::string_view name(symbol sym) const noexcept {
+      return names_[sym];
+    }
+
+    std::size_t size() const noexcept {
+      return names_.size();
+    }
+
+  private:
+    static constexpr symbol empty = ~symbol{0};
+
+    struct slot {
+      std::uint32_t hash = 0;
+      symbol id = empty;
+    };
+
+    std::vector<slot> slots_;
+    std::vector<std::string_view> names_;
+    std::deque<std::string> storage_;
+
+    void grow();
+  };
+
+} // namespace soda
@@ -0,0 +1,56 @@
+#include "token_cursor.hpp"
+
+#include <algorithm>
+#include <bit>
+
+namespace soda {
+
+  token_cursor::token_cursor(tokenizer &tokens, bool skip_comments,
+                             std::size_t capacity)
+      : tokens_{tokens}, skip_comments_{skip_comments} {
+    capacity = std::bit_ceil(std::max<std::size_t>(capacity, 2));
+    ring_ = std::make_unique<token[]>(capacity);
+    mask_ = capacity - 1;
+    for (std::size_t i = 0; i < capacity; i++) {
+      ring_[i].range.filename = tokens.token().range.filename;
+    }
+  }
+
+  void token_cursor::fill(std::size_t index) {
+    while (filled_ <= index) {
+      // the slot about to be reused must not hold a token that is still
+      // reachable from the current position or an active checkpoint
+      auto oldest = marks_.empty() ? pos_ : std::min(pos_, marks_.front());
+      if (filled_ - oldest > mask_) {
+        grow();
+      }
+      auto &slot = ring_[filled_ & mask_];
+      do {
+        tokens_.next(slot);
+      } while (skip_comments_ && slot.kind == token::kind::comment);
+      filled_++;
+    }
+  }
+
+  void token_cursor::grow() {
+    auto old_capacity = mask_ + 1;
+    auto capacity = old_capacity * 2;
+    auto ring = std::make_unique<token[]>(capacity);
+    auto oldest = filled_ >= old_capacity ? filled_ - old_capacity : 0;
+    for (auto i = oldest; i < filled_; i++) {
+      auto &from = ring_[i & mask_];
+      auto &to = ring[i & (capacity - 1)];
+      to.kind = from.kind;
+      to.text.swap(from.text);
+      to.range = std::move(from.range);
+    }
+    for (std::size_t i = 0; i < capacity; i++) {
+      if (ring[i].range.filename.empty()) {
+        ring[i].range.filename = tokens_.token().range.filename;
+      }
+    }
+    ring_ = std::move(ring);
+    mask_ = capacity - 1;
+  }
+
+} // namespace soda
@@ -0,0 +1,148 @@
+#pragma once
+
+#include "tokenizer.hpp"
+
+#include <cassert>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <vector>
+
+namespace soda {
+
+  //
+  // Buffered cursor over a tokenizer
+  //
+  // Tokens are lexed into a ring buffer so that the parser can peek several
+  // tokens ahead, and checkpoints taken with mark() can be rewound to
+  // without lexing anything twice. Token text is swapped into the ring
+  // rather than copied. The ring only grows when an active checkpoint pins
+  // more tokens than it holds.
+  //
+
+  class token_cursor {
+  public:
+    using checkpoint = std::size_t;
+
+    explicit token_cursor(tokenizer &tokens, bool skip_comments = true,
+                          std::size_t capacity = 64);
+
+    token const &peek(std::size_t k = 0) {
+      auto i = pos_ + k;
+      if (i >= filled_) {
+        fill(i);
+      }
+      return ring_[i & mask_];
+    }
+
+    void advance() {
+      if (pos_ >= filled_) {
+        fill(pos_);
+      }
+      pos_++;
+    }
+
+    checkpoint mark() {
+      marks_.push_back(pos_);
+      return pos_;
+    }
+
+    // Return to a checkpoint, which is released like commit() does.
+    void rewind(checkpoint cp) {
+      assert(!marks_.empty() && marks_.back() == cp);
+      marks_.pop_back();
+      pos_ = cp;
+    }
+
+    // Release a checkpoint, keeping the current position.
+    void commit(checkpoint cp) {
+      assert(!marks_.empty() && marks_.back() == cp);
+      (void)cp;
+      marks_.pop_back();
+    }
+
+    // Drop buffered lookahead and continue lexing at a source position.
+    void seek(source_position pos) {
+      assert(marks_.empty());
+      filled_ = pos_;
+      tokens_.seek(pos);
+    }
+
+    // Forward iterator over the remaining tokens. Iterators stay valid (and
+    // may be re-read) for as long as the tokens they refer to are buffered.
+    class iterator {
+    public:
+      using iterator_category = std::forward_iterator_tag;
+      using difference_type = std::ptrdiff_t;
+      using value_type = soda::token;
+      using pointer = soda::token const *;
+      using reference = soda::token const &;
+
+      iterator() = default;
+
+      iterator(token_cursor *cursor, std::size_t index)
+          : cursor_{cursor}, index_{index} {
+      }
+
+      reference operator*() const {
+        return cursor_->at(index_);
+      }
+
+      pointer operator->() const {
+        return &cursor_->at(index_);
+      }
+
+      iterator &operator++() {
+        index_++;
+        return *this;
+      }
+
+      iterator operator++(int) {
+        auto it = *this;
+        index_++;
+        return it;
+      }
+
+      bool operator==(iterator const &other) const {
+        return index_ == other.index_;
+      }
+
+      bool operator==(std::default_sentinel_t) const {
+        return cursor_->at(index_).kind == token::kind::end;
+      }
+
+    private:
+      token_cursor *cursor_ = nullptr;
+      std::size_t index_ = 0;
+    };
+
+    iterator begin() {
+      return iterator{this, pos_};
+    }
+
+    std::default_sentinel_t end() const noexcept {
+      return std::default_sentinel;
+    }
+
+  private:
+    tokenizer &tokens_;
+    bool skip_comments_;
+    std::unique_ptr<token[]> ring_;
+    std::size_t mask_;
+    std::size_t pos_ = 0;    // absolute index of the current token
+    std::size_t filled_ = 0; // absolute index one past the last lexed token
+    std::vector<checkpoint> marks_;
+
+    token const &at(std::size_t index) {
+      if (index >= filled_) {
+        fill(index);
+      }
+      assert(index + (mask_ + 1) >= filled_ && "token no longer buffered");
+      return ring_[index & mask_];
+    }
+
+    void fill(std::size_t index);
+    void grow();
+  };
+
+} // namespace soda
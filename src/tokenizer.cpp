@@ -154,7 +154,7 @@ namespace soda {
       case token::kind::kw_if:
         return "kw_if";
       case token::kind::kw_let:
-        return "let";
+        return "kw_let";
       case token::kind::kw_return:
         return "kw_return";
       case token::kind::kw_switch:
@@ -228,6 +228,30 @@ namespace soda {
     return ch_;
   }
 
+  void tokenizer::seek(source_position pos) {
+    assert(input_);
+    input_->clear();
+    input_->seekg(pos.offset - base_);
+    offset_ = pos.offset;
+    line_ = pos.line + 1;
+    column_ = pos.column;
+    // account for the new current character like get_char() does
+    ch_ = input_->get();
+    if (ch_ == '\n') {
+      line_++;
+      column_ = 0;
+    } else if (ch_ == '\r') {
+      if (peek_char() == '\n') {
+        input_->get();
+        offset_++;
+      }
+      line_++;
+      column_ = 0;
+    } else {
+      column_++;
+    }
+  }
+
   int tokenizer::peek_char() {
     assert(input_);
     return input_->peek();
@@ -283,8 +307,10 @@ namespace soda {
       {"false", token::kind::kw_false},
       {"for", token::kind::kw_for},
       {"foreach", token::kind::kw_foreach},
+      {"fun", token::kind::kw_fun},
       {"goto", token::kind::kw_goto},
       {"if", token::kind::kw_if},
+      {"let", token::kind::kw_let},
       {"return", token::kind::kw_return},
       {"switch", token::kind::kw_switch},
       {"true", token::kind::kw_true},
@@ -314,7 +340,7 @@ namespace soda {
     }
 
     // integer and floating-point numbers
-    else if (std::isdigit(ch_) || ch_ == '.') {
+    else if (std::isdigit(ch_) || (ch_ == '.' && is_dec(peek_char()))) {
       if (ch_ == '0') {
         tok_.text += static_cast<char>(ch_);
         switch (get_char()) {
@@ -369,15 +395,15 @@ namespace soda {
     // character and string literals
     else if (ch_ == '"' || ch_ == '\'') {
       auto quote = ch_;
-      auto last = ch_;
+      bool escaped = false;
       tok_.text += static_cast<char>(ch_);
       while (get_char() != eof) {
         tok_.text += static_cast<char>(ch_);
-        if (ch_ == quote && last != '\\') {
+        if (ch_ == quote && !escaped) {
           get_char();
           break;
         }
-        last = ch_;
+        escaped = ch_ == '\\' && !escaped;
       }
       if (ch_ == eof) {
         tok_.text = "eof encountered inside quoted literal";
@@ -483,7 +509,7 @@ namespace soda {
         return tok_.end(token::kind::div_assign, end_pos());
       } else if (ch_ == '/') { // // (comment)
         tok_.text += static_cast<char>(ch_);
-        while (get_char() != '\n') {
+        while (get_char() != '\n' && ch_ != eof) {
           tok_.text += static_cast<char>(ch_);
         }
         return tok_.end(token::kind::comment, end_pos());
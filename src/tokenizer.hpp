@@ -141,13 +141,26 @@ namespace soda {
           line_{1}, column_{1}, delete_input{false} {
     }
 
+    // Tokenize input that starts at the given position of a larger source,
+    // so that token ranges refer to the original file.
+    tokenizer(std::istream &input, std::filesystem::path fn,
+              source_position start)
+        : fn_{fn}, input_{&input}, tok_{fn_}, ch_{input_->get()},
+          offset_{start.offset}, line_{start.line + 1},
+          column_{start.column + 1}, base_{start.offset},
+          delete_input{false} {
+    }
+
     ~tokenizer() {
       if (delete_input) {
         delete input_;
       }
     }
 
+    // Single-pass iteration: begin() lexes the first token and each
+    // increment lexes the next one. Use token_cursor for lookahead.
     auto begin() {
+      next_token();
       return iterator{this};
     }
 
@@ -159,8 +172,31 @@ namespace soda {
       return tok_;
     }
 
+    // Continue lexing at a position of the underlying stream, e.g. after
+    // the caller has skipped over a region of the source itself.
+    void seek(source_position pos);
+
+    // Lex the next token and return it. The returned reference stays valid
+    // until the following call.
+    soda::token const &next() {
+      next_token();
+      return tok_;
+    }
+
+    // Lex the next token into a caller-owned token by swapping text buffers,
+    // so neither side allocates once both have grown. The caller's token
+    // must already carry this tokenizer's filename.
+    void next(soda::token &into) {
+      next_token();
+      into.kind = tok_.kind;
+      into.text.swap(tok_.text);
+      into.range.start = tok_.range.start;
+      into.range.end = tok_.range.end;
+    }
+
     class iterator {
     public:
+      using iterator_concept = std::input_iterator_tag;
       using difference_type = std::ptrdiff_t;
       using value_type = soda::token;
 
@@ -169,25 +205,21 @@ namespace soda {
       iterator(tokenizer *p) : parent_{p} {
       }
 
-      bool operator==(iterator const &) const {
-        return false;
-      }
-
       bool operator==(sentinel) const {
         return parent_->tok_.kind == token::kind::end;
       }
 
       soda::token const &operator*() const {
-        parent_->next_token();
         return parent_->tok_;
       }
 
       iterator &operator++() {
+        parent_->next_token();
         return *this;
       }
 
-      iterator &operator++(int) {
-        return *this;
+      void operator++(int) {
+        parent_->next_token();
       }
 
     private:
@@ -204,6 +236,7 @@ namespace soda {
     std::size_t offset_;
     std::size_t line_;
     std::size_t column_;
+    std::size_t base_ = 0;
     bool delete_input;
 
     int get_char();
@@ -0,0 +1,173 @@
+#include "types.hpp"
+
+#include "utils.hpp"
+
+#include <algorithm>
+#include <array>
+#include <mutex>
+#include <sstream>
+
+namespace soda {
+
+  namespace {
+
+    constexpr std::array<type, 7> primitives{{
+        {type_kind::error, nullptr, {}},
+        {type_kind::void_type, nullptr, {}},
+        {type_kind::bool_type, nullptr, {}},
+        {type_kind::char_type, nullptr, {}},
+        {type_kind::int_type, nullptr, {}},
+        {type_kind::float_type, nullptr, {}},
+        {type_kind::string_type, nullptr, {}},
+    }};
+
+    std::size_t hash_of(type_kind kind, type const *inner,
+                        std::span<type const *const> params) {
+      std::size_t hash = static_cast<std::size_t>(kind);
+      hash_combine(hash, inner);
+      for (auto p : params) {
+        hash_combine(hash, p);
+      }
+      return hash;
+    }
+
+    void write(std::ostream &out, type const &t) {
+      switch (t.kind) {
+        case type_kind::error:
+          out << "<error>";
+          break;
+        case type_kind::void_type:
+          out << "void";
+          break;
+        case type_kind::bool_type:
+          out << "bool";
+          break;
+        case type_kind::char_type:
+          out << "char";
+          break;
+        case type_kind::int_type:
+          out << "int";
+          break;
+        case type_kind::float_type:
+          out << "float";
+          break;
+        case type_kind::string_type:
+          out << "string";
+          break;
+        case type_kind::array_type:
+          write(out, *t.inner);
+          out << "[]";
+          break;
+        case type_kind::function_type: {
+          out << "fun(";
+          auto sep = "";
+          for (auto p : t.params) {
+            out << sep;
+            write(out, *p);
+            sep = ", ";
+          }
+          out << "): ";
+          write(out, *t.inner);
+          break;
+        }
+      }
+    }
+
+  } // namespace
+
+  std::string to_string(type const &t) {
+    std::stringstream ss;
+    write(ss, t);
+    return ss.str();
+  }
+
+  type const *type_table::primitive(type_kind kind) noexcept {
+    if (kind >= type_kind::array_type) {
+      return nullptr;
+    }
+    return &primitives[static_cast<std::size_t>(kind)];
+  }
+
+  type const *type_table::primitive(std::string_view name) noexcept {
+    for (auto const &t : primitives) {
+      if (t.kind != type_kind::error && to_string(t) == name) {
+        return &t;
+      }
+    }
+    return nullptr;
+  }
+
+  type const *type_table::array_of(type const *element) {
+    return intern(type_kind::array_type, element, {});
+  }
+
+  type const *type_table::function_of(std::span<type const *const> params,
+                                      type const *result) {
+    return intern(type_kind::function_type, result, params);
+  }
+
+  std::size_t type_table::size() const {
+    std::shared_lock lock{mutex_};
+    return count_;
+  }
+
+  type const *type_table::find(std::size_t hash, type_kind kind,
+                               type const *inner,
+                               std::span<type const *const> params) const {
+    auto mask = slots_.size() - 1;
+    for (auto i = hash & mask;; i = (i + 1) & mask) {
+      auto t = slots_[i];
+      if (!t) {
+        return nullptr;
+      }
+      if (t->kind == kind && t->inner == inner &&
+          std::ranges::equal(t->params, params)) {
+        return t;
+      }
+    }
+  }
+
+  type const *type_table::intern(type_kind kind, type const *inner,
+                                 std::span<type const *const> params) {
+    auto hash = hash_of(kind, inner, params);
+    {
+      std::shared_lock lock{mutex_};
+      if (auto t = find(hash, kind, inner, params)) {
+        return t;
+      }
+    }
+    std::unique_lock lock{mutex_};
+    // another thread may have created it in the meantime
+    if (auto t = find(hash, kind, inner, params)) {
+      return t;
+    }
+    auto t = arena_.make<type>(kind, inner, arena_.copy(params));
+    auto mask = slots_.size() - 1;
+    auto i = hash & mask;
+    while (slots_[i]) {
+      i = (i + 1) & mask;
+    }
+    slots_[i] = t;
+    if (++count_ * 2 > slots_.size()) {
+      grow();
+    }
+    return t;
+  }
+
+  void type_table::grow() {
+    std::vector<type const *> slots(slots_.size() * 2);
+    auto mask = slots.size() - 1;
+    for (auto t : slots_) {
+      if (!t) {
+        continue;
+      }
+      auto i = hash_of(t->kind, t->inner, t->params) & mask;
+      while (slots[i]) {
+        i = (i + 1) & mask;
+      }
+      slots[i] = t;
+    }
+    slots_ = std::move(slots);
+  }
+
+} // namespace soda
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "arena.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <shared_mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace soda {
+
+  enum class type_kind : std::uint8_t {
+    error,
+    void_type,
+    bool_type,
+    char_type,
+    int_type,
+    float_type,
+    string_type,
+    array_type,
+    function_type,
+  };
+
+  //
+  // Canonical types
+  //
+  // Every distinct type exists exactly once, so two types are equal iff
+  // their pointers are, and a type's address can serve as its hash. The
+  // primitive types are static objects shared by all type tables; composite
+  // types belong to the table (and its arena) that created them.
+  //
+
+  class type {
+  public:
+    type_kind kind;
+    // element type of an array, result type of a function
+    type const *inner = nullptr;
+    std::span<type const *const> params;
+
+    bool is_primitive() const noexcept {
+      return kind < type_kind::array_type;
+    }
+
+    bool is_numeric() const noexcept {
+      return kind == type_kind::int_type || kind == type_kind::float_type;
+    }
+  };
+
+  std::string to_string(type const &t);
+
+  inline std::ostream &operator<<(std::ostream &out, type const &t) {
+    return out << to_string(t);
+  }
+
+  //
+  // Interning table for composite types
+  //
+  // Lookups of existing types take a shared lock only, so checker threads
+  // can look up and create types concurrently; creating a type takes the
+  // lock exclusively.
+  //
+
+  class type_table {
+  public:
+    type_table() : slots_(256) {
+    }
+
+    static type const *primitive(type_kind kind) noexcept;
+
+    // The primitive type with the given source name, e.g. "int", or nullptr.
+    static type const *primitive(std::string_view name) noexcept;
+
+    type const *array_of(type const *element);
+    type const *function_of(std::span<type const *const> params,
+                            type const *result);
+
+    std::size_t size() const;
+
+  private:
+    mutable std::shared_mutex mutex_;
+    arena arena_;
+    std::vector<type const *> slots_;
+    std::size_t count_ = 0;
+
+    type const *intern(type_kind kind, type const *inner,
+                       std::span<type const *const> params);
+    type const *find(std::size_t hash, type_kind kind, type const *inner,
+                     std::span<type const *const> params) const;
+    void grow();
+
+    type_table(type_table const &) = delete;
+    type_table &operator=(type_table const &) = delete;
+  };
+
+} // namespace soda
@@ -0,0 +1,109 @@
+#include "loops.hpp"
+#include "optimize.hpp"
+#include "rewrite.hpp"
+
+#include <algorithm>
+#include <vector>
+
+namespace soda::ir {
+
+  namespace {
+
+    // The most iterations unrolled, and the most instructions they may add.
+    constexpr std::uint64_t max_trips = 16;
+    constexpr std::size_t max_growth = 128;
+
+  } // namespace
+
+  // Unrolls innermost loops made of a header that tests whether to go
+  // around and a run of blocks from the body to the latch, each jumping to
+  // the next, whose trip count is a small constant. The run, after the
+  // header's instructions, is copied into the preheader once per
+  // iteration, with the header's phis standing for the values of the
+  // iteration. The phis then start at the values of the last iteration and
+  // the header goes straight out of the loop, which drops the run and
+  // leaves the phis with a single value.
+  void unroll_loops(function &f, pass_stats &stats) {
+    loop_nest loops{f};
+    if (!loops.size()) {
+      return;
+    }
+    auto const &g = f.graph;
+    auto size = f.size();
+    rewriter rw{f};
+    // the value of each value of the loop in the iteration being copied
+    std::vector<value_id> current(size, no_value);
+    std::vector<value_id> next, ops;
+    std::vector<block_id> run;
+    auto value = [&](value_id v) {
+      return current[v] == no_value ? v : current[v];
+    };
+    std::size_t count = 0;
+
+    for (std::uint32_t l = 0; l < loops.size(); l++) {
+      auto const &loop = loops[l];
+      auto h = loop.header;
+      if (!loop.innermost || loop.preheader == no_block ||
+          loop.trip_count > max_trips || !straight_run(f, loop, run)) {
+        continue;
+      }
+      std::size_t phis = 0, work = 0;
+      for (auto v : f.values_of(h)) {
+        phis += f.instrs[v].op == opcode::phi;
+      }
+      work += f.blocks[h].count - phis - 1;
+      for (auto b : run) {
+        work += f.blocks[b].count - 1;
+      }
+      if (loop.trip_count * work > max_growth) {
+        continue;
+      }
+
+      auto preds = g.preds(h);
+      auto entry = std::ranges::find(preds, loop.preheader) - preds.begin();
+      auto latch = 1 - entry;
+      auto end = f.terminator(loop.preheader);
+      auto first = f.blocks[h].first;
+      for (auto v = first; v < first + phis; v++) {
+        current[v] = f.operands_of(v)[entry];
+      }
+      auto copy = [&](value_id v) {
+        auto i = f.instrs[v];
+        ops.assign(f.operands_of(v).begin(), f.operands_of(v).end());
+        for (auto &o : ops) {
+          o = value(o);
+        }
+        current[v] = rw.insert(end, i.op, i.type, ops, i.imm);
+      };
+      for (std::uint64_t k = 0; k < loop.trip_count; k++) {
+        for (auto v = first + phis; v < f.terminator(h); v++) {
+          copy(v);
+        }
+        for (auto b : run) {
+          for (auto v = f.blocks[b].first; v < f.terminator(b); v++) {
+            copy(v);
+          }
+        }
+        // the phis take their values at once
+        next.clear();
+        for (auto v = first; v < first + phis; v++) {
+          next.push_back(value(f.operands_of(v)[latch]));
+        }
+        std::ranges::copy(next, current.begin() + first);
+      }
+      for (auto v = first; v < first + phis; v++) {
+        f.operands[f.instrs[v].first + entry] = current[v];
+      }
+      rw.fold_branch(h, g.succs(h)[0] == loop.body ? 1 : 0);
+      count++;
+    }
+    if (!count) {
+      return;
+    }
+    stats.branches_folded += count;
+    auto result = rw.apply();
+    stats.instrs_removed += result.instrs_removed;
+    stats.blocks_removed += result.blocks_removed;
+  }
+
+} // namespace soda::ir
@@ -1,10 +1,21 @@
 #include "utils.hpp"
 
+#include <cfloat>
+#include <cmath>
 #include <sstream>
 #include <stdexcept>
 
 namespace soda {
 
+  std::string quote(std::string_view name) {
+    std::string s;
+    s.reserve(name.size() + 2);
+    s += '\'';
+    s += name;
+    s += '\'';
+    return s;
+  }
+
   unsigned long long int parse_int(source_range const &range,
                                    std::string const &s) {
     std::string ns;
@@ -66,4 +77,165 @@ namespace soda {
     }
   }
 
+  bool requires_extended_precision(std::string_view s, long double value) {
+    if (std::isfinite(value) && value != 0.0L &&
+        (std::fabs(value) > DBL_MAX || std::fabs(value) < DBL_MIN)) {
+      return true;
+    }
+    int digits = 0;
+    bool leading = true;
+    for (auto ch : s) {
+      if (ch == 'e' || ch == 'E') {
+        break;
+      } else if (ch >= '0' && ch <= '9') {
+        if (ch != '0') {
+          leading = false;
+        }
+        if (!leading) {
+          digits++;
+        }
+      }
+    }
+    // trailing zeros in the fraction are not significant, but being
+    // conservative here only costs a pool entry
+    return digits > DBL_DIG;
+  }
+
+  static void append_utf8(std::string &out, char32_t cp) {
+    if (cp < 0x80) {
+      out += static_cast<char>(cp);
+    } else if (cp < 0x800) {
+      out += static_cast<char>(0xC0 | (cp >> 6));
+      out += static_cast<char>(0x80 | (cp & 0x3F));
+    } else if (cp < 0x10000) {
+      out += static_cast<char>(0xE0 | (cp >> 12));
+      out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+      out += static_cast<char>(0x80 | (cp & 0x3F));
+    } else {
+      out += static_cast<char>(0xF0 | (cp >> 18));
+      out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+      out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+      out += static_cast<char>(0x80 | (cp & 0x3F));
+    }
+  }
+
+  static int hex_value(char ch) {
+    if (ch >= '0' && ch <= '9')
+      return ch - '0';
+    else if (ch >= 'a' && ch <= 'f')
+      return ch - 'a' + 10;
+    else if (ch >= 'A' && ch <= 'F')
+      return ch - 'A' + 10;
+    return -1;
+  }
+
+  // Decodes one (possibly escaped) character starting at s[i], advancing i
+  // past it. Plain bytes are returned as-is, UTF-8 sequences are passed
+  // through by the callers one byte at a time.
+  static char32_t decode_escape(source_range const &range, std::string_view s,
+                                std::size_t &i) {
+    if (s[i] != '\\') {
+      return static_cast<unsigned char>(s[i++]);
+    }
+    if (++i >= s.size()) {
+      throw parse_error{range, "incomplete escape sequence"};
+    }
+    switch (s[i++]) {
+      case 'a':
+        return '\a';
+      case 'b':
+        return '\b';
+      case 'f':
+        return '\f';
+      case 'n':
+        return '\n';
+      case 'r':
+        return '\r';
+      case 't':
+        return '\t';
+      case 'v':
+        return '\v';
+      case '0':
+        return '\0';
+      case '\\':
+        return '\\';
+      case '\'':
+        return '\'';
+      case '"':
+        return '"';
+      case 'x': {
+        int hi = i < s.size() ? hex_value(s[i]) : -1;
+        int lo = i + 1 < s.size() ? hex_value(s[i + 1]) : -1;
+        if (hi < 0 || lo < 0) {
+          throw parse_error{range, "invalid \\x escape sequence"};
+        }
+        i += 2;
+        return static_cast<char32_t>(hi * 16 + lo);
+      }
+      case 'u': {
+        if (i >= s.size() || s[i] != '{') {
+          throw parse_error{range, "expected '{' after \\u"};
+        }
+        char32_t cp = 0;
+        int ndigits = 0;
+        for (i++; i < s.size() && s[i] != '}'; i++, ndigits++) {
+          auto v = hex_value(s[i]);
+          if (v < 0 || ndigits >= 6) {
+            throw parse_error{range, "invalid \\u escape sequence"};
+          }
+          cp = cp * 16 + v;
+        }
+        if (i >= s.size() || ndigits == 0 || cp > 0x10FFFF) {
+          throw parse_error{range, "invalid \\u escape sequence"};
+        }
+        i++;
+        return cp;
+      }
+      default: {
+        std::stringstream ss;
+        ss << "unknown escape sequence '\\" << s[i - 1] << "'";
+        throw parse_error{range, ss.str()};
+      }
+    }
+  }
+
+  std::string decode_string(source_range const &range, std::string_view s) {
+    std::string res;
+    res.reserve(s.size());
+    auto body = s.substr(1, s.size() >= 2 ? s.size() - 2 : 0);
+    for (std::size_t i = 0; i < body.size();) {
+      // \x escapes produce raw bytes, \u escapes code points
+      bool escaped = body[i] == '\\' && i + 1 < body.size() &&
+                     body[i + 1] != 'x';
+      auto cp = decode_escape(range, body, i);
+      if (escaped) {
+        append_utf8(res, cp);
+      } else {
+        res += static_cast<char>(cp);
+      }
+    }
+    return res;
+  }
+
+  std::uint8_t decode_char(source_range const &range, std::string_view s) {
+    auto body = s.substr(1, s.size() >= 2 ? s.size() - 2 : 0);
+    if (body.empty()) {
+      throw parse_error{range, "empty character literal"};
+    }
+    // a char is one byte of a string's UTF-8, so 'é' (two bytes) or
+    // '\u{e9}' could never equal an element of one
+    std::size_t i = 0;
+    bool byte_escape = body.size() >= 2 && body.substr(0, 2) == "\\x";
+    auto cp = decode_escape(range, body, i);
+    if (cp >= 0x80 && !byte_escape) {
+      throw parse_error{range, "character literal is not a single byte; use "
+                               "a \\x escape or a string"};
+    }
+    if (i != body.size()) {
+      throw parse_error{range, "character literal contains more than one "
+                               "character"};
+    }
+    return static_cast<std::uint8_t>(cp);
+  }
+
 } // namespace soda
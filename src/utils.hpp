@@ -3,7 +3,11 @@
 #include "parse_error.hpp"
 
 #include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
 #include <string>
+#include <string_view>
 #include <utility>
 
 namespace soda {
@@ -20,9 +24,27 @@ namespace soda {
 #endif
   }
 
+  template <typename T>
+  inline void hash_combine(std::size_t &seed, T const &value) {
+    seed ^= std::hash<T>{}(value) + 0x9e3779b97f4a7c15ull + (seed << 6) +
+            (seed >> 2);
+  }
+
+  // The name in single quotes, as diagnostics refer to names.
+  std::string quote(std::string_view name);
+
   unsigned long long int parse_int(source_range const &range,
                                    std::string const &s);
 
   long double parse_float(source_range const &range, std::string const &s);
 
+  // True when a floating-point literal has more significant digits than a
+  // double can round-trip, or a magnitude outside the range of a double.
+  bool requires_extended_precision(std::string_view s, long double value);
+
+  // Decode the escape sequences of a quoted literal (including its quotes)
+  // into UTF-8, or into the single byte of a character literal.
+  std::string decode_string(source_range const &range, std::string_view s);
+  std::uint8_t decode_char(source_range const &range, std::string_view s);
+
 } // namespace soda
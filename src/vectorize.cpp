@@ -0,0 +1,204 @@
+#include "vectorize.hpp"
+
+#include "backend.hpp"
+#include "rewrite.hpp"
+
+#include <algorithm>
+
+namespace soda::ir {
+
+  namespace {
+
+    // Whether the phi p of a loop's header, with the value from the latch
+    // its operand at latch, is a reduction, filling in r if so. Only the
+    // value from the latch may use the phi in the loop.
+    bool find_reduction(function const &f, loop_nest const &loops,
+                        std::uint32_t l, use_map const &uses,
+                        std::vector<block_id> const &block_of, value_id p,
+                        std::size_t latch, reduction &r) {
+      auto next = f.operands_of(p)[latch];
+      auto const &n = f.instrs[next];
+      if (f.instrs[p].type->kind != type_kind::int_type ||
+          uses.users(next).size() != 1) {
+        return false;
+      }
+      auto args = f.operands_of(next);
+      switch (n.op) {
+        case opcode::add:
+        case opcode::bit_and:
+        case opcode::bit_or:
+        case opcode::bit_xor:
+          if (args[1] == p) {
+            r.input = args[0];
+            break;
+          }
+          [[fallthrough]];
+        case opcode::sub:
+          if (args[0] != p) {
+            return false;
+          }
+          r.input = args[1];
+          break;
+        default:
+          return false;
+      }
+      r.phi = p;
+      r.next = next;
+      r.op = n.op;
+      return r.input != p &&
+             std::ranges::all_of(uses.users(p), [&](value_id u) {
+               return u == next || !loops.contains(l, block_of[u]);
+             });
+    }
+
+    // Whether the phi p of loop l is dead: what the loop computes from it
+    // only flows back into it, never out of the loop, into another phi or
+    // into an effect. Strength reduction and lowering at -O0 leave such
+    // phis behind, and vector iterations can leave them as they are.
+    bool is_dead_phi(function const &f, loop_nest const &loops,
+                     std::uint32_t l, use_map const &uses,
+                     std::vector<block_id> const &block_of, value_id p,
+                     std::vector<value_id> &work) {
+      std::vector<value_id> seen;
+      work.assign(1, p);
+      while (!work.empty()) {
+        auto v = work.back();
+        work.pop_back();
+        for (auto u : uses.users(v)) {
+          auto op = f.instrs[u].op;
+          if (u == p || std::ranges::find(seen, u) != seen.end()) {
+            continue;
+          }
+          if (!loops.contains(l, block_of[u]) || op == opcode::phi ||
+              has_effect(op) || is_terminator(op)) {
+            return false;
+          }
+          seen.push_back(u);
+          work.push_back(u);
+        }
+      }
+      return true;
+    }
+
+  } // namespace
+
+  bool is_lane_op(function const &f, value_id v) {
+    if (f.instrs[v].type->kind != type_kind::int_type) {
+      return false;
+    }
+    switch (f.instrs[v].op) {
+      case opcode::neg:
+      case opcode::bit_not:
+      case opcode::add:
+      case opcode::sub:
+      case opcode::mul:
+      case opcode::bit_and:
+      case opcode::bit_xor:
+      case opcode::bit_or:
+        return true;
+      case opcode::lshift:
+        return !may_trap(f, v);
+      default:
+        return false;
+    }
+  }
+
+  std::vector<vector_loop> plan_vector_loops(function const &f) {
+    std::vector<vector_loop> plans;
+    loop_nest loops{f};
+    if (!loops.size()) {
+      return plans;
+    }
+    use_map uses{f};
+    auto block_of = blocks_of(f);
+    // the loop, plus one, whose iterations were found to need each value
+    std::vector<std::uint32_t> needed(f.size(), 0);
+    std::vector<block_id> run;
+    std::vector<value_id> work;
+
+    for (std::uint32_t l = 0; l < loops.size(); l++) {
+      auto const &loop = loops[l];
+      auto h = loop.header;
+      if (!loop.innermost || loop.preheader == no_block ||
+          loop.tested == loop_forest::no_loop || loop.test != opcode::lt ||
+          loop.ivs[loop.tested].step != 1 || !straight_run(f, loop, run)) {
+        continue;
+      }
+      auto inside = [&](value_id v) {
+        return loops.contains(l, block_of[v]);
+      };
+      auto is_iv = [&](value_id v) {
+        return std::ranges::any_of(loop.ivs, [&](induction_variable iv) {
+          return iv.phi == v;
+        });
+      };
+
+      vector_loop plan{h, loop.preheader, loop.ivs[loop.tested].phi,
+                       loop.bound, loop.ivs, {}, {}};
+      auto latch = f.graph.preds(h)[0] == loop.latch ? 0 : 1;
+      bool ok = true;
+      for (auto p : f.values_of(h)) {
+        if (f.instrs[p].op != opcode::phi || !ok) {
+          break;
+        }
+        reduction r;
+        if (is_iv(p) ||
+            is_dead_phi(f, loops, l, uses, block_of, p, work)) {
+          continue;
+        }
+        ok = find_reduction(f, loops, l, uses, block_of, p, latch, r);
+        plan.reductions.push_back(r);
+      }
+      if (!ok || plan.reductions.empty()) {
+        continue;
+      }
+
+      // what the inputs are computed from, up to the induction variables
+      // and what does not change in the loop
+      work.clear();
+      for (auto const &r : plan.reductions) {
+        work.push_back(r.input);
+      }
+      while (!work.empty() && ok) {
+        auto v = work.back();
+        work.pop_back();
+        auto op = f.instrs[v].op;
+        if (needed[v] == l + 1 || op == opcode::constant || !inside(v)) {
+          continue;
+        }
+        needed[v] = l + 1;
+        if (op == opcode::phi) {
+          ok = is_iv(v);
+        } else if (!is_lane_op(f, v)) {
+          ok = false;
+        } else {
+          auto ops = f.operands_of(v);
+          work.insert(work.end(), ops.begin(), ops.end());
+        }
+      }
+      if (!ok) {
+        continue;
+      }
+
+      // the rest may be left out of the vector iterations
+      run.insert(run.begin(), h);
+      for (auto b : run) {
+        for (auto v : f.values_of(b)) {
+          auto op = f.instrs[v].op;
+          if (needed[v] == l + 1) {
+            if (op != opcode::phi) {
+              plan.values.push_back(v);
+            }
+          } else if (has_effect(op) || may_trap(f, v)) {
+            ok = false;
+          }
+        }
+      }
+      if (ok) {
+        plans.push_back(std::move(plan));
+      }
+    }
+    return plans;
+  }
+
+} // namespace soda::ir
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "ir.hpp"
+#include "loops.hpp"
+
+#include <vector>
+
+namespace soda::ir {
+
+  //
+  // Loop vectorization
+  //
+  // A counted loop whose iterations depend on each other only through
+  // induction variables and reductions can run several iterations at once,
+  // one in each lane of a vector register. The loop must be innermost, a
+  // header and a straight run of blocks like those unroll_loops takes, and
+  // go on while an induction variable stepping by 1 is below a bound that
+  // does not change in it. Every phi of the header is an induction
+  // variable, dead, in that what the loop computes from it only flows back
+  // into it, or a reduction: an int the latch brings its value added to,
+  // and-ed, or-ed or xor-ed with, or less, the input of an iteration, and
+  // that nothing else in the loop uses. What the inputs are computed
+  // from in the loop must be int operations that lanes can do on their
+  // own: addition, subtraction, multiplication, negation, the bitwise
+  // operators and left shifts by a constant below 64. Everything else in
+  // the loop must be without effect and unable to trap, so that leaving it
+  // out of the vector iterations changes nothing.
+  //
+  // A backend runs the vector iterations while at least a full vector of
+  // them is left, combines the lanes of each reduction into its phi, moves
+  // the induction variables on, and leaves the remaining iterations to
+  // the loop as it was.
+  //
+
+  struct reduction {
+    value_id phi = no_value;
+    // the value from the latch, and the input of an iteration it combines
+    // with the phi by op
+    value_id next = no_value;
+    value_id input = no_value;
+    opcode op = opcode::add;
+  };
+
+  struct vector_loop {
+    block_id header = no_block;
+    block_id preheader = no_block;
+    // the induction variable that stays below bound
+    value_id counter = no_value;
+    value_id bound = no_value;
+    std::vector<induction_variable> ivs;
+    std::vector<reduction> reductions;
+    // what an iteration computes for the inputs of the reductions, in
+    // order, operands first
+    std::vector<value_id> values;
+  };
+
+  // Whether v is an operation on ints that vector lanes can do apart.
+  bool is_lane_op(function const &f, value_id v);
+
+  // The loops of f that can be vectorized.
+  std::vector<vector_loop> plan_vector_loops(function const &f);
+
+} // namespace soda::ir
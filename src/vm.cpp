@@ -0,0 +1,891 @@
+#include "vm.hpp"
+
+#include "utils.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstring>
+#include <new>
+
+// threaded code where computed goto is available, unless built with
+// -DSODA_VM_THREADED=0 to compare
+#if !defined(SODA_VM_THREADED)
+#if defined(__GNUC__)
+#define SODA_VM_THREADED 1
+#else
+#define SODA_VM_THREADED 0
+#endif
+#endif
+
+// native code is entered through handlers of the threaded code
+#if SODA_VM_THREADED && SODA_VM_JIT_TARGET
+#define SODA_VM_JIT 1
+#else
+#define SODA_VM_JIT 0
+#endif
+
+namespace soda::vm {
+
+  struct machine::threaded {
+#if SODA_VM_THREADED
+    void const *handler;
+#else
+    opcode op;
+#endif
+    std::uint32_t a;
+    std::uint32_t b;
+    std::int64_t c;
+  };
+
+  struct machine::entry {
+    std::uint32_t start;
+    std::uint32_t registers;
+    std::uint32_t params;
+    std::uint32_t constant_count;
+    std::uint64_t const *constants;
+    // calls and loop iterations, for tiering
+    std::uint32_t heat;
+  };
+
+  struct machine::frame {
+    threaded const *ret;
+    std::uint64_t *regs;
+    std::uint32_t size;
+  };
+
+  namespace {
+
+    double to_float(std::uint64_t bits) {
+      return std::bit_cast<double>(bits);
+    }
+
+    std::uint64_t bits(double d) {
+      return std::bit_cast<std::uint64_t>(d);
+    }
+
+    string_object const &string_at(std::uint64_t bits) {
+      return *std::bit_cast<string_object const *>(
+          static_cast<std::uintptr_t>(bits));
+    }
+
+    array_object *array_at(std::uint64_t bits) {
+      return std::bit_cast<array_object *>(static_cast<std::uintptr_t>(bits));
+    }
+
+    int compare(string_object const &a, string_object const &b) {
+      auto n = static_cast<std::size_t>(std::min(a.length, b.length));
+      auto c = n ? std::memcmp(a.data, b.data, n) : 0;
+      return c ? c : (a.length > b.length) - (a.length < b.length);
+    }
+
+    std::uint64_t mul_high(std::uint64_t a, std::uint64_t b) {
+#if defined(__SIZEOF_INT128__)
+      __extension__ using int128 = __int128;
+      return static_cast<std::uint64_t>(
+          static_cast<int128>(static_cast<std::int64_t>(a)) *
+              static_cast<std::int64_t>(b) >>
+          64);
+#else
+      auto x = static_cast<std::int64_t>(a), y = static_cast<std::int64_t>(b);
+      std::int64_t x1 = x >> 32, y1 = y >> 32;
+      std::uint64_t x0 = static_cast<std::uint32_t>(x);
+      std::uint64_t y0 = static_cast<std::uint32_t>(y);
+      std::int64_t t = x1 * static_cast<std::int64_t>(y0) +
+                       static_cast<std::int64_t>(x0 * y0 >> 32);
+      std::int64_t w1 = (t & 0xffffffff) + static_cast<std::int64_t>(x0) * y1;
+      return static_cast<std::uint64_t>(x1 * y1 + (t >> 32) + (w1 >> 32));
+#endif
+    }
+
+  } // namespace
+
+  machine::machine(module const &m, limits const &lim, tiering const &tier)
+      : m_{m}, limits_{lim}, tiering_{tier}, globals_{m.globals},
+        stack_(lim.stack), natives_(m.functions.size()) {
+    tiering_.jit = tiering_.jit && SODA_VM_JIT;
+    for (auto const &fn : m.functions) {
+      auto start = static_cast<std::uint32_t>(code_.size());
+      auto table_base = static_cast<std::int64_t>(tables_.size());
+      auto args_base = static_cast<std::int64_t>(args_.size());
+      entries_.push_back({start, fn.registers, fn.params,
+                          static_cast<std::uint32_t>(fn.constants.size()),
+                          fn.constants.data(), 0});
+      owners_.insert(owners_.end(), fn.code.size(),
+                     static_cast<std::uint32_t>(entries_.size() - 1));
+      args_.insert(args_.end(), fn.args.begin(), fn.args.end());
+      for (auto t : fn.tables) {
+        for (auto &target : t.dense) {
+          target += start;
+        }
+        for (auto &target : t.targets) {
+          target += start;
+        }
+        t.fallback += start;
+        tables_.push_back(std::move(t));
+      }
+      for (auto const &i : fn.code) {
+        threaded t{};
+#if !SODA_VM_THREADED
+        t.op = i.op;
+#endif
+        t.a = i.a;
+        t.b = i.b;
+        t.c = i.c;
+        auto [a, b, c] = format_of(i.op);
+        if (b == field::target) {
+          t.b += start;
+        }
+        if (c == field::target) {
+          t.c += start;
+        }
+        if (i.op == opcode::switch_) {
+          t.c += table_base;
+        } else if (i.op == opcode::call || i.op == opcode::callv) {
+          t.c += args_base;
+        }
+        code_.push_back(t);
+      }
+    }
+#if SODA_VM_THREADED
+    // fills in the handlers
+    std::uint64_t unused;
+    execute(nullptr, nullptr, 0, unused);
+#endif
+  }
+
+  machine::~machine() = default;
+
+  status machine::call(std::uint32_t fn, std::span<std::uint64_t const> args,
+                       std::uint64_t &result) {
+    auto &e = entries_[fn];
+    if (tiering_.jit && ++e.heat == tiering_.threshold) {
+      tier_up(fn);
+    }
+    result = 0;
+    message_ = {};
+    if (e.registers > stack_.size()) {
+      return status::stack_limit;
+    }
+    auto regs = stack_.data();
+    std::copy_n(e.constants, e.constant_count, regs);
+    std::ranges::copy(args, regs + e.constant_count);
+    return execute(code_.data() + e.start, regs, e.registers, result);
+  }
+
+  // Translate the function numbered fn and enter its native code from
+  // loops and from instructions that start a run of it, or if it cannot be
+  // translated, stop counting its loops. Going in and out of native code
+  // costs more than a few instructions save, so a run must be at least
+  // min_run instructions in a straight line before one for the
+  // interpreter.
+  bool machine::tier_up(std::uint32_t fn) {
+    constexpr std::uint32_t min_run = 4;
+    auto const &e = entries_[fn];
+    auto const &code = m_.functions[fn].code;
+    auto native = native_function::compile(m_.functions[fn], e.start,
+                                           globals_.data());
+    std::vector<std::uint32_t> run(code.size() + 1);
+    for (auto pc = code.size(); pc-- > 0;) {
+      auto &t = code_[e.start + pc];
+      if (!native || !native->at(e.start + pc)) {
+        t.handler = originals_[e.start + pc];
+        continue;
+      }
+      auto op = code[pc].op;
+      run[pc] = op == opcode::jump || op == opcode::switch_ ? min_run
+                                                           : run[pc + 1] + 1;
+      if (run[pc] >= min_run || t.handler == loop_header_) {
+        t.handler = enter_native_;
+      }
+    }
+    if (!native) {
+      return false;
+    }
+    natives_[fn] = std::move(native);
+    compiled_++;
+    return true;
+  }
+
+  string_object const *machine::concatenate(string_object const &a,
+                                            string_object const &b) {
+    auto length = static_cast<std::size_t>(a.length + b.length);
+    auto size = sizeof(string_object) + length;
+    if (size > limits_.memory - std::min(allocated_, limits_.memory)) {
+      return nullptr;
+    }
+    allocated_ += size;
+    auto &block = heap_.emplace_back(std::make_unique<std::byte[]>(size));
+    auto data = reinterpret_cast<char *>(block.get() + sizeof(string_object));
+    if (a.length) {
+      std::memcpy(data, a.data, static_cast<std::size_t>(a.length));
+    }
+    if (b.length) {
+      std::memcpy(data + a.length, b.data, static_cast<std::size_t>(b.length));
+    }
+    return new (block.get())
+        string_object{static_cast<std::int64_t>(length), data};
+  }
+
+#if SODA_VM_THREADED
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#define SODA_VM_CASE(name) op_##name:
+#define SODA_VM_DISPATCH() goto *ip->handler
+#else
+#define SODA_VM_CASE(name) case opcode::name:
+#define SODA_VM_DISPATCH() goto dispatch
+#endif
+
+// on to the next instruction, or to the target of a jump, counting it;
+// taken jumps and calls also check the limit on steps, since every loop
+// and recursion goes through one
+#define SODA_VM_NEXT()                                                         \
+  do {                                                                         \
+    ++ip;                                                                      \
+    ++count;                                                                   \
+    SODA_VM_DISPATCH();                                                        \
+  } while (false)
+#define SODA_VM_JUMP(target)                                                   \
+  do {                                                                         \
+    ip = code + (target);                                                      \
+    if (++count > steps) {                                                     \
+      goto out_of_steps;                                                       \
+    }                                                                          \
+    SODA_VM_DISPATCH();                                                        \
+  } while (false)
+#define SODA_VM_TRAP(what)                                                     \
+  do {                                                                         \
+    message_ = what;                                                           \
+    goto trapped;                                                              \
+  } while (false)
+
+  // Run from ip in the frame at regs of size registers, until the frame
+  // returns. Without ip, fills in the handlers of the threaded code.
+  status machine::execute(threaded const *ip, std::uint64_t *regs,
+                          std::uint32_t size, std::uint64_t &result) {
+#if SODA_VM_THREADED
+    // in the order of opcode
+    static void const *const handlers[] = {
+        &&op_move,   &&op_iadd,   &&op_isub,   &&op_imul,   &&op_idiv,
+        &&op_imod,   &&op_ipow,   &&op_iand,   &&op_ior,    &&op_ixor,
+        &&op_ishl,   &&op_ishr,   &&op_imulh,  &&op_ineg,   &&op_inot,
+        &&op_lnot,   &&op_fadd,   &&op_fsub,   &&op_fmul,   &&op_fdiv,
+        &&op_fmod,   &&op_fpow,   &&op_fneg,   &&op_ilt,    &&op_ile,
+        &&op_ieq,    &&op_ine,    &&op_flt,    &&op_fle,    &&op_feq,
+        &&op_fne,    &&op_slt,    &&op_sle,    &&op_seq,    &&op_sne,
+        &&op_scat,   &&op_slen,   &&op_alen,   &&op_sindex, &&op_aindex,
+        &&op_astore, &&op_gload,  &&op_gstore, &&op_call,   &&op_callv,
+        &&op_ret,    &&op_ret_void, &&op_jump, &&op_jt,     &&op_jf,
+        &&op_switch_, &&op_iadd_k, &&op_imul_k, &&op_iand_k, &&op_ior_k,
+        &&op_ixor_k, &&op_ishl_k, &&op_ishr_k, &&op_ilt_k,  &&op_ile_k,
+        &&op_igt_k,  &&op_ige_k,  &&op_ieq_k,  &&op_ine_k,  &&op_jlt,
+        &&op_jle,    &&op_jeq,    &&op_jne,    &&op_jlt_k,  &&op_jle_k,
+        &&op_jgt_k,  &&op_jge_k,  &&op_jeq_k,  &&op_jne_k,
+    };
+    static_assert(std::size(handlers) == opcode_count);
+    if (!ip) {
+      auto t = code_.begin();
+      for (auto const &fn : m_.functions) {
+        for (auto const &i : fn.code) {
+          (t++)->handler = handlers[static_cast<std::size_t>(i.op)];
+        }
+      }
+      for (auto const &i : code_) {
+        originals_.push_back(i.handler);
+      }
+#if SODA_VM_JIT
+      enter_native_ = &&op_enter_native;
+      loop_header_ = &&op_loop_header;
+      // count the iterations of loops at the instructions backward jumps
+      // go to
+      for (std::size_t fn = 0; tiering_.jit && fn < entries_.size(); fn++) {
+        auto const &f = m_.functions[fn];
+        auto start = entries_[fn].start;
+        for (std::uint32_t pc = 0; pc < f.code.size(); pc++) {
+          auto const &i = f.code[pc];
+          auto loop = [&](std::uint32_t to) {
+            if (to <= pc) {
+              code_[start + to].handler = loop_header_;
+            }
+          };
+          auto [a, b, c] = format_of(i.op);
+          if (b == field::target) {
+            loop(i.b);
+          } else if (c == field::target) {
+            loop(static_cast<std::uint32_t>(i.c));
+          } else if (i.op == opcode::switch_) {
+            auto const &table = f.tables[static_cast<std::size_t>(i.c)];
+            std::ranges::for_each(table.dense, loop);
+            std::ranges::for_each(table.targets, loop);
+            loop(table.fallback);
+          }
+        }
+      }
+#endif
+      return status::ok;
+    }
+#endif
+
+    auto const code = code_.data();
+    auto const stack_end = stack_.data() + stack_.size();
+    auto const steps = limits_.steps - std::min(executed_, limits_.steps);
+    auto const depth = frames_.size();
+    auto globals = globals_.data();
+    std::uint64_t count = 0;
+    std::uint64_t value = 0;
+    entry *callee = nullptr;
+
+#if SODA_VM_THREADED
+    SODA_VM_DISPATCH();
+#else
+  dispatch:
+    switch (ip->op) {
+#endif
+
+      SODA_VM_CASE(move) {
+        regs[ip->a] = regs[ip->b];
+        SODA_VM_NEXT();
+      }
+
+      //
+      // Ints
+      //
+
+      SODA_VM_CASE(iadd) {
+        regs[ip->a] = regs[ip->b] + regs[ip->c];
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(isub) {
+        regs[ip->a] = regs[ip->b] - regs[ip->c];
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(imul) {
+        regs[ip->a] = regs[ip->b] * regs[ip->c];
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(idiv) {
+        auto x = static_cast<std::int64_t>(regs[ip->b]);
+        auto y = static_cast<std::int64_t>(regs[ip->c]);
+        if (y == 0) {
+          SODA_VM_TRAP("division by zero");
+        }
+        if (y == -1 && x == std::numeric_limits<std::int64_t>::min()) {
+          SODA_VM_TRAP("division overflow");
+        }
+        regs[ip->a] = static_cast<std::uint64_t>(x / y);
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(imod) {
+        auto x = static_cast<std::int64_t>(regs[ip->b]);
+        auto y = static_cast<std::int64_t>(regs[ip->c]);
+        if (y == 0) {
+          SODA_VM_TRAP("division by zero");
+        }
+        if (y == -1 && x == std::numeric_limits<std::int64_t>::min()) {
+          SODA_VM_TRAP("division overflow");
+        }
+        regs[ip->a] = static_cast<std::uint64_t>(x % y);
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(ipow) {
+        auto base = regs[ip->b];
+        auto exp = static_cast<std::int64_t>(regs[ip->c]);
+        if (exp < 0) {
+          SODA_VM_TRAP("negative exponent");
+        }
+        std::uint64_t acc = 1;
+        for (; exp; exp >>= 1) {
+          if (exp & 1) {
+            acc *= base;
+          }
+          base *= base;
+        }
+        regs[ip->a] = acc;
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(iand) {
+        regs[ip->a] = regs[ip->b] & regs[ip->c];
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(ior) {
+        regs[ip->a] = regs[ip->b] | regs[ip->c];
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(ixor) {
+        regs[ip->a] = regs[ip->b] ^ regs[ip->c];
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(ishl) {
+        if (regs[ip->c] >= 64) {
+          SODA_VM_TRAP("shift out of range");
+        }
+        regs[ip->a] = regs[ip->b] << regs[ip->c];
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(ishr) {
+        if (regs[ip->c] >= 64) {
+          SODA_VM_TRAP("shift out of range");
+        }
+        regs[ip->a] = static_cast<std::uint64_t>(
+            static_cast<std::int64_t>(regs[ip->b]) >> regs[ip->c]);
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(imulh) {
+        regs[ip->a] = mul_high(regs[ip->b], regs[ip->c]);
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(ineg) {
+        regs[ip->a] = 0 - regs[ip->b];
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(inot) {
+        regs[ip->a] = ~regs[ip->b];
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(lnot) {
+        regs[ip->a] = !regs[ip->b];
+        SODA_VM_NEXT();
+      }
+
+      //
+      // Floats
+      //
+
+      SODA_VM_CASE(fadd) {
+        regs[ip->a] = bits(to_float(regs[ip->b]) + to_float(regs[ip->c]));
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(fsub) {
+        regs[ip->a] = bits(to_float(regs[ip->b]) - to_float(regs[ip->c]));
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(fmul) {
+        regs[ip->a] = bits(to_float(regs[ip->b]) * to_float(regs[ip->c]));
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(fdiv) {
+        regs[ip->a] = bits(to_float(regs[ip->b]) / to_float(regs[ip->c]));
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(fmod) {
+        regs[ip->a] =
+            bits(std::fmod(to_float(regs[ip->b]), to_float(regs[ip->c])));
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(fpow) {
+        regs[ip->a] =
+            bits(std::pow(to_float(regs[ip->b]), to_float(regs[ip->c])));
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(fneg) {
+        regs[ip->a] = bits(-to_float(regs[ip->b]));
+        SODA_VM_NEXT();
+      }
+
+      //
+      // Comparisons
+      //
+
+      SODA_VM_CASE(ilt) {
+        regs[ip->a] = static_cast<std::int64_t>(regs[ip->b]) <
+                      static_cast<std::int64_t>(regs[ip->c]);
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(ile) {
+        regs[ip->a] = static_cast<std::int64_t>(regs[ip->b]) <=
+                      static_cast<std::int64_t>(regs[ip->c]);
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(ieq) {
+        regs[ip->a] = regs[ip->b] == regs[ip->c];
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(ine) {
+        regs[ip->a] = regs[ip->b] != regs[ip->c];
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(flt) {
+        regs[ip->a] = to_float(regs[ip->b]) < to_float(regs[ip->c]);
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(fle) {
+        regs[ip->a] = to_float(regs[ip->b]) <= to_float(regs[ip->c]);
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(feq) {
+        regs[ip->a] = to_float(regs[ip->b]) == to_float(regs[ip->c]);
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(fne) {
+        regs[ip->a] = to_float(regs[ip->b]) != to_float(regs[ip->c]);
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(slt) {
+        regs[ip->a] =
+            compare(string_at(regs[ip->b]), string_at(regs[ip->c])) < 0;
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(sle) {
+        regs[ip->a] =
+            compare(string_at(regs[ip->b]), string_at(regs[ip->c])) <= 0;
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(seq) {
+        regs[ip->a] =
+            compare(string_at(regs[ip->b]), string_at(regs[ip->c])) == 0;
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(sne) {
+        regs[ip->a] =
+            compare(string_at(regs[ip->b]), string_at(regs[ip->c])) != 0;
+        SODA_VM_NEXT();
+      }
+
+      //
+      // Strings and arrays
+      //
+
+      SODA_VM_CASE(scat) {
+        auto s = concatenate(string_at(regs[ip->b]), string_at(regs[ip->c]));
+        if (!s) {
+          goto out_of_memory;
+        }
+        regs[ip->a] = std::bit_cast<std::uintptr_t>(s);
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(slen) {
+        regs[ip->a] =
+            static_cast<std::uint64_t>(string_at(regs[ip->b]).length);
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(alen) {
+        auto array = array_at(regs[ip->b]);
+        regs[ip->a] = array ? static_cast<std::uint64_t>(array->length) : 0;
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(sindex) {
+        auto const &s = string_at(regs[ip->b]);
+        auto i = regs[ip->c];
+        if (i >= static_cast<std::uint64_t>(s.length)) {
+          SODA_VM_TRAP("index out of range");
+        }
+        regs[ip->a] = static_cast<unsigned char>(s.data[i]);
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(aindex) {
+        auto array = array_at(regs[ip->b]);
+        auto i = regs[ip->c];
+        if (!array || i >= static_cast<std::uint64_t>(array->length)) {
+          SODA_VM_TRAP("index out of range");
+        }
+        regs[ip->a] = array->data[i];
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(astore) {
+        auto array = array_at(regs[ip->a]);
+        auto i = regs[ip->b];
+        if (!array || i >= static_cast<std::uint64_t>(array->length)) {
+          SODA_VM_TRAP("index out of range");
+        }
+        array->data[i] = regs[ip->c];
+        SODA_VM_NEXT();
+      }
+
+      //
+      // Globals and calls
+      //
+
+      SODA_VM_CASE(gload) {
+        regs[ip->a] = globals[ip->c];
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(gstore) {
+        globals[ip->c] = regs[ip->a];
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(call) {
+        callee = &entries_[ip->b];
+        goto enter;
+      }
+      SODA_VM_CASE(callv) {
+        auto fn = regs[ip->b];
+        if (!fn) {
+          SODA_VM_TRAP("call of a null function");
+        }
+        callee = &entries_[fn - 1];
+        goto enter;
+      }
+      SODA_VM_CASE(ret) {
+        value = regs[ip->a];
+        goto returning;
+      }
+      SODA_VM_CASE(ret_void) {
+        value = 0;
+        goto returning;
+      }
+
+      //
+      // Control flow
+      //
+
+      SODA_VM_CASE(jump) {
+        SODA_VM_JUMP(ip->c);
+      }
+      SODA_VM_CASE(jt) {
+        if (regs[ip->a]) {
+          SODA_VM_JUMP(ip->c);
+        }
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(jf) {
+        if (!regs[ip->a]) {
+          SODA_VM_JUMP(ip->c);
+        }
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(switch_) {
+        auto const &t = tables_[static_cast<std::size_t>(ip->c)];
+        auto x = static_cast<std::int64_t>(regs[ip->a]);
+        auto target = t.fallback;
+        if (!t.dense.empty()) {
+          auto offset = static_cast<std::uint64_t>(x) -
+                        static_cast<std::uint64_t>(t.low);
+          if (offset < t.dense.size()) {
+            target = t.dense[offset];
+          }
+        } else if (auto it = std::ranges::lower_bound(t.values, x);
+                   it != t.values.end() && *it == x) {
+          target = t.targets[static_cast<std::size_t>(it - t.values.begin())];
+        }
+        SODA_VM_JUMP(target);
+      }
+
+      //
+      // Superinstructions
+      //
+
+      SODA_VM_CASE(iadd_k) {
+        regs[ip->a] = regs[ip->b] + static_cast<std::uint64_t>(ip->c);
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(imul_k) {
+        regs[ip->a] = regs[ip->b] * static_cast<std::uint64_t>(ip->c);
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(iand_k) {
+        regs[ip->a] = regs[ip->b] & static_cast<std::uint64_t>(ip->c);
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(ior_k) {
+        regs[ip->a] = regs[ip->b] | static_cast<std::uint64_t>(ip->c);
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(ixor_k) {
+        regs[ip->a] = regs[ip->b] ^ static_cast<std::uint64_t>(ip->c);
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(ishl_k) {
+        regs[ip->a] = regs[ip->b] << ip->c;
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(ishr_k) {
+        regs[ip->a] = static_cast<std::uint64_t>(
+            static_cast<std::int64_t>(regs[ip->b]) >> ip->c);
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(ilt_k) {
+        regs[ip->a] = static_cast<std::int64_t>(regs[ip->b]) < ip->c;
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(ile_k) {
+        regs[ip->a] = static_cast<std::int64_t>(regs[ip->b]) <= ip->c;
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(igt_k) {
+        regs[ip->a] = static_cast<std::int64_t>(regs[ip->b]) > ip->c;
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(ige_k) {
+        regs[ip->a] = static_cast<std::int64_t>(regs[ip->b]) >= ip->c;
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(ieq_k) {
+        regs[ip->a] = static_cast<std::int64_t>(regs[ip->b]) == ip->c;
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(ine_k) {
+        regs[ip->a] = static_cast<std::int64_t>(regs[ip->b]) != ip->c;
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(jlt) {
+        if (static_cast<std::int64_t>(regs[ip->a]) <
+            static_cast<std::int64_t>(regs[ip->b])) {
+          SODA_VM_JUMP(ip->c);
+        }
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(jle) {
+        if (static_cast<std::int64_t>(regs[ip->a]) <=
+            static_cast<std::int64_t>(regs[ip->b])) {
+          SODA_VM_JUMP(ip->c);
+        }
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(jeq) {
+        if (regs[ip->a] == regs[ip->b]) {
+          SODA_VM_JUMP(ip->c);
+        }
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(jne) {
+        if (regs[ip->a] != regs[ip->b]) {
+          SODA_VM_JUMP(ip->c);
+        }
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(jlt_k) {
+        if (static_cast<std::int64_t>(regs[ip->a]) < ip->c) {
+          SODA_VM_JUMP(ip->b);
+        }
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(jle_k) {
+        if (static_cast<std::int64_t>(regs[ip->a]) <= ip->c) {
+          SODA_VM_JUMP(ip->b);
+        }
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(jgt_k) {
+        if (static_cast<std::int64_t>(regs[ip->a]) > ip->c) {
+          SODA_VM_JUMP(ip->b);
+        }
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(jge_k) {
+        if (static_cast<std::int64_t>(regs[ip->a]) >= ip->c) {
+          SODA_VM_JUMP(ip->b);
+        }
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(jeq_k) {
+        if (static_cast<std::int64_t>(regs[ip->a]) == ip->c) {
+          SODA_VM_JUMP(ip->b);
+        }
+        SODA_VM_NEXT();
+      }
+      SODA_VM_CASE(jne_k) {
+        if (static_cast<std::int64_t>(regs[ip->a]) != ip->c) {
+          SODA_VM_JUMP(ip->b);
+        }
+        SODA_VM_NEXT();
+      }
+
+#if SODA_VM_JIT
+      //
+      // Tiering
+      //
+
+    op_loop_header: {
+      auto pc = static_cast<std::size_t>(ip - code);
+      auto fn = owners_[pc];
+      if (++entries_[fn].heat == tiering_.threshold && tier_up(fn)) {
+        SODA_VM_DISPATCH();
+      }
+      goto *originals_[pc];
+    }
+    op_enter_native: {
+      auto pc = static_cast<std::uint32_t>(ip - code);
+      auto const &native = *natives_[owners_[pc]];
+      auto fuel = steps > count ? steps - count : 0;
+      auto left = fuel;
+      auto next = native.run(native.at(pc), regs, left);
+      count += fuel - left;
+      if (next == native_function::out_of_fuel) {
+        goto out_of_steps;
+      }
+      // the interpreter runs what native code left to it
+      ip = code + next;
+      goto *originals_[next];
+    }
+#endif
+
+#if !SODA_VM_THREADED
+    }
+    unreachable();
+#endif
+
+  enter: {
+#if SODA_VM_JIT
+    if (tiering_.jit && ++callee->heat == tiering_.threshold) {
+      tier_up(static_cast<std::uint32_t>(callee - entries_.data()));
+    }
+#endif
+    auto next = regs + size;
+    if (callee->registers > static_cast<std::size_t>(stack_end - next)) {
+      goto out_of_stack;
+    }
+    std::copy_n(callee->constants, callee->constant_count, next);
+    auto args = args_.data() + ip->c;
+    for (std::uint32_t k = 0; k < args[0]; k++) {
+      next[callee->constant_count + k] = regs[args[k + 1]];
+    }
+    frames_.push_back({ip + 1, regs, size});
+    regs = next;
+    size = callee->registers;
+    SODA_VM_JUMP(callee->start);
+  }
+
+  returning:
+    if (frames_.size() == depth) {
+      executed_ += count + 1;
+      result = value;
+      return status::ok;
+    }
+    {
+      auto const &caller = frames_.back();
+      ip = caller.ret;
+      regs = caller.regs;
+      size = caller.size;
+      frames_.pop_back();
+      regs[(ip - 1)->a] = value;
+      ++count;
+      SODA_VM_DISPATCH();
+    }
+
+  trapped:
+    executed_ += count;
+    frames_.resize(depth);
+    return status::trap;
+  out_of_steps:
+    executed_ += count;
+    frames_.resize(depth);
+    return status::step_limit;
+  out_of_memory:
+    executed_ += count;
+    frames_.resize(depth);
+    return status::memory_limit;
+  out_of_stack:
+    executed_ += count;
+    frames_.resize(depth);
+    return status::stack_limit;
+  }
+
+#undef SODA_VM_TRAP
+#undef SODA_VM_JUMP
+#undef SODA_VM_NEXT
+#undef SODA_VM_DISPATCH
+#undef SODA_VM_CASE
+#if SODA_VM_THREADED
+#pragma GCC diagnostic pop
+#endif
+
+  status run_main(module const &m, std::uint64_t &result,
+                  std::string_view &message) {
+    machine vm{m};
+    auto s = vm.call(m.main, {}, result);
+    message = vm.message();
+    return s;
+  }
+
+} // namespace soda::vm
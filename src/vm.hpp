@@ -0,0 +1,141 @@
+#pragma once
+
+#include "bytecode.hpp"
+#include "jit.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <span>
+#include <string_view>
+#include <vector>
+
+namespace soda::vm {
+
+  //
+  // Virtual machine
+  //
+  // The machine runs the functions of a compiled module. Before running,
+  // the code of every function is copied into one array in threaded form,
+  // with each instruction holding the address of the code that executes
+  // it, so that dispatch is one indirect jump at the end of each handler
+  // (computed goto, a GNU extension); other compilers get a switch in a
+  // loop. Jump targets become indices into that array.
+  //
+  // The frames of all active calls are windows on one array of registers,
+  // and a call pushes a return record rather than recursing on the C++
+  // stack, so the depth of recursion is bounded only by the registers
+  // left. Limits on the number of instructions executed, on the memory
+  // allocated for strings and on the registers of the stack stop a run
+  // instead of letting it go on or crash, so that the machine can run
+  // untrusted code, as the compiler does when it evaluates calls.
+  //
+  // Traps end a run with the message the native backends print. Strings
+  // made by concatenation are owned by the machine and live as long as it.
+  //
+  // A function becomes hot when its calls and the iterations of its loops
+  // reach a threshold, counted at calls and at the instructions backward
+  // jumps go to. A hot function is translated by the template JIT, where
+  // there is one, and from then on its instructions with native code are
+  // entered from the interpreter wherever it reaches them: at the call, at
+  // a loop in a frame already running, or after an instruction native code
+  // left to the interpreter.
+  //
+
+  struct limits {
+    std::uint64_t steps = std::numeric_limits<std::uint64_t>::max();
+    std::size_t memory = std::numeric_limits<std::size_t>::max();
+    // registers, for all frames together
+    std::size_t stack = std::size_t{1} << 20;
+  };
+
+  struct tiering {
+    bool jit = jit_available;
+    // calls and loop iterations of a function before it is translated
+    std::uint32_t threshold = 1000;
+  };
+
+  enum class status : std::uint8_t {
+    ok,
+    trap,
+    step_limit,
+    memory_limit,
+    stack_limit,
+  };
+
+  class machine {
+  public:
+    explicit machine(module const &m, limits const &lim = {},
+                     tiering const &tier = {});
+    ~machine();
+
+    machine(machine const &) = delete;
+    machine &operator=(machine const &) = delete;
+
+    // Call the function numbered fn with args, which must be as many as it
+    // takes, leaving what it returns, or 0, in result.
+    status call(std::uint32_t fn, std::span<std::uint64_t const> args,
+                std::uint64_t &result);
+
+    // Why the last run trapped.
+    std::string_view message() const noexcept {
+      return message_;
+    }
+
+    // The instructions executed by all runs, where native code counts one
+    // for each step it takes.
+    std::uint64_t executed() const noexcept {
+      return executed_;
+    }
+
+    // The functions translated to native code.
+    std::size_t compiled() const noexcept {
+      return compiled_;
+    }
+
+    std::span<std::uint64_t> globals() noexcept {
+      return globals_;
+    }
+
+  private:
+    struct threaded;
+    struct entry;
+    struct frame;
+
+    module const &m_;
+    limits limits_;
+    tiering tiering_;
+    std::vector<threaded> code_;
+    std::vector<entry> entries_;
+    std::vector<switch_table> tables_;
+    std::vector<std::uint32_t> args_;
+    std::vector<std::uint64_t> globals_;
+    std::vector<std::uint64_t> stack_;
+    std::vector<frame> frames_;
+    std::vector<std::unique_ptr<std::byte[]>> heap_;
+    std::size_t allocated_ = 0;
+    std::uint64_t executed_ = 0;
+    std::string_view message_;
+    // for tiering: the function of each instruction, and its handler in
+    // the interpreter
+    std::vector<std::uint32_t> owners_;
+    std::vector<void const *> originals_;
+    void const *enter_native_ = nullptr;
+    void const *loop_header_ = nullptr;
+    std::vector<std::unique_ptr<native_function>> natives_;
+    std::size_t compiled_ = 0;
+
+    status execute(threaded const *ip, std::uint64_t *regs,
+                   std::uint32_t size, std::uint64_t &result);
+    bool tier_up(std::uint32_t fn);
+    string_object const *concatenate(string_object const &a,
+                                     string_object const &b);
+  };
+
+  // Run the main of m to completion, returning its status and leaving its
+  // exit status, what it returns or 0, in result.
+  status run_main(module const &m, std::uint64_t &result,
+                  std::string_view &message);
+
+} // namespace soda::vm
@@ -0,0 +1,2337 @@
+#include "x86_backend.hpp"
+
+#include "backend.hpp"
+#include "cfg.hpp"
+#include "switch_lowering.hpp"
+#include "utils.hpp"
+#include "vectorize.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace soda {
+
+  namespace {
+
+    using ir::opcode;
+    using ir::value_id;
+
+    // The runtime support of every program. The routines are local to the
+    // object and follow the System V convention; the failures are jumped
+    // to, from wherever the stack is.
+    constexpr std::string_view runtime = R"(	.text
+soda_trap:
+	andq $-16, %rsp
+	movq %rsi, %rdx
+	movq %rdi, %rsi
+	movl $2, %edi
+	call write@PLT
+	call abort@PLT
+
+soda_fail_div0:
+	leaq .Lsoda_div0(%rip), %rdi
+	movl $(.Lsoda_overflow - .Lsoda_div0), %esi
+	jmp soda_trap
+
+soda_fail_overflow:
+	leaq .Lsoda_overflow(%rip), %rdi
+	movl $(.Lsoda_exponent - .Lsoda_overflow), %esi
+	jmp soda_trap
+
+soda_fail_exponent:
+	leaq .Lsoda_exponent(%rip), %rdi
+	movl $(.Lsoda_shift - .Lsoda_exponent), %esi
+	jmp soda_trap
+
+soda_fail_shift:
+	leaq .Lsoda_shift(%rip), %rdi
+	movl $(.Lsoda_index - .Lsoda_shift), %esi
+	jmp soda_trap
+
+soda_fail_index:
+	leaq .Lsoda_index(%rip), %rdi
+	movl $(.Lsoda_memory - .Lsoda_index), %esi
+	jmp soda_trap
+
+soda_fail_memory:
+	leaq .Lsoda_memory(%rip), %rdi
+	movl $(.Lsoda_end - .Lsoda_memory), %esi
+	jmp soda_trap
+
+# rdi to the power of rsi, by squaring
+soda_pow:
+	testq %rsi, %rsi
+	js soda_fail_exponent
+	movl $1, %eax
+	jmp 2f
+1:	testb $1, %sil
+	jz 3f
+	imulq %rdi, %rax
+3:	imulq %rdi, %rdi
+	shrq %rsi
+2:	testq %rsi, %rsi
+	jnz 1b
+	ret
+
+# a new string of rdi followed by rsi
+soda_str_cat:
+	pushq %rbx
+	pushq %r12
+	pushq %r13
+	movq %rdi, %rbx
+	movq %rsi, %r12
+	movq (%rdi), %rdi
+	addq (%rsi), %rdi
+	addq $16, %rdi
+	call malloc@PLT
+	testq %rax, %rax
+	jz soda_fail_memory
+	movq %rax, %r13
+	movq (%rbx), %rdx
+	addq (%r12), %rdx
+	movq %rdx, (%r13)
+	leaq 16(%r13), %rdi
+	movq %rdi, 8(%r13)
+	movq 8(%rbx), %rsi
+	movq (%rbx), %rdx
+	call memcpy@PLT
+	movq 8(%r13), %rdi
+	addq (%rbx), %rdi
+	movq 8(%r12), %rsi
+	movq (%r12), %rdx
+	call memcpy@PLT
+	movq %r13, %rax
+	popq %r13
+	popq %r12
+	popq %rbx
+	ret
+
+# the sign of rdi less rsi, in lexicographic order of their bytes
+soda_str_cmp:
+	pushq %rbx
+	pushq %r12
+	subq $8, %rsp
+	movq %rdi, %rbx
+	movq %rsi, %r12
+	movq (%rdi), %rdx
+	cmpq (%rsi), %rdx
+	cmovgq (%rsi), %rdx
+	movq 8(%rdi), %rdi
+	movq 8(%rsi), %rsi
+	call memcmp@PLT
+	movslq %eax, %rax
+	testq %rax, %rax
+	jnz 1f
+	movq (%rbx), %rax
+	subq (%r12), %rax
+1:	addq $8, %rsp
+	popq %r12
+	popq %rbx
+	ret
+
+# whether rdi and rsi have the same bytes
+soda_str_eq:
+	movq (%rdi), %rdx
+	cmpq (%rsi), %rdx
+	jne 1f
+	subq $8, %rsp
+	movq 8(%rdi), %rdi
+	movq 8(%rsi), %rsi
+	call memcmp@PLT
+	addq $8, %rsp
+	testl %eax, %eax
+	sete %al
+	movzbl %al, %eax
+	ret
+1:	xorl %eax, %eax
+	ret
+
+	.section .rodata
+.Lsoda_div0:
+	.ascii "soda: division by zero\n"
+.Lsoda_overflow:
+	.ascii "soda: division overflow\n"
+.Lsoda_exponent:
+	.ascii "soda: negative exponent\n"
+.Lsoda_shift:
+	.ascii "soda: shift out of range\n"
+.Lsoda_index:
+	.ascii "soda: index out of range\n"
+.Lsoda_memory:
+	.ascii "soda: out of memory\n"
+.Lsoda_end:
+	.p2align 4
+.Lsoda_sign:
+	.quad 0x8000000000000000, 0
+)";
+
+    // Sets .Lsoda_avx2 if the processor has AVX2 and the system saves the
+    // ymm registers, for programs with loops vectorized with it; main calls
+    // it first.
+    constexpr std::string_view detect_avx2 = R"(
+	.data
+.Lsoda_avx2:
+	.byte 0
+
+	.text
+soda_detect_avx2:
+	pushq %rbx
+	xorl %eax, %eax
+	cpuid
+	cmpl $7, %eax
+	jb 1f
+	movl $1, %eax
+	cpuid
+	andl $0x18000000, %ecx
+	cmpl $0x18000000, %ecx
+	jne 1f
+	xorl %ecx, %ecx
+	xgetbv
+	andl $6, %eax
+	cmpl $6, %eax
+	jne 1f
+	movl $7, %eax
+	xorl %ecx, %ecx
+	cpuid
+	btl $5, %ebx
+	setc .Lsoda_avx2(%rip)
+1:	popq %rbx
+	ret
+)";
+
+    enum reg : std::uint8_t {
+      rax,
+      rcx,
+      rdx,
+      rbx,
+      rsp,
+      rbp,
+      rsi,
+      rdi,
+      r8,
+      r9,
+      r10,
+      r11,
+      r12,
+      r13,
+      r14,
+      r15,
+      xmm0,
+      xmm14 = xmm0 + 14,
+      xmm15 = xmm0 + 15,
+    };
+
+    constexpr reg xmm(unsigned k) {
+      return static_cast<reg>(xmm0 + k);
+    }
+
+    constexpr bool is_xmm(reg r) {
+      return r >= xmm0;
+    }
+
+    std::string_view name(reg r) {
+      static constexpr std::string_view names[] = {
+          "%rax",   "%rcx",   "%rdx",   "%rbx",   "%rsp",   "%rbp",
+          "%rsi",   "%rdi",   "%r8",    "%r9",    "%r10",   "%r11",
+          "%r12",   "%r13",   "%r14",   "%r15",   "%xmm0",  "%xmm1",
+          "%xmm2",  "%xmm3",  "%xmm4",  "%xmm5",  "%xmm6",  "%xmm7",
+          "%xmm8",  "%xmm9",  "%xmm10", "%xmm11", "%xmm12", "%xmm13",
+          "%xmm14", "%xmm15"};
+      return names[r];
+    }
+
+    std::string_view name32(reg r) {
+      static constexpr std::string_view names[] = {
+          "%eax", "%ecx", "%edx",  "%ebx",  "%esp",  "%ebp",
+          "%esi", "%edi", "%r8d",  "%r9d",  "%r10d", "%r11d",
+          "%r12d", "%r13d", "%r14d", "%r15d"};
+      return names[r];
+    }
+
+    // The registers given to values, those the caller saves first.
+    constexpr reg caller_saved[] = {rsi, rdi, r8, r9, r10};
+    constexpr reg callee_saved[] = {rbx, r12, r13, r14, r15};
+    constexpr unsigned xmm_count = 14;
+
+    constexpr reg int_args[] = {rdi, rsi, rdx, rcx, r8, r9};
+    constexpr unsigned float_args = 8;
+
+    enum class reg_class : std::uint8_t {
+      none,
+      gpr,
+      xmm,
+    };
+
+    reg_class class_of(type const *t) {
+      switch (t->kind) {
+        case type_kind::void_type:
+          return reg_class::none;
+        case type_kind::float_type:
+          return reg_class::xmm;
+        default:
+          return reg_class::gpr;
+      }
+    }
+
+    struct location {
+      enum class kind : std::uint8_t {
+        none,
+        reg,
+        stack,
+      };
+
+      enum kind kind = kind::none;
+      reg r = rax;
+      // from %rbp
+      std::int32_t offset = 0;
+
+      static location in(reg r) {
+        return {kind::reg, r, 0};
+      }
+
+      static location at(std::int32_t offset) {
+        return {kind::stack, rax, offset};
+      }
+
+      bool is_reg() const noexcept {
+        return kind == kind::reg;
+      }
+
+      bool is_stack() const noexcept {
+        return kind == kind::stack;
+      }
+
+      bool operator==(location const &) const = default;
+    };
+
+    bool fits_int32(std::int64_t k) {
+      return k >= std::numeric_limits<std::int32_t>::min() &&
+             k <= std::numeric_limits<std::int32_t>::max();
+    }
+
+    // The condition code of a comparison of ints.
+    std::string_view condition(opcode op) {
+      switch (op) {
+        case opcode::lt:
+          return "l";
+        case opcode::gt:
+          return "g";
+        case opcode::le:
+          return "le";
+        case opcode::ge:
+          return "ge";
+        case opcode::eq:
+          return "e";
+        case opcode::ne:
+          return "ne";
+        default:
+          unreachable();
+      }
+    }
+
+    std::string_view inverse(std::string_view cc) {
+      if (cc == "l") {
+        return "ge";
+      } else if (cc == "ge") {
+        return "l";
+      } else if (cc == "g") {
+        return "le";
+      } else if (cc == "le") {
+        return "g";
+      } else if (cc == "e") {
+        return "ne";
+      }
+      return "e";
+    }
+
+    // Whether v is a constant below 2^32, whose high half is 0.
+    bool is_half(ir::function const &f, value_id v) {
+      auto const &i = f.instrs[v];
+      return i.op == opcode::constant && i.imm >> 32 == 0;
+    }
+
+    // Whether running loop a vector of width iterations at a time is
+    // likely to be faster, counting an instruction for each value of an
+    // iteration against one for each operation on lanes, of which a
+    // multiplication takes several. Only the induction variables that an
+    // iteration reads have lanes to move on.
+    bool pays_off(ir::function const &f, ir::vector_loop const &loop,
+                  std::size_t width) {
+      auto read = [&](value_id phi) {
+        return std::ranges::any_of(loop.reductions,
+                                   [&](ir::reduction const &r) {
+                                     return r.input == phi;
+                                   }) ||
+               std::ranges::any_of(loop.values, [&](value_id v) {
+                 return std::ranges::find(f.operands_of(v), phi) !=
+                        f.operands_of(v).end();
+               });
+      };
+      // the comparison or count and the branch
+      auto steps = 2 + loop.reductions.size();
+      auto scalar = steps + loop.ivs.size() + loop.values.size();
+      auto lanes = steps;
+      for (auto const &iv : loop.ivs) {
+        lanes += read(iv.phi);
+      }
+      for (auto v : loop.values) {
+        auto ops = f.operands_of(v);
+        switch (f.instrs[v].op) {
+          case opcode::mul:
+            if (ops[0] == ops[1]) {
+              lanes += 6;
+            } else if (is_half(f, ops[0]) || is_half(f, ops[1])) {
+              lanes += 5;
+            } else {
+              lanes += 8;
+            }
+            break;
+          case opcode::neg:
+          case opcode::bit_not:
+            lanes += 2;
+            break;
+          default:
+            lanes++;
+            break;
+        }
+      }
+      return lanes < width * scalar;
+    }
+
+    void write_ascii(std::ostream &out, std::string_view s) {
+      static constexpr char digits[] = "01234567";
+      out << "\t.ascii \"";
+      for (unsigned char c : s) {
+        if (c == '"' || c == '\\') {
+          out << '\\' << c;
+        } else if (c >= 0x20 && c < 0x7f) {
+          out << c;
+        } else {
+          out << '\\' << digits[c >> 6] << digits[c >> 3 & 7]
+              << digits[c & 7];
+        }
+      }
+      out << "\"\n";
+    }
+
+    class x86_writer {
+    public:
+      x86_writer(ast::program const &prog, diagnostics &diags,
+                 x86_options const &opts)
+          : prog_{prog}, diags_{diags}, opts_{opts} {
+      }
+
+      bool write(std::ostream &out, std::span<ir::function const> funs);
+
+    private:
+      // dst = src, or the leaf value if there is one
+      struct move {
+        location dst;
+        location src;
+        value_id leaf = ir::no_value;
+      };
+
+      struct interval {
+        std::uint32_t start;
+        std::uint32_t end;
+        value_id value;
+      };
+
+      ast::program const &prog_;
+      diagnostics &diags_;
+      x86_options opts_;
+      std::unordered_map<ast::decl const *, std::string> names_;
+      std::unordered_map<std::string_view, std::string> strings_;
+      std::unordered_map<std::uint64_t, std::string> floats_;
+      std::unordered_map<std::int64_t, std::string> lanes_;
+      // whether a loop tests for AVX2
+      bool avx2_ = false;
+      // read-only data, and data with addresses in it
+      std::ostringstream rodata_;
+      std::ostringstream data_;
+      std::ostream *out_ = nullptr;
+      std::size_t labels_ = 0;
+
+      // the function being written, and its index
+      ir::function const *f_ = nullptr;
+      std::size_t index_ = 0;
+      std::vector<block_id> block_of_;
+      std::vector<bool> live_;
+      std::vector<std::uint32_t> uses_;
+      // comparisons written as part of the branch after them
+      std::vector<bool> fused_;
+      // the blocks in the order they are written, in reverse postorder so
+      // that the arms of a branch come before the block they join at, and
+      // the block written after each
+      std::vector<block_id> order_;
+      std::vector<block_id> next_;
+      // the position of each value, and the first and last of each block
+      std::vector<std::uint32_t> pos_;
+      std::vector<std::uint32_t> block_from_;
+      std::vector<std::uint32_t> block_to_;
+      // the positions of calls, including those to the runtime
+      std::vector<std::uint32_t> calls_;
+      // the live intervals of the values, by start
+      std::vector<interval> intervals_;
+      std::vector<location> loc_;
+      std::vector<reg> saved_;
+      std::uint32_t slots_ = 0;
+      bool frame_ = false;
+      std::ostringstream stubs_;
+      std::unordered_map<std::uint64_t, std::string> edge_labels_;
+      std::vector<ir::vector_loop> vector_loops_;
+
+      void name_symbols();
+      std::string const &string_label(std::string_view s);
+      std::string const &float_label(std::uint64_t bits);
+      std::string const &lanes_label(std::int64_t step);
+      std::string label(block_id b) const;
+      std::string new_label();
+
+      void write_function(ir::function const &f);
+      void plan();
+      bool calls_out(value_id v) const;
+      std::vector<location> passed() const;
+      void allocate();
+      void write_prologue();
+      void write_epilogue();
+
+      void ins(std::string_view op);
+      void ins(std::string_view op, std::string_view a);
+      void ins(std::string_view op, std::string_view a, std::string_view b);
+      void ins(std::string_view op, std::string_view a, std::string_view b,
+               std::string_view c);
+      std::string operand(location l) const;
+      std::string source(value_id v);
+      void load_imm(std::uint64_t bits, reg r);
+      void load(value_id v, reg r);
+      void store(reg r, value_id v);
+      reg in_reg(value_id v, reg scratch);
+      reg dest(value_id v, reg scratch) const;
+      void emit_move(move const &m);
+      void parallel_move(std::vector<move> &moves);
+
+      void write_value(value_id v);
+      void int_binary(value_id v, std::string_view op, bool commutative);
+      void float_binary(value_id v, std::string_view op);
+      void unary(value_id v, std::string_view op);
+      void divide(value_id v, bool remainder);
+      void shift(value_id v, std::string_view op);
+      std::string_view compare_ints(value_id a, value_id b, opcode op);
+      void compare_floats(value_id a, value_id b, opcode op);
+      void compare(value_id v);
+      void index(value_id v);
+      void store_index(value_id v);
+      void call_runtime(std::string_view callee,
+                        std::span<value_id const> args);
+      void call(value_id v);
+
+      void edge_moves(block_id b, std::size_t k, std::vector<move> &moves);
+      std::string edge_target(block_id b, std::size_t k);
+      void write_edge(block_id b, std::size_t k);
+      void write_terminator(block_id b);
+      void write_switch(block_id b);
+      void search(block_id b, ir::switch_plan const &plan, std::size_t lo,
+                  std::size_t hi, bool compared);
+      void write_cluster(block_id b, ir::switch_plan const &plan,
+                         ir::switch_cluster const &c, bool compared);
+      void compare_imm(std::int64_t k, reg r);
+
+      void write_vector_loop(ir::vector_loop const &loop);
+      bool vector_iterations(ir::vector_loop const &loop, bool wide,
+                             std::string const &skip);
+    };
+
+    void x86_writer::name_symbols() {
+      std::unordered_set<std::string> taken;
+      for (auto const &tu : prog_.tus) {
+        for (auto const &d : tu->decls) {
+          if (d->kind != ast::node_kind::fun_decl &&
+              d->kind != ast::node_kind::let_decl) {
+            continue;
+          }
+          auto base = (d->kind == ast::node_kind::fun_decl ? "s_" : "g_") +
+                      d->name;
+          auto name = base;
+          for (int n = 2; !taken.insert(name).second; n++) {
+            name = base + '_' + std::to_string(n);
+          }
+          names_.emplace(d.get(), std::move(name));
+        }
+      }
+    }
+
+    std::string const &x86_writer::string_label(std::string_view s) {
+      auto [it, inserted] = strings_.try_emplace(s);
+      if (inserted) {
+        auto n = std::to_string(strings_.size() - 1);
+        it->second = ".Lstr" + n;
+        rodata_ << ".Lchars" << n << ":\n";
+        write_ascii(rodata_, s);
+        data_ << "\t.p2align 3\n"
+              << it->second << ":\n\t.quad " << s.size() << ", .Lchars" << n
+              << '\n';
+      }
+      return it->second;
+    }
+
+    std::string const &x86_writer::float_label(std::uint64_t bits) {
+      auto [it, inserted] = floats_.try_emplace(bits);
+      if (inserted) {
+        it->second = ".Lfloat" + std::to_string(floats_.size() - 1);
+        rodata_ << "\t.p2align 3\n"
+                << it->second << ":\n\t.quad " << bits << '\n';
+      }
+      return it->second;
+    }
+
+    // The lanes of an induction variable from 0 by step, for vectors of up
+    // to four.
+    std::string const &x86_writer::lanes_label(std::int64_t step) {
+      auto [it, inserted] = lanes_.try_emplace(step);
+      if (inserted) {
+        it->second = ".Llanes" + std::to_string(lanes_.size() - 1);
+        rodata_ << "\t.p2align 5\n" << it->second << ":\n\t.quad 0";
+        for (std::uint64_t k = 1; k < 4; k++) {
+          rodata_ << ", "
+                  << static_cast<std::int64_t>(
+                         k * static_cast<std::uint64_t>(step));
+        }
+        rodata_ << '\n';
+      }
+      return it->second;
+    }
+
+    std::string x86_writer::label(block_id b) const {
+      return ".L" + std::to_string(index_) + '_' + std::to_string(b);
+    }
+
+    std::string x86_writer::new_label() {
+      return ".Lx" + std::to_string(labels_++);
+    }
+
+    bool x86_writer::write(std::ostream &out,
+                           std::span<ir::function const> funs) {
+      program_layout layout;
+      if (!lay_out(prog_, funs, layout, diags_)) {
+        return false;
+      }
+      name_symbols();
+      // the empty string first, for undefined strings
+      string_label({});
+
+      out << "# Generated by sodac.\n\n" << runtime;
+      out_ = &out;
+      for (index_ = 0; index_ < layout.functions.size(); index_++) {
+        write_function(*layout.functions[index_]);
+      }
+
+      if (avx2_) {
+        out << detect_avx2;
+      }
+      auto main = names_.at(layout.main);
+      out << "\n\t.globl main\n\t.type main, @function\nmain:\n"
+          << "\tsubq $8, %rsp\n"
+          << (avx2_ ? "\tcall soda_detect_avx2\n" : "") << "\tcall " << main
+          << '\n';
+      if (layout.main->canonical->inner->kind == type_kind::void_type) {
+        out << "\txorl %eax, %eax\n";
+      }
+      out << "\taddq $8, %rsp\n\tret\n\t.size main, .-main\n";
+
+      for (auto let : layout.globals) {
+        auto const &init = layout.inits.at(let);
+        std::string value = "0";
+        switch (init.kind) {
+          case global_init::kind::none:
+            if (let->canonical->kind == type_kind::string_type) {
+              value = string_label({});
+            }
+            break;
+          case global_init::kind::bits:
+            value = std::to_string(init.bits);
+            break;
+          case global_init::kind::string:
+            // named first, as that writes the string's own data
+            value = string_label(init.string);
+            break;
+          case global_init::kind::function:
+            value = names_.at(init.function);
+            break;
+        }
+        data_ << "\t.p2align 3\n"
+              << names_.at(let) << ":\n\t.quad " << value << '\n';
+      }
+      out << "\n\t.section .rodata\n"
+          << rodata_.view() << "\n\t.data\n"
+          << data_.view() << "\n\t.section .note.GNU-stack,\"\",@progbits\n";
+      return true;
+    }
+
+    //
+    // Planning and register allocation
+    //
+
+    // Whether v calls a function, which may overwrite the registers the
+    // caller saves.
+    bool x86_writer::calls_out(value_id v) const {
+      auto const &f = *f_;
+      auto const &i = f.instrs[v];
+      auto ops = f.operands_of(v);
+      if (i.op == opcode::call) {
+        return true;
+      }
+      if (ops.size() != 2) {
+        return false;
+      }
+      auto kind = f.instrs[ops[0]].type->kind;
+      switch (i.op) {
+        case opcode::pow:
+          return true;
+        case opcode::mod:
+          return kind == type_kind::float_type;
+        case opcode::add:
+          return kind == type_kind::string_type;
+        default:
+          return is_compare(i.op) && kind == type_kind::string_type;
+      }
+    }
+
+    void x86_writer::plan() {
+      auto const &f = *f_;
+      auto n = f.size();
+      block_of_.assign(n, 0);
+      pos_.assign(n, 0);
+      block_from_.assign(f.blocks.size(), 0);
+      block_to_.assign(f.blocks.size(), 0);
+      calls_.clear();
+      order_ = reverse_postorder(f.graph, 0).rpo;
+      next_.assign(f.blocks.size(), no_block);
+      for (std::size_t k = 1; k < order_.size(); k++) {
+        next_[order_[k - 1]] = order_[k];
+      }
+      std::uint32_t pos = 0;
+      for (auto b : order_) {
+        block_from_[b] = pos;
+        for (auto v : f.values_of(b)) {
+          block_of_[v] = b;
+          pos_[v] = pos;
+          pos += 2;
+        }
+        block_to_[b] = pos - 1;
+      }
+
+      live_.assign(n, false);
+      std::vector<value_id> work;
+      for (value_id v = 0; v < n; v++) {
+        auto op = f.instrs[v].op;
+        if (ir::is_terminator(op) || has_effect(op) || may_trap(f, v)) {
+          live_[v] = true;
+          work.push_back(v);
+        }
+      }
+      uses_.assign(n, 0);
+      while (!work.empty()) {
+        auto v = work.back();
+        work.pop_back();
+        for (auto op : f.operands_of(v)) {
+          uses_[op]++;
+          if (!live_[op]) {
+            live_[op] = true;
+            work.push_back(op);
+          }
+        }
+      }
+      for (value_id v = 0; v < n; v++) {
+        if (live_[v] && calls_out(v)) {
+          calls_.push_back(pos_[v]);
+        }
+      }
+      std::ranges::sort(calls_);
+
+      // a comparison of ints right before the branch on it
+      fused_.assign(n, false);
+      for (block_id b = 0; b < f.blocks.size(); b++) {
+        auto t = f.terminator(b);
+        if (f.instrs[t].op != opcode::branch) {
+          continue;
+        }
+        auto c = f.operands_of(t)[0];
+        if (c + 1 != t || uses_[c] != 1 || !is_compare(f.instrs[c].op)) {
+          continue;
+        }
+        auto kind = f.instrs[f.operands_of(c)[0]].type->kind;
+        fused_[c] = kind != type_kind::float_type &&
+                    kind != type_kind::string_type;
+      }
+    }
+
+    // Where the caller passes each parameter of the function.
+    std::vector<location> x86_writer::passed() const {
+      auto params = f_->fun->canonical->params;
+      std::vector<location> args(params.size());
+      std::size_t ints = 0, floats = 0, stacked = 0;
+      for (std::size_t k = 0; k < params.size(); k++) {
+        if (class_of(params[k]) == reg_class::xmm && floats < float_args) {
+          args[k] = location::in(xmm(floats++));
+        } else if (class_of(params[k]) != reg_class::xmm &&
+                   ints < std::size(int_args)) {
+          args[k] = location::in(int_args[ints++]);
+        } else {
+          args[k] =
+              location::at(16 + 8 * static_cast<std::int32_t>(stacked++));
+        }
+      }
+      return args;
+    }
+
+    void x86_writer::allocate() {
+      auto const &f = *f_;
+      auto n = f.size();
+      auto has_location = [&](value_id v) {
+        auto const &i = f.instrs[v];
+        return live_[v] && uses_[v] && !is_leaf(i.op) && !fused_[v] &&
+               class_of(i.type) != reg_class::none;
+      };
+
+      // the uses of each value by live instructions, bucketed
+      std::vector<std::uint32_t> first(n + 1, 0);
+      for (value_id u = 0; u < n; u++) {
+        if (live_[u]) {
+          for (auto o : f.operands_of(u)) {
+            first[o + 1]++;
+          }
+        }
+      }
+      for (value_id v = 0; v < n; v++) {
+        first[v + 1] += first[v];
+      }
+      std::vector<std::pair<value_id, std::uint32_t>> users(first[n]);
+      {
+        auto next = first;
+        for (value_id u = 0; u < n; u++) {
+          if (!live_[u]) {
+            continue;
+          }
+          auto ops = f.operands_of(u);
+          for (std::uint32_t j = 0; j < ops.size(); j++) {
+            users[next[ops[j]]++] = {u, j};
+          }
+        }
+      }
+
+      // The hull of each live range, walking from each use back to the
+      // definition through the blocks where the value is live in.
+      intervals_.clear();
+      std::vector<value_id> stamp(f.blocks.size(), ir::no_value);
+      std::vector<block_id> work;
+      for (value_id v = 0; v < n; v++) {
+        if (!has_location(v)) {
+          continue;
+        }
+        auto d = block_of_[v];
+        auto op = f.instrs[v].op;
+        interval it{op == opcode::param ? 0
+                    : op == opcode::phi ? block_from_[d]
+                                        : pos_[v],
+                    pos_[v], v};
+        auto live_in = [&](block_id b) {
+          if (b != d && stamp[b] != v) {
+            stamp[b] = v;
+            it.start = std::min(it.start, block_from_[b]);
+            work.push_back(b);
+          }
+        };
+        for (auto k = first[v]; k < first[v + 1]; k++) {
+          auto [u, j] = users[k];
+          if (f.instrs[u].op == opcode::phi) {
+            auto p = f.graph.preds(block_of_[u])[j];
+            it.end = std::max(it.end, block_to_[p]);
+            live_in(p);
+          } else {
+            it.end = std::max(it.end, pos_[fused_[u] ? u + 1 : u]);
+            live_in(block_of_[u]);
+          }
+        }
+        while (!work.empty()) {
+          auto b = work.back();
+          work.pop_back();
+          for (auto p : f.graph.preds(b)) {
+            it.end = std::max(it.end, block_to_[p]);
+            live_in(p);
+          }
+        }
+        intervals_.push_back(it);
+      }
+      std::ranges::sort(intervals_, [](interval const &a, interval const &b) {
+        return a.start < b.start || (a.start == b.start && a.value < b.value);
+      });
+
+      loc_.assign(n, location{});
+      saved_.clear();
+      slots_ = 0;
+      std::vector<bool> busy(xmm0 + 16, false);
+      std::vector<bool> used(xmm0, false);
+      // the slots given up, with where their last value ended
+      std::vector<std::pair<std::uint32_t, std::uint32_t>> free_slots;
+      std::vector<interval> active, spilled;
+      auto slot_location = [&](std::uint32_t slot) {
+        return location::at(-8 * static_cast<std::int32_t>(slot + 1));
+      };
+      // An interval that gives up its register takes a slot for all of
+      // its life, so not one that was still in use when it started.
+      auto spill = [&](interval const &it) {
+        auto slot = slots_;
+        auto reuse = std::ranges::find_if(free_slots, [&](auto const &s) {
+          return s.second <= it.start;
+        });
+        if (reuse == free_slots.end()) {
+          slots_++;
+        } else {
+          slot = reuse->first;
+          free_slots.erase(reuse);
+        }
+        loc_[it.value] = slot_location(slot);
+        spilled.push_back(it);
+      };
+      std::vector<reg> candidates, hints;
+      auto args = passed();
+      for (auto const &it : intervals_) {
+        std::erase_if(active, [&](interval const &a) {
+          if (a.end > it.start) {
+            return false;
+          }
+          busy[loc_[a.value].r] = false;
+          return true;
+        });
+        std::erase_if(spilled, [&](interval const &a) {
+          if (a.end > it.start) {
+            return false;
+          }
+          free_slots.emplace_back(
+              static_cast<std::uint32_t>(-loc_[a.value].offset / 8 - 1),
+              a.end);
+          return true;
+        });
+
+        auto call = std::ranges::upper_bound(calls_, it.start);
+        auto crosses = call != calls_.end() && *call < it.end;
+        candidates.clear();
+        if (class_of(f.instrs[it.value].type) == reg_class::xmm) {
+          for (unsigned k = 0; k < xmm_count && !crosses; k++) {
+            candidates.push_back(xmm(k));
+          }
+        } else {
+          if (!crosses) {
+            candidates.assign(std::begin(caller_saved),
+                              std::end(caller_saved));
+          }
+          candidates.insert(candidates.end(), std::begin(callee_saved),
+                            std::end(callee_saved));
+        }
+
+        // A free register is taken from, in order, the phis the value
+        // flows into, its own operands if it is a phi, where it is passed
+        // if it is a parameter, and the first operand of an operator that
+        // dies here, to save the moves in between.
+        hints.clear();
+        auto v = it.value;
+        for (auto k = first[v]; k < first[v + 1]; k++) {
+          if (auto u = users[k].first;
+              f.instrs[u].op == opcode::phi && loc_[u].is_reg()) {
+            hints.push_back(loc_[u].r);
+          }
+        }
+        auto const &i = f.instrs[v];
+        if (i.op == opcode::phi || i.op <= opcode::rshift) {
+          for (auto o : f.operands_of(v)) {
+            if (loc_[o].is_reg()) {
+              hints.push_back(loc_[o].r);
+            }
+            if (i.op != opcode::phi) {
+              break;
+            }
+          }
+        } else if (i.op == opcode::param && args[i.imm].is_reg()) {
+          hints.push_back(args[i.imm].r);
+        }
+        auto free = [&](reg c) {
+          return !busy[c] &&
+                 std::ranges::find(candidates, c) != candidates.end();
+        };
+        hints.insert(hints.end(), candidates.begin(), candidates.end());
+        auto r = std::ranges::find_if(hints, free);
+        if (r != hints.end()) {
+          loc_[it.value] = location::in(*r);
+          busy[*r] = true;
+          active.push_back(it);
+          continue;
+        }
+        // the interval ending last gives up its register, if it can take
+        // this one's
+        auto victim = active.end();
+        for (auto a = active.begin(); a != active.end(); ++a) {
+          if (std::ranges::find(candidates, loc_[a->value].r) !=
+                  candidates.end() &&
+              (victim == active.end() || a->end > victim->end)) {
+            victim = a;
+          }
+        }
+        if (victim == active.end() || victim->end <= it.end) {
+          spill(it);
+          continue;
+        }
+        loc_[it.value] = loc_[victim->value];
+        spill(*victim);
+        *victim = it;
+      }
+
+      for (value_id v = 0; v < n; v++) {
+        if (loc_[v].is_reg() && !is_xmm(loc_[v].r)) {
+          used[loc_[v].r] = true;
+        }
+      }
+      for (auto r : callee_saved) {
+        if (used[r]) {
+          saved_.push_back(r);
+        }
+      }
+      // the slots are below the saved registers
+      auto below = -8 * static_cast<std::int32_t>(saved_.size());
+      for (auto &l : loc_) {
+        if (l.is_stack()) {
+          l.offset += below;
+        }
+      }
+      auto params = f.fun->canonical->params;
+      std::size_t ints = 0, floats = 0;
+      for (auto p : params) {
+        (class_of(p) == reg_class::xmm ? floats : ints)++;
+      }
+      frame_ = slots_ || !saved_.empty() || !calls_.empty() ||
+               ints > std::size(int_args) || floats > float_args;
+    }
+
+    void x86_writer::write_prologue() {
+      if (!frame_) {
+        return;
+      }
+      ins("pushq", "%rbp");
+      ins("movq", "%rsp", "%rbp");
+      auto size = 8 * (saved_.size() + slots_);
+      size = (size + 15) & ~std::size_t{15};
+      if (size) {
+        ins("subq", '$' + std::to_string(size), "%rsp");
+      }
+      for (std::size_t k = 0; k < saved_.size(); k++) {
+        ins("movq", name(saved_[k]),
+            operand(location::at(-8 * static_cast<std::int32_t>(k + 1))));
+      }
+    }
+
+    void x86_writer::write_epilogue() {
+      for (std::size_t k = 0; k < saved_.size(); k++) {
+        ins("movq",
+            operand(location::at(-8 * static_cast<std::int32_t>(k + 1))),
+            name(saved_[k]));
+      }
+      if (frame_) {
+        ins("leave");
+      }
+      ins("ret");
+    }
+
+    void x86_writer::write_function(ir::function const &f) {
+      f_ = &f;
+      plan();
+      allocate();
+      stubs_.str({});
+      edge_labels_.clear();
+      vector_loops_.clear();
+      if (opts_.vectors != vector_isa::none) {
+        vector_loops_ = ir::plan_vector_loops(f);
+      }
+
+      auto &out = *out_;
+      auto const &fname = names_.at(f.fun);
+      out << "\n\t.text\n\t.p2align 4\n\t.type " << fname << ", @function\n"
+          << fname << ":\n";
+      write_prologue();
+
+      // the parameters from where the caller passed them
+      auto args = passed();
+      std::vector<move> moves;
+      for (value_id v = 0; v < f.size(); v++) {
+        if (f.instrs[v].op == opcode::param && loc_[v].kind !=
+                                                   location::kind::none) {
+          moves.push_back({loc_[v], args[f.instrs[v].imm]});
+        }
+      }
+      parallel_move(moves);
+
+      for (auto b : order_) {
+        out << label(b) << ":\n";
+        for (auto v : f.values_of(b)) {
+          auto op = f.instrs[v].op;
+          if (live_[v] && !is_leaf(op) && !fused_[v] && op != opcode::phi &&
+              op != opcode::param && !ir::is_terminator(op)) {
+            write_value(v);
+          }
+        }
+        write_terminator(b);
+      }
+      out << stubs_.view() << "\t.size " << fname << ", .-" << fname << '\n';
+    }
+
+    //
+    // Operands and moves
+    //
+
+    void x86_writer::ins(std::string_view op) {
+      *out_ << '\t' << op << '\n';
+    }
+
+    void x86_writer::ins(std::string_view op, std::string_view a) {
+      *out_ << '\t' << op << ' ' << a << '\n';
+    }
+
+    void x86_writer::ins(std::string_view op, std::string_view a,
+                         std::string_view b) {
+      *out_ << '\t' << op << ' ' << a << ", " << b << '\n';
+    }
+
+    void x86_writer::ins(std::string_view op, std::string_view a,
+                         std::string_view b, std::string_view c) {
+      *out_ << '\t' << op << ' ' << a << ", " << b << ", " << c << '\n';
+    }
+
+    std::string x86_writer::operand(location l) const {
+      if (l.is_reg()) {
+        return std::string{name(l.r)};
+      }
+      return std::to_string(l.offset) + "(%rbp)";
+    }
+
+    // v as the source operand of an instruction on 64 bits or a double: a
+    // register, a slot, an immediate or a constant in memory. Empty if it
+    // must be loaded into a register first.
+    std::string x86_writer::source(value_id v) {
+      auto const &i = f_->instrs[v];
+      if (!is_leaf(i.op)) {
+        return operand(loc_[v]);
+      }
+      auto bits = i.op == opcode::constant ? i.imm : 0;
+      if (i.op == opcode::function ||
+          i.type->kind == type_kind::string_type) {
+        return {};
+      }
+      if (i.type->kind == type_kind::float_type) {
+        return float_label(bits) + "(%rip)";
+      }
+      auto k = static_cast<std::int64_t>(bits);
+      return fits_int32(k) ? '$' + std::to_string(k) : std::string{};
+    }
+
+    void x86_writer::load_imm(std::uint64_t bits, reg r) {
+      auto k = static_cast<std::int64_t>(bits);
+      if (bits == 0) {
+        ins("xorl", name32(r), name32(r));
+      } else if (bits <= std::numeric_limits<std::uint32_t>::max()) {
+        ins("movl", '$' + std::to_string(bits), name32(r));
+      } else if (fits_int32(k)) {
+        ins("movq", '$' + std::to_string(k), name(r));
+      } else {
+        ins("movabsq", '$' + std::to_string(k), name(r));
+      }
+    }
+
+    void x86_writer::load(value_id v, reg r) {
+      auto const &f = *f_;
+      auto const &i = f.instrs[v];
+      if (is_leaf(i.op)) {
+        auto bits = i.op == opcode::constant ? i.imm : 0;
+        if (i.op == opcode::function) {
+          ins("leaq", names_.at(f.symbols[i.imm]) + "(%rip)", name(r));
+        } else if (i.type->kind == type_kind::string_type) {
+          auto s = i.op == opcode::constant ? f.strings[bits] : "";
+          ins("leaq", string_label(s) + "(%rip)", name(r));
+        } else if (is_xmm(r) && bits == 0) {
+          ins("xorpd", name(r), name(r));
+        } else if (is_xmm(r)) {
+          ins("movsd", float_label(bits) + "(%rip)", name(r));
+        } else {
+          load_imm(bits, r);
+        }
+        return;
+      }
+      auto l = loc_[v];
+      if (l.is_reg() && l.r == r) {
+        return;
+      }
+      if (l.is_reg()) {
+        ins(is_xmm(r) ? "movapd" : "movq", name(l.r), name(r));
+      } else {
+        ins(is_xmm(r) ? "movsd" : "movq", operand(l), name(r));
+      }
+    }
+
+    void x86_writer::store(reg r, value_id v) {
+      auto l = loc_[v];
+      if (l.kind == location::kind::none || (l.is_reg() && l.r == r)) {
+        return;
+      }
+      if (l.is_reg()) {
+        ins(is_xmm(r) ? "movapd" : "movq", name(r), name(l.r));
+      } else {
+        ins(is_xmm(r) ? "movsd" : "movq", name(r), operand(l));
+      }
+    }
+
+    reg x86_writer::in_reg(value_id v, reg scratch) {
+      if (loc_[v].is_reg()) {
+        return loc_[v].r;
+      }
+      load(v, scratch);
+      return scratch;
+    }
+
+    reg x86_writer::dest(value_id v, reg scratch) const {
+      return loc_[v].is_reg() ? loc_[v].r : scratch;
+    }
+
+    void x86_writer::emit_move(move const &m) {
+      auto const &f = *f_;
+      if (m.leaf != ir::no_value) {
+        if (m.dst.is_reg()) {
+          load(m.leaf, m.dst.r);
+          return;
+        }
+        auto const &i = f.instrs[m.leaf];
+        auto s = source(m.leaf);
+        if (class_of(i.type) == reg_class::xmm) {
+          load_imm(i.op == opcode::constant ? i.imm : 0, r11);
+          s = "%r11";
+        } else if (s.empty()) {
+          load(m.leaf, r11);
+          s = "%r11";
+        }
+        ins("movq", s, operand(m.dst));
+        return;
+      }
+      if (m.dst.is_reg() && m.src.is_reg()) {
+        auto both = is_xmm(m.dst.r) && is_xmm(m.src.r);
+        ins(both ? "movapd" : "movq", name(m.src.r), name(m.dst.r));
+      } else if (m.dst.is_reg()) {
+        ins(is_xmm(m.dst.r) ? "movsd" : "movq", operand(m.src),
+            name(m.dst.r));
+      } else if (m.src.is_reg()) {
+        ins(is_xmm(m.src.r) ? "movsd" : "movq", name(m.src.r),
+            operand(m.dst));
+      } else {
+        ins("movq", operand(m.src), "%r11");
+        ins("movq", "%r11", operand(m.dst));
+      }
+    }
+
+    // Emit moves whose destinations are distinct as if they all happened
+    // at once: each one once no other reads its destination, and when the
+    // rest form cycles, one destination is first copied aside.
+    void x86_writer::parallel_move(std::vector<move> &moves) {
+      std::erase_if(moves, [](move const &m) {
+        return m.leaf == ir::no_value && m.dst == m.src;
+      });
+      auto read = [&](location l) {
+        return std::ranges::any_of(moves, [&](move const &m) {
+          return m.leaf == ir::no_value && m.src == l;
+        });
+      };
+      while (!moves.empty()) {
+        auto progress = false;
+        for (std::size_t k = 0; k < moves.size();) {
+          if (read(moves[k].dst)) {
+            k++;
+            continue;
+          }
+          emit_move(moves[k]);
+          moves.erase(moves.begin() + static_cast<std::ptrdiff_t>(k));
+          progress = true;
+        }
+        if (!progress) {
+          auto blocked = moves.front().dst;
+          auto temp = location::in(
+              blocked.is_reg() && is_xmm(blocked.r) ? xmm15 : rax);
+          emit_move({temp, blocked});
+          for (auto &m : moves) {
+            if (m.leaf == ir::no_value && m.src == blocked) {
+              m.src = temp;
+            }
+          }
+        }
+      }
+    }
+
+    //
+    // Instruction selection
+    //
+
+    void x86_writer::write_value(value_id v) {
+      auto const &f = *f_;
+      auto const &i = f.instrs[v];
+      auto ops = f.operands_of(v);
+      auto kind = ops.empty() ? type_kind::void_type
+                              : f.instrs[ops[0]].type->kind;
+      auto is_float = kind == type_kind::float_type;
+      auto result = [&](reg r) {
+        store(r, v);
+      };
+      switch (i.op) {
+        case opcode::pos: {
+          auto r = dest(v, is_float ? xmm15 : rax);
+          load(ops[0], r);
+          result(r);
+          break;
+        }
+        case opcode::neg:
+          if (is_float) {
+            auto r = dest(v, xmm15);
+            load(ops[0], r);
+            ins("xorpd", ".Lsoda_sign(%rip)", name(r));
+            result(r);
+          } else {
+            unary(v, "negq");
+          }
+          break;
+        case opcode::bit_not:
+          unary(v, "notq");
+          break;
+        case opcode::log_not: {
+          auto r = dest(v, rax);
+          load(ops[0], r);
+          ins("xorl", "$1", name32(r));
+          result(r);
+          break;
+        }
+        case opcode::add:
+          if (kind == type_kind::string_type) {
+            call_runtime("soda_str_cat", ops);
+            result(rax);
+          } else if (is_float) {
+            float_binary(v, "addsd");
+          } else {
+            int_binary(v, "addq", true);
+          }
+          break;
+        case opcode::sub:
+          if (is_float) {
+            float_binary(v, "subsd");
+          } else {
+            int_binary(v, "subq", false);
+          }
+          break;
+        case opcode::mul:
+          if (is_float) {
+            float_binary(v, "mulsd");
+          } else {
+            int_binary(v, "imulq", true);
+          }
+          break;
+        case opcode::div:
+          if (is_float) {
+            float_binary(v, "divsd");
+          } else {
+            divide(v, false);
+          }
+          break;
+        case opcode::mod:
+          if (is_float) {
+            call_runtime("fmod@PLT", ops);
+            result(xmm0);
+          } else {
+            divide(v, true);
+          }
+          break;
+        case opcode::pow:
+          if (is_float) {
+            call_runtime("pow@PLT", ops);
+            result(xmm0);
+          } else {
+            call_runtime("soda_pow", ops);
+            result(rax);
+          }
+          break;
+        case opcode::bit_and:
+          int_binary(v, "andq", true);
+          break;
+        case opcode::bit_xor:
+          int_binary(v, "xorq", true);
+          break;
+        case opcode::bit_or:
+          int_binary(v, "orq", true);
+          break;
+        case opcode::lt:
+        case opcode::gt:
+        case opcode::le:
+        case opcode::ge:
+        case opcode::eq:
+        case opcode::ne:
+          compare(v);
+          break;
+        case opcode::lshift:
+          shift(v, "shlq");
+          break;
+        case opcode::rshift:
+          shift(v, "sarq");
+          break;
+        case opcode::mul_high: {
+          load(ops[0], rax);
+          auto s = source(ops[1]);
+          if (s.empty() || s.front() == '$') {
+            load(ops[1], r11);
+            s = "%r11";
+          }
+          ins("imulq", s);
+          result(rdx);
+          break;
+        }
+        case opcode::index:
+          index(v);
+          break;
+        case opcode::length: {
+          auto r = dest(v, rax);
+          load(ops[0], r);
+          auto l = '(' + std::string{name(r)} + ')';
+          if (kind == type_kind::string_type) {
+            ins("movq", l, name(r));
+          } else {
+            // null is the empty array
+            auto done = new_label();
+            ins("testq", name(r), name(r));
+            ins("jz", done);
+            ins("movq", l, name(r));
+            *out_ << done << ":\n";
+          }
+          result(r);
+          break;
+        }
+        case opcode::load_global: {
+          auto g = names_.at(f.symbols[i.imm]) + "(%rip)";
+          auto r = class_of(i.type) == reg_class::xmm ? dest(v, xmm15)
+                                                      : dest(v, rax);
+          ins(is_xmm(r) ? "movsd" : "movq", g, name(r));
+          result(r);
+          break;
+        }
+        case opcode::store_global: {
+          auto g = names_.at(f.symbols[i.imm]) + "(%rip)";
+          if (is_float) {
+            ins("movsd", name(in_reg(ops[0], xmm15)), g);
+            break;
+          }
+          auto s = source(ops[0]);
+          if (s.empty() || loc_[ops[0]].is_stack()) {
+            load(ops[0], rax);
+            s = "%rax";
+          }
+          ins("movq", s, g);
+          break;
+        }
+        case opcode::store_index:
+          store_index(v);
+          break;
+        case opcode::call:
+          call(v);
+          break;
+        default:
+          unreachable();
+      }
+    }
+
+    void x86_writer::int_binary(value_id v, std::string_view op,
+                                bool commutative) {
+      auto ops = f_->operands_of(v);
+      auto a = ops[0], b = ops[1];
+      auto d = loc_[v];
+      if (commutative && d.is_reg() && loc_[b] == d) {
+        std::swap(a, b);
+      }
+      // an addition into a register of its own
+      if (op == "addq" && d.is_reg() && loc_[a].is_reg() && loc_[a] != d) {
+        auto s = source(b);
+        if (!s.empty() && s.front() == '$') {
+          ins("leaq", s.substr(1) + '(' + std::string{name(loc_[a].r)} + ')',
+              name(d.r));
+          return;
+        }
+        if (loc_[b].is_reg() && loc_[b] != d) {
+          ins("leaq",
+              '(' + std::string{name(loc_[a].r)} + ", " +
+                  std::string{name(loc_[b].r)} + ')',
+              name(d.r));
+          return;
+        }
+      }
+      auto r = d.is_reg() && loc_[b] != d ? d.r : rax;
+      load(a, r);
+      auto s = source(b);
+      if (s.empty()) {
+        load(b, r11);
+        s = "%r11";
+      }
+      ins(op, s, name(r));
+      store(r, v);
+    }
+
+    void x86_writer::float_binary(value_id v, std::string_view op) {
+      auto ops = f_->operands_of(v);
+      auto d = loc_[v];
+      auto r = d.is_reg() && loc_[ops[1]] != d ? d.r : xmm15;
+      load(ops[0], r);
+      ins(op, source(ops[1]), name(r));
+      store(r, v);
+    }
+
+    void x86_writer::unary(value_id v, std::string_view op) {
+      auto r = dest(v, rax);
+      load(f_->operands_of(v)[0], r);
+      ins(op, name(r));
+      store(r, v);
+    }
+
+    // Division and remainder of ints, trapping on a zero divisor and on
+    // the smallest int divided by -1, which is its own negation and 0.
+    void x86_writer::divide(value_id v, bool remainder) {
+      auto const &f = *f_;
+      auto ops = f.operands_of(v);
+      load(ops[0], rax);
+      auto d = in_reg(ops[1], r11);
+      auto const &divisor = f.instrs[ops[1]];
+      auto safe = divisor.op == opcode::constant && int_value(divisor) != 0 &&
+                  int_value(divisor) != -1;
+      std::string divide, done;
+      if (!safe) {
+        divide = new_label();
+        done = new_label();
+        ins("testq", name(d), name(d));
+        ins("jz", "soda_fail_div0");
+        ins("cmpq", "$-1", name(d));
+        ins("jne", divide);
+        ins("negq", "%rax");
+        ins("jo", "soda_fail_overflow");
+        if (remainder) {
+          ins("xorl", "%edx", "%edx");
+        }
+        ins("jmp", done);
+        *out_ << divide << ":\n";
+      }
+      ins("cqto");
+      ins("idivq", name(d));
+      if (!safe) {
+        *out_ << done << ":\n";
+      }
+      store(remainder ? rdx : rax, v);
+    }
+
+    void x86_writer::shift(value_id v, std::string_view op) {
+      auto const &f = *f_;
+      auto ops = f.operands_of(v);
+      auto const &count = f.instrs[ops[1]];
+      if (count.op == opcode::constant && count.imm < 64) {
+        auto r = dest(v, rax);
+        load(ops[0], r);
+        ins(op, '$' + std::to_string(count.imm), name(r));
+        store(r, v);
+        return;
+      }
+      load(ops[1], rcx);
+      ins("cmpq", "$63", "%rcx");
+      ins("ja", "soda_fail_shift");
+      auto r = dest(v, rax);
+      load(ops[0], r);
+      ins(op, "%cl", name(r));
+      store(r, v);
+    }
+
+    // Set the flags for op on the ints a and b, returning the condition
+    // code to test.
+    std::string_view x86_writer::compare_ints(value_id a, value_id b,
+                                              opcode op) {
+      auto constant = [&](value_id v) { return is_leaf(f_->instrs[v].op); };
+      if (constant(a) && !constant(b)) {
+        std::swap(a, b);
+        op = mirror(op);
+      }
+      auto lhs = constant(a) ? std::string{} : operand(loc_[a]);
+      auto rhs = source(b);
+      if (rhs.empty()) {
+        load(b, r11);
+        rhs = "%r11";
+      }
+      if (lhs.empty() || (loc_[a].is_stack() && loc_[b].is_stack())) {
+        load(a, rax);
+        lhs = "%rax";
+      }
+      if (rhs == "$0" && loc_[a].is_reg()) {
+        ins("testq", lhs, lhs);
+      } else {
+        ins("cmpq", rhs, lhs);
+      }
+      return condition(op);
+    }
+
+    // Set al to op on the floats a and b, which is false if either is a
+    // NaN, except for ne.
+    void x86_writer::compare_floats(value_id a, value_id b, opcode op) {
+      switch (op) {
+        case opcode::lt:
+        case opcode::le:
+          ins("ucomisd", source(a), name(in_reg(b, xmm15)));
+          ins(op == opcode::lt ? "seta" : "setae", "%al");
+          break;
+        case opcode::gt:
+        case opcode::ge:
+          ins("ucomisd", source(b), name(in_reg(a, xmm15)));
+          ins(op == opcode::gt ? "seta" : "setae", "%al");
+          break;
+        case opcode::eq:
+          ins("ucomisd", source(b), name(in_reg(a, xmm15)));
+          ins("sete", "%al");
+          ins("setnp", "%cl");
+          ins("andb", "%cl", "%al");
+          break;
+        case opcode::ne:
+          ins("ucomisd", source(b), name(in_reg(a, xmm15)));
+          ins("setne", "%al");
+          ins("setp", "%cl");
+          ins("orb", "%cl", "%al");
+          break;
+        default:
+          unreachable();
+      }
+    }
+
+    void x86_writer::compare(value_id v) {
+      auto const &f = *f_;
+      auto op = f.instrs[v].op;
+      auto ops = f.operands_of(v);
+      switch (f.instrs[ops[0]].type->kind) {
+        case type_kind::string_type:
+          if (op == opcode::eq || op == opcode::ne) {
+            call_runtime("soda_str_eq", ops);
+            if (op == opcode::ne) {
+              ins("xorl", "$1", "%eax");
+            }
+            store(rax, v);
+            return;
+          }
+          call_runtime("soda_str_cmp", ops);
+          ins("testq", "%rax", "%rax");
+          ins("set" + std::string{condition(op)}, "%al");
+          break;
+        case type_kind::float_type:
+          compare_floats(ops[0], ops[1], op);
+          break;
+        default:
+          ins("set" + std::string{compare_ints(ops[0], ops[1], op)}, "%al");
+          break;
+      }
+      ins("movzbl", "%al", "%eax");
+      store(rax, v);
+    }
+
+    // The element at an index, after checking it against the length, and
+    // that the array is not null, unless it is known to be in bounds.
+    void x86_writer::index(value_id v) {
+      auto const &f = *f_;
+      auto ops = f.operands_of(v);
+      auto a = name(in_reg(ops[0], r11));
+      auto i = name(in_reg(ops[1], rax));
+      auto is_string = f.instrs[ops[0]].type->kind == type_kind::string_type;
+      if (!is_string && !f.instrs[v].imm) {
+        ins("testq", a, a);
+        ins("jz", "soda_fail_index");
+      }
+      if (!f.instrs[v].imm) {
+        ins("cmpq", '(' + std::string{a} + ')', i);
+        ins("jae", "soda_fail_index");
+      }
+      ins("movq", "8(" + std::string{a} + ')', "%r11");
+      if (is_string) {
+        ins("movzbl", "(%r11, " + std::string{i} + ')', "%eax");
+        store(rax, v);
+        return;
+      }
+      auto element = "(%r11, " + std::string{i} + ", 8)";
+      auto r = class_of(f.instrs[v].type) == reg_class::xmm ? dest(v, xmm15)
+                                                            : dest(v, rax);
+      ins(is_xmm(r) ? "movsd" : "movq", element, name(r));
+      store(r, v);
+    }
+
+    void x86_writer::store_index(value_id v) {
+      auto const &f = *f_;
+      auto ops = f.operands_of(v);
+      auto a = name(in_reg(ops[0], r11));
+      auto i = name(in_reg(ops[1], rax));
+      ins("testq", a, a);
+      ins("jz", "soda_fail_index");
+      ins("cmpq", '(' + std::string{a} + ')', i);
+      ins("jae", "soda_fail_index");
+      ins("movq", "8(" + std::string{a} + ')', "%r11");
+      auto element = "(%r11, " + std::string{i} + ", 8)";
+      if (class_of(f.instrs[ops[2]].type) == reg_class::xmm) {
+        ins("movsd", name(in_reg(ops[2], xmm15)), element);
+        return;
+      }
+      auto s = source(ops[2]);
+      if (s.empty() || loc_[ops[2]].is_stack()) {
+        load(ops[2], rdx);
+        s = "%rdx";
+      }
+      ins("movq", s, element);
+    }
+
+    // Call a routine with the arguments in registers.
+    void x86_writer::call_runtime(std::string_view callee,
+                                  std::span<value_id const> args) {
+      std::vector<move> moves;
+      unsigned ints = 0, floats = 0;
+      for (auto a : args) {
+        auto to = class_of(f_->instrs[a].type) == reg_class::xmm
+                      ? location::in(xmm(floats++))
+                      : location::in(int_args[ints++]);
+        if (is_leaf(f_->instrs[a].op)) {
+          moves.push_back({to, {}, a});
+        } else {
+          moves.push_back({to, loc_[a]});
+        }
+      }
+      parallel_move(moves);
+      ins("call", callee);
+    }
+
+    void x86_writer::call(value_id v) {
+      auto const &f = *f_;
+      auto ops = f.operands_of(v);
+      auto callee = ops[0];
+      auto args = ops.subspan(1);
+      auto direct = f.instrs[callee].op == opcode::function;
+
+      std::vector<move> moves;
+      std::vector<value_id> stacked;
+      unsigned ints = 0, floats = 0;
+      for (auto a : args) {
+        location to;
+        if (class_of(f.instrs[a].type) == reg_class::xmm) {
+          if (floats == float_args) {
+            stacked.push_back(a);
+            continue;
+          }
+          to = location::in(xmm(floats++));
+        } else {
+          if (ints == std::size(int_args)) {
+            stacked.push_back(a);
+            continue;
+          }
+          to = location::in(int_args[ints++]);
+        }
+        if (is_leaf(f.instrs[a].op)) {
+          moves.push_back({to, {}, a});
+        } else {
+          moves.push_back({to, loc_[a]});
+        }
+      }
+      if (!direct) {
+        moves.push_back({location::in(r10), loc_[callee]});
+      }
+
+      // the arguments on the stack, keeping it aligned to 16 bytes
+      auto pad = stacked.size() % 2 ? 8 : 0;
+      if (pad) {
+        ins("subq", "$8", "%rsp");
+      }
+      for (auto a = stacked.rbegin(); a != stacked.rend(); ++a) {
+        auto s = source(*a);
+        if (s.empty() || (loc_[*a].is_reg() && is_xmm(loc_[*a].r))) {
+          if (loc_[*a].is_reg()) {
+            ins("movq", name(loc_[*a].r), "%r11");
+          } else {
+            load(*a, r11);
+          }
+          s = "%r11";
+        }
+        ins("pushq", s);
+      }
+      parallel_move(moves);
+      if (direct) {
+        ins("call", names_.at(f.symbols[f.instrs[callee].imm]));
+      } else {
+        ins("call", "*%r10");
+      }
+      if (auto bytes = 8 * stacked.size() + pad) {
+        ins("addq", '$' + std::to_string(bytes), "%rsp");
+      }
+      store(class_of(f.instrs[v].type) == reg_class::xmm ? xmm0 : rax, v);
+    }
+
+    //
+    // Control flow
+    //
+
+    // The moves on the edge to the kth successor of b.
+    void x86_writer::edge_moves(block_id b, std::size_t k,
+                                std::vector<move> &moves) {
+      auto const &f = *f_;
+      auto s = f.graph.succs(b)[k];
+      auto j = edge_index(f, b, k);
+      moves.clear();
+      for (auto v : f.values_of(s)) {
+        if (f.instrs[v].op != opcode::phi) {
+          break;
+        }
+        auto value = f.operands_of(v)[j];
+        if (loc_[v].kind == location::kind::none || value == v) {
+          continue;
+        }
+        if (is_leaf(f.instrs[value].op)) {
+          moves.push_back({loc_[v], {}, value});
+        } else {
+          moves.push_back({loc_[v], loc_[value]});
+        }
+      }
+    }
+
+    // The label to jump to for the edge to the kth successor of b: its
+    // block, or a stub with its moves.
+    std::string x86_writer::edge_target(block_id b, std::size_t k) {
+      auto key = std::uint64_t{b} << 32 | k;
+      if (auto it = edge_labels_.find(key); it != edge_labels_.end()) {
+        return it->second;
+      }
+      std::vector<move> moves;
+      edge_moves(b, k, moves);
+      auto s = f_->graph.succs(b)[k];
+      if (moves.empty()) {
+        return edge_labels_[key] = label(s);
+      }
+      auto stub = label(b) + '_' + std::to_string(k);
+      auto out = out_;
+      out_ = &stubs_;
+      stubs_ << stub << ":\n";
+      parallel_move(moves);
+      ins("jmp", label(s));
+      out_ = out;
+      return edge_labels_[key] = stub;
+    }
+
+    // The edge to the kth successor of b, from the end of b, running the
+    // vector iterations of a loop it enters once its phis are set.
+    void x86_writer::write_edge(block_id b, std::size_t k) {
+      std::vector<move> moves;
+      edge_moves(b, k, moves);
+      parallel_move(moves);
+      if (auto it = std::ranges::find(vector_loops_, b,
+                                      &ir::vector_loop::preheader);
+          it != vector_loops_.end()) {
+        write_vector_loop(*it);
+      }
+      if (auto s = f_->graph.succs(b)[k]; s != next_[b]) {
+        ins("jmp", label(s));
+      }
+    }
+
+    void x86_writer::write_terminator(block_id b) {
+      auto const &f = *f_;
+      auto t = f.terminator(b);
+      auto ops = f.operands_of(t);
+      auto succs = f.graph.succs(b);
+      switch (f.instrs[t].op) {
+        case opcode::jump:
+          write_edge(b, 0);
+          break;
+        case opcode::branch: {
+          auto c = ops[0];
+          auto const &cond = f.instrs[c];
+          if (is_leaf(cond.op)) {
+            write_edge(b, cond.op == opcode::constant && cond.imm ? 0 : 1);
+            break;
+          }
+          std::string_view cc = "ne";
+          if (fused_[c]) {
+            auto cops = f.operands_of(c);
+            cc = compare_ints(cops[0], cops[1], cond.op);
+          } else if (loc_[c].is_reg()) {
+            ins("testq", name(loc_[c].r), name(loc_[c].r));
+          } else {
+            ins("cmpq", "$0", operand(loc_[c]));
+          }
+          // fall through to the first successor when it is next
+          std::vector<move> moves;
+          edge_moves(b, 0, moves);
+          if (succs[0] == next_[b] && succs[1] != next_[b] &&
+              moves.empty()) {
+            ins("j" + std::string{inverse(cc)}, edge_target(b, 1));
+            break;
+          }
+          ins("j" + std::string{cc}, edge_target(b, 0));
+          write_edge(b, 1);
+          break;
+        }
+        case opcode::switch_:
+          write_switch(b);
+          break;
+        case opcode::ret:
+          if (!ops.empty()) {
+            load(ops[0],
+                 class_of(f.instrs[ops[0]].type) == reg_class::xmm ? xmm0
+                                                                   : rax);
+          }
+          write_epilogue();
+          break;
+        default:
+          unreachable();
+      }
+    }
+
+    void x86_writer::compare_imm(std::int64_t k, reg r) {
+      if (fits_int32(k)) {
+        ins("cmpq", '$' + std::to_string(k), name(r));
+      } else {
+        ins("movabsq", '$' + std::to_string(k), "%rdx");
+        ins("cmpq", "%rdx", name(r));
+      }
+    }
+
+    // A switch with its value in rax, through the clusters of its plan if
+    // the case values are constant, otherwise comparing with each in turn.
+    void x86_writer::write_switch(block_id b) {
+      auto const &f = *f_;
+      auto t = f.terminator(b);
+      auto ops = f.operands_of(t);
+      auto fallback = f.graph.succs(b).size() - 1;
+      load(ops[0], rax);
+      ir::switch_plan plan;
+      if (ir::plan_switch(f, b, plan) && !plan.clusters.empty()) {
+        search(b, plan, 0, plan.clusters.size(), false);
+        return;
+      }
+      for (std::size_t k = 0; k < fallback; k++) {
+        auto s = source(ops[k + 1]);
+        if (s.empty()) {
+          load(ops[k + 1], r11);
+          s = "%r11";
+        }
+        ins("cmpq", s, "%rax");
+        ins("je", edge_target(b, k));
+      }
+      write_edge(b, fallback);
+    }
+
+    // The binary search over the clusters from lo to hi. When compared,
+    // the flags are still those of comparing with the low value of lo.
+    void x86_writer::search(block_id b, ir::switch_plan const &plan,
+                            std::size_t lo, std::size_t hi, bool compared) {
+      if (hi - lo == 1) {
+        write_cluster(b, plan, plan.clusters[lo], compared);
+        return;
+      }
+      auto mid = lo + (hi - lo) / 2;
+      auto left = new_label();
+      compare_imm(plan.clusters[mid].low, rax);
+      ins("jl", left);
+      search(b, plan, mid, hi, true);
+      *out_ << left << ":\n";
+      search(b, plan, lo, mid, false);
+    }
+
+    void x86_writer::write_cluster(block_id b, ir::switch_plan const &plan,
+                                   ir::switch_cluster const &c,
+                                   bool compared) {
+      auto fallback = edge_target(b, plan.fallback);
+      if (c.kind == ir::cluster_kind::range && c.low == c.high) {
+        if (!compared) {
+          compare_imm(c.low, rax);
+        }
+        ins("je", edge_target(b, c.first));
+        ins("jmp", fallback);
+        return;
+      }
+      // the offset from the low value, unsigned, so that one comparison
+      // checks both ends
+      auto span = static_cast<std::int64_t>(static_cast<std::uint64_t>(c.high) -
+                                            static_cast<std::uint64_t>(c.low));
+      ins("movq", "%rax", "%r11");
+      if (fits_int32(c.low)) {
+        ins("subq", '$' + std::to_string(c.low), "%r11");
+      } else {
+        ins("movabsq", '$' + std::to_string(c.low), "%rdx");
+        ins("subq", "%rdx", "%r11");
+      }
+      compare_imm(span, r11);
+      switch (c.kind) {
+        case ir::cluster_kind::range:
+          ins("jbe", edge_target(b, c.first));
+          ins("jmp", fallback);
+          break;
+        case ir::cluster_kind::table: {
+          ins("ja", fallback);
+          auto table = new_label();
+          rodata_ << "\t.p2align 2\n" << table << ":\n";
+          for (std::int64_t k = 0; k <= span; k++) {
+            rodata_ << "\t.long " << edge_target(b, plan.table[c.first + k])
+                    << " - " << table << '\n';
+          }
+          ins("leaq", table + "(%rip)", "%rdx");
+          ins("movslq", "(%rdx, %r11, 4)", "%r11");
+          ins("addq", "%rdx", "%r11");
+          ins("jmp", "*%r11");
+          break;
+        }
+        case ir::cluster_kind::bits:
+          ins("ja", fallback);
+          for (auto k = c.first; k < c.first + c.count; k++) {
+            load_imm(plan.tests[k].mask, rdx);
+            ins("btq", "%r11", "%rdx");
+            ins("jc", edge_target(b, plan.tests[k].target));
+          }
+          ins("jmp", fallback);
+          break;
+      }
+    }
+
+    //
+    // Vector loops
+    //
+
+    // The iterations of a vectorized loop that fill whole vectors, on the
+    // edge from its preheader: with AVX2 if the processor has it and SSE2
+    // otherwise, or as the options say, where that pays off. Left out if a
+    // reduction's phi is not used, so has no location, or the registers
+    // run out.
+    void x86_writer::write_vector_loop(ir::vector_loop const &loop) {
+      auto const &f = *f_;
+      if (std::ranges::any_of(loop.reductions, [&](ir::reduction const &r) {
+            return loc_[r.phi].kind == location::kind::none;
+          })) {
+        return;
+      }
+      auto done = new_label();
+      auto narrow = pays_off(f, loop, 2);
+      if (opts_.vectors == vector_isa::sse2) {
+        if (narrow && vector_iterations(loop, false, done)) {
+          *out_ << done << ":\n";
+        }
+        return;
+      }
+      if (!pays_off(f, loop, 4)) {
+        return;
+      }
+      std::ostringstream code;
+      auto out = out_;
+      out_ = &code;
+      auto other = narrow ? new_label() : done;
+      ins("cmpb", "$0", ".Lsoda_avx2(%rip)");
+      ins("je", other);
+      auto written = vector_iterations(loop, true, done);
+      if (narrow) {
+        ins("jmp", done);
+        *out_ << other << ":\n";
+        written = written && vector_iterations(loop, false, done);
+      }
+      *out_ << done << ":\n";
+      out_ = out;
+      if (written) {
+        *out_ << code.view();
+        avx2_ = true;
+      }
+    }
+
+    // Runs the iterations of loop a vector at a time, two lanes to an SSE2
+    // register or, if wide, four to an AVX2 register, while a whole vector
+    // of them is left, then moves its phis on past them, or jumps to skip
+    // if there are none. Every value an iteration needs has a register of
+    // lanes: those the loop does not change are broadcast before it, an
+    // induction variable starts at its value plus the lane times its step,
+    // and a reduction starts with its identity in every lane. Returns
+    // false, having written nothing, if the registers run out.
+    bool x86_writer::vector_iterations(ir::vector_loop const &loop,
+                                       bool wide, std::string const &skip) {
+      auto const &f = *f_;
+      std::int64_t width = wide ? 4 : 2;
+      // the vector registers holding no float where the loop is entered,
+      // the first last
+      auto at = block_to_[loop.preheader];
+      std::vector<reg> free;
+      for (auto k = xmm0 + 16; k-- > xmm0;) {
+        if (std::ranges::none_of(intervals_, [&](interval const &it) {
+              return it.start <= at && at <= it.end &&
+                     loc_[it.value] == location::in(static_cast<reg>(k));
+            })) {
+          free.push_back(static_cast<reg>(k));
+        }
+      }
+      bool ok = true;
+      auto take = [&] {
+        if (free.empty()) {
+          ok = false;
+          return xmm15;
+        }
+        auto r = free.back();
+        free.pop_back();
+        return r;
+      };
+      auto vec = [&](reg r) {
+        std::string s{name(r)};
+        if (wide) {
+          s[1] = 'y';
+        }
+        return s;
+      };
+      // d = a op b, where without VEX d must be a or not b
+      auto binary = [&](std::string_view op, std::string_view b, reg a,
+                        reg d) {
+        if (wide) {
+          ins('v' + std::string{op}, b, vec(a), vec(d));
+          return;
+        }
+        if (a != d) {
+          ins("movdqa", name(a), name(d));
+        }
+        ins(op, b, name(d));
+      };
+      // every lane of d = r
+      auto broadcast = [&](reg r, reg d) {
+        if (wide) {
+          ins("vmovq", name(r), name(d));
+          ins("vpbroadcastq", name(d), vec(d));
+        } else {
+          ins("movq", name(r), name(d));
+          ins("punpcklqdq", name(d), name(d));
+        }
+      };
+      auto lane_op = [](opcode op) -> std::string_view {
+        switch (op) {
+          case opcode::bit_and:
+            return "pand";
+          case opcode::bit_or:
+            return "por";
+          case opcode::bit_xor:
+            return "pxor";
+          case opcode::sub:
+            return "psubq";
+          default:
+            return "paddq";
+        }
+      };
+      auto computed = [&](value_id v) {
+        return std::ranges::find(loop.values, v) != loop.values.end();
+      };
+
+      std::ostringstream code;
+      auto out = out_;
+      out_ = &code;
+      // the iterations left, rounded down to whole vectors, in rax to
+      // count down and in r11 for the phis
+      load(loop.bound, rax);
+      auto counter = name(in_reg(loop.counter, rcx));
+      ins("cmpq", "%rax", counter);
+      ins("jge", skip);
+      ins("subq", counter, "%rax");
+      ins("andq", '$' + std::to_string(-width), "%rax");
+      ins("jz", skip);
+      ins("movq", "%rax", "%r11");
+
+      std::unordered_map<value_id, reg> lanes;
+      std::unordered_map<std::uint64_t, reg> constants;
+      std::unordered_map<std::int64_t, reg> steps;
+      auto set_up = [&](value_id v) {
+        auto const &i = f.instrs[v];
+        if (lanes.contains(v) || computed(v)) {
+          return;
+        }
+        if (i.op == opcode::constant && constants.contains(i.imm)) {
+          lanes[v] = constants[i.imm];
+          return;
+        }
+        auto r = take();
+        lanes[v] = r;
+        broadcast(in_reg(v, rdx), r);
+        if (i.op == opcode::constant) {
+          constants[i.imm] = r;
+        }
+        auto iv = std::ranges::find(loop.ivs, v,
+                                    &ir::induction_variable::phi);
+        if (iv == loop.ivs.end()) {
+          return;
+        }
+        binary("paddq", lanes_label(iv->step) + "(%rip)", r, r);
+        if (!steps.contains(iv->step)) {
+          auto s = take();
+          steps[iv->step] = s;
+          load_imm(static_cast<std::uint64_t>(iv->step) * width, rdx);
+          broadcast(rdx, s);
+        }
+      };
+      // the last use of each value computed in an iteration
+      std::unordered_map<value_id, std::size_t> last;
+      for (std::size_t k = 0; k < loop.values.size(); k++) {
+        auto v = loop.values[k];
+        auto ops = f.operands_of(v);
+        set_up(ops[0]);
+        last[ops[0]] = k;
+        if (ops.size() > 1 && f.instrs[v].op != opcode::lshift) {
+          set_up(ops[1]);
+          last[ops[1]] = k;
+        }
+      }
+      std::vector<reg> sums;
+      for (auto const &r : loop.reductions) {
+        set_up(r.input);
+        last[r.input] = loop.values.size();
+        sums.push_back(take());
+        binary(r.op == opcode::bit_and ? "pcmpeqd" : "pxor", vec(sums.back()),
+               sums.back(), sums.back());
+      }
+      // for the reductions across the lanes at the end
+      auto spare = take();
+
+      auto head = new_label();
+      ins(".p2align", "4");
+      *out_ << head << ":\n";
+      for (std::size_t k = 0; k < loop.values.size() && ok; k++) {
+        auto v = loop.values[k];
+        auto ops = f.operands_of(v);
+        auto op = f.instrs[v].op;
+        auto d = take();
+        auto a = lanes[ops[0]];
+        switch (op) {
+          case opcode::neg:
+            binary("pxor", vec(d), d, d);
+            binary("psubq", vec(a), d, d);
+            break;
+          case opcode::bit_not:
+            binary("pcmpeqd", vec(d), d, d);
+            binary("pxor", vec(a), d, d);
+            break;
+          case opcode::lshift:
+            binary("psllq", '$' + std::to_string(f.instrs[ops[1]].imm), a,
+                   d);
+            break;
+          case opcode::mul: {
+            // the low halves multiplied, plus the products of each high
+            // half with the other low half shifted up, which are the same
+            // for a square
+            auto b = lanes[ops[1]];
+            auto half = is_half(f, ops[1]);
+            if (!half && is_half(f, ops[0])) {
+              std::swap(a, b);
+              half = true;
+            }
+            auto t = take();
+            binary("psrlq", "$32", a, t);
+            binary("pmuludq", vec(b), t, t);
+            if (ops[0] == ops[1]) {
+              binary("paddq", vec(t), t, t);
+            } else if (!half) {
+              auto u = take();
+              binary("psrlq", "$32", b, u);
+              binary("pmuludq", vec(a), u, u);
+              binary("paddq", vec(u), t, t);
+              free.push_back(u);
+            }
+            binary("psllq", "$32", t, t);
+            binary("pmuludq", vec(b), a, d);
+            binary("paddq", vec(t), d, d);
+            free.push_back(t);
+            break;
+          }
+          default:
+            binary(lane_op(op), vec(lanes[ops[1]]), a, d);
+            break;
+        }
+        lanes[v] = d;
+        for (std::size_t j = 0; j < ops.size(); j++) {
+          if (computed(ops[j]) && last[ops[j]] == k &&
+              (j == 0 || ops[j] != ops[0])) {
+            free.push_back(lanes[ops[j]]);
+          }
+        }
+      }
+      for (std::size_t k = 0; k < sums.size(); k++) {
+        auto const &r = loop.reductions[k];
+        binary(lane_op(r.op == opcode::sub ? opcode::add : r.op),
+               vec(lanes[r.input]), sums[k], sums[k]);
+      }
+      for (auto const &iv : loop.ivs) {
+        if (lanes.contains(iv.phi)) {
+          binary("paddq", vec(steps[iv.step]), lanes[iv.phi],
+                 lanes[iv.phi]);
+        }
+      }
+      ins("subq", '$' + std::to_string(width), "%rax");
+      ins("jnz", head);
+
+      for (auto const &iv : loop.ivs) {
+        if (loc_[iv.phi].kind == location::kind::none) {
+          continue;
+        }
+        if (iv.step == 1) {
+          ins("addq", "%r11", operand(loc_[iv.phi]));
+          continue;
+        }
+        if (fits_int32(iv.step)) {
+          ins("imulq", '$' + std::to_string(iv.step), "%r11", "%rdx");
+        } else {
+          load_imm(static_cast<std::uint64_t>(iv.step), rdx);
+          ins("imulq", "%r11", "%rdx");
+        }
+        ins("addq", "%rdx", operand(loc_[iv.phi]));
+      }
+      for (std::size_t k = 0; k < sums.size(); k++) {
+        auto const &r = loop.reductions[k];
+        auto a = sums[k];
+        auto op = lane_op(r.op == opcode::sub ? opcode::add : r.op);
+        if (wide) {
+          ins("vextracti128", "$1", vec(a), name(spare));
+          ins('v' + std::string{op}, name(spare), name(a), name(a));
+          ins("vpshufd", "$0x4e", name(a), name(spare));
+          ins('v' + std::string{op}, name(spare), name(a), name(a));
+          ins("vmovq", name(a), "%rdx");
+        } else {
+          ins("pshufd", "$0x4e", name(a), name(spare));
+          ins(op, name(spare), name(a));
+          ins("movq", name(a), "%rdx");
+        }
+        auto scalar = r.op == opcode::bit_and  ? "andq"
+                      : r.op == opcode::bit_or  ? "orq"
+                      : r.op == opcode::bit_xor ? "xorq"
+                      : r.op == opcode::sub     ? "subq"
+                                                : "addq";
+        ins(scalar, "%rdx", operand(loc_[r.phi]));
+      }
+      if (wide) {
+        ins("vzeroupper");
+      }
+      out_ = out;
+      if (ok) {
+        *out_ << code.view();
+      }
+      return ok;
+    }
+
+  } // namespace
+
+  bool emit_x86(std::ostream &out, ast::program const &prog,
+                std::span<ir::function const> funs, diagnostics &diags,
+                x86_options const &opts) {
+    return x86_writer{prog, diags, opts}.write(out, funs);
+  }
+
+} // namespace soda
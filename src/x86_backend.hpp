@@ -0,0 +1,79 @@
+#pragma once
+
+#include "ast.hpp"
+#include "diagnostic.hpp"
+#include "ir.hpp"
+
+#include <cstdint>
+#include <ostream>
+#include <span>
+
+namespace soda {
+
+  //
+  // x86-64 code generation
+  //
+  // A program is written as GNU assembler text for x86-64 Linux, to be
+  // assembled with as and linked against the C library, so that building
+  // an executable needs no C compiler. Instructions are selected from the
+  // optimized IR one value at a time, with a few patterns: a comparison
+  // feeding the branch right after it sets the flags the branch tests,
+  // constants are immediate operands where they fit, additions into
+  // another register are lea, and a switch on constant case values is
+  // dispatched through the clusters of its plan.
+  //
+  // Registers are allocated by linear scan (Poletto and Sarkar) over one
+  // live interval per value, the hull of the positions where it is live
+  // in the order the blocks are written, which is reverse postorder. A
+  // value prefers the register of a phi it flows into, of its operand, or
+  // the one its parameter is passed in, to save moves. A value live across
+  // a call gets a register the callee saves, or none if it is a float,
+  // since the System V ABI saves no vector registers. When no register is
+  // free, the interval that ends last is spilled to a stack slot for its
+  // whole life. rax, rcx, rdx, r11 and xmm14 and xmm15 are kept back for the
+  // instructions that need them and for spilled operands.
+  //
+  // A phi is assigned on each incoming edge as a parallel move, in an
+  // order that reads every source before it is overwritten, breaking
+  // cycles through a scratch register. The moves of an edge that is not
+  // the only one leaving its block are written after the function's
+  // blocks, as a stub the edge jumps to.
+  //
+  // Functions follow the System V calling convention. Traps and string
+  // operations are small routines written before the program, which call
+  // write, abort, malloc, memcpy and memcmp; pow and fmod are the C
+  // library's. The program must have a function main, as for the C
+  // backend.
+  //
+  // The loops plan_vector_loops finds first run as many iterations as fill
+  // whole vectors, a vector at a time, on the edge into the loop, which
+  // then does the rest. A vector is two lanes of 64 bits in an SSE2
+  // register, which every x86-64 processor has, or four in an AVX2
+  // register if the processor running the program has them, as cpuid
+  // tells when it starts. Multiplication, which has no instruction on
+  // lanes of 64 bits before AVX-512, is put together from multiplications
+  // of their halves, so a width is only used where a count of the
+  // instructions of an iteration says it is faster. The vector registers
+  // holding no float across the loop's entry hold the lanes, and a loop
+  // needing more is left as it is.
+  //
+
+  // The vector instructions loops may be vectorized with: none, SSE2, or
+  // AVX2 where the processor has it and SSE2 elsewhere.
+  enum class vector_isa : std::uint8_t {
+    none,
+    sse2,
+    avx2,
+  };
+
+  struct x86_options {
+    vector_isa vectors = vector_isa::avx2;
+  };
+
+  // Write the assembler text for prog, whose functions are funs. Errors
+  // are those of lay_out, appended to diags, and false is returned.
+  bool emit_x86(std::ostream &out, ast::program const &prog,
+                std::span<ir::function const> funs, diagnostics &diags,
+                x86_options const &opts = {});
+
+} // namespace soda
@@ -0,0 +1,134 @@
+#!/bin/sh
+# Runs the test programs on every backend at every optimization level and
+# compares each exit status with the one documented in the program, in a
+# line "// exit status: N". A trap aborts the program, which is 134. The
+# IR is verified after lowering and every optimization pass as it builds. The
+# programs in vectors are built for x86-64 with each choice of --vectors,
+# which must all give the documented status. The programs in diagnostics
+# must make sodac report what their .expected file has, as they are, with
+# --hash-cons and with --lazy (alone and with --hash-cons); a lazily parsed
+# body's syntax errors come when it is loaded, so the order is not compared
+# with --lazy. A line "// flags: F" in a program adds F to each of these.
+#
+# usage: tests/check.sh [sodac]
+
+sodac=${1:-./sodac}
+case $sodac in
+  /*) ;;
+  *) sodac=$PWD/$sodac ;;
+esac
+dir=$(dirname "$0")
+tmp=$(mktemp -d "${TMPDIR:-/tmp}/soda-check.XXXXXX")
+trap 'rm -rf "$tmp"' EXIT
+
+passed=0
+failed=0
+
+pass() {
+  passed=$((passed + 1))
+}
+
+fail() {
+  failed=$((failed + 1))
+  echo "FAIL: $*"
+}
+
+# The documented exit status of a program.
+expected() {
+  sed -n 's|^// exit status: \([0-9]*\).*|\1|p' "$1" | head -n 1
+}
+
+# The options a diagnostics program is checked with, besides the others.
+options() {
+  sed -n 's|^// flags: \(.*\)|\1|p' "$1" | head -n 1
+}
+
+# Runs the executable built from program $1, described by $2, expecting
+# status $3.
+run_exe() {
+  "$tmp/exe" >/dev/null 2>&1
+  status=$?
+  if [ "$status" -eq "$3" ]; then
+    pass
+  else
+    fail "$1 ($2): exit status $status, expected $3"
+  fi
+}
+
+for program in "$dir"/programs/*.soda; do
+  want=$(expected "$program")
+  if [ -z "$want" ]; then
+    fail "$program: no documented exit status"
+    continue
+  fi
+  for level in -O0 -O1 -O2; do
+    "$sodac" "$level" --verify-ir --run "$program" >/dev/null 2>"$tmp/log"
+    status=$?
+    if [ "$status" -eq "$want" ]; then
+      pass
+    else
+      fail "$program (vm $level): exit status $status, expected $want"
+      cat "$tmp/log"
+    fi
+    for backend in c x86-64; do
+      if ! "$sodac" "$level" --verify-ir --backend "$backend" \
+          -o "$tmp/exe" "$program" >"$tmp/log" 2>&1; then
+        fail "$program ($backend $level): build failed"
+        cat "$tmp/log"
+        continue
+      fi
+      run_exe "$program" "$backend $level" "$want"
+    done
+  done
+done
+
+for program in "$dir"/vectors/*.soda; do
+  want=$(expected "$program")
+  if [ -z "$want" ]; then
+    fail "$program: no documented exit status"
+    continue
+  fi
+  for level in -O0 -O1 -O2; do
+    for isa in none sse2 avx2; do
+      if ! "$sodac" "$level" --verify-ir --backend x86-64 \
+          --vectors "$isa" -o "$tmp/exe" "$program" >"$tmp/log" 2>&1; then
+        fail "$program (vectors $isa $level): build failed"
+        cat "$tmp/log"
+        continue
+      fi
+      run_exe "$program" "vectors $isa $level" "$want"
+    done
+  done
+done
+
+for program in "$dir"/diagnostics/*.soda; do
+  name=$(basename "$program")
+  expected=${program%.soda}.expected
+  options=$(options "$program")
+  # run from the program's directory, so that its name is all of its path
+  for flags in "" --hash-cons; do
+    (cd "$(dirname "$program")" && "$sodac" $options $flags "$name") \
+        >/dev/null 2>"$tmp/out"
+    if cmp -s "$tmp/out" "$expected"; then
+      pass
+    else
+      fail "$program${flags:+ ($flags)}: unexpected diagnostics"
+      diff "$expected" "$tmp/out"
+    fi
+  done
+  sort "$expected" >"$tmp/want"
+  for flags in --lazy "--lazy --hash-cons"; do
+    (cd "$(dirname "$program")" && "$sodac" $options $flags "$name") \
+        >/dev/null 2>"$tmp/out"
+    sort "$tmp/out" >"$tmp/lazy"
+    if cmp -s "$tmp/lazy" "$tmp/want"; then
+      pass
+    else
+      fail "$program ($flags): unexpected diagnostics"
+      diff "$tmp/want" "$tmp/lazy"
+    fi
+  done
+done
+
+echo "$passed passed, $failed failed"
+[ "$failed" -eq 0 ]
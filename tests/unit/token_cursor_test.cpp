@@ -0,0 +1,199 @@
+// Checks that token_cursor peeks, rewinds to checkpoints and iterates over
+// the right tokens as the ring buffer wraps around and grows.
+
+#include "token_cursor.hpp"
+
+#include <cstddef>
+#include <iostream>
+#include <iterator>
+#include <span>
+#include <spanstream>
+#include <string>
+
+static_assert(std::forward_iterator<soda::token_cursor::iterator>);
+static_assert(std::sentinel_for<std::default_sentinel_t,
+                                soda::token_cursor::iterator>);
+
+namespace {
+
+  int failures = 0;
+
+  void check(bool ok, std::string const &what) {
+    if (!ok) {
+      std::cerr << "FAIL: " << what << '\n';
+      failures++;
+    }
+  }
+
+  // "t0 t1 ... t<n-1>", with a comment after every third identifier
+  std::string identifiers(std::size_t n) {
+    std::string text;
+    for (std::size_t i = 0; i < n; i++) {
+      text += "t" + std::to_string(i) + (i % 3 == 2 ? " /* c */ " : " ");
+    }
+    return text;
+  }
+
+  // Whether t is the identifier at index i of identifiers(n), or the end.
+  bool is_token(soda::token const &t, std::size_t i, std::size_t n) {
+    return i < n ? t.kind == soda::token::kind::ident &&
+                       t.text == "t" + std::to_string(i)
+                 : t.kind == soda::token::kind::end;
+  }
+
+  // Peek up to depth tokens ahead at every position of a cursor whose
+  // ring starts out with capacity slots.
+  void peek_ahead(std::size_t n, std::size_t capacity, std::size_t depth) {
+    auto text = identifiers(n);
+    std::ispanstream in{std::span<char const>{text}};
+    soda::tokenizer tokens{in};
+    soda::token_cursor cursor{tokens, true, capacity};
+    auto where = " (capacity " + std::to_string(capacity) + ", depth " +
+                 std::to_string(depth) + ")";
+    for (std::size_t i = 0; i <= n; i++) {
+      for (std::size_t k = depth + 1; k-- > 0;) {
+        if (!is_token(cursor.peek(k), i + k, n)) {
+          check(false, "peek(" + std::to_string(k) + ") at token " +
+                           std::to_string(i) + where);
+          return;
+        }
+      }
+      check(is_token(cursor.peek(), i, n),
+            "peek() at token " + std::to_string(i) + where);
+      cursor.advance();
+    }
+  }
+
+  // Peek past the whole input at once, then read it in order.
+  void peek_to_end(std::size_t n) {
+    auto text = identifiers(n);
+    std::ispanstream in{std::span<char const>{text}};
+    soda::tokenizer tokens{in};
+    soda::token_cursor cursor{tokens, true, 2};
+    check(is_token(cursor.peek(n), n, n), "peek(n) from the start");
+    for (std::size_t i = 0; i <= n; i++) {
+      check(is_token(cursor.peek(), i, n),
+            "token " + std::to_string(i) + " after peek(n)");
+      cursor.advance();
+    }
+  }
+
+  // At every position, mark, read span tokens on and rewind, so that the
+  // checkpoint pins more tokens than the ring holds at first and the ring
+  // has wrapped around many times before.
+  void rewind_across(std::size_t n, std::size_t capacity, std::size_t span) {
+    auto text = identifiers(n);
+    std::ispanstream in{std::span<char const>{text}};
+    soda::tokenizer tokens{in};
+    soda::token_cursor cursor{tokens, true, capacity};
+    auto where = " (capacity " + std::to_string(capacity) + ", span " +
+                 std::to_string(span) + ")";
+    for (std::size_t i = 0; i <= n; i++) {
+      auto cp = cursor.mark();
+      for (std::size_t k = 0; k < span && i + k <= n; k++) {
+        if (!is_token(cursor.peek(), i + k, n)) {
+          check(false, "token " + std::to_string(i + k) + " after mark at " +
+                           std::to_string(i) + where);
+          return;
+        }
+        cursor.advance();
+      }
+      cursor.rewind(cp);
+      if (!is_token(cursor.peek(), i, n)) {
+        check(false, "rewind to token " + std::to_string(i) + where);
+        return;
+      }
+      cursor.advance();
+    }
+  }
+
+  // Nested checkpoints: the inner one is rewound to and the outer one kept
+  // or rewound to in turn.
+  void nested_marks(std::size_t capacity) {
+    std::size_t n = 200;
+    auto text = identifiers(n);
+    std::ispanstream in{std::span<char const>{text}};
+    soda::tokenizer tokens{in};
+    soda::token_cursor cursor{tokens, true, capacity};
+    auto where = " (capacity " + std::to_string(capacity) + ")";
+    for (std::size_t i = 0; i + 20 <= n; i += 7) {
+      auto outer = cursor.mark();
+      for (int k = 0; k < 5; k++) {
+        cursor.advance();
+      }
+      auto inner = cursor.mark();
+      for (int k = 0; k < 12; k++) {
+        cursor.advance();
+      }
+      cursor.rewind(inner);
+      check(is_token(cursor.peek(), i + 5, n),
+            "rewind to inner mark at " + std::to_string(i + 5) + where);
+      if (i % 2) {
+        cursor.rewind(outer);
+        check(is_token(cursor.peek(), i, n),
+              "rewind to outer mark at " + std::to_string(i) + where);
+        for (int k = 0; k < 7; k++) {
+          cursor.advance();
+        }
+      } else {
+        cursor.commit(outer);
+        check(is_token(cursor.peek(), i + 5, n),
+              "commit outer mark at " + std::to_string(i) + where);
+        cursor.advance();
+        cursor.advance();
+      }
+    }
+  }
+
+  // Iterate over the rest of the input from every position, twice over
+  // through copies of the iterators, without moving the cursor.
+  void iterate(std::size_t n, std::size_t capacity) {
+    auto text = identifiers(n);
+    std::ispanstream in{std::span<char const>{text}};
+    soda::tokenizer tokens{in};
+    soda::token_cursor cursor{tokens, true, capacity};
+    auto where = " (capacity " + std::to_string(capacity) + ")";
+    for (std::size_t i = 0; i <= n; i += 13) {
+      auto first = cursor.begin();
+      auto j = i;
+      for (auto it = first; it != cursor.end(); ++it, j++) {
+        if (!is_token(*it, j, n)) {
+          check(false, "iterator at token " + std::to_string(j) + " from " +
+                           std::to_string(i) + where);
+          return;
+        }
+      }
+      check(j == n, "iteration from " + std::to_string(i) + " ends at " +
+                        std::to_string(j) + where);
+      // a copy moves on alone, and the original can be read again
+      auto copy = first;
+      auto old = copy++;
+      check(old == first && is_token(*first, i, n) &&
+                (i == n || is_token(*copy, i + 1, n)),
+            "iterator copy at token " + std::to_string(i) + where);
+      check(is_token(cursor.peek(), i, n),
+            "cursor after iteration at " + std::to_string(i) + where);
+      for (int k = 0; k < 13; k++) {
+        cursor.advance();
+      }
+    }
+  }
+
+} // namespace
+
+int main() {
+  for (std::size_t capacity : {2, 4, 64}) {
+    for (std::size_t depth : {0, 1, 3, 4, 5, 70}) {
+      peek_ahead(300, capacity, depth);
+    }
+  }
+  peek_to_end(300);
+  for (std::size_t capacity : {2, 4, 64}) {
+    for (std::size_t span : {1, 3, 4, 5, 100}) {
+      rewind_across(300, capacity, span);
+    }
+    nested_marks(capacity);
+    iterate(300, capacity);
+  }
+  return failures ? 1 : 0;
+}